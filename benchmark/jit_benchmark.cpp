@@ -0,0 +1,383 @@
+#include "../include/Runtime.hpp"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/Mangling.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/PassPlugin.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Executes kernels optimized with and without the `TurboLoopPass`, to check
+// that the loop nests it emits pay off on this machine.
+//
+// Each kernel is optimized by the same pipeline, once with `turbo-loop`
+// first, compiled with ORC for the host, checked to compute the same results
+// as its reference, and timed on local buffers.
+// The pass is loaded from the plugin named by `TURBO_LOOP_PLUGIN`, or
+// `./libTurboLoop.so`, with `-turbo-loop-codegen` and `-turbo-loop-parallel`
+// set, so that it replaces the scheduled loop nests; their parallel loops
+// call `turboloop_parallel_for` of the runtime linked into this binary.
+
+// `void kernel(double *C, double *A, double *B, i64 n)`, on `n x n` column
+// major matrices.
+using KernelFn = void (*)(double *, double *, double *, int64_t);
+
+struct Kernel {
+    const char *name;
+    const char *ir;
+};
+
+static const Kernel kernels[] = {
+    // for j in 0:n-1, k in 0:n-1, i in 0:n-1
+    //   C(i,j) += A(i,k) * B(k,j)
+    {"gemm", R"(
+define void @gemm(double* noalias %C, double* noalias %A, double* noalias %B, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %jloop, label %exit
+
+jloop:
+  %j = phi i64 [ 0, %entry ], [ %jnext, %jlatch ]
+  %nj = mul nsw i64 %n, %j
+  br label %kloop
+
+kloop:
+  %k = phi i64 [ 0, %jloop ], [ %knext, %klatch ]
+  %nk = mul nsw i64 %n, %k
+  %bidx = add nsw i64 %k, %nj
+  %bp = getelementptr inbounds double, double* %B, i64 %bidx
+  %b = load double, double* %bp
+  br label %iloop
+
+iloop:
+  %i = phi i64 [ 0, %kloop ], [ %inext, %iloop ]
+  %aidx = add nsw i64 %i, %nk
+  %ap = getelementptr inbounds double, double* %A, i64 %aidx
+  %a = load double, double* %ap
+  %cidx = add nsw i64 %i, %nj
+  %cp = getelementptr inbounds double, double* %C, i64 %cidx
+  %c = load double, double* %cp
+  %ab = fmul double %a, %b
+  %cab = fadd double %c, %ab
+  store double %cab, double* %cp
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp slt i64 %inext, %n
+  br i1 %ic, label %iloop, label %klatch
+
+klatch:
+  %knext = add nuw nsw i64 %k, 1
+  %kc = icmp slt i64 %knext, %n
+  br i1 %kc, label %kloop, label %jlatch
+
+jlatch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %jloop, label %exit
+
+exit:
+  ret void
+}
+)"},
+    // for j in 0:n-1, i in 0:j
+    //   C(i,j) += A(i,j) * B(j,i)
+    {"triangular", R"(
+define void @triangular(double* noalias %C, double* noalias %A, double* noalias %B, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %jloop, label %exit
+
+jloop:
+  %j = phi i64 [ 0, %entry ], [ %jnext, %jlatch ]
+  %nj = mul nsw i64 %n, %j
+  br label %iloop
+
+iloop:
+  %i = phi i64 [ 0, %jloop ], [ %inext, %iloop ]
+  %idx = add nsw i64 %i, %nj
+  %ap = getelementptr inbounds double, double* %A, i64 %idx
+  %a = load double, double* %ap
+  %ni = mul nsw i64 %n, %i
+  %bidx = add nsw i64 %j, %ni
+  %bp = getelementptr inbounds double, double* %B, i64 %bidx
+  %b = load double, double* %bp
+  %cp = getelementptr inbounds double, double* %C, i64 %idx
+  %c = load double, double* %cp
+  %ab = fmul double %a, %b
+  %cab = fadd double %c, %ab
+  store double %cab, double* %cp
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp sle i64 %inext, %j
+  br i1 %ic, label %iloop, label %jlatch
+
+jlatch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %jloop, label %exit
+
+exit:
+  ret void
+}
+)"},
+    // for j in 1:n-2, i in 1:n-2
+    //   C(i,j) = B(i,j) * (A(i-1,j) + A(i+1,j) + A(i,j-1) + A(i,j+1))
+    {"stencil", R"(
+define void @stencil(double* noalias %C, double* noalias %A, double* noalias %B, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 2
+  %nm1 = add nsw i64 %n, -1
+  br i1 %guard, label %jloop, label %exit
+
+jloop:
+  %j = phi i64 [ 1, %entry ], [ %jnext, %jlatch ]
+  %nj = mul nsw i64 %n, %j
+  br label %iloop
+
+iloop:
+  %i = phi i64 [ 1, %jloop ], [ %inext, %iloop ]
+  %idx = add nsw i64 %i, %nj
+  %west = add nsw i64 %idx, -1
+  %east = add nsw i64 %idx, 1
+  %south = sub nsw i64 %idx, %n
+  %north = add nsw i64 %idx, %n
+  %wp = getelementptr inbounds double, double* %A, i64 %west
+  %w = load double, double* %wp
+  %ep = getelementptr inbounds double, double* %A, i64 %east
+  %e = load double, double* %ep
+  %sp = getelementptr inbounds double, double* %A, i64 %south
+  %s = load double, double* %sp
+  %np = getelementptr inbounds double, double* %A, i64 %north
+  %nn = load double, double* %np
+  %we = fadd double %w, %e
+  %sn = fadd double %s, %nn
+  %sum = fadd double %we, %sn
+  %bp = getelementptr inbounds double, double* %B, i64 %idx
+  %b = load double, double* %bp
+  %x = fmul double %b, %sum
+  %cp = getelementptr inbounds double, double* %C, i64 %idx
+  store double %x, double* %cp
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp slt i64 %inext, %nm1
+  br i1 %ic, label %iloop, label %jlatch
+
+jlatch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %nm1
+  br i1 %jc, label %jloop, label %exit
+
+exit:
+  ret void
+}
+)"},
+};
+
+// The pipelines differ only in `turbo-loop`, which requires loops in
+// simplified and LCSSA form. It runs as the module pass, which may outline
+// parallel loops.
+constexpr const char *referencePipeline =
+    "function(loop-simplify,lcssa),default<O2>";
+constexpr const char *turboLoopPipeline =
+    "function(loop-simplify,lcssa),turbo-loop,default<O2>";
+
+// A kernel, optimized by a pipeline, and compiled by its own JIT.
+struct CompiledKernel {
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    KernelFn f = nullptr;
+};
+
+// Parses `kernel`, optimizes it with `pipeline` for the host, and compiles
+// it to `ck`.
+// Returns `true` on failure, after printing the reason.
+static bool compile(CompiledKernel &ck, const Kernel &kernel,
+                    llvm::StringRef pipeline, const llvm::PassPlugin &plugin) {
+    auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!JTMB) {
+        llvm::errs() << llvm::toString(JTMB.takeError()) << "\n";
+        return true;
+    }
+    auto TM = JTMB->createTargetMachine();
+    if (!TM) {
+        llvm::errs() << llvm::toString(TM.takeError()) << "\n";
+        return true;
+    }
+    auto ctx = std::make_unique<llvm::LLVMContext>();
+    llvm::SMDiagnostic err;
+    std::unique_ptr<llvm::Module> mod =
+        llvm::parseAssemblyString(kernel.ir, err, *ctx);
+    if (!mod) {
+        err.print(kernel.name, llvm::errs());
+        return true;
+    }
+    mod->setDataLayout((*TM)->createDataLayout());
+    mod->setTargetTriple((*TM)->getTargetTriple().str());
+
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::PassBuilder PB(TM->get());
+    plugin.registerPassBuilderCallbacks(PB);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    llvm::ModulePassManager MPM;
+    if (llvm::Error e = PB.parsePassPipeline(MPM, pipeline)) {
+        llvm::errs() << llvm::toString(std::move(e)) << "\n";
+        return true;
+    }
+    MPM.run(*mod, MAM);
+    if (llvm::verifyModule(*mod, &llvm::errs()))
+        return true;
+
+    auto jit = llvm::orc::LLJITBuilder()
+                   .setJITTargetMachineBuilder(std::move(*JTMB))
+                   .create();
+    if (!jit) {
+        llvm::errs() << llvm::toString(jit.takeError()) << "\n";
+        return true;
+    }
+    ck.jit = std::move(*jit);
+    llvm::orc::MangleAndInterner mangle(ck.jit->getExecutionSession(),
+                                        ck.jit->getDataLayout());
+    llvm::orc::SymbolMap runtime;
+    runtime[mangle("turboloop_parallel_for")] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(&turboloop_parallel_for),
+        llvm::JITSymbolFlags::Exported);
+    if (llvm::Error e = ck.jit->getMainJITDylib().define(
+            llvm::orc::absoluteSymbols(std::move(runtime)))) {
+        llvm::errs() << llvm::toString(std::move(e)) << "\n";
+        return true;
+    }
+    if (llvm::Error e = ck.jit->addIRModule(
+            llvm::orc::ThreadSafeModule(std::move(mod), std::move(ctx)))) {
+        llvm::errs() << llvm::toString(std::move(e)) << "\n";
+        return true;
+    }
+    auto sym = ck.jit->lookup(kernel.name);
+    if (!sym) {
+        llvm::errs() << llvm::toString(sym.takeError()) << "\n";
+        return true;
+    }
+    ck.f = reinterpret_cast<KernelFn>(sym->getAddress());
+    return false;
+}
+
+// The operands of a kernel, filled with the same values for every version.
+struct Buffers {
+    std::vector<double> C, A, B;
+    Buffers(int64_t n) : C(n * n), A(n * n), B(n * n) {
+        uint64_t state = 0x9e3779b97f4a7c15;
+        auto next = [&] {
+            state = state * 6364136223846793005 + 1442695040888963407;
+            return double(state >> 11) * 0x1p-53;
+        };
+        for (auto *v : {&C, &A, &B})
+            for (double &x : *v)
+                x = next();
+    }
+    void run(KernelFn f, int64_t n) { f(C.data(), A.data(), B.data(), n); }
+};
+
+// Checks that `f` and `g` compute the same `C`, up to the rounding of
+// reassociated sums.
+// Returns `true` on a mismatch, after printing the first.
+static bool mismatch(const Kernel &kernel, KernelFn f, KernelFn g, int64_t n) {
+    Buffers x(n), y(n);
+    x.run(f, n);
+    y.run(g, n);
+    for (size_t i = 0; i < x.C.size(); ++i) {
+        double scale = std::max(std::abs(x.C[i]), 1.0);
+        if (!(std::abs(x.C[i] - y.C[i]) <= 1e-12 * n * scale)) {
+            llvm::errs() << kernel.name << " (n = " << n << "): C[" << i
+                         << "] is " << y.C[i] << " with turbo-loop, but "
+                         << x.C[i] << " without\n";
+            return true;
+        }
+    }
+    return false;
+}
+
+static void BM_JIT(benchmark::State &state, KernelFn f) {
+    int64_t n = state.range(0);
+    Buffers buf(n);
+    for (auto _ : state) {
+        buf.run(f, n);
+        benchmark::ClobberMemory();
+    }
+}
+
+int main(int argc, char **argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    const char *path = std::getenv("TURBO_LOOP_PLUGIN");
+    auto plugin = llvm::PassPlugin::Load(path ? path : "./libTurboLoop.so");
+    if (!plugin) {
+        llvm::errs() << llvm::toString(plugin.takeError()) << "\n";
+        return 1;
+    }
+    // the plugin registered its options when loaded
+    llvm::StringMap<llvm::cl::Option *> &opts =
+        llvm::cl::getRegisteredOptions();
+    for (const char *name : {"turbo-loop-codegen", "turbo-loop-parallel"}) {
+        llvm::cl::Option *opt = opts.lookup(name);
+        if (!opt) {
+            llvm::errs() << "the plugin has no option -" << name << "\n";
+            return 1;
+        }
+        opt->addOccurrence(0, name, "true");
+    }
+    constexpr int64_t sizes[] = {64, 256};
+    // kept alive while the benchmarks run
+    std::vector<CompiledKernel> compiled;
+    compiled.reserve(2 * std::size(kernels));
+    for (const Kernel &kernel : kernels) {
+        CompiledKernel &reference = compiled.emplace_back();
+        CompiledKernel &turboLoop = compiled.emplace_back();
+        if (compile(reference, kernel, referencePipeline, *plugin) ||
+            compile(turboLoop, kernel, turboLoopPipeline, *plugin))
+            return 1;
+        for (int64_t n : sizes)
+            if (mismatch(kernel, reference.f, turboLoop.f, n))
+                return 1;
+        std::string name = std::string("BM_JIT/") + kernel.name;
+        for (auto [suffix, f] : {std::make_pair("/reference", reference.f),
+                                 std::make_pair("/turbo-loop", turboLoop.f)}) {
+            auto *b = benchmark::RegisterBenchmark((name + suffix).c_str(),
+                                                   BM_JIT, f);
+            for (int64_t n : sizes)
+                b->Arg(n);
+        }
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
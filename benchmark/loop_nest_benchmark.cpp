@@ -0,0 +1,394 @@
+#include "../include/ArrayReference.hpp"
+#include "../include/Instrumentation.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/Loops.hpp"
+#include "../include/Math.hpp"
+#include "../include/MemoryUse.hpp"
+#include "../include/POSet.hpp"
+#include "../include/Schedule.hpp"
+#include "../include/Serialization.hpp"
+#include "../include/Symbolics.hpp"
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <iostream>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <memory>
+#include <string>
+#include <utility>
+
+// End to end benchmarks of the analysis of canonical loop nests: building
+// their loop nests, which prunes redundant bounds, constructing dependences
+// and their Farkas polyhedra, and scheduling.
+//
+// Each kernel is benchmarked with symbolic sizes (`size == 0`), and with
+// constant sizes. The time spent in each phase is reported as counters, in
+// seconds per iteration, e.g. in the JSON written with
+// `--benchmark_out=<file> --benchmark_out_format=json`. Phase times are
+// inclusive: Farkas polyhedra are pruned while they are built.
+// The heap memory held by the analyzed loop block is reported by kind of
+// object, e.g. `MatrixBytes`, and, when building with the `track_allocations`
+// option, the bytes allocated by each phase per iteration, e.g.
+// `turbo-loop-farkas-bytes`.
+//
+// If `LOOP_BLOCK_CORPUS` names a corpus of serialized loop blocks, e.g. one
+// captured with `-turbo-loop-capture`, its loop blocks are benchmarked too.
+
+using LoopPtr = llvm::IntrusiveRefCntPtr<AffineLoopNest>;
+
+// `n`, or the symbol `id` if `n == 0`.
+static MPoly extent(int64_t n, IDType id) {
+    if (n)
+        return n;
+    return Polynomial::Monomial(Polynomial::ID{id});
+}
+
+// The constraint `a' * i <= b` on the loops `i`.
+struct Bound {
+    llvm::SmallVector<int64_t, 4> a;
+    MPoly b;
+};
+
+// The loop nest `0 <= i_l <= upper[l]`, further constrained by `bounds`.
+static LoopPtr loopNest(llvm::ArrayRef<MPoly> upper,
+                        llvm::ArrayRef<Bound> bounds = {}) {
+    size_t numLoops = upper.size();
+    IntMatrix A(2 * numLoops + bounds.size(), numLoops);
+    llvm::SmallVector<MPoly, 8> b;
+    for (size_t l = 0; l < numLoops; ++l) {
+        A(2 * l, l) = 1;
+        b.push_back(upper[l]);
+        A(2 * l + 1, l) = -1;
+        b.push_back(0);
+    }
+    for (size_t i = 0; i < bounds.size(); ++i) {
+        for (size_t l = 0; l < numLoops; ++l)
+            A(2 * numLoops + i, l) = bounds[i].a[l];
+        b.push_back(bounds[i].b);
+    }
+    PartiallyOrderedSet poset;
+    return llvm::makeIntrusiveRefCnt<AffineLoopNest>(A, b, poset);
+}
+
+// An array dimension, indexed by `index' * i + offset`.
+struct Dim {
+    llvm::SmallVector<int64_t, 4> index;
+    MPoly stride;
+    int64_t offset = 0;
+};
+
+// Adds an access to `lblock`, with `position[d]` the position of the access
+// in loop `d`, or of loop `d` in the loop `d - 1` (the omega of its schedule).
+static void access(LoopBlock &lblock, size_t arrayID, const LoopPtr &loop,
+                   std::initializer_list<Dim> dims,
+                   std::initializer_list<int64_t> position, bool isLoad) {
+    ArrayReference ref(arrayID, loop, dims.size());
+    PtrMatrix<int64_t> IndMat = ref.indexMatrix();
+    size_t d = 0;
+    for (const Dim &dim : dims) {
+        for (size_t l = 0; l < dim.index.size(); ++l)
+            IndMat(l, d) = dim.index[l];
+        ref.stridesOffsets[d++] = std::make_pair(dim.stride, MPoly(dim.offset));
+    }
+    Schedule sch(loop->getNumLoops());
+    llvm::MutableArrayRef<int64_t> omega = sch.getOmega();
+    d = 0;
+    for (int64_t p : position)
+        omega[2 * d++] = p;
+    lblock.memory.emplace_back(ref, nullptr, sch, isLoad);
+}
+
+// `C(m,n) += A(m,k) * B(k,n)`, with loops `[n, k, m]`, and `m` unrolled by
+// `unroll`, i.e. `m = unroll * m' + r` for `r in 0:unroll-1`.
+static void gemm(LoopBlock &lblock, int64_t size, int64_t unroll) {
+    MPoly M = extent(size, 1), N = extent(size, 2), K = extent(size, 3);
+    // `m' <= M-1` is redundant once unrolled, and pruned
+    LoopPtr loop = unroll == 1 ? loopNest({N - 1, K - 1, M - 1})
+                               : loopNest({N - 1, K - 1, M - 1},
+                                          {{{0, 0, unroll}, M - MPoly(unroll)}});
+    enum { C, A, B };
+    int64_t p = 0;
+    for (int64_t r = 0; r < unroll; ++r) {
+        access(lblock, C, loop, {{{0, 0, unroll}, 1, r}, {{1, 0, 0}, M}},
+               {0, 0, 0, p++}, true);
+        access(lblock, A, loop, {{{0, 0, unroll}, 1, r}, {{0, 1, 0}, M}},
+               {0, 0, 0, p++}, true);
+    }
+    access(lblock, B, loop, {{{0, 1, 0}, 1}, {{1, 0, 0}, K}}, {0, 0, 0, p++},
+           true);
+    for (int64_t r = 0; r < unroll; ++r)
+        access(lblock, C, loop, {{{0, 0, unroll}, 1, r}, {{1, 0, 0}, M}},
+               {0, 0, 0, p++}, false);
+}
+
+// The triangular solve of `TriangularExampleTest`, `A = B / U'`:
+// for m in 0:M-1, n in 0:N-1
+//   A(m,n) = B(m,n)
+// for m in 0:M-1, n in 0:N-1
+//   A(m,n) /= U(n,n)
+//   for k in n+1:N-1
+//     A(m,k) -= A(m,n) * U(n,k)
+static void triangularExample(LoopBlock &lblock, int64_t size, int64_t) {
+    MPoly M = extent(size, 1), N = extent(size, 2);
+    LoopPtr loopMN = loopNest({M - 1, N - 1});
+    LoopPtr loopMNK = loopNest({M - 1, N - 1, N - 1}, {{{0, 1, -1}, -1}});
+    enum { B, A, U };
+    access(lblock, B, loopMN, {{{1, 0}, 1}, {{0, 1}, M}}, {0, 0, 0}, true);
+    access(lblock, A, loopMN, {{{1, 0}, 1}, {{0, 1}, M}}, {0, 0, 1}, false);
+    access(lblock, A, loopMN, {{{1, 0}, 1}, {{0, 1}, M}}, {0, 1, 0}, true);
+    access(lblock, U, loopMN, {{{0, 1}, 1}, {{0, 1}, N}}, {0, 1, 1}, true);
+    access(lblock, A, loopMN, {{{1, 0}, 1}, {{0, 1}, M}}, {0, 1, 2}, false);
+    access(lblock, U, loopMNK, {{{0, 1, 0}, 1}, {{0, 0, 1}, N}}, {0, 1, 3, 0},
+           true);
+    access(lblock, A, loopMNK, {{{1, 0, 0}, 1}, {{0, 1, 0}, M}}, {0, 1, 3, 1},
+           true);
+    access(lblock, A, loopMNK, {{{1, 0, 0}, 1}, {{0, 0, 1}, M}}, {0, 1, 3, 2},
+           true);
+    access(lblock, A, loopMNK, {{{1, 0, 0}, 1}, {{0, 0, 1}, M}}, {0, 1, 3, 3},
+           false);
+}
+
+// Forward substitution, `x = L \ b`:
+// for i in 0:N-1
+//   x(i) = b(i)
+//   for j in 0:i-1
+//     x(i) -= L(i,j) * x(j)
+//   x(i) /= L(i,i)
+static void triangularSolve(LoopBlock &lblock, int64_t size, int64_t) {
+    MPoly N = extent(size, 1);
+    LoopPtr loopI = loopNest({N - 1});
+    LoopPtr loopIJ = loopNest({N - 1, N - 2}, {{{-1, 1}, -1}});
+    enum { b, x, L };
+    access(lblock, b, loopI, {{{1}, 1}}, {0, 0}, true);
+    access(lblock, x, loopI, {{{1}, 1}}, {0, 1}, false);
+    access(lblock, x, loopIJ, {{{1, 0}, 1}}, {0, 2, 0}, true);
+    access(lblock, L, loopIJ, {{{1, 0}, 1}, {{0, 1}, N}}, {0, 2, 1}, true);
+    access(lblock, x, loopIJ, {{{0, 1}, 1}}, {0, 2, 2}, true);
+    access(lblock, x, loopIJ, {{{1, 0}, 1}}, {0, 2, 3}, false);
+    access(lblock, x, loopI, {{{1}, 1}}, {0, 3}, true);
+    access(lblock, L, loopI, {{{1}, 1}, {{1}, N}}, {0, 4}, true);
+    access(lblock, x, loopI, {{{1}, 1}}, {0, 5}, false);
+}
+
+// Right looking Cholesky factorization, in place:
+// for k in 0:N-1
+//   A(k,k) = sqrt(A(k,k))
+//   for i in k+1:N-1
+//     A(i,k) /= A(k,k)
+//   for j in k+1:N-1, i in j:N-1
+//     A(i,j) -= A(i,k) * A(j,k)
+static void cholesky(LoopBlock &lblock, int64_t size, int64_t) {
+    MPoly N = extent(size, 1);
+    LoopPtr loopK = loopNest({N - 1});
+    LoopPtr loopKI = loopNest({N - 1, N - 1}, {{{1, -1}, -1}});
+    LoopPtr loopKJI =
+        loopNest({N - 1, N - 1, N - 1}, {{{1, -1, 0}, -1}, {{0, 1, -1}, 0}});
+    access(lblock, 0, loopK, {{{1}, 1}, {{1}, N}}, {0, 0}, true);
+    access(lblock, 0, loopK, {{{1}, 1}, {{1}, N}}, {0, 1}, false);
+    access(lblock, 0, loopKI, {{{0, 1}, 1}, {{1, 0}, N}}, {0, 2, 0}, true);
+    access(lblock, 0, loopKI, {{{1, 0}, 1}, {{1, 0}, N}}, {0, 2, 1}, true);
+    access(lblock, 0, loopKI, {{{0, 1}, 1}, {{1, 0}, N}}, {0, 2, 2}, false);
+    access(lblock, 0, loopKJI, {{{0, 0, 1}, 1}, {{0, 1, 0}, N}}, {0, 3, 0, 0},
+           true);
+    access(lblock, 0, loopKJI, {{{0, 0, 1}, 1}, {{1, 0, 0}, N}}, {0, 3, 0, 1},
+           true);
+    access(lblock, 0, loopKJI, {{{0, 1, 0}, 1}, {{1, 0, 0}, N}}, {0, 3, 0, 2},
+           true);
+    access(lblock, 0, loopKJI, {{{0, 0, 1}, 1}, {{0, 1, 0}, N}}, {0, 3, 0, 3},
+           false);
+}
+
+// Gauss-Seidel 5 point stencil, in place:
+// for i in 1:N-2, j in 1:N-2
+//   A(i,j) = (A(i-1,j) + A(i,j-1) + A(i,j) + A(i+1,j) + A(i,j+1)) / 5
+static void seidel2D(LoopBlock &lblock, int64_t size, int64_t) {
+    MPoly N = extent(size, 1);
+    LoopPtr loop = loopNest({N - 3, N - 3});
+    constexpr int64_t offsets[5][2] = {{0, 1}, {1, 0}, {1, 1}, {2, 1}, {1, 2}};
+    int64_t p = 0;
+    for (auto [di, dj] : offsets)
+        access(lblock, 0, loop, {{{1, 0}, 1, di}, {{0, 1}, N, dj}}, {0, 0, p++},
+               true);
+    access(lblock, 0, loop, {{{1, 0}, 1, 1}, {{0, 1}, N, 1}}, {0, 0, p},
+           false);
+}
+
+// Time iterated Jacobi 7 point stencil, alternating between `A` and `B`:
+// for t in 0:T-1
+//   for i in 1:N-2, j in 1:N-2, k in 1:N-2
+//     B(i,j,k) = (A(i,j,k) + A(i±1,j,k) + A(i,j±1,k) + A(i,j,k±1)) / 7
+//   for i in 1:N-2, j in 1:N-2, k in 1:N-2
+//     A(i,j,k) = B(i,j,k)
+static void jacobi3D(LoopBlock &lblock, int64_t size, int64_t) {
+    MPoly T = extent(size, 1), N = extent(size, 2);
+    LoopPtr loop = loopNest({T - 1, N - 3, N - 3, N - 3});
+    constexpr int64_t offsets[7][3] = {{1, 1, 1}, {0, 1, 1}, {2, 1, 1},
+                                       {1, 0, 1}, {1, 2, 1}, {1, 1, 0},
+                                       {1, 1, 2}};
+    enum { A, B };
+    int64_t p = 0;
+    for (auto [di, dj, dk] : offsets)
+        access(lblock, A, loop,
+               {{{0, 1, 0, 0}, 1, di},
+                {{0, 0, 1, 0}, N, dj},
+                {{0, 0, 0, 1}, N * N, dk}},
+               {0, 0, 0, 0, p++}, true);
+    access(lblock, B, loop,
+           {{{0, 1, 0, 0}, 1, 1}, {{0, 0, 1, 0}, N, 1}, {{0, 0, 0, 1}, N * N, 1}},
+           {0, 0, 0, 0, p}, false);
+    access(lblock, B, loop,
+           {{{0, 1, 0, 0}, 1, 1}, {{0, 0, 1, 0}, N, 1}, {{0, 0, 0, 1}, N * N, 1}},
+           {0, 1, 0, 0, 0}, true);
+    access(lblock, A, loop,
+           {{{0, 1, 0, 0}, 1, 1}, {{0, 0, 1, 0}, N, 1}, {{0, 0, 0, 1}, N * N, 1}},
+           {0, 1, 0, 0, 1}, false);
+}
+
+// The convolution of `ConvReversePass`, with a 3x3 filter for constant sizes:
+// for n in 0:N-1, m in 0:M-1, j in 0:J-1, i in 0:I-1
+//   C(m+i,n+j) += A(m,n) * B(i,j)
+static void convolution(LoopBlock &lblock, int64_t size, int64_t) {
+    MPoly M = extent(size, 1), N = extent(size, 2);
+    MPoly I = size ? MPoly(3) : extent(0, 3), J = size ? MPoly(3) : extent(0, 4);
+    LoopPtr loop = loopNest({N - 1, M - 1, J - 1, I - 1});
+    enum { B, A, C };
+    access(lblock, B, loop, {{{0, 0, 0, 1}, 1}, {{0, 0, 1, 0}, I}},
+           {0, 0, 0, 0, 0}, true);
+    access(lblock, A, loop, {{{0, 1, 0, 0}, 1}, {{1, 0, 0, 0}, M}},
+           {0, 0, 0, 0, 1}, true);
+    access(lblock, C, loop, {{{0, 1, 0, 1}, 1}, {{1, 0, 1, 0}, M + I - 1}},
+           {0, 0, 0, 0, 2}, true);
+    access(lblock, C, loop, {{{0, 1, 0, 1}, 1}, {{1, 0, 1, 0}, M + I - 1}},
+           {0, 0, 0, 0, 3}, false);
+}
+
+// Reports the time spent, and bytes allocated, in each phase since `start`,
+// per iteration.
+static void reportPhases(benchmark::State &state,
+                         const uint64_t (&start)[numPhases],
+                         const AllocationCounts &allocatedStart) {
+    AllocationCounts allocated = allocationCounts() - allocatedStart;
+    for (Phase p : {Phase::DependenceConstruction, Phase::Farkas,
+                    Phase::RedundancyElimination, Phase::Scheduling}) {
+        double ns = phaseNanoseconds[size_t(p)] - start[size_t(p)];
+        state.counters[phaseNames[size_t(p)]] =
+            benchmark::Counter(1e-9 * ns, benchmark::Counter::kAvgIterations);
+        if (trackingAllocations)
+            state.counters[std::string(phaseNames[size_t(p)]) + "-bytes"] =
+                benchmark::Counter(allocated.bytes[size_t(p)],
+                                   benchmark::Counter::kAvgIterations);
+    }
+}
+
+// Reports the heap memory held by `lblock`, by kind of object.
+static void reportMemoryUse(benchmark::State &state, const LoopBlock &lblock) {
+    MemoryUse use = memoryUse(lblock);
+    for (size_t k = 0; k < numObjectKinds; ++k)
+        state.counters[std::string(objectKindNames[k]) + "Bytes"] =
+            use.bytes[k];
+}
+
+// Analyzes the loop block built by `build(lblock)` on each iteration.
+template <typename F>
+static void analyze(benchmark::State &state, F &&build) {
+    uint64_t start[numPhases];
+    for (size_t p = 0; p < numPhases; ++p)
+        start[p] = phaseNanoseconds[p];
+    AllocationCounts allocatedStart = allocationCounts();
+    size_t numMemory = 0, numEdges = 0;
+    bool failed = false;
+    for (auto _ : state) {
+        LoopBlock lblock;
+        build(lblock);
+        lblock.fillEdges();
+        failed = lblock.optimizeSchedules(1);
+        benchmark::DoNotOptimize(failed);
+        numMemory = lblock.memory.size();
+        numEdges = lblock.edges.size();
+    }
+    reportPhases(state, start, allocatedStart);
+    {
+        // once more, outside of the timed loop
+        LoopBlock lblock;
+        build(lblock);
+        lblock.fillEdges();
+        lblock.optimizeSchedules(1);
+        reportMemoryUse(state, lblock);
+    }
+    state.counters["accesses"] = numMemory;
+    state.counters["edges"] = numEdges;
+    // the phases are timed whether or not a legal schedule is found
+    state.counters["scheduled"] = !failed;
+}
+
+static void BM_LoopNest(benchmark::State &state,
+                        void (*kernel)(LoopBlock &, int64_t, int64_t)) {
+    int64_t size = state.range(0), unroll = state.range(1);
+    analyze(state, [&](LoopBlock &lblock) { kernel(lblock, size, unroll); });
+}
+
+// sizes are symbolic, or constant
+#define SIZES                                                                  \
+    { 0, 64, 512 }
+BENCHMARK_CAPTURE(BM_LoopNest, gemm, gemm)
+    ->ArgNames({"size", "unroll"})
+    ->ArgsProduct({SIZES, {1, 2, 4}});
+BENCHMARK_CAPTURE(BM_LoopNest, triangular_example, triangularExample)
+    ->ArgNames({"size", "unroll"})
+    ->ArgsProduct({SIZES, {1}});
+BENCHMARK_CAPTURE(BM_LoopNest, triangular_solve, triangularSolve)
+    ->ArgNames({"size", "unroll"})
+    ->ArgsProduct({SIZES, {1}});
+BENCHMARK_CAPTURE(BM_LoopNest, cholesky, cholesky)
+    ->ArgNames({"size", "unroll"})
+    ->ArgsProduct({SIZES, {1}});
+BENCHMARK_CAPTURE(BM_LoopNest, seidel_2d, seidel2D)
+    ->ArgNames({"size", "unroll"})
+    ->ArgsProduct({SIZES, {1}});
+BENCHMARK_CAPTURE(BM_LoopNest, jacobi_3d, jacobi3D)
+    ->ArgNames({"size", "unroll"})
+    ->ArgsProduct({SIZES, {1}});
+BENCHMARK_CAPTURE(BM_LoopNest, convolution, convolution)
+    ->ArgNames({"size", "unroll"})
+    ->ArgsProduct({SIZES, {1}});
+#undef SIZES
+
+int main(int argc, char **argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    std::unique_ptr<llvm::MemoryBuffer> corpus;
+    if (const char *path = std::getenv("LOOP_BLOCK_CORPUS")) {
+        auto buf = llvm::MemoryBuffer::getFile(
+            path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+        if (!buf) {
+            std::cerr << "could not read " << path << std::endl;
+            return 1;
+        }
+        corpus = std::move(*buf);
+        llvm::StringRef bytes = corpus->getBuffer();
+        size_t i = 0, offset = 0;
+        if (forEachLoopBlock(bytes, [&](const LoopBlockView &view) {
+                llvm::StringRef block = bytes.substr(offset, view.size);
+                offset += view.size;
+                std::string name = "BM_LoopNest/corpus/" + std::to_string(i++);
+                benchmark::RegisterBenchmark(
+                    name.c_str(), [block](benchmark::State &state) {
+                        LoopBlockView view;
+                        view.parse(block);
+                        analyze(state, [&](LoopBlock &lblock) {
+                            view.materialize(lblock);
+                        });
+                    });
+            }))
+            std::cerr << "skipping the malformed end of " << path << std::endl;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "../include/Math.hpp"
+#include "../include/NormalForm.hpp"
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+// Integer row reduction against the multi-modular Hermite normal form, on
+// random `M x (M + 2)` matrices with coefficients in `[-magnitude,
+// magnitude]`. Each benchmark takes `{rows, magnitude}`, and reports the
+// `log2` of the Hadamard bound of the matrix, on which `hermite` selects
+// between them, and whether the result was exact: row reduction silently
+// overflows, and `modularHermite` gives up, once the bound is large.
+
+static IntMatrix randomMatrix(size_t M, int64_t magnitude) {
+    std::mt19937_64 rng(M * 1009 + magnitude);
+    std::uniform_int_distribution<int64_t> coef(-magnitude, magnitude);
+    IntMatrix A(M, M + 2);
+    for (auto &a : A)
+        a = coef(rng);
+    return A;
+}
+// `U * A == H`, without overflow
+static bool isExactProduct(PtrMatrix<int64_t> U, PtrMatrix<int64_t> A,
+                           PtrMatrix<int64_t> H) {
+    for (size_t i = 0; i < H.numRow(); ++i) {
+        for (size_t j = 0; j < H.numCol(); ++j) {
+            __int128_t h = 0;
+            for (size_t k = 0; k < A.numRow(); ++k)
+                h += widen(U(i, k)) * A(k, j);
+            if (h != H(i, j))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void BM_HermiteRowReduction(benchmark::State &state) {
+    IntMatrix A = randomMatrix(state.range(0), state.range(1));
+    const size_t M = A.numRow();
+    IntMatrix H = A;
+    SquareMatrix<int64_t> U(M);
+    for (auto _ : state) {
+        H = A;
+        U = SquareMatrix<int64_t>::identity(M);
+        NormalForm::simplifyEqualityConstraintsImpl(H, U);
+        benchmark::DoNotOptimize(H.data());
+    }
+    state.counters["bits"] = NormalForm::hadamardBits(A);
+    state.counters["exact"] = isExactProduct(U, A, H);
+}
+static void BM_HermiteModular(benchmark::State &state) {
+    IntMatrix A = randomMatrix(state.range(0), state.range(1));
+    bool exact = false;
+    for (auto _ : state) {
+        auto HU = NormalForm::modularHermite(A);
+        exact = HU.hasValue();
+        benchmark::DoNotOptimize(HU);
+    }
+    state.counters["bits"] = NormalForm::hadamardBits(A);
+    state.counters["exact"] = exact;
+}
+static void shapes(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"rows", "mag"})->ArgsProduct({{2, 4, 6, 8}, {1, 6, 100}});
+}
+BENCHMARK(BM_HermiteRowReduction)->Apply(shapes);
+BENCHMARK(BM_HermiteModular)->Apply(shapes);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,233 @@
+// counts the bytes and allocations of each benchmark, in any build
+#ifndef TURBOLOOP_TRACK_ALLOCATIONS
+#define TURBOLOOP_TRACK_ALLOCATIONS 1
+#endif
+#include "../include/CompileBudget.hpp"
+#include "../include/Constraints.hpp"
+#include "../include/Instrumentation.hpp"
+#include "../include/Math.hpp"
+#include "../include/Polyhedra.hpp"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/SmallVector.h>
+#include <random>
+
+// Which elimination strategy wins at which size: Fourier-Motzkin elimination
+// of one variable at a time (`removeVariable`), which prunes redundant
+// bounds after every step, the substitution based `removeExtraVariables`,
+// and `pruneBounds` on its own, on generated polyhedra. Each benchmark takes
+//   {variables, inequalities, coefficient magnitude, equalities},
+// and the eliminations keep the first half of the variables, as when
+// projecting a dependence polyhedron onto one of its loop nests.
+// Next to time, they report the constraints in and out, the most
+// constraints held at once (before pruning), and the bytes and allocations
+// per iteration. Like the pass, eliminations run under a budget of
+// constraint rows, relaxing the polyhedra once it is exhausted; they report
+// whether it was.
+// HiGHS is not a dependency of the build, so the ILP based redundancy
+// elimination of `ILPConstraintElimination.hpp` is not benchmarked.
+
+struct Allocations {
+    AllocationCounts start = allocationCounts();
+    void report(benchmark::State &state) const {
+        AllocationCounts d = allocationCounts() - start;
+        state.counters["bytes"] = benchmark::Counter(
+            d.totalBytes(), benchmark::Counter::kAvgIterations);
+        state.counters["allocs"] = benchmark::Counter(
+            d.totalCount(), benchmark::Counter::kAvgIterations);
+    }
+};
+
+// A*x <= b && E*x == q
+static constexpr BudgetLimits limits{1 << 16, 0.0};
+
+struct Polyhedron {
+    IntMatrix A;
+    llvm::SmallVector<int64_t, 8> b;
+    IntMatrix E;
+    llvm::SmallVector<int64_t, 8> q;
+};
+
+struct Shape {
+    size_t numVar, numIneq;
+    int64_t magnitude;
+    size_t numEq;
+};
+static Shape shape(const benchmark::State &state) {
+    return {size_t(state.range(0)), size_t(state.range(1)), state.range(2),
+            size_t(state.range(3))};
+}
+
+// Dense constraints with coefficients in `[-magnitude, magnitude]`, all
+// satisfied by a random point, so that the polyhedron is not empty.
+static Polyhedron dense(Shape s) {
+    std::mt19937_64 rng(s.numVar * 1000003 + s.numIneq * 1009 + s.numEq);
+    std::uniform_int_distribution<int64_t> coef(-s.magnitude, s.magnitude),
+        point(-10, 10), slack(0, s.magnitude);
+    llvm::SmallVector<int64_t, 16> x(s.numVar);
+    for (auto &xv : x)
+        xv = point(rng);
+    Polyhedron p{IntMatrix(s.numIneq, s.numVar), {}, IntMatrix(s.numEq, s.numVar),
+                 {}};
+    for (size_t c = 0; c < s.numIneq; ++c) {
+        int64_t ax = 0;
+        for (size_t v = 0; v < s.numVar; ++v)
+            ax += (p.A(c, v) = coef(rng)) * x[v];
+        p.b.push_back(ax + slack(rng));
+    }
+    for (size_t c = 0; c < s.numEq; ++c) {
+        int64_t ex = 0;
+        for (size_t v = 0; v < s.numVar; ++v)
+            ex += (p.E(c, v) = coef(rng)) * x[v];
+        p.q.push_back(ex);
+    }
+    return p;
+}
+
+// The dependence polyhedron of two triangular loop nests of depth
+// `numVar / 2`, `0 <= x_0 < magnitude` and `0 <= x_l <= x_{l-1}`, the
+// first `numEq` of whose indices are equal. `numIneq` is ignored.
+static Polyhedron dependence(Shape s) {
+    size_t depth = s.numVar / 2;
+    size_t numEq = std::min(s.numEq, depth);
+    Polyhedron p{IntMatrix(4 * depth, 2 * depth), {}, IntMatrix(numEq, 2 * depth),
+                 {}};
+    size_t c = 0;
+    for (size_t n = 0; n < 2; ++n) {
+        for (size_t l = 0; l < depth; ++l) {
+            size_t v = n * depth + l;
+            p.A(c++, v) = -1;
+            p.b.push_back(0);
+            p.A(c, v) = 1;
+            if (l) {
+                p.A(c++, v - 1) = -1;
+                p.b.push_back(0);
+            } else {
+                ++c;
+                p.b.push_back(s.magnitude - 1);
+            }
+        }
+    }
+    for (size_t l = 0; l < numEq; ++l) {
+        p.E(l, l) = 1;
+        p.E(l, depth + l) = -1;
+        p.q.push_back(0);
+    }
+    return p;
+}
+
+static void reportConstraints(benchmark::State &state, const Polyhedron &in,
+                              size_t out, bool overBudget) {
+    state.counters["constraintsIn"] = in.A.numRow() + in.E.numRow();
+    state.counters["constraintsOut"] = out;
+    state.counters["overBudget"] = overBudget;
+}
+
+// The constraints held while eliminating `i`, before redundant ones are
+// pruned: each lower bound is combined with each upper bound, unless an
+// equality is substituted instead.
+static size_t combinedBounds(const Polyhedron &p, size_t i) {
+    for (size_t c = 0; c < p.E.numRow(); ++c)
+        if (p.E(c, i))
+            return p.A.numRow() + p.E.numRow();
+    size_t numNeg = 0, numPos = 0;
+    for (size_t c = 0; c < p.A.numRow(); ++c) {
+        numNeg += p.A(c, i) < 0;
+        numPos += p.A(c, i) > 0;
+    }
+    return p.A.numRow() - numNeg - numPos + numNeg * numPos + p.E.numRow();
+}
+
+template <Polyhedron (*Generate)(Shape)>
+static void BM_RemoveVariable(benchmark::State &state) {
+    Shape s = shape(state);
+    Polyhedron p = Generate(s);
+    IntegerPolyhedra poly(p.A, p.b);
+    size_t peak = 0, out = 0;
+    bool overBudget = false;
+    Allocations allocations;
+    for (auto _ : state) {
+        Polyhedron c = p;
+        CompileBudget budget("benchmark", limits);
+        BudgetScope scope(&budget);
+        for (size_t i = s.numVar; i > s.numVar / 2;) {
+            peak = std::max(peak, combinedBounds(c, --i));
+            poly.removeVariable(c.A, c.b, c.E, c.q, i);
+        }
+        overBudget |= budgetExhausted();
+        out = c.A.numRow() + c.E.numRow();
+        benchmark::DoNotOptimize(c.A.data());
+    }
+    allocations.report(state);
+    reportConstraints(state, p, out, overBudget);
+    state.counters["peakConstraints"] = peak;
+}
+
+template <Polyhedron (*Generate)(Shape)>
+static void BM_RemoveExtraVariables(benchmark::State &state) {
+    Shape s = shape(state);
+    Polyhedron p = Generate(s);
+    size_t out = 0;
+    bool overBudget = false;
+    Allocations allocations;
+    for (auto _ : state) {
+        Polyhedron c = p;
+        CompileBudget budget("benchmark", limits);
+        BudgetScope scope(&budget);
+        removeExtraVariables(c.A, c.b, c.E, c.q, s.numVar / 2);
+        overBudget |= budgetExhausted();
+        out = c.A.numRow() + c.E.numRow();
+        benchmark::DoNotOptimize(c.A.data());
+    }
+    allocations.report(state);
+    reportConstraints(state, p, out, overBudget);
+    // one augment variable per inequality, eliminated by substitution
+    state.counters["peakConstraints"] = p.A.numRow() + p.E.numRow();
+}
+
+template <Polyhedron (*Generate)(Shape)>
+static void BM_PruneBounds(benchmark::State &state) {
+    Shape s = shape(state);
+    Polyhedron p = Generate(s);
+    IntegerPolyhedra poly(p.A, p.b);
+    size_t out = 0;
+    bool overBudget = false;
+    Allocations allocations;
+    for (auto _ : state) {
+        Polyhedron c = p;
+        CompileBudget budget("benchmark", limits);
+        BudgetScope scope(&budget);
+        poly.pruneBounds(c.A, c.b, c.E, c.q);
+        overBudget |= budgetExhausted();
+        out = c.A.numRow() + c.E.numRow();
+        benchmark::DoNotOptimize(c.A.data());
+    }
+    allocations.report(state);
+    reportConstraints(state, p, out, overBudget);
+    state.counters["peakConstraints"] = p.A.numRow() + p.E.numRow();
+}
+
+// Beyond these shapes, e.g. with 8 dense variables, or 12 dense constraints
+// of magnitude 8, the coefficients of the auxiliary systems of redundancy
+// elimination overflow, and `removeVariable` does not terminate.
+static void denseShapes(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"var", "ineq", "mag", "eq"})
+        ->ArgsProduct({{4, 6}, {8, 12, 16}, {1}, {0, 2}})
+        ->ArgsProduct({{4, 6, 8}, {8}, {1, 8}, {2}});
+}
+static void dependenceShapes(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"var", "ineq", "mag", "eq"})
+        ->ArgsProduct({{4, 6, 8, 10, 12}, {0}, {1024}, {0, 1, 2}});
+}
+
+BENCHMARK_TEMPLATE(BM_RemoveVariable, dense)->Apply(denseShapes);
+BENCHMARK_TEMPLATE(BM_RemoveVariable, dependence)->Apply(dependenceShapes);
+BENCHMARK_TEMPLATE(BM_RemoveExtraVariables, dense)->Apply(denseShapes);
+BENCHMARK_TEMPLATE(BM_RemoveExtraVariables, dependence)
+    ->Apply(dependenceShapes);
+BENCHMARK_TEMPLATE(BM_PruneBounds, dense)->Apply(denseShapes);
+BENCHMARK_TEMPLATE(BM_PruneBounds, dependence)->Apply(dependenceShapes);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,174 @@
+#include "../include/POSet.hpp"
+#include "../include/Symbolics.hpp"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/SmallVector.h>
+#include <random>
+
+// Scaling of `PartiallyOrderedSet`, which ingests every `llvm.assume` of a
+// function: `push` maintains the transitive closure of the relations, and
+// is cubic in the number of variables for relations that chain.
+// Each benchmark takes the number of variables, and fits its complexity.
+// Variable `0` is zero, as in `TurboLoopPass`.
+
+// `j - i in itv`
+struct Relation {
+    size_t i, j;
+    Interval itv;
+};
+
+// `x_1 < x_2 < ... < x_n`, each fact tightening all earlier ones.
+static llvm::SmallVector<Relation> chain(size_t n) {
+    llvm::SmallVector<Relation> rels;
+    for (size_t i = 1; i < n; ++i)
+        rels.push_back({i, i + 1, Interval::positive()});
+    return rels;
+}
+
+// Relations between a quarter of all pairs of variables, chosen at random,
+// bounding their differences from both sides, consistently with random
+// values of the variables.
+static llvm::SmallVector<Relation> denseRandom(size_t n) {
+    std::mt19937_64 rng(n);
+    std::uniform_int_distribution<int64_t> value(-1000, 1000), slack(0, 100);
+    std::uniform_int_distribution<size_t> var(0, n);
+    llvm::SmallVector<int64_t> x(n + 1);
+    for (size_t i = 1; i <= n; ++i)
+        x[i] = value(rng);
+    llvm::SmallVector<Relation> rels;
+    while (rels.size() < n * (n + 1) / 8) {
+        size_t i = var(rng), j = var(rng);
+        if (i == j)
+            continue;
+        int64_t d = x[j] - x[i];
+        rels.push_back({i, j, Interval{d - slack(rng), d + slack(rng)}});
+    }
+    return rels;
+}
+
+// Lower bounds on the differences of a quarter of all pairs of variables,
+// chosen at random, consistently with random values of the variables. Each
+// tightens the bounds derived through many others.
+static llvm::SmallVector<Relation> oneSidedRandom(size_t n) {
+    std::mt19937_64 rng(n);
+    std::uniform_int_distribution<int64_t> value(-1000, 1000), slack(0, 100);
+    std::uniform_int_distribution<size_t> var(0, n);
+    llvm::SmallVector<int64_t> x(n + 1);
+    for (size_t i = 1; i <= n; ++i)
+        x[i] = value(rng);
+    llvm::SmallVector<Relation> rels;
+    while (rels.size() < n * (n + 1) / 8) {
+        size_t i = var(rng), j = var(rng);
+        if (i == j)
+            continue;
+        rels.push_back(
+            {i, j, Interval::LowerBound(x[j] - x[i] - slack(rng))});
+    }
+    return rels;
+}
+
+// The assumptions Julia emits for `n` array sizes: each is non-negative,
+// the sizes of pairs of arrays are checked to be equal (e.g. `size(A,2) ==
+// size(B,1)` for `A * B`), and views are no larger than their parents.
+static llvm::SmallVector<Relation> juliaSizes(size_t n) {
+    llvm::SmallVector<Relation> rels;
+    for (size_t i = 1; i <= n; ++i) {
+        rels.push_back({0, i, Interval::nonNegative()});
+        if (i % 3 == 0)
+            rels.push_back({i - 1, i, Interval::zero()});
+        else if (i % 3 == 2)
+            rels.push_back({i, i - 1, Interval::nonNegative()});
+    }
+    return rels;
+}
+
+static PartiallyOrderedSet build(llvm::ArrayRef<Relation> rels) {
+    PartiallyOrderedSet poset;
+    for (const Relation &r : rels)
+        poset.push(r.i, r.j, r.itv);
+    return poset;
+}
+
+template <llvm::SmallVector<Relation> (*Relations)(size_t)>
+static void BM_POSetPush(benchmark::State &state) {
+    size_t n = state.range(0);
+    llvm::SmallVector<Relation> rels = Relations(n);
+    for (auto _ : state) {
+        PartiallyOrderedSet poset = build(rels);
+        benchmark::DoNotOptimize(poset.delta.data());
+    }
+    state.SetComplexityN(n);
+    state.counters["relations"] = rels.size();
+}
+BENCHMARK_TEMPLATE(BM_POSetPush, chain)
+    ->RangeMultiplier(2)
+    ->Range(8, 256)
+    ->Complexity();
+BENCHMARK_TEMPLATE(BM_POSetPush, denseRandom)
+    ->RangeMultiplier(2)
+    ->Range(8, 256)
+    ->Complexity();
+BENCHMARK_TEMPLATE(BM_POSetPush, oneSidedRandom)
+    ->RangeMultiplier(2)
+    ->Range(8, 128)
+    ->Complexity();
+BENCHMARK_TEMPLATE(BM_POSetPush, juliaSizes)
+    ->RangeMultiplier(2)
+    ->Range(8, 256)
+    ->Complexity();
+
+// The intervals of the differences of all pairs of variables.
+static void BM_POSetQuery(benchmark::State &state) {
+    size_t n = state.range(0);
+    PartiallyOrderedSet poset = build(denseRandom(n));
+    for (auto _ : state) {
+        int64_t known = 0;
+        for (size_t i = 0; i <= n; ++i)
+            for (size_t j = 0; j <= n; ++j)
+                known += poset(i, j).isConstant();
+        benchmark::DoNotOptimize(known);
+    }
+    state.SetComplexityN(n);
+}
+BENCHMARK(BM_POSetQuery)->RangeMultiplier(2)->Range(8, 256)->Complexity();
+
+// The intervals of `n` products of up to three sizes.
+static void BM_POSetAsInterval(benchmark::State &state) {
+    size_t n = state.range(0);
+    PartiallyOrderedSet poset = build(juliaSizes(n));
+    std::mt19937_64 rng(n);
+    std::uniform_int_distribution<IDType> var(1, n);
+    llvm::SmallVector<Polynomial::Monomial> monomials;
+    for (size_t k = 0; k < n; ++k) {
+        IDType ids[3] = {var(rng), var(rng), var(rng)};
+        std::sort(ids, ids + 3);
+        switch (k % 3) {
+        case 0:
+            monomials.emplace_back(Polynomial::ID{ids[0]});
+            break;
+        case 1:
+            monomials.emplace_back(Polynomial::ID{ids[0]},
+                                   Polynomial::ID{ids[1]});
+            break;
+        default:
+            monomials.emplace_back(Polynomial::ID{ids[0]},
+                                   Polynomial::ID{ids[1]},
+                                   Polynomial::ID{ids[2]});
+        }
+    }
+    for (auto _ : state) {
+        int64_t nonNegative = 0;
+        for (const Polynomial::Monomial &m : monomials)
+            nonNegative += poset.asInterval(m).lowerBound >= 0;
+        benchmark::DoNotOptimize(nonNegative);
+    }
+    state.SetComplexityN(n);
+}
+BENCHMARK(BM_POSetAsInterval)
+    ->RangeMultiplier(2)
+    ->Range(8, 256)
+    ->Complexity();
+
+BENCHMARK_MAIN();
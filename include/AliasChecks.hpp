@@ -0,0 +1,206 @@
+#pragma once
+
+#include "./ArrayReference.hpp"
+#include "./CodeGen.hpp"
+#include "./CostModeling.hpp"
+#include "./LoopBlock.hpp"
+#include "./Loops.hpp"
+#include "./Math.hpp"
+#include "./Symbolics.hpp"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Transforms/Utils/ScalarEvolutionExpander.h>
+#include <utility>
+
+// Runtime alias checks and loop versioning.
+// `LoopBlock::fillEdges` only relates accesses to the same `arrayID`, i.e.
+// it assumes distinct arrays do not overlap. When arrays are given by
+// pointers that may alias, we version the loop nest: the optimized schedule
+// runs if the ranges of addresses accessed through each pair of base
+// pointers, at least one of which is stored to, are disjoint, and the
+// original loop otherwise. The ranges are computed from the `ArrayReference`
+// extents, so the check costs a few compares per entry into the nest.
+
+// Symbolic `[min, max]` of the element offset, from the array's base, of
+// the accesses of `ref`; `None` if the loop ranges are unknown.
+// Constant strides may have either sign. Other strides are assumed to be
+// non-negative, and are appended to `nonNegative` for the caller to check.
+llvm::Optional<std::pair<MPoly, MPoly>>
+accessExtent(const ArrayReference &ref,
+             llvm::SmallVectorImpl<MPoly> &nonNegative) {
+    llvm::Optional<llvm::SmallVector<std::pair<MPoly, MPoly>>> ranges =
+        loopRanges(*ref.loop);
+    if (!ranges)
+        return {};
+    PtrMatrix<const int64_t> indMat = ref.indexMatrix();
+    std::pair<MPoly, MPoly> extent;
+    for (size_t d = 0; d < ref.arrayDim(); ++d) {
+        auto &[stride, offset] = ref.stridesOffsets[d];
+        MPoly lo = offset, hi = offset;
+        for (size_t j = 0; j < indMat.numRow(); ++j) {
+            int64_t a = indMat(j, d);
+            if (a == 0)
+                continue;
+            MPoly l = a > 0 ? (*ranges)[j].first : (*ranges)[j].second;
+            MPoly h = a > 0 ? (*ranges)[j].second : (*ranges)[j].first;
+            l *= a;
+            h *= a;
+            lo += l;
+            hi += h;
+        }
+        lo *= stride;
+        hi *= stride;
+        llvm::Optional<int64_t> c = stride.getCompileTimeConstant();
+        if (c && (*c < 0))
+            std::swap(lo, hi);
+        else if (!c && !llvm::is_contained(nonNegative, stride))
+            nonNegative.push_back(stride);
+        extent.first += lo;
+        extent.second += hi;
+    }
+    return extent;
+}
+
+// Emits, before `insertPt`, the check that the ranges of bytes accessed by
+// `lblock` through distinct base pointers do not overlap, for each pair with
+// at least one store. `basePointers[id]` is the base of `arrayID` `id`, and
+// `symbols` are as in `toSCEV`.
+// Symbolic strides, assumed non-negative by `accessExtent`, are checked too.
+// Elements are sized by their `DataLayout` allocation size.
+// Returns `nullptr`, emitting nothing, if an extent or element type is
+// unknown, or two arrays share a base pointer.
+llvm::Value *emitNoAliasCheck(llvm::Instruction *insertPt,
+                              llvm::ScalarEvolution &SE,
+                              const LoopBlock &lblock,
+                              llvm::ArrayRef<llvm::Value *> basePointers,
+                              llvm::ArrayRef<const llvm::SCEV *> symbols) {
+    llvm::IRBuilder<> builder(insertPt);
+    llvm::Type *i64 = builder.getInt64Ty();
+    const llvm::DataLayout &DL = insertPt->getModule()->getDataLayout();
+    // byte extents `[begin, end)` relative to the base, as `SCEV`s
+    struct Extent {
+        size_t arrayID;
+        bool stored;
+        llvm::SmallVector<const llvm::SCEV *> begin, end;
+    };
+    llvm::SmallVector<Extent> arrays;
+    llvm::SmallVector<MPoly> strides;
+    for (auto &ma : lblock.memory) {
+        const size_t id = ma.ref.arrayID;
+        if ((id >= basePointers.size()) || !basePointers[id])
+            return nullptr;
+        llvm::Optional<std::pair<MPoly, MPoly>> extent =
+            accessExtent(ma.ref, strides);
+        if (!extent)
+            return nullptr;
+        llvm::Type *T = CostModeling::elementType(ma);
+        if (!T || !T->isSized())
+            return nullptr;
+        const int64_t bytes = DL.getTypeAllocSize(T).getFixedSize();
+        MPoly begin = extent->first, end = extent->second;
+        begin *= bytes;
+        end += 1;
+        end *= bytes;
+        const llvm::SCEV *b = toSCEV(SE, begin, symbols, i64);
+        const llvm::SCEV *e = toSCEV(SE, end, symbols, i64);
+        if (!b || !e)
+            return nullptr;
+        Extent *a = nullptr;
+        for (auto &x : arrays)
+            if (x.arrayID == id)
+                a = &x;
+        if (!a)
+            a = &arrays.emplace_back(Extent{id, false, {}, {}});
+        a->stored |= !ma.isLoad;
+        a->begin.push_back(b);
+        a->end.push_back(e);
+    }
+    for (size_t i = 0; i < arrays.size(); ++i)
+        for (size_t j = i + 1; j < arrays.size(); ++j)
+            if (basePointers[arrays[i].arrayID] ==
+                basePointers[arrays[j].arrayID])
+                return nullptr;
+    llvm::SmallVector<const llvm::SCEV *> strideSCEVs;
+    for (auto &stride : strides) {
+        const llvm::SCEV *S = toSCEV(SE, stride, symbols, i64);
+        if (!S)
+            return nullptr;
+        strideSCEVs.push_back(S);
+    }
+    llvm::SCEVExpander expander(SE, DL, "turboloop.alias");
+    llvm::SmallVector<llvm::Value *> begins, ends;
+    for (auto &a : arrays) {
+        const llvm::SCEV *base =
+            SE.getPtrToIntExpr(SE.getSCEV(basePointers[a.arrayID]), i64);
+        begins.push_back(expander.expandCodeFor(
+            SE.getAddExpr(base, SE.getSMinExpr(a.begin)), i64, insertPt));
+        ends.push_back(expander.expandCodeFor(
+            SE.getAddExpr(base, SE.getSMaxExpr(a.end)), i64, insertPt));
+    }
+    llvm::Value *noAlias = builder.getTrue();
+    for (const llvm::SCEV *S : strideSCEVs) {
+        llvm::Value *x = expander.expandCodeFor(S, i64, insertPt);
+        noAlias = builder.CreateAnd(
+            noAlias, builder.CreateICmpSGE(x, builder.getInt64(0)),
+            "turboloop.noalias");
+    }
+    for (size_t i = 0; i < arrays.size(); ++i) {
+        for (size_t j = i + 1; j < arrays.size(); ++j) {
+            if (!(arrays[i].stored || arrays[j].stored))
+                continue;
+            llvm::Value *disjoint =
+                builder.CreateOr(builder.CreateICmpULE(ends[i], begins[j]),
+                                 builder.CreateICmpULE(ends[j], begins[i]));
+            noAlias = builder.CreateAnd(noAlias, disjoint, "turboloop.noalias");
+        }
+    }
+    return noAlias;
+}
+
+// Versions the loop `L`: the loops emitted by `codegen` run if the value
+// returned by `emitCheck`, emitting before `L`'s preheader's terminator, is
+// true, and `L` otherwise.
+// Requires `L` to have a preheader, and a unique exit block without `phi`s.
+// `L` remains in `LI`; the emitted loops are not added, and `DT` is
+// recalculated.
+// Returns `true` on failure, leaving the IR unchanged.
+bool versionLoopNest(
+    llvm::Loop *L, LoopNestCodeGen &codegen,
+    std::function<llvm::Value *(llvm::Instruction *insertPt)> emitCheck,
+    llvm::DominatorTree &DT) {
+    llvm::BasicBlock *preheader = L->getLoopPreheader();
+    llvm::BasicBlock *exit = L->getExitBlock();
+    if (!preheader || !exit || llvm::isa<llvm::PHINode>(exit->front()) ||
+        !codegen.sharedLoopsAgree())
+        return true;
+    llvm::BranchInst *br =
+        llvm::dyn_cast<llvm::BranchInst>(preheader->getTerminator());
+    if (!br || br->isConditional())
+        return true;
+    llvm::Value *check = emitCheck(br);
+    if (!check)
+        return true;
+    llvm::Function *F = preheader->getParent();
+    llvm::BasicBlock *versioned = llvm::BasicBlock::Create(
+        F->getContext(), "turboloop.versioned", F, L->getHeader());
+    llvm::IRBuilder<>(versioned).CreateBr(exit);
+    [[maybe_unused]] bool failed = codegen.emit(versioned);
+    assert(!failed);
+    llvm::IRBuilder<>(br).CreateCondBr(check, versioned, L->getHeader());
+    br->eraseFromParent();
+    DT.recalculate(*F);
+    return false;
+}
@@ -0,0 +1,400 @@
+#pragma once
+
+#include "./ArrayReference.hpp"
+#include "./CostModeling.hpp"
+#include "./Instrumentation.hpp"
+#include "./LoopBlock.hpp"
+#include "./Loops.hpp"
+#include "./POSet.hpp"
+#include "./Schedule.hpp"
+#include "./Serialization.hpp"
+#include "./Symbolics.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// A persistent cache of the schedules chosen for loop blocks, shared by all
+// processes compiling the same kernels, so that warm starts skip dependence
+// analysis and scheduling.
+//
+// Entries are content addressed: the key is a canonical encoding of the
+// `LoopBlock` before scheduling (see `fingerprint`), and the value the
+// `Schedule` of each of its `MemoryAccess`es (see `encodeSchedules`), in
+// the format of `Serialization.hpp`.
+//
+// The file is memory mapped, and only ever replaced, never modified in
+// place: a writer takes a lock on `<path>.lock`, merges its new entries
+// with those of the current file into a temporary file, and renames it to
+// `<path>`. Thus, any number of processes may read it concurrently, and
+// readers never see a partially written file. The layout, little endian, is
+//  - header: `magic`, `uint32_t version`, `uint32_t numEntries`;
+//  - index: `numEntries` pairs `uint64_t hash, uint64_t offset`, sorted;
+//  - records: at each offset, `uint32_t keySize, uint32_t valueSize`,
+//    followed by the key and value bytes.
+// Hashes are `xxHash64` of the key; keys are compared in full, so that a
+// collision cannot return a wrong schedule.
+
+namespace AnalysisCacheFormat {
+constexpr char magic[8] = {'T', 'L', 'C', 'A', 'C', 'H', 'E', '\0'};
+// bump whenever the encoding of keys or values changes
+constexpr uint32_t version = 4;
+constexpr size_t headerBytes = sizeof(magic) + 2 * sizeof(uint32_t);
+constexpr size_t indexEntryBytes = 2 * sizeof(uint64_t);
+constexpr size_t recordHeaderBytes = 2 * sizeof(uint32_t);
+} // namespace AnalysisCacheFormat
+
+// Builds the canonical encoding of a `LoopBlock`. Symbols, arrays and loop
+// nests are numbered in order of first appearance, so that the encoding is
+// independent of the `llvm::Value`s they stand for, and the same kernel
+// compiled in another function, or process, has the same key.
+struct Fingerprint {
+    std::string bytes;
+    llvm::DenseMap<IDType, uint32_t> symbols;
+    // original ids, by canonical id
+    llvm::SmallVector<IDType> symbolIds;
+    llvm::DenseMap<size_t, uint32_t> arrays;
+    llvm::DenseMap<const AffineLoopNest *, uint32_t> loops;
+    // by canonical id
+    llvm::SmallVector<const AffineLoopNest *> loopNests;
+
+    void add(int64_t x) { appendBytes<int64_t>(bytes, x); }
+    void addSymbol(IDType id) {
+        auto [it, inserted] = symbols.try_emplace(id, symbolIds.size());
+        if (inserted)
+            symbolIds.push_back(id);
+        appendBytes<uint32_t>(bytes, it->second);
+    }
+    void add(const MPoly &p) {
+        add(int64_t(p.terms.size()));
+        for (auto &t : p.terms) {
+            add(t.coefficient);
+            add(int64_t(t.exponent.prodIDs.size()));
+            for (auto v : t.exponent.prodIDs)
+                addSymbol(v.id);
+        }
+    }
+    void add(PtrMatrix<const int64_t> A) {
+        add(int64_t(A.numRow()));
+        add(int64_t(A.numCol()));
+        for (size_t i = 0; i < A.numRow(); ++i)
+            for (size_t j = 0; j < A.numCol(); ++j)
+                add(A(i, j));
+    }
+    void add(const AffineLoopNest &aln) {
+        auto [it, inserted] = loops.try_emplace(&aln, loops.size());
+        add(int64_t(it->second));
+        if (!inserted)
+            return;
+        loopNests.push_back(&aln);
+        add(aln.A);
+        for (auto &b : aln.b)
+            add(b);
+    }
+    // The relations the `poset` of each loop nest knows between the symbols
+    // decide which dependencies are empty, so they are part of the key.
+    // Added once the whole block is walked, so that every symbol, including
+    // those seen only in strides and offsets, is related to `0` and to each
+    // other.
+    void addRelations() {
+        for (const AffineLoopNest *aln : loopNests) {
+            for (size_t i = 0; i < symbolIds.size(); ++i) {
+                Interval itv = aln->poset(0, symbolIds[i]);
+                add(itv.lowerBound);
+                add(itv.upperBound);
+                for (size_t j = 0; j < i; ++j) {
+                    itv = aln->poset(symbolIds[j], symbolIds[i]);
+                    add(itv.lowerBound);
+                    add(itv.upperBound);
+                }
+            }
+        }
+    }
+    void add(const MemoryAccess &ma) {
+        add(int64_t(ma.isLoad));
+        // the element type, which the cost model vectorizes and tiles by
+        llvm::Type *T = CostModeling::elementType(ma);
+        add(T ? int64_t(T->getTypeID()) : -1);
+        add(int64_t(CostModeling::elementBits(ma)));
+        auto [it, inserted] =
+            arrays.try_emplace(ma.ref.arrayID, arrays.size());
+        add(int64_t(it->second));
+        add(*ma.ref.loop);
+        add(int64_t(ma.ref.arrayDim()));
+        for (auto &[stride, offset] : ma.ref.stridesOffsets) {
+            add(stride);
+            add(offset);
+        }
+        add(ma.ref.indexMatrix());
+        // the initial schedule, i.e. program order
+        add(int64_t(ma.schedule.numLoops));
+        for (auto x : ma.schedule.data)
+            add(x);
+    }
+};
+
+// The canonical encoding of `lblock`, which must not have been scheduled
+// yet, and of the `target` it is scheduled for, e.g. its triple, CPU and
+// features, and the cost model's parameters.
+std::string fingerprint(const LoopBlock &lblock, llvm::StringRef target) {
+    Fingerprint fp;
+    appendBytes<uint32_t>(fp.bytes, target.size());
+    fp.bytes.append(target.data(), target.size());
+    fp.add(int64_t(lblock.memory.size()));
+    for (auto &ma : lblock.memory)
+        fp.add(ma);
+    fp.add(int64_t(lblock.valueFlow.size()));
+    for (auto [l, s] : lblock.valueFlow) {
+        fp.add(int64_t(l));
+        fp.add(int64_t(s));
+    }
+    fp.addRelations();
+    return std::move(fp.bytes);
+}
+
+// The schedules of the `memory` of `lblock`.
+std::string encodeSchedules(const LoopBlock &lblock) {
+    std::string s;
+    appendBytes<uint32_t>(s, lblock.memory.size());
+    for (auto &ma : lblock.memory)
+        appendSchedule(s, ma.schedule);
+    return s;
+}
+
+// Sets the schedules of the `memory` of `lblock` to those encoded in
+// `value` by `encodeSchedules`.
+// Returns `true` on failure, i.e. if `value` does not match `lblock`, in
+// which case the schedules are left untouched.
+bool restoreSchedules(LoopBlock &lblock, llvm::StringRef value) {
+    ByteReader r{value};
+    if (r.read<uint32_t>() != lblock.memory.size())
+        return true;
+    llvm::SmallVector<Schedule, 0> schedules;
+    for (auto &ma : lblock.memory)
+        if (readSchedule(r, schedules.emplace_back(ma.schedule.numLoops)))
+            return true;
+    if (!r.bytes.empty())
+        return true;
+    for (size_t i = 0; i < schedules.size(); ++i) {
+        Schedule &sch = lblock.memory[i].schedule;
+        const Schedule &x = schedules[i];
+        sch.data = x.data;
+        sch.vectorized = x.vectorized;
+        sch.vectorWidth = x.vectorWidth;
+        sch.maskedTail = x.maskedTail;
+        sch.unrolledInner = x.unrolledInner;
+        sch.unrolledOuter = x.unrolledOuter;
+        sch.unrolledInnerLoop = x.unrolledInnerLoop;
+        sch.unrolledOuterLoop = x.unrolledOuterLoop;
+        sch.tileL1 = x.tileL1;
+        sch.tileL2 = x.tileL2;
+        sch.parallel = x.parallel;
+    }
+    return false;
+}
+
+struct AnalysisCache {
+    std::string path;
+    // the mapped file; `nullptr` if it does not exist or is not valid
+    std::unique_ptr<llvm::MemoryBuffer> file;
+    size_t numEntries = 0;
+    // entries found by this process, not yet written
+    std::map<std::string, std::string> pending;
+    // written once this many entries are pending, and on destruction
+    size_t flushThreshold;
+    std::mutex mutex;
+
+    AnalysisCache(std::string path, size_t flushThreshold = 64)
+        : path(std::move(path)), flushThreshold(flushThreshold) {
+        map();
+    }
+    AnalysisCache(const AnalysisCache &) = delete;
+    AnalysisCache &operator=(const AnalysisCache &) = delete;
+    ~AnalysisCache() { flush(); }
+
+    // Maps the current file, validating its header and index.
+    void map() {
+        file.reset();
+        numEntries = 0;
+        auto buf = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                               /*RequiresNullTerminator=*/
+                                               false);
+        if (!buf)
+            return;
+        llvm::StringRef bytes = (*buf)->getBuffer();
+        using namespace AnalysisCacheFormat;
+        if ((bytes.size() < headerBytes) ||
+            std::memcmp(bytes.data(), magic, sizeof(magic)) ||
+            (readBytes<uint32_t>(bytes.data() + sizeof(magic)) != version))
+            return;
+        size_t n = readBytes<uint32_t>(bytes.data() + sizeof(magic) + 4);
+        if ((bytes.size() - headerBytes) / indexEntryBytes < n)
+            return;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t offset = readBytes<uint64_t>(
+                bytes.data() + headerBytes + i * indexEntryBytes + 8);
+            if ((offset > bytes.size()) ||
+                (bytes.size() - offset < recordHeaderBytes))
+                return;
+            uint64_t size =
+                uint64_t(readBytes<uint32_t>(bytes.data() + offset)) +
+                readBytes<uint32_t>(bytes.data() + offset + 4);
+            if (bytes.size() - offset - recordHeaderBytes < size)
+                return;
+        }
+        file = std::move(*buf);
+        numEntries = n;
+    }
+    uint64_t hashAt(size_t i) const {
+        return readBytes<uint64_t>(file->getBufferStart() +
+                                   AnalysisCacheFormat::headerBytes +
+                                   i * AnalysisCacheFormat::indexEntryBytes);
+    }
+    // the key and value of the `i`th entry of `file`
+    std::pair<llvm::StringRef, llvm::StringRef> entryAt(size_t i) const {
+        const char *base = file->getBufferStart();
+        uint64_t offset =
+            readBytes<uint64_t>(base + AnalysisCacheFormat::headerBytes +
+                                i * AnalysisCacheFormat::indexEntryBytes + 8);
+        const char *p = base + offset;
+        uint32_t keySize = readBytes<uint32_t>(p);
+        uint32_t valueSize = readBytes<uint32_t>(p + 4);
+        p += AnalysisCacheFormat::recordHeaderBytes;
+        return {llvm::StringRef(p, keySize),
+                llvm::StringRef(p + keySize, valueSize)};
+    }
+    llvm::Optional<std::string> lookupFile(llvm::StringRef key) const {
+        if (!file)
+            return {};
+        uint64_t h = llvm::xxHash64(key);
+        size_t lo = 0, hi = numEntries;
+        while (lo < hi) {
+            size_t mid = lo + ((hi - lo) >> 1);
+            if (hashAt(mid) < h)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (; (lo < numEntries) && (hashAt(lo) == h); ++lo) {
+            auto [k, v] = entryAt(lo);
+            if (k == key)
+                return v.str();
+        }
+        return {};
+    }
+    // The value cached for `key`, if any.
+    llvm::Optional<std::string> lookup(llvm::StringRef key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = pending.find(key.str());
+        llvm::Optional<std::string> value =
+            it != pending.end() ? llvm::Optional<std::string>(it->second)
+                                : lookupFile(key);
+        if (value)
+            ++NumAnalysisCacheHits;
+        else
+            ++NumAnalysisCacheMisses;
+        return value;
+    }
+    void insert(std::string key, std::string value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.emplace(std::move(key), std::move(value));
+        if (pending.size() >= flushThreshold)
+            flushLocked();
+    }
+    // Writes the pending entries, merged with those written by other
+    // processes since the file was mapped.
+    // Returns `true` on failure, in which case the entries stay pending.
+    bool flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return flushLocked();
+    }
+    bool flushLocked() {
+        if (pending.empty() || path.empty())
+            return false;
+        int lockFD;
+        if (llvm::sys::fs::openFileForWrite(path + ".lock", lockFD,
+                                            llvm::sys::fs::CD_OpenAlways))
+            return true;
+        bool failed = bool(llvm::sys::fs::lockFile(lockFD));
+        if (!failed) {
+            map();
+            failed = write();
+            llvm::sys::fs::unlockFile(lockFD);
+        }
+        llvm::sys::fs::closeFile(lockFD);
+        if (failed)
+            return true;
+        pending.clear();
+        map();
+        return false;
+    }
+    // Writes the entries of `file` and `pending` to a temporary file, and
+    // renames it to `path`. Requires holding the lock.
+    bool write() {
+        struct Entry {
+            uint64_t hash;
+            llvm::StringRef key, value;
+        };
+        llvm::SmallVector<Entry, 0> entries;
+        for (size_t i = 0; i < numEntries; ++i) {
+            auto [k, v] = entryAt(i);
+            entries.push_back({hashAt(i), k, v});
+        }
+        for (auto &[k, v] : pending)
+            if (!lookupFile(k))
+                entries.push_back({llvm::xxHash64(k), k, v});
+        std::sort(entries.begin(), entries.end(),
+                  [](const Entry &x, const Entry &y) {
+                      return (x.hash < y.hash) ||
+                             ((x.hash == y.hash) && (x.key < y.key));
+                  });
+        using namespace AnalysisCacheFormat;
+        std::string out;
+        out.append(magic, sizeof(magic));
+        appendBytes<uint32_t>(out, version);
+        appendBytes<uint32_t>(out, entries.size());
+        uint64_t offset = headerBytes + entries.size() * indexEntryBytes;
+        for (auto &e : entries) {
+            appendBytes<uint64_t>(out, e.hash);
+            appendBytes<uint64_t>(out, offset);
+            offset += recordHeaderBytes + e.key.size() + e.value.size();
+        }
+        for (auto &e : entries) {
+            appendBytes<uint32_t>(out, e.key.size());
+            appendBytes<uint32_t>(out, e.value.size());
+            out.append(e.key.data(), e.key.size());
+            out.append(e.value.data(), e.value.size());
+        }
+        int fd;
+        llvm::SmallString<128> tmp;
+        if (llvm::sys::fs::createUniqueFile(path + ".%%%%%%.tmp", fd, tmp))
+            return true;
+        {
+            llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+            os << out;
+            os.close();
+            if (os.has_error()) {
+                os.clear_error();
+                llvm::sys::fs::remove(tmp);
+                return true;
+            }
+        }
+        if (llvm::sys::fs::rename(tmp, path)) {
+            llvm::sys::fs::remove(tmp);
+            return true;
+        }
+        return false;
+    }
+};
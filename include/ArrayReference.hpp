@@ -224,7 +224,7 @@ struct ArrayReference {
         os << "ArrayReference " << ar.arrayID << " (dim = " << ar.arrayDim()
            << "):" << std::endl;
         for (auto ax : ar) {
-            std::cout << ax << std::endl;
+            os << ax << std::endl;
         }
         return os;
     }
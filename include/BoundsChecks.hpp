@@ -0,0 +1,477 @@
+#pragma once
+
+#include "./Instrumentation.hpp"
+#include "./IntegerMap.hpp"
+#include "./POSet.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/LCSSA.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Transforms/Utils/LoopUtils.h>
+#include <llvm/Transforms/Utils/ScalarEvolutionExpander.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <utility>
+
+// Hoisting bounds checks.
+// Bounds checks branch to a block ending in `unreachable` (e.g., after a
+// call throwing a `BoundsError`). Such blocks may be moved earlier: if any
+// iteration of a loop nest fails its check, we may as well find out before
+// entering the nest. For a check `lhs < rhs` with `lhs` affine in the loops
+// and `rhs` invariant, the set of iterations passing is convex, so it
+// suffices to check the extreme iterations, i.e. the first and last
+// iteration of each loop. We version the nest: if the checks pass at every
+// extreme, we run the original loop with the checks removed, and a clone
+// keeping them otherwise, so that errors are still thrown at the same
+// iteration. Within the fast version, the checks are facts, which we add to
+// a copy of the `PartiallyOrderedSet` kept for that nest only, for use in
+// delinearization and dependence analysis.
+
+// A conditional branch in a loop nest leaving to a block ending in
+// `unreachable`. The other successor is taken iff `lhs pred rhs`.
+struct BoundsCheck {
+    llvm::BranchInst *branch;
+    unsigned inBounds; // successor index taken when in bounds
+    llvm::CmpInst::Predicate pred;
+    const llvm::SCEV *lhs; // affine in the loops of the nest
+    const llvm::SCEV *rhs; // invariant in the nest
+};
+
+bool endsInUnreachable(const llvm::BasicBlock *BB) {
+    return llvm::isa<llvm::UnreachableInst>(BB->getTerminator());
+}
+
+// Predicates with which the in bounds iterations are convex, and hence
+// characterized by the extremes. `ult` and `ule` additionally require
+// `0 <= lhs`, and `rhs >= 0` (checked at runtime) for this to hold.
+bool isConvexPredicate(llvm::CmpInst::Predicate pred) {
+    switch (pred) {
+    case llvm::CmpInst::ICMP_EQ:
+    case llvm::CmpInst::ICMP_SLT:
+    case llvm::CmpInst::ICMP_SLE:
+    case llvm::CmpInst::ICMP_SGT:
+    case llvm::CmpInst::ICMP_SGE:
+    case llvm::CmpInst::ICMP_ULT:
+    case llvm::CmpInst::ICMP_ULE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The number of times the latch of `L` branches back to the header, if
+// every other exit of `L` ends in `unreachable`; else `SCEVCouldNotCompute`.
+const llvm::SCEV *latchExitCount(llvm::Loop *L, llvm::ScalarEvolution &SE) {
+    llvm::BasicBlock *latch = L->getLoopLatch();
+    if (!latch || !L->isLoopExiting(latch))
+        return SE.getCouldNotCompute();
+    llvm::SmallVector<llvm::BasicBlock *, 4> exiting;
+    L->getExitingBlocks(exiting);
+    for (auto BB : exiting) {
+        if (BB == latch)
+            continue;
+        for (auto succ : llvm::successors(BB))
+            if (!L->contains(succ) && !endsInUnreachable(succ))
+                return SE.getCouldNotCompute();
+    }
+    return SE.getExitCount(L, latch);
+}
+
+// `S`, affine in the loops of `root`, as an integer of the wider type `W`,
+// in which it does not wrap. Its value is congruent to that of `S`, and
+// equal where it fits in `S`'s type. `nullptr` if `S` is not affine.
+const llvm::SCEV *widenAffine(const llvm::SCEV *S, llvm::Loop *root,
+                              llvm::Type *W, llvm::ScalarEvolution &SE) {
+    if (SE.isLoopInvariant(S, root))
+        return SE.getSignExtendExpr(S, W);
+    auto *AR = llvm::dyn_cast<llvm::SCEVAddRecExpr>(S);
+    if (!AR || !AR->isAffine() || !root->contains(AR->getLoop()))
+        return nullptr;
+    const llvm::SCEV *start = widenAffine(AR->getStart(), root, W, SE);
+    const llvm::SCEV *step =
+        widenAffine(AR->getStepRecurrence(SE), root, W, SE);
+    if (!start || !step)
+        return nullptr;
+    return SE.getAddRecExpr(start, step, AR->getLoop(),
+                            llvm::SCEV::FlagAnyWrap);
+}
+
+// The number of backedges taken by `L` as an integer of type `W`; `nullptr`
+// if unknown, or if it varies within `root` and may wrap.
+const llvm::SCEV *widenedExitCount(llvm::Loop *L, llvm::Loop *root,
+                                   llvm::Type *W, llvm::ScalarEvolution &SE) {
+    const llvm::SCEV *btc = latchExitCount(L, SE);
+    if (llvm::isa<llvm::SCEVCouldNotCompute>(btc))
+        return nullptr;
+    if (SE.isLoopInvariant(btc, root))
+        return SE.getZeroExtendExpr(btc, W);
+    if (llvm::SCEVExprContains(btc, [](const llvm::SCEV *x) {
+            auto *AR = llvm::dyn_cast<llvm::SCEVAddRecExpr>(x);
+            return AR && !AR->hasNoSignedWrap();
+        }))
+        return nullptr;
+    return widenAffine(btc, root, W, SE);
+}
+
+// The values of `S`, at the extreme iterations of the loops from `L` out to
+// `root`, as integers of type `W`, twice as wide as `S`. Empty if `S` is not
+// affine in these loops, or a trip count is unknown. Up to `2^depth` values
+// are returned; as `S` is affine, it lies within their convex hull in every
+// iteration.
+llvm::SmallVector<const llvm::SCEV *>
+extremeValues(const llvm::SCEV *S, llvm::Loop *L, llvm::Loop *root,
+              llvm::Type *W, llvm::ScalarEvolution &SE) {
+    const llvm::SCEV *wide = widenAffine(S, root, W, SE);
+    if (!wide)
+        return {};
+    llvm::SmallVector<const llvm::SCEV *> values{wide}, next;
+    for (llvm::Loop *l = L;; l = l->getParentLoop()) {
+        const llvm::SCEV *btc = nullptr;
+        next.clear();
+        auto add = [&](const llvm::SCEV *x) {
+            if (std::find(next.begin(), next.end(), x) == next.end())
+                next.push_back(x);
+        };
+        for (auto v : values) {
+            if (SE.isLoopInvariant(v, l)) {
+                add(v);
+                continue;
+            }
+            auto *AR = llvm::dyn_cast<llvm::SCEVAddRecExpr>(v);
+            if (!AR || (AR->getLoop() != l))
+                return {};
+            if (!btc && !(btc = widenedExitCount(l, root, W, SE)))
+                return {};
+            add(AR->getStart());
+            add(AR->evaluateAtIteration(btc, SE));
+        }
+        std::swap(values, next);
+        if (l == root)
+            break;
+    }
+    for (auto v : values)
+        if (!SE.isLoopInvariant(v, root))
+            return {};
+    return values;
+}
+
+// The bounds checks within `root`.
+llvm::SmallVector<BoundsCheck> findBoundsChecks(llvm::Loop *root,
+                                                llvm::ScalarEvolution &SE) {
+    llvm::SmallVector<BoundsCheck> checks;
+    for (auto BB : root->blocks()) {
+        auto *br = llvm::dyn_cast<llvm::BranchInst>(BB->getTerminator());
+        if (!br || !br->isConditional())
+            continue;
+        unsigned inBounds;
+        if (!root->contains(br->getSuccessor(1)) &&
+            endsInUnreachable(br->getSuccessor(1)))
+            inBounds = 0;
+        else if (!root->contains(br->getSuccessor(0)) &&
+                 endsInUnreachable(br->getSuccessor(0)))
+            inBounds = 1;
+        else
+            continue;
+        auto *cmp = llvm::dyn_cast<llvm::ICmpInst>(br->getCondition());
+        if (!cmp || !cmp->getOperand(0)->getType()->isIntegerTy())
+            continue;
+        llvm::CmpInst::Predicate pred =
+            inBounds ? cmp->getInversePredicate() : cmp->getPredicate();
+        const llvm::SCEV *lhs = SE.getSCEV(cmp->getOperand(0));
+        const llvm::SCEV *rhs = SE.getSCEV(cmp->getOperand(1));
+        if (!SE.isLoopInvariant(rhs, root)) {
+            std::swap(lhs, rhs);
+            pred = llvm::CmpInst::getSwappedPredicate(pred);
+        }
+        if (!SE.isLoopInvariant(rhs, root) || !isConvexPredicate(pred))
+            continue;
+        checks.push_back(BoundsCheck{br, inBounds, pred, lhs, rhs});
+    }
+    return checks;
+}
+
+// Decomposes `S` into `value + offset`, giving the `poset` id of `value`,
+// or `0` if `S` is a constant; returns `false` if `S` is not of this form.
+bool asPosetOffset(ValueToPosetMap &valueToPosetMap, const llvm::SCEV *S,
+                   size_t &id, int64_t &offset) {
+    // leave room, so that differences of offsets do not overflow
+    auto small = [](const llvm::SCEVConstant *C) {
+        return C->getAPInt().getMinSignedBits() <= 62;
+    };
+    id = 0;
+    offset = 0;
+    if (auto *C = llvm::dyn_cast<llvm::SCEVConstant>(S)) {
+        if (!small(C))
+            return false;
+        offset = C->getAPInt().getSExtValue();
+        return true;
+    }
+    if (auto *U = llvm::dyn_cast<llvm::SCEVUnknown>(S)) {
+        id = valueToPosetMap.push(U->getValue());
+        return true;
+    }
+    auto *A = llvm::dyn_cast<llvm::SCEVAddExpr>(S);
+    if (!A || (A->getNumOperands() != 2))
+        return false;
+    auto *C = llvm::dyn_cast<llvm::SCEVConstant>(A->getOperand(0));
+    auto *U = llvm::dyn_cast<llvm::SCEVUnknown>(A->getOperand(1));
+    if (!C || !U || !small(C))
+        return false;
+    id = valueToPosetMap.push(U->getValue());
+    offset = C->getAPInt().getSExtValue();
+    return true;
+}
+
+// Adds the fact `x pred y` to `poset`, if both `x` and `y` are a value plus
+// a constant offset.
+void pushFact(ValueToPosetMap &valueToPosetMap, PartiallyOrderedSet &poset,
+              const llvm::SCEV *x, llvm::CmpInst::Predicate pred,
+              const llvm::SCEV *y) {
+    size_t i, j;
+    int64_t c, d;
+    if (!asPosetOffset(valueToPosetMap, x, i, c) ||
+        !asPosetOffset(valueToPosetMap, y, j, d))
+        return;
+    ++NumPOSetFacts;
+    if (llvm::CmpInst::isUnsigned(pred)) {
+        // `x >= 0`, and `y >= 0`
+        if (i)
+            poset.push(0, i, Interval::LowerBound(-c));
+        if (j)
+            poset.push(0, j, Interval::LowerBound(-d));
+    }
+    if (i == j)
+        return;
+    // `(j + d) - (i + c)` compared to `0`
+    const int64_t e = c - d;
+    switch (pred) {
+    case llvm::CmpInst::ICMP_EQ:
+        poset.push(i, j, Interval(e, e));
+        break;
+    case llvm::CmpInst::ICMP_SLT:
+    case llvm::CmpInst::ICMP_ULT:
+        poset.push(i, j, Interval::LowerBound(e + 1));
+        break;
+    case llvm::CmpInst::ICMP_SLE:
+    case llvm::CmpInst::ICMP_ULE:
+        poset.push(i, j, Interval::LowerBound(e));
+        break;
+    case llvm::CmpInst::ICMP_SGT:
+        poset.push(i, j, Interval::UpperBound(e - 1));
+        break;
+    case llvm::CmpInst::ICMP_SGE:
+        poset.push(i, j, Interval::UpperBound(e));
+        break;
+    default:
+        break;
+    }
+}
+
+// Emits `lhs pred rhs`, where `lhs` and `rhs` are the values, widened not
+// to wrap, of the check's operands of width `bits` at an extreme iteration.
+// The check in the loop compares the values truncated to `bits`, which are
+// equal to the wide values when these fit, so this is also checked.
+llvm::Value *emitExtremeCheck(llvm::IRBuilder<> &builder, llvm::Value *lhs,
+                              llvm::CmpInst::Predicate pred, llvm::Value *rhs,
+                              unsigned bits) {
+    llvm::Type *W = lhs->getType();
+    llvm::Value *fits = nullptr;
+    switch (pred) {
+    case llvm::CmpInst::ICMP_SLT:
+    case llvm::CmpInst::ICMP_SLE:
+        fits = builder.CreateICmpSGE(
+            lhs, llvm::ConstantInt::get(
+                     W, llvm::APInt::getSignedMinValue(bits).sext(
+                            W->getIntegerBitWidth())));
+        break;
+    case llvm::CmpInst::ICMP_SGT:
+    case llvm::CmpInst::ICMP_SGE:
+        fits = builder.CreateICmpSLE(
+            lhs, llvm::ConstantInt::get(
+                     W, llvm::APInt::getSignedMaxValue(bits).sext(
+                            W->getIntegerBitWidth())));
+        break;
+    case llvm::CmpInst::ICMP_ULT:
+    case llvm::CmpInst::ICMP_ULE:
+        // `rhs >= 0` is checked once by the caller
+        fits = builder.CreateICmpSGE(lhs, llvm::ConstantInt::get(W, 0));
+        pred = llvm::ICmpInst::getSignedPredicate(pred);
+        break;
+    default: // `eq`
+        break;
+    }
+    llvm::Value *cmp = builder.CreateICmp(pred, lhs, rhs);
+    return fits ? builder.CreateAnd(fits, cmp) : cmp;
+}
+
+// Loop attribute marking the clones keeping their bounds checks.
+constexpr const char *boundsCheckedLoop = "turboloop.boundschecked";
+
+// Versions the loop nest `root` on its bounds checks that can be checked at
+// the extreme iterations, removing them from `root`, and leaving them in a
+// clone run when any extreme fails. The facts established by the removed
+// checks are added to `poset`, so it should hold for `root` alone.
+// Requires `root` to have a preheader. It is put in LCSSA form first, so
+// that values used after it merge with the clone's; `DT` is recalculated,
+// and the clone is added to `LI`, marked with `boundsCheckedLoop`.
+// Returns `true` if nothing was hoisted, leaving the IR unchanged.
+bool hoistBoundsChecks(llvm::Loop *root, llvm::ScalarEvolution &SE,
+                       llvm::DominatorTree &DT, llvm::LoopInfo &LI,
+                       ValueToPosetMap &valueToPosetMap,
+                       PartiallyOrderedSet &poset) {
+    llvm::BasicBlock *preheader = root->getLoopPreheader();
+    if (!preheader || llvm::getBooleanLoopAttribute(root, boundsCheckedLoop))
+        return true;
+    llvm::Instruction *insertPt = preheader->getTerminator();
+    struct Hoisted {
+        BoundsCheck check;
+        llvm::SmallVector<const llvm::SCEV *> extremes;
+    };
+    llvm::SmallVector<Hoisted> hoisted;
+    for (auto &check : findBoundsChecks(root, SE)) {
+        llvm::Loop *L = LI.getLoopFor(check.branch->getParent());
+        llvm::Type *W = llvm::IntegerType::get(
+            check.lhs->getType()->getContext(),
+            2 * check.lhs->getType()->getIntegerBitWidth());
+        llvm::SmallVector<const llvm::SCEV *> extremes =
+            extremeValues(check.lhs, L, root, W, SE);
+        if (extremes.empty())
+            continue;
+        bool safe = llvm::isSafeToExpandAt(check.rhs, insertPt, SE);
+        for (auto e : extremes)
+            safe &= llvm::isSafeToExpandAt(e, insertPt, SE);
+        if (safe)
+            hoisted.push_back(Hoisted{check, std::move(extremes)});
+    }
+    if (hoisted.empty())
+        return true;
+    if (!root->isRecursivelyLCSSAForm(DT, LI))
+        llvm::formLCSSARecursively(*root, DT, &LI, &SE);
+    // `preheader` now branches to the checked clone, or `root`'s preheader
+    llvm::BasicBlock *fastPreheader =
+        llvm::SplitBlock(preheader, preheader->getTerminator(), &DT, &LI,
+                         nullptr, "turboloop.inbounds.ph");
+    llvm::ValueToValueMapTy VMap;
+    llvm::SmallVector<llvm::BasicBlock *, 16> cloned;
+    llvm::Loop *checked =
+        llvm::cloneLoopWithPreheader(fastPreheader, preheader, root, VMap,
+                                     ".checked", &LI, &DT, cloned);
+    llvm::remapInstructionsInBlocks(cloned, VMap);
+    // so that we do not version the clone again
+    for (llvm::Loop *L : checked->getLoopsInPreorder())
+        llvm::addStringMetadataToLoop(L, boundsCheckedLoop, 1);
+    // exits are shared, so add incoming values from the clone
+    llvm::SmallVector<llvm::BasicBlock *, 4> exits;
+    root->getUniqueExitBlocks(exits);
+    for (auto exit : exits) {
+        for (auto &phi : exit->phis()) {
+            llvm::SmallVector<std::pair<llvm::Value *, llvm::BasicBlock *>>
+                incoming;
+            for (unsigned k = 0; k < phi.getNumIncomingValues(); ++k) {
+                llvm::BasicBlock *BB = phi.getIncomingBlock(k);
+                if (!root->contains(BB))
+                    continue;
+                llvm::Value *v = phi.getIncomingValue(k);
+                if (llvm::Value *w = VMap.lookup(v))
+                    v = w;
+                incoming.emplace_back(v, llvm::cast<llvm::BasicBlock>(VMap[BB]));
+            }
+            for (auto &[v, BB] : incoming)
+                phi.addIncoming(v, BB);
+        }
+    }
+    insertPt = preheader->getTerminator();
+    llvm::SCEVExpander expander(SE, preheader->getModule()->getDataLayout(),
+                                "turboloop.bounds");
+    llvm::IRBuilder<> builder(insertPt);
+    llvm::Value *inBounds = nullptr;
+    auto conjoin = [&](llvm::Value *x) {
+        inBounds =
+            inBounds ? builder.CreateAnd(inBounds, x, "turboloop.inbounds") : x;
+    };
+    for (auto &h : hoisted) {
+        const BoundsCheck &check = h.check;
+        llvm::Type *T = check.rhs->getType();
+        llvm::Type *W = h.extremes.front()->getType();
+        llvm::Value *rhs = expander.expandCodeFor(
+            SE.getSignExtendExpr(check.rhs, W), W, insertPt);
+        if (llvm::CmpInst::isUnsigned(check.pred))
+            conjoin(builder.CreateICmpSGE(rhs, llvm::ConstantInt::get(W, 0)));
+        for (auto e : h.extremes) {
+            llvm::Value *lhs = expander.expandCodeFor(e, W, insertPt);
+            conjoin(emitExtremeCheck(builder, lhs, check.pred, rhs,
+                                     T->getIntegerBitWidth()));
+        }
+    }
+    builder.CreateCondBr(inBounds, fastPreheader, checked->getLoopPreheader());
+    insertPt->eraseFromParent();
+    for (auto &h : hoisted) {
+        const BoundsCheck &check = h.check;
+        llvm::BranchInst *br = check.branch;
+        br->getSuccessor(1 - check.inBounds)
+            ->removePredecessor(br->getParent());
+        llvm::BranchInst::Create(br->getSuccessor(check.inBounds), br);
+        llvm::Value *cond = br->getCondition();
+        br->eraseFromParent();
+        llvm::RecursivelyDeleteTriviallyDeadInstructions(cond);
+        for (auto e : h.extremes)
+            pushFact(valueToPosetMap, poset,
+                     SE.getTruncateExpr(e, check.rhs->getType()), check.pred,
+                     check.rhs);
+    }
+    SE.forgetLoop(root);
+    DT.recalculate(*preheader->getParent());
+    return false;
+}
+
+// The posets of the loop nests versioned on their bounds checks, each with
+// the facts holding within its fast version.
+using NestPosets = llvm::DenseMap<llvm::Loop *, PartiallyOrderedSet>;
+
+// The poset holding within `L`: that of the innermost nest of `nestPosets`
+// containing `L`, or `poset` if there is none.
+const PartiallyOrderedSet &posetWithin(const NestPosets &nestPosets,
+                                       llvm::Loop *L,
+                                       const PartiallyOrderedSet &poset) {
+    for (; L; L = L->getParentLoop()) {
+        auto it = nestPosets.find(L);
+        if (it != nestPosets.end())
+            return it->second;
+    }
+    return poset;
+}
+
+// Hoists bounds checks out of each loop nest in `LI`, trying outer loops
+// first, so that checks that cannot be hoisted out of a nest may still be
+// hoisted out of its inner loops. Each versioned nest gets a copy of the
+// poset holding within it, with the facts its checks establish, in
+// `nestPosets`; `poset` itself is left unchanged.
+// Returns whether the IR changed.
+bool hoistBoundsChecks(llvm::LoopInfo &LI, llvm::ScalarEvolution &SE,
+                       llvm::DominatorTree &DT,
+                       ValueToPosetMap &valueToPosetMap,
+                       const PartiallyOrderedSet &poset,
+                       NestPosets &nestPosets) {
+    bool changed = false;
+    // the clones are not visited, as they are added after this snapshot
+    for (llvm::Loop *L : LI.getLoopsInPreorder()) {
+        PartiallyOrderedSet facts = posetWithin(nestPosets, L, poset);
+        if (hoistBoundsChecks(L, SE, DT, LI, valueToPosetMap, facts))
+            continue;
+        nestPosets[L] = std::move(facts);
+        changed = true;
+    }
+    return changed;
+}
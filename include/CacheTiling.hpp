@@ -0,0 +1,320 @@
+#pragma once
+
+#include "./ArrayReference.hpp"
+#include "./CostModeling.hpp"
+#include "./LoopBlock.hpp"
+#include "./Math.hpp"
+#include "./Schedule.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Support/Debug.h>
+
+#define DEBUG_TYPE "turbo-loop"
+
+// Cache tiling (the "next in the road map" of the README).
+// Given a loop nest whose register tile has already been chosen (see
+// `CostModeling.hpp`), we pick L1 and then L2 tile sizes for its inner most
+// permutable band of loops.
+// The footprint of a tile is computed per array from the `ArrayReference`
+// index matrices: along each array dimension, a tile with sizes `T` touches
+// `1 + sum_l |indMat(l, d)| * (T_l - 1)` elements, and the contiguous first
+// dimension is rounded up to whole cache lines.
+// Tile sizes are multiples of the register tile, and grow by doubling the
+// level that most reduces the bytes moved into the cache per iteration, for
+// as long as the footprint fits.
+namespace CostModeling {
+
+struct CacheParameters {
+    unsigned lineBytes = 64;
+    unsigned l1Bytes = 32 * 1024;
+    unsigned l2Bytes = 1024 * 1024;
+    // fraction of each cache a tile may occupy, leaving room for conflict
+    // misses and data outside the loop nest.
+    double occupancy = 0.5;
+    // Fields of `overrides` that are non-zero take precedence over the
+    // target's; fields neither provides are left at their defaults.
+    static CacheParameters get(const llvm::TargetTransformInfo &TTI,
+                               CacheParameters overrides) {
+        CacheParameters cp;
+        if (unsigned line = TTI.getCacheLineSize())
+            cp.lineBytes = line;
+        if (llvm::Optional<unsigned> l1 =
+                TTI.getCacheSize(llvm::TargetTransformInfo::CacheLevel::L1D))
+            cp.l1Bytes = *l1;
+        if (llvm::Optional<unsigned> l2 =
+                TTI.getCacheSize(llvm::TargetTransformInfo::CacheLevel::L2D))
+            cp.l2Bytes = *l2;
+        if (overrides.lineBytes)
+            cp.lineBytes = overrides.lineBytes;
+        if (overrides.l1Bytes)
+            cp.l1Bytes = overrides.l1Bytes;
+        if (overrides.l2Bytes)
+            cp.l2Bytes = overrides.l2Bytes;
+        cp.occupancy = overrides.occupancy;
+        return cp;
+    }
+    static CacheParameters get(const llvm::TargetTransformInfo &TTI) {
+        return get(TTI, CacheParameters{0, 0, 0});
+    }
+};
+
+// Tile sizes are indexed by schedule level; levels outside of the tiled band
+// have size `1` in `l1` and `l2` (i.e., one iteration per tile).
+struct CacheTile {
+    // first schedule level of the tiled band
+    size_t band = 0;
+    llvm::SmallVector<size_t, 4> l1;
+    llvm::SmallVector<size_t, 4> l2;
+    size_t l1Footprint = 0;
+    size_t l2Footprint = 0;
+};
+
+// Constant trip count of `loop` within `aln`, if its bounds are constant.
+llvm::Optional<size_t> tripCount(const AffineLoopNest &aln, size_t loop) {
+    llvm::Optional<int64_t> lower, upper;
+    for (size_t c = 0; c < aln.A.numRow(); ++c) {
+        int64_t a = aln.A(c, loop);
+        if (!a)
+            continue;
+        bool single = true;
+        for (size_t l = 0; l < aln.A.numCol(); ++l)
+            single &= (l == loop) || (aln.A(c, l) == 0);
+        llvm::Optional<int64_t> bc = aln.b[c].getCompileTimeConstant();
+        if (!(single && bc))
+            continue;
+        // a * i <= b
+        if (a > 0) {
+            int64_t u = *bc >= 0 ? *bc / a : -((a - 1 - *bc) / a);
+            upper = upper ? std::min(*upper, u) : u;
+        } else {
+            int64_t l = *bc >= 0 ? -(*bc / -a) : (-*bc - a - 1) / -a;
+            lower = lower ? std::max(*lower, l) : l;
+        }
+    }
+    if (lower && upper)
+        return size_t(std::max(*upper - *lower + 1, int64_t(0)));
+    return {};
+}
+
+struct CacheTiling {
+    const RegisterTiling &rt;
+    CacheParameters cache;
+    // arrays, as indices into `rt.members` of a representative access;
+    // accesses with the same array and index matrix share a footprint.
+    llvm::SmallVector<unsigned> arrays;
+    // smallest tile size of each level, i.e. the register tile
+    llvm::SmallVector<size_t, 4> base;
+    // largest useful tile size of each level
+    llvm::SmallVector<size_t, 4> maxTile;
+    size_t band;
+
+    static constexpr size_t unknownTripCount = 4096;
+
+    CacheTiling(const RegisterTiling &rt, CacheParameters cache)
+        : rt(rt), cache(cache), base(rt.numLoops, 1),
+          maxTile(rt.numLoops, unknownTripCount), band(firstTileableLevel()) {
+        const LoopBlock &lblock = rt.lblock;
+        for (unsigned m = 0; m < rt.members.size(); ++m) {
+            const ArrayReference &ref = lblock.memory[rt.members[m]].ref;
+            bool found = false;
+            for (auto a : arrays) {
+                const ArrayReference &refa = lblock.memory[rt.members[a]].ref;
+                if ((found = (ref.arrayID == refa.arrayID) &&
+                             (ref.indexMatrix() == refa.indexMatrix())))
+                    break;
+            }
+            if (!found)
+                arrays.push_back(m);
+        }
+        const Schedule &sch = lblock.memory[rt.members.front()].schedule;
+        if (sch.vectorized >= 0)
+            base[sch.vectorized] *= sch.vectorWidth;
+        if (sch.unrolledInnerLoop >= 0)
+            base[sch.unrolledInnerLoop] *= sch.unrolledInner;
+        if (sch.unrolledOuterLoop >= 0)
+            base[sch.unrolledOuterLoop] *= sch.unrolledOuter;
+        const AffineLoopNest &aln = *lblock.memory[rt.members.front()].ref.loop;
+        for (size_t l = 0; l < rt.numLoops; ++l) {
+            int64_t loop = rt.loops(0, l);
+            if (loop < 0)
+                continue;
+            if (llvm::Optional<size_t> trip = tripCount(aln, loop))
+                maxTile[l] = std::max(*trip, base[l]);
+        }
+    }
+    // A band of levels may be tiled if it is permutable; we require each
+    // dependence between members to have a non-zero distance along at most
+    // one level of the band. The original schedule being legal, that
+    // distance is then either non-negative, or the dependence is carried by
+    // a level outside of the band.
+    size_t firstTileableLevel() const {
+        const LoopBlock &lblock = rt.lblock;
+        size_t first = 0;
+        for (auto &d : lblock.edges) {
+            size_t in = rt.memberIndex(d.in), out = rt.memberIndex(d.out);
+            if ((in == rt.members.size()) || (out == rt.members.size()))
+                continue;
+            // find the last two levels with non-zero distance
+            size_t nonZero = 0;
+            for (size_t l = rt.numLoops; l-- > first;) {
+                if ((rt.loops(in, l) >= 0) && (rt.loops(out, l) >= 0) &&
+                    zeroDistance(d, rt.loops(in, l), rt.loops(out, l)))
+                    continue;
+                if (++nonZero == 2) {
+                    first = l + 1;
+                    break;
+                }
+            }
+        }
+        return first;
+    }
+    // number of bytes of the array accessed by `rt.members[m]` touched by a
+    // tile of size `tile`
+    size_t footprint(unsigned m, llvm::ArrayRef<size_t> tile) const {
+        const MemoryAccess &ma = rt.lblock.memory[rt.members[m]];
+        PtrMatrix<const int64_t> indMat = ma.ref.indexMatrix();
+        const size_t elBytes = std::max(elementBits(ma) / 8, size_t(1));
+        size_t bytes = elBytes;
+        for (size_t d = 0; d < indMat.numCol(); ++d) {
+            size_t range = 1;
+            for (size_t l = 0; l < rt.numLoops; ++l) {
+                int64_t loop = rt.loops(m, l);
+                // skewed levels are not tiled
+                if (loop >= 0)
+                    range += std::abs(indMat(loop, d)) * (tile[l] - 1);
+            }
+            if ((d == 0) && isOne(ma.ref.stridesOffsets[0].first)) {
+                size_t lineBytes = cache.lineBytes;
+                bytes = ((range * elBytes + lineBytes - 1) / lineBytes) *
+                        lineBytes;
+            } else if (d == 0) {
+                // unknown stride; each element is in its own cache line
+                bytes = range * cache.lineBytes;
+            } else {
+                bytes *= range;
+            }
+        }
+        return bytes;
+    }
+    size_t footprint(llvm::ArrayRef<size_t> tile) const {
+        size_t bytes = 0;
+        for (auto a : arrays)
+            bytes += footprint(a, tile);
+        return bytes;
+    }
+    // bytes moved into the cache per iteration of the tile
+    double traffic(llvm::ArrayRef<size_t> tile) const {
+        double iterations = 1;
+        for (auto t : tile)
+            iterations *= t;
+        return footprint(tile) / iterations;
+    }
+    // Starting from `tile`, repeatedly doubles the size of the band level
+    // that most reduces the traffic, while the footprint fits in `bytes`.
+    llvm::SmallVector<size_t, 4> grow(llvm::SmallVector<size_t, 4> tile,
+                                      size_t bytes) const {
+        while (true) {
+            double bestTraffic = traffic(tile);
+            size_t bestLevel = rt.numLoops;
+            for (size_t l = band; l < rt.numLoops; ++l) {
+                if (tile[l] >= maxTile[l])
+                    continue;
+                size_t old = tile[l];
+                tile[l] = std::min(2 * old, maxTile[l]);
+                double t = traffic(tile);
+                if ((t < bestTraffic) && (footprint(tile) <= bytes)) {
+                    bestTraffic = t;
+                    bestLevel = l;
+                }
+                tile[l] = old;
+            }
+            if (bestLevel == rt.numLoops)
+                return tile;
+            tile[bestLevel] = std::min(2 * tile[bestLevel], maxTile[bestLevel]);
+        }
+    }
+    CacheTile search() const {
+        CacheTile ct;
+        ct.band = band;
+        llvm::SmallVector<size_t, 4> tile(rt.numLoops, 1);
+        for (size_t l = band; l < rt.numLoops; ++l)
+            tile[l] = base[l];
+        ct.l1 = grow(tile, size_t(cache.occupancy * cache.l1Bytes));
+        ct.l1Footprint = footprint(ct.l1);
+        ct.l2 = grow(ct.l1, size_t(cache.occupancy * cache.l2Bytes));
+        ct.l2Footprint = footprint(ct.l2);
+        return ct;
+    }
+};
+
+void apply(LoopBlock &lblock, const RegisterTiling &rt, const CacheTiling &ctg,
+           const CacheTile &ct) {
+    const size_t numLoops = rt.numLoops;
+    for (auto m : rt.members) {
+        Schedule &sch = lblock.memory[m].schedule;
+        sch.tileL1.assign(numLoops, 0);
+        sch.tileL2.assign(numLoops, 0);
+        for (size_t l = ct.band; l < numLoops; ++l) {
+            // a tile covering the whole loop is no tile
+            if (ct.l2[l] < ctg.maxTile[l])
+                sch.tileL2[l] = ct.l2[l];
+            if (ct.l1[l] < ct.l2[l])
+                sch.tileL1[l] = ct.l1[l];
+        }
+    }
+}
+
+// One loop of a tiled loop nest, from outer most to inner most.
+// `cacheLevel` is `2` or `1` for loops over L2 or L1 tiles, and `0` for the
+// loops over the iterations within a tile.
+struct TiledLoop {
+    size_t level;
+    uint8_t cacheLevel;
+    size_t step;
+};
+
+// The loop structure of `sch` once tiled: loops over L2 tiles, then L1
+// tiles, then the original levels. `LoopNestCodeGen` emits it, except for
+// levels whose bounds depend on other levels of the band, which it does not
+// tile.
+llvm::SmallVector<TiledLoop> tiledLoops(const Schedule &sch) {
+    llvm::SmallVector<TiledLoop> tl;
+    for (size_t l = 0; l < sch.tileL2.size(); ++l)
+        if (sch.tileL2[l])
+            tl.push_back(TiledLoop{l, 2, sch.tileL2[l]});
+    for (size_t l = 0; l < sch.tileL1.size(); ++l)
+        if (sch.tileL1[l])
+            tl.push_back(TiledLoop{l, 1, sch.tileL1[l]});
+    for (size_t l = 0; l < sch.numLoops; ++l)
+        tl.push_back(TiledLoop{l, 0, 1});
+    return tl;
+}
+
+// Chooses and applies cache tiles for every loop nest in `lblock`.
+// Requires `optimizeRegisterTiling` to have been called.
+void optimizeCacheTiling(LoopBlock &lblock, RegisterFile registers,
+                         CacheParameters cache) {
+    for (auto &nest : loopNests(lblock)) {
+        RegisterTiling rt(lblock, nest, registers);
+        CacheTiling ctg(rt, cache);
+        CacheTile ct = ctg.search();
+        LLVM_DEBUG({
+            llvm::dbgs() << "Cache tile: band = " << ct.band << "; L1 = [ ";
+            for (auto t : ct.l1)
+                llvm::dbgs() << t << " ";
+            llvm::dbgs() << "], " << ct.l1Footprint << " bytes; L2 = [ ";
+            for (auto t : ct.l2)
+                llvm::dbgs() << t << " ";
+            llvm::dbgs() << "], " << ct.l2Footprint << " bytes\n";
+        });
+        apply(lblock, rt, ctg, ct);
+    }
+}
+
+} // namespace CostModeling
+
+#undef DEBUG_TYPE
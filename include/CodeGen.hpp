@@ -0,0 +1,875 @@
+#pragma once
+
+#include "./CompileBudget.hpp"
+#include "./Instrumentation.hpp"
+#include "./LinearAlgebra.hpp"
+#include "./Loops.hpp"
+#include "./Math.hpp"
+#include "./Parallelization.hpp"
+#include "./Schedule.hpp"
+#include "./Symbolics.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Transforms/Utils/LoopUtils.h>
+#include <llvm/Transforms/Utils/ScalarEvolutionExpander.h>
+
+// Code generation by polyhedral scanning.
+// A statement's iteration domain is an `AffineLoopNest`, `A * x <= b`, over
+// its original loops `x`; its schedule executes it at levels `y = Phi' * x`.
+// For unimodular `Phi`, the domain over the levels is `A * inv(Phi') * y <=
+// b`, and constructing an `AffineLoopNest` from it eliminates inner levels
+// via Fourier-Motzkin, so that the bounds of level `l` (`lowerA[l]`,
+// `upperA[l]`, `lowerb[l]`, `upperb[l]`) only depend on outer levels. Each
+// level is then a loop from the max of its lower bounds to the min of its
+// upper bounds. Statements share a loop while their `omega`s agree, and are
+// ordered within it by `omega`.
+// The symbolic parts of the bounds, `MPoly`s, are converted to `SCEV`s and
+// expanded with `SCEVExpander` before the loop nest.
+// A vectorized level (`Schedule::vectorized`) steps by `vectorWidth`; its
+// remaining iterations run either as scalar iterations, or as a single
+// iteration with lanes past the upper bound masked off
+// (`Schedule::maskedTail`). The mask is computed from the bounds, so that
+// triangular loops need no scalar epilogue.
+// Levels unrolled by the register tiling (`Schedule::unrolledInnerLoop` and
+// `Schedule::unrolledOuterLoop`) are unrolled and jammed: the level steps by
+// its unroll factor (times its vector width, if vectorized), the levels
+// within it are emitted once, and each statement within them once per
+// unrolled iteration; the remaining iterations run as they would without
+// unrolling. Levels whose inner levels' bounds depend on them are not
+// unrolled, as the copies would not share the inner loops.
+// Levels with cache tiles (`Schedule::tileL2`, `Schedule::tileL1`) are
+// strip-mined: before the first tiled level, loops step over the L2 tiles
+// and then the L1 tiles of each tiled level of the band, and the tiled
+// levels then run within their innermost tile.
+// Optionally, the outermost parallel level (`Schedule::parallel`) is
+// outlined into a function over a range of its iterations, run through
+// `turboloop_parallel_for`; the values it uses from the enclosing function
+// are passed in a context struct.
+
+// Function attribute marking the outlined bodies of parallel loops.
+constexpr const char *outlinedParallelLoop = "turboloop.outlined";
+
+// Converts `p` to a `SCEV` of type `T`; the `VarID` `v` is `symbols[v.getID()]`
+// (e.g. the values of a `ValueToPosetMap`, with `symbols[0]` unused).
+// Returns `nullptr` if `p` uses a symbol not in `symbols`.
+const llvm::SCEV *toSCEV(llvm::ScalarEvolution &SE, const MPoly &p,
+                         llvm::ArrayRef<const llvm::SCEV *> symbols,
+                         llvm::Type *T) {
+    llvm::SmallVector<const llvm::SCEV *> terms;
+    for (auto &t : p.terms) {
+        llvm::SmallVector<const llvm::SCEV *> factors;
+        factors.push_back(SE.getConstant(T, t.coefficient, true));
+        for (auto v : t.exponent.prodIDs) {
+            if ((v.getID() >= symbols.size()) || !symbols[v.getID()])
+                return nullptr;
+            factors.push_back(
+                SE.getTruncateOrSignExtend(symbols[v.getID()], T));
+        }
+        terms.push_back(SE.getMulExpr(factors));
+    }
+    if (terms.empty())
+        return SE.getZero(T);
+    return SE.getAddExpr(terms);
+}
+
+// The lanes of a statement in a vectorized loop: lane `k` executes the
+// iteration whose original induction variables are `ivs[j] + k * step[j]`.
+// `mask` is `nullptr` if all lanes are active.
+struct VectorLanes {
+    unsigned width = 1;
+    llvm::Value *mask = nullptr;
+    llvm::SmallVector<int64_t> step;
+    bool isScalar() const { return width == 1; }
+};
+
+// `x` in every lane.
+llvm::Value *broadcast(llvm::IRBuilder<> &builder, llvm::Value *x,
+                       const VectorLanes &lanes) {
+    if (lanes.isScalar())
+        return x;
+    return builder.CreateVectorSplat(lanes.width, x);
+}
+// `x + k * step` in lane `k`.
+llvm::Value *laneValues(llvm::IRBuilder<> &builder, llvm::Value *x,
+                        int64_t step, const VectorLanes &lanes) {
+    if (lanes.isScalar())
+        return x;
+    llvm::SmallVector<llvm::Constant *> offsets;
+    for (unsigned k = 0; k < lanes.width; ++k)
+        offsets.push_back(llvm::ConstantInt::get(x->getType(), k * step));
+    return builder.CreateAdd(broadcast(builder, x, lanes),
+                             llvm::ConstantVector::get(offsets));
+}
+// Loads elements of type `T`, lane `k` from `ptr + k`.
+llvm::Value *emitLoad(llvm::IRBuilder<> &builder, llvm::Type *T,
+                      llvm::Value *ptr, const VectorLanes &lanes) {
+    if (lanes.isScalar())
+        return builder.CreateLoad(T, ptr);
+    const llvm::DataLayout &DL =
+        builder.GetInsertBlock()->getModule()->getDataLayout();
+    llvm::Type *VT = llvm::FixedVectorType::get(T, lanes.width);
+    llvm::Value *vptr = builder.CreatePointerCast(
+        ptr, VT->getPointerTo(ptr->getType()->getPointerAddressSpace()));
+    if (lanes.mask)
+        return builder.CreateMaskedLoad(VT, vptr, DL.getABITypeAlign(T),
+                                        lanes.mask);
+    return builder.CreateAlignedLoad(VT, vptr, DL.getABITypeAlign(T));
+}
+// Stores `x`, lane `k` to `ptr + k`.
+void emitStore(llvm::IRBuilder<> &builder, llvm::Value *x, llvm::Value *ptr,
+               const VectorLanes &lanes) {
+    if (lanes.isScalar()) {
+        builder.CreateStore(x, ptr);
+        return;
+    }
+    const llvm::DataLayout &DL =
+        builder.GetInsertBlock()->getModule()->getDataLayout();
+    llvm::Type *T = x->getType()->getScalarType();
+    llvm::Value *vptr = builder.CreatePointerCast(
+        ptr, x->getType()->getPointerTo(
+                 ptr->getType()->getPointerAddressSpace()));
+    if (lanes.mask)
+        builder.CreateMaskedStore(x, vptr, DL.getABITypeAlign(T), lanes.mask);
+    else
+        builder.CreateAlignedStore(x, vptr, DL.getABITypeAlign(T));
+}
+
+// The domain of `aln` over the schedule levels of `sch`, and the matrix
+// mapping levels back to loops, `x = toLoops * y`; `None` if `Phi` is not
+// unimodular.
+// The bounds are exact whatever the current `CompileBudget`: the loops are
+// emitted from them, and a relaxation would drop bounds, running iterations
+// outside of the domain.
+llvm::Optional<std::pair<llvm::IntrusiveRefCntPtr<AffineLoopNest>,
+                         SquareMatrix<int64_t>>>
+scheduledLoopNest(const AffineLoopNest &aln, const Schedule &sch) {
+    BudgetScope unbudgeted(nullptr);
+    const size_t numLoops = aln.getNumLoops();
+    if (sch.numLoops != numLoops)
+        return {};
+    SquarePtrMatrix<const int64_t> Phi = sch.getPhi();
+    SquareMatrix<int64_t> PhiT(numLoops);
+    for (size_t j = 0; j < numLoops; ++j)
+        for (size_t l = 0; l < numLoops; ++l)
+            PhiT(l, j) = Phi(j, l);
+    llvm::Optional<SquareMatrix<int64_t>> toLoops = integerInverse(PhiT);
+    if (!toLoops)
+        return {};
+    const size_t numConstraints = aln.A.numRow();
+    IntMatrix A(numConstraints, numLoops);
+    for (size_t r = 0; r < numConstraints; ++r) {
+        for (size_t l = 0; l < numLoops; ++l) {
+            int64_t x = 0;
+            for (size_t j = 0; j < numLoops; ++j)
+                x += aln.A(r, j) * (*toLoops)(j, l);
+            A(r, l) = x;
+        }
+    }
+    return std::make_pair(
+        llvm::makeIntrusiveRefCnt<AffineLoopNest>(std::move(A), aln.b,
+                                                  aln.poset),
+        std::move(*toLoops));
+}
+
+class LoopNestCodeGen {
+  public:
+    // Emits the statement, given the builder, the values of its original
+    // loops' induction variables, and its lanes if vectorized.
+    typedef std::function<void(llvm::IRBuilder<> &,
+                               llvm::ArrayRef<llvm::Value *>,
+                               const VectorLanes &)>
+        Body;
+
+  private:
+    struct Statement {
+        const AffineLoopNest *original;
+        const Schedule *schedule;
+        llvm::IntrusiveRefCntPtr<AffineLoopNest> loop;
+        SquareMatrix<int64_t> toLoops;
+        Body body;
+        // `SCEV`s of `loop->lowerb` and `loop->upperb`
+        llvm::SmallVector<llvm::SmallVector<const llvm::SCEV *>> lower;
+        llvm::SmallVector<llvm::SmallVector<const llvm::SCEV *>> upper;
+    };
+    llvm::ScalarEvolution &SE;
+    llvm::SCEVExpander expander;
+    llvm::ArrayRef<const llvm::SCEV *> symbols;
+    llvm::IntegerType *indexType;
+    llvm::SmallVector<Statement, 0> statements;
+    // emission state
+    llvm::IRBuilder<> *builder = nullptr;
+    llvm::Instruction *invariantInsertPt = nullptr;
+    llvm::BasicBlock *nestExit = nullptr;
+    // values of the enclosing schedule levels
+    llvm::SmallVector<llvm::Value *> levels;
+    // lanes of the enclosing vectorized level, if any
+    VectorLanes lanes;
+    size_t vectorLevel = 0;
+    // outline parallel levels, and whether we are within one
+    bool parallel;
+    bool inParallel = false;
+    // An enclosing level unrolled and jammed by `factor`: copy `k` of a
+    // statement runs the iteration `levels[level] + k * step`.
+    struct JammedLevel {
+        size_t level;
+        unsigned factor;
+        int64_t step;
+    };
+    llvm::SmallVector<JammedLevel> jammed;
+    // first and last iterations of the enclosing tile of each level, or
+    // `nullptr`s for levels without one; empty outside of a tiled band
+    llvm::SmallVector<std::pair<llvm::Value *, llvm::Value *>> tileRanges;
+
+    llvm::Value *expand(const llvm::SCEV *S) {
+        return expander.expandCodeFor(S, indexType, invariantInsertPt);
+    }
+    // `floor(n / d)` for `d > 0`
+    llvm::Value *floorDiv(llvm::Value *n, int64_t d) {
+        if (d == 1)
+            return n;
+        llvm::Value *D = llvm::ConstantInt::get(indexType, d);
+        llvm::Value *q = builder->CreateSDiv(n, D);
+        llvm::Value *negRem = builder->CreateICmpSLT(
+            builder->CreateSRem(n, D), llvm::ConstantInt::get(indexType, 0));
+        return builder->CreateSub(q,
+                                  builder->CreateZExt(negRem, indexType));
+    }
+    // `ceil(n / d)` for `d > 0`
+    llvm::Value *ceilDiv(llvm::Value *n, int64_t d) {
+        if (d == 1)
+            return n;
+        return builder->CreateNeg(floorDiv(builder->CreateNeg(n), d));
+    }
+    // The max of the lower bounds, or the min of the upper bounds, of
+    // `level`; row `r` of `A` is `sum(A(r, k) * y_k, k) <= b[r]`.
+    llvm::Value *bound(PtrMatrix<const int64_t> A,
+                       llvm::ArrayRef<const llvm::SCEV *> b, size_t level,
+                       bool isLower) {
+        llvm::Value *result = nullptr;
+        for (size_t r = 0; r < A.numRow(); ++r) {
+            llvm::Value *x = expand(b[r]);
+            for (size_t k = 0; k < level; ++k) {
+                if (int64_t a = A(r, k))
+                    x = builder->CreateSub(
+                        x, builder->CreateMul(
+                               levels[k], llvm::ConstantInt::get(indexType, a)));
+            }
+            int64_t a = A(r, level);
+            x = isLower ? ceilDiv(builder->CreateNeg(x), -a) : floorDiv(x, a);
+            if (result)
+                result = builder->CreateSelect(
+                    isLower ? builder->CreateICmpSGT(x, result)
+                            : builder->CreateICmpSLT(x, result),
+                    x, result);
+            else
+                result = x;
+        }
+        return result;
+    }
+    void emitStatement(const Statement &s) {
+        const size_t numLoops = s.schedule->numLoops;
+        llvm::SmallVector<llvm::Value *> ivs;
+        for (size_t j = 0; j < numLoops; ++j) {
+            llvm::Value *x = llvm::ConstantInt::get(indexType, 0);
+            for (size_t l = 0; l < numLoops; ++l) {
+                if (int64_t c = s.toLoops(j, l))
+                    x = builder->CreateAdd(
+                        x, c == 1 ? levels[l]
+                                  : builder->CreateMul(
+                                        levels[l],
+                                        llvm::ConstantInt::get(indexType, c)));
+            }
+            ivs.push_back(x);
+        }
+        VectorLanes l = lanes;
+        if (!l.isScalar())
+            for (size_t j = 0; j < numLoops; ++j)
+                l.step.push_back(s.toLoops(j, vectorLevel));
+        s.body(*builder, ivs, l);
+    }
+    // Emits `run`, statements in order, once for each copy of the enclosing
+    // unrolled and jammed levels from `jammed[j]` on; the copies of inner
+    // levels are adjacent.
+    void emitCopies(llvm::ArrayRef<unsigned> run, size_t j = 0) {
+        if (j == jammed.size()) {
+            for (auto i : run)
+                emitStatement(statements[i]);
+            return;
+        }
+        const JammedLevel &u = jammed[j];
+        llvm::Value *base = levels[u.level];
+        for (unsigned k = 0; k < u.factor; ++k) {
+            if (k)
+                levels[u.level] = builder->CreateAdd(
+                    base, llvm::ConstantInt::get(indexType, k * u.step), "",
+                    false, true);
+            emitCopies(run, j + 1);
+        }
+        levels[u.level] = base;
+    }
+    // Scalar loop over `[lb, ub]`.
+    void emitScalarLoop(llvm::ArrayRef<unsigned> group, size_t level,
+                        llvm::Value *lb, llvm::Value *ub) {
+        llvm::LLVMContext &ctx = builder->getContext();
+        llvm::Function *F = builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock *preheader = builder->GetInsertBlock();
+        llvm::BasicBlock *header =
+            llvm::BasicBlock::Create(ctx, "turboloop.header", F, nestExit);
+        llvm::BasicBlock *exit =
+            llvm::BasicBlock::Create(ctx, "turboloop.exit", F, nestExit);
+        builder->CreateCondBr(builder->CreateICmpSLE(lb, ub), header, exit);
+        builder->SetInsertPoint(header);
+        llvm::PHINode *iv = builder->CreatePHI(indexType, 2, "turboloop.iv");
+        iv->addIncoming(lb, preheader);
+        levels.push_back(iv);
+        emitLevel(group, level + 1);
+        levels.pop_back();
+        llvm::Value *next = builder->CreateAdd(
+            iv, llvm::ConstantInt::get(indexType, 1), "", false, true);
+        iv->addIncoming(next, builder->GetInsertBlock());
+        builder->CreateCondBr(builder->CreateICmpSLE(next, ub), header, exit);
+        builder->SetInsertPoint(exit);
+    }
+    // Loop over `[lb, ub]` in steps of `step`; `body` emits the iterations
+    // `[first, last]` of each step.
+    void emitStripLoop(
+        llvm::Value *lb, llvm::Value *ub, int64_t step,
+        llvm::function_ref<void(llvm::Value *, llvm::Value *)> body) {
+        llvm::LLVMContext &ctx = builder->getContext();
+        llvm::Function *F = builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock *preheader = builder->GetInsertBlock();
+        llvm::BasicBlock *header = llvm::BasicBlock::Create(
+            ctx, "turboloop.tile.header", F, nestExit);
+        llvm::BasicBlock *exit =
+            llvm::BasicBlock::Create(ctx, "turboloop.tile.exit", F, nestExit);
+        builder->CreateCondBr(builder->CreateICmpSLE(lb, ub), header, exit);
+        builder->SetInsertPoint(header);
+        llvm::PHINode *iv = builder->CreatePHI(indexType, 2, "turboloop.tile");
+        iv->addIncoming(lb, preheader);
+        llvm::Value *last = builder->CreateAdd(
+            iv, llvm::ConstantInt::get(indexType, step - 1), "", false, true);
+        body(iv, builder->CreateSelect(builder->CreateICmpSLT(last, ub), last,
+                                       ub));
+        llvm::Value *next = builder->CreateAdd(
+            iv, llvm::ConstantInt::get(indexType, step), "", false, true);
+        iv->addIncoming(next, builder->GetInsertBlock());
+        builder->CreateCondBr(builder->CreateICmpSLE(next, ub), header, exit);
+        builder->SetInsertPoint(exit);
+    }
+    // Loop over `[lb, ub]` in steps of `factor * width`, running `factor`
+    // copies of the statements within, each over `width` lanes, followed by
+    // the remainder, run as the loop over `[lb, ub]` would without unrolling.
+    void emitUnrolledLoop(llvm::ArrayRef<unsigned> group, size_t level,
+                          llvm::Value *lb, llvm::Value *ub, unsigned width,
+                          unsigned factor) {
+        llvm::LLVMContext &ctx = builder->getContext();
+        llvm::Function *F = builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock *preheader = builder->GetInsertBlock();
+        llvm::BasicBlock *header = llvm::BasicBlock::Create(
+            ctx, "turboloop.unroll.header", F, nestExit);
+        llvm::BasicBlock *remainder = llvm::BasicBlock::Create(
+            ctx, "turboloop.unroll.remainder", F, nestExit);
+        const int64_t step = int64_t(factor) * width;
+        llvm::Value *S = llvm::ConstantInt::get(indexType, step);
+        llvm::Value *Sm1 = llvm::ConstantInt::get(indexType, step - 1);
+        builder->CreateCondBr(
+            builder->CreateICmpSLE(builder->CreateAdd(lb, Sm1, "", false, true),
+                                   ub),
+            header, remainder);
+        builder->SetInsertPoint(header);
+        llvm::PHINode *iv = builder->CreatePHI(indexType, 2, "turboloop.iv");
+        iv->addIncoming(lb, preheader);
+        levels.push_back(iv);
+        if (width > 1) {
+            lanes = VectorLanes{width, nullptr, {}};
+            vectorLevel = level;
+        }
+        jammed.push_back({level, factor, width});
+        emitLevel(group, level + 1);
+        jammed.pop_back();
+        if (width > 1)
+            lanes = VectorLanes{};
+        levels.pop_back();
+        llvm::Value *next = builder->CreateAdd(iv, S, "", false, true);
+        llvm::BasicBlock *latch = builder->GetInsertBlock();
+        iv->addIncoming(next, latch);
+        builder->CreateCondBr(
+            builder->CreateICmpSLE(
+                builder->CreateAdd(next, Sm1, "", false, true), ub),
+            header, remainder);
+        builder->SetInsertPoint(remainder);
+        llvm::PHINode *rem = builder->CreatePHI(indexType, 2, "turboloop.rem");
+        rem->addIncoming(lb, preheader);
+        rem->addIncoming(next, latch);
+        if (width > 1)
+            emitVectorLoop(group, level, rem, ub, width);
+        else
+            emitScalarLoop(group, level, rem, ub);
+        ++NumUnrolledLoops;
+    }
+    // Loop over `[lb, ub]` in steps of `width`, followed by the remainder.
+    void emitVectorLoop(llvm::ArrayRef<unsigned> group, size_t level,
+                        llvm::Value *lb, llvm::Value *ub, unsigned width) {
+        llvm::LLVMContext &ctx = builder->getContext();
+        llvm::Function *F = builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock *preheader = builder->GetInsertBlock();
+        llvm::BasicBlock *header = llvm::BasicBlock::Create(
+            ctx, "turboloop.vector.header", F, nestExit);
+        llvm::BasicBlock *remainder = llvm::BasicBlock::Create(
+            ctx, "turboloop.remainder", F, nestExit);
+        llvm::Value *W = llvm::ConstantInt::get(indexType, width);
+        llvm::Value *Wm1 = llvm::ConstantInt::get(indexType, width - 1);
+        builder->CreateCondBr(
+            builder->CreateICmpSLE(builder->CreateAdd(lb, Wm1, "", false, true),
+                                   ub),
+            header, remainder);
+        builder->SetInsertPoint(header);
+        llvm::PHINode *iv = builder->CreatePHI(indexType, 2, "turboloop.iv");
+        iv->addIncoming(lb, preheader);
+        levels.push_back(iv);
+        lanes = VectorLanes{width, nullptr, {}};
+        vectorLevel = level;
+        emitLevel(group, level + 1);
+        lanes = VectorLanes{};
+        levels.pop_back();
+        llvm::Value *next = builder->CreateAdd(iv, W, "", false, true);
+        llvm::BasicBlock *latch = builder->GetInsertBlock();
+        iv->addIncoming(next, latch);
+        builder->CreateCondBr(
+            builder->CreateICmpSLE(
+                builder->CreateAdd(next, Wm1, "", false, true), ub),
+            header, remainder);
+        builder->SetInsertPoint(remainder);
+        llvm::PHINode *rem = builder->CreatePHI(indexType, 2, "turboloop.rem");
+        rem->addIncoming(lb, preheader);
+        rem->addIncoming(next, latch);
+        if (!statements[group.front()].schedule->maskedTail)
+            return emitScalarLoop(group, level, rem, ub);
+        llvm::BasicBlock *tail = llvm::BasicBlock::Create(
+            ctx, "turboloop.masked.tail", F, nestExit);
+        llvm::BasicBlock *exit =
+            llvm::BasicBlock::Create(ctx, "turboloop.exit", F, nestExit);
+        builder->CreateCondBr(builder->CreateICmpSLE(rem, ub), tail, exit);
+        builder->SetInsertPoint(tail);
+        levels.push_back(rem);
+        lanes = VectorLanes{width, nullptr, {}};
+        // lane `k` is active if `rem + k <= ub`
+        lanes.mask = builder->CreateICmpSLE(laneValues(*builder, rem, 1, lanes),
+                                            broadcast(*builder, ub, lanes));
+        vectorLevel = level;
+        emitLevel(group, level + 1);
+        lanes = VectorLanes{};
+        levels.pop_back();
+        builder->CreateBr(exit);
+        builder->SetInsertPoint(exit);
+    }
+    // Do the bounds of the levels within `level` not depend on it, for all
+    // of `group`?
+    bool innerBoundsIndependent(llvm::ArrayRef<unsigned> group,
+                                size_t level) const {
+        for (auto i : group) {
+            const Statement &s = statements[i];
+            for (size_t l = level + 1; l < s.schedule->numLoops; ++l) {
+                for (size_t r = 0; r < s.loop->lowerA[l].numRow(); ++r)
+                    if (s.loop->lowerA[l](r, level))
+                        return false;
+                for (size_t r = 0; r < s.loop->upperA[l].numRow(); ++r)
+                    if (s.loop->upperA[l](r, level))
+                        return false;
+            }
+        }
+        return true;
+    }
+    // The width `group` is vectorized by at `level`, or `1` if it is not, or
+    // cannot be: the bounds of inner levels must not depend on `level`, and
+    // vectorized levels may not be nested.
+    unsigned vectorWidth(llvm::ArrayRef<unsigned> group, size_t level) const {
+        const Schedule &sch = *statements[group.front()].schedule;
+        if ((sch.vectorized != int64_t(level)) || (sch.vectorWidth <= 1) ||
+            !lanes.isScalar())
+            return 1;
+        for (auto i : group) {
+            const Statement &s = statements[i];
+            if ((s.schedule->vectorized != sch.vectorized) ||
+                (s.schedule->vectorWidth != sch.vectorWidth) ||
+                (s.schedule->maskedTail != sch.maskedTail))
+                return 1;
+        }
+        return innerBoundsIndependent(group, level) ? sch.vectorWidth : 1;
+    }
+    // The factor `group` is unrolled and jammed by at `level`, or `1` if it
+    // is not, or cannot be: all of `group` must agree on it, and the bounds
+    // of inner levels must not depend on `level`.
+    unsigned unrollFactor(llvm::ArrayRef<unsigned> group, size_t level) const {
+        auto factor = [&](const Schedule &sch) {
+            if (sch.unrolledInnerLoop == int64_t(level))
+                return std::max(int64_t(sch.unrolledInner), int64_t(1));
+            if (sch.unrolledOuterLoop == int64_t(level))
+                return std::max(int64_t(sch.unrolledOuter), int64_t(1));
+            return int64_t(1);
+        };
+        int64_t f = factor(*statements[group.front()].schedule);
+        if (f <= 1)
+            return 1;
+        for (auto i : group)
+            if (factor(*statements[i].schedule) != f)
+                return 1;
+        return innerBoundsIndependent(group, level) ? unsigned(f) : 1;
+    }
+    // Is `level` the parallel level of all of `group`, and may it be
+    // outlined, i.e. is it neither within another parallel level nor within
+    // a vectorized one?
+    bool outlineable(llvm::ArrayRef<unsigned> group, size_t level) const {
+        if (!parallel || inParallel || !lanes.isScalar())
+            return false;
+        for (auto i : group)
+            if (statements[i].schedule->parallel != int64_t(level))
+                return false;
+        return true;
+    }
+    // Loop over `[lb, ub]`, vectorized and unrolled as `group` is at
+    // `level`.
+    void emitLoopOver(llvm::ArrayRef<unsigned> group, size_t level,
+                      llvm::Value *lb, llvm::Value *ub) {
+        unsigned width = vectorWidth(group, level);
+        if (unsigned factor = unrollFactor(group, level); factor > 1)
+            emitUnrolledLoop(group, level, lb, ub, width, factor);
+        else if (width > 1)
+            emitVectorLoop(group, level, lb, ub, width);
+        else
+            emitScalarLoop(group, level, lb, ub);
+    }
+    // Loop over `[lb, ub]`, outlined into a function running the iterations
+    // `[begin, end)`, called through `turboloop_parallel_for`.
+    void emitParallelLoop(llvm::ArrayRef<unsigned> group, size_t level,
+                          llvm::Value *lb, llvm::Value *ub) {
+        llvm::LLVMContext &ctx = builder->getContext();
+        llvm::BasicBlock *outer = builder->GetInsertBlock();
+        llvm::Function *F = outer->getParent();
+        llvm::Function *body = llvm::Function::Create(
+            parallelBodyType(ctx), llvm::Function::InternalLinkage,
+            F->getName() + ".turboloop.parallel", F->getParent());
+        body->addFnAttr(outlinedParallelLoop);
+        llvm::BasicBlock *entry = llvm::BasicBlock::Create(ctx, "entry", body);
+        llvm::BasicBlock *exit = llvm::BasicBlock::Create(ctx, "exit", body);
+        llvm::BasicBlock *outerExit = nestExit;
+        nestExit = exit;
+        inParallel = true;
+        builder->SetInsertPoint(entry);
+        emitLoopOver(group, level, body->getArg(1),
+                     builder->CreateSub(body->getArg(2),
+                                        llvm::ConstantInt::get(indexType, 1)));
+        builder->CreateBr(exit);
+        builder->SetInsertPoint(exit);
+        builder->CreateRetVoid();
+        inParallel = false;
+        nestExit = outerExit;
+        builder->SetInsertPoint(outer);
+        // the values of `F` used in `body`, i.e. invariants and outer levels
+        llvm::SetVector<llvm::Value *> captures;
+        for (auto &BB : *body) {
+            for (auto &I : BB) {
+                for (llvm::Value *op : I.operands()) {
+                    auto *J = llvm::dyn_cast<llvm::Instruction>(op);
+                    auto *A = llvm::dyn_cast<llvm::Argument>(op);
+                    if ((J && (J->getFunction() == F)) ||
+                        (A && (A->getParent() == F)))
+                        captures.insert(op);
+                }
+            }
+        }
+        llvm::SmallVector<llvm::Type *> types;
+        for (llvm::Value *v : captures)
+            types.push_back(v->getType());
+        llvm::StructType *contextType = llvm::StructType::get(ctx, types);
+        llvm::AllocaInst *context =
+            llvm::IRBuilder<>(&F->getEntryBlock(),
+                              F->getEntryBlock().getFirstInsertionPt())
+                .CreateAlloca(contextType, nullptr, "turboloop.context");
+        llvm::IRBuilder<> unpack(entry, entry->begin());
+        llvm::Value *bodyContext = unpack.CreatePointerCast(
+            body->getArg(0), contextType->getPointerTo());
+        for (unsigned i = 0; i < captures.size(); ++i) {
+            llvm::Value *v = captures[i];
+            builder->CreateStore(
+                v, builder->CreateStructGEP(contextType, context, i));
+            llvm::Value *x = unpack.CreateLoad(
+                types[i], unpack.CreateStructGEP(contextType, bodyContext, i));
+            v->replaceUsesWithIf(x, [&](llvm::Use &U) {
+                return llvm::cast<llvm::Instruction>(U.getUser())
+                           ->getFunction() == body;
+            });
+        }
+        emitParallelFor(*builder, body, context, lb,
+                        builder->CreateAdd(
+                            ub, llvm::ConstantInt::get(indexType, 1)),
+                        llvm::ConstantInt::get(indexType, 0));
+        ++NumParallelLoops;
+    }
+    // The tile loops of the band of `group` starting at `level`, as levels
+    // and tile sizes, outer most first: the loops over the L2 tiles, then
+    // over the L1 tiles, of each tiled level (see
+    // `CostModeling::tiledLoops`). Empty if `level` has no tile, or the band
+    // may not be tiled here: the tile loops are shared, so all of `group`
+    // must share every level of the band, with the same tiles; they are
+    // scalar loops, so not within a vectorized level; and a parallel level
+    // is outlined instead. Inner levels whose bounds depend on other levels
+    // of the band are left untiled, as their range is not known before
+    // those levels.
+    llvm::SmallVector<std::pair<size_t, int64_t>>
+    bandTiles(llvm::ArrayRef<unsigned> group, size_t level) const {
+        const Schedule &sch = *statements[group.front()].schedule;
+        auto tile = [](llvm::ArrayRef<uint32_t> sizes, size_t l) {
+            return l < sizes.size() ? int64_t(sizes[l]) : int64_t(0);
+        };
+        auto tiled = [&](size_t l) {
+            return tile(sch.tileL2, l) || tile(sch.tileL1, l);
+        };
+        if (!tileRanges.empty() || !lanes.isScalar() || !tiled(level) ||
+            outlineable(group, level))
+            return {};
+        for (auto i : group) {
+            const Schedule &si = *statements[i].schedule;
+            if ((si.numLoops != sch.numLoops) || (si.tileL1 != sch.tileL1) ||
+                (si.tileL2 != sch.tileL2))
+                return {};
+            for (size_t l = level; l < sch.numLoops; ++l)
+                if (si.getOmega()[2 * l] != sch.getOmega()[2 * l])
+                    return {};
+        }
+        const AffineLoopNest &loop = *statements[group.front()].loop;
+        llvm::SmallVector<size_t> band;
+        for (size_t l = level; l < sch.numLoops; ++l) {
+            if (!tiled(l))
+                continue;
+            bool independent = true;
+            for (size_t k = level; k < l; ++k) {
+                for (size_t r = 0; r < loop.lowerA[l].numRow(); ++r)
+                    independent &= (loop.lowerA[l](r, k) == 0);
+                for (size_t r = 0; r < loop.upperA[l].numRow(); ++r)
+                    independent &= (loop.upperA[l](r, k) == 0);
+            }
+            if (independent)
+                band.push_back(l);
+        }
+        llvm::SmallVector<std::pair<size_t, int64_t>> tiles;
+        for (auto l : band)
+            if (int64_t t = tile(sch.tileL2, l))
+                tiles.emplace_back(l, t);
+        for (auto l : band)
+            if (int64_t t = tile(sch.tileL1, l))
+                tiles.emplace_back(l, t);
+        return tiles;
+    }
+    // The first and last iterations of `level`: those of its enclosing tile
+    // if it has one, else its bounds.
+    std::pair<llvm::Value *, llvm::Value *>
+    levelRange(llvm::ArrayRef<unsigned> group, size_t level) {
+        if ((level < tileRanges.size()) && tileRanges[level].first)
+            return tileRanges[level];
+        const Statement &s = statements[group.front()];
+        return {bound(s.loop->lowerA[level], s.lower[level], level, true),
+                bound(s.loop->upperA[level], s.upper[level], level, false)};
+    }
+    // Emits the loops over `tiles`, and within them the loops of `group`
+    // from `level` on.
+    void emitTileLoops(llvm::ArrayRef<unsigned> group, size_t level,
+                       llvm::ArrayRef<std::pair<size_t, int64_t>> tiles) {
+        if (tiles.empty())
+            return emitLoop(group, level);
+        size_t l = tiles.front().first;
+        auto [lb, ub] = levelRange(group, l);
+        auto outer = tileRanges[l];
+        emitStripLoop(lb, ub, tiles.front().second,
+                      [&](llvm::Value *first, llvm::Value *last) {
+                          tileRanges[l] = {first, last};
+                          emitTileLoops(group, level, tiles.drop_front());
+                      });
+        tileRanges[l] = outer;
+    }
+    void emitLoop(llvm::ArrayRef<unsigned> group, size_t level) {
+        if (auto tiles = bandTiles(group, level); !tiles.empty()) {
+            tileRanges.assign(statements[group.front()].schedule->numLoops,
+                              {nullptr, nullptr});
+            emitTileLoops(group, level, tiles);
+            tileRanges.clear();
+            NumTileLoops += tiles.size();
+            return;
+        }
+        auto [lb, ub] = levelRange(group, level);
+        if (outlineable(group, level))
+            emitParallelLoop(group, level, lb, ub);
+        else
+            emitLoopOver(group, level, lb, ub);
+    }
+    // Emits `group`, statements sharing the outer `level` loops, in the
+    // order of `omega[2 * level]`.
+    void emitLevel(llvm::ArrayRef<unsigned> group, size_t level) {
+        llvm::SmallVector<unsigned> order(group.begin(), group.end());
+        auto position = [&](unsigned i) {
+            return statements[i].schedule->getOmega()[2 * level];
+        };
+        std::stable_sort(order.begin(), order.end(), [&](unsigned a,
+                                                         unsigned b) {
+            return position(a) < position(b);
+        });
+        for (size_t i = 0; i < order.size();) {
+            size_t j = i + 1;
+            if (statements[order[i]].schedule->numLoops == level) {
+                while ((j < order.size()) &&
+                       (statements[order[j]].schedule->numLoops == level))
+                    ++j;
+                emitCopies(llvm::ArrayRef<unsigned>(order).slice(i, j - i));
+                i = j;
+                continue;
+            }
+            while ((j < order.size()) &&
+                   (statements[order[j]].schedule->numLoops > level) &&
+                   (position(order[j]) == position(order[i])))
+                ++j;
+            emitLoop(llvm::ArrayRef<unsigned>(order).slice(i, j - i), level);
+            i = j;
+        }
+    }
+  public:
+    // `symbols[v.getID()]` is the value of the symbol `v`, see `toSCEV`.
+    // With `parallel`, parallel levels are outlined, and the module must be
+    // linked with the runtime library. Outlining adds functions to the
+    // module, so only a module pass may set it.
+    LoopNestCodeGen(llvm::ScalarEvolution &SE, const llvm::DataLayout &DL,
+                    llvm::ArrayRef<const llvm::SCEV *> symbols,
+                    llvm::IntegerType *indexType, bool parallel = false)
+        : SE(SE), expander(SE, DL, "turboloop"), symbols(symbols),
+          indexType(indexType), parallel(parallel) {}
+
+    // Adds a statement executing `body` over the domain `aln`, scheduled by
+    // `sch`; both must outlive the code generator.
+    // Returns `true` on failure.
+    bool addStatement(const AffineLoopNest &aln, const Schedule &sch,
+                      Body body) {
+        auto scheduled = scheduledLoopNest(aln, sch);
+        if (!scheduled)
+            return true;
+        Statement s{&aln, &sch, std::move(scheduled->first),
+                    std::move(scheduled->second), std::move(body), {}, {}};
+        const size_t numLoops = sch.numLoops;
+        s.lower.resize(numLoops);
+        s.upper.resize(numLoops);
+        for (size_t l = 0; l < numLoops; ++l) {
+            for (auto &b : s.loop->lowerb[l]) {
+                const llvm::SCEV *S = toSCEV(SE, b, symbols, indexType);
+                if (!S)
+                    return true;
+                s.lower[l].push_back(S);
+            }
+            for (auto &b : s.loop->upperb[l]) {
+                const llvm::SCEV *S = toSCEV(SE, b, symbols, indexType);
+                if (!S)
+                    return true;
+                s.upper[l].push_back(S);
+            }
+            // unbounded loops cannot be scanned
+            if (s.lower[l].empty() || s.upper[l].empty())
+                return true;
+        }
+        statements.push_back(std::move(s));
+        return false;
+    }
+
+    // Statements sharing a loop must agree on it: same domain and the same
+    // schedule of it and all outer levels. Checked by `emit`.
+    bool sharedLoopsAgree() const {
+        for (size_t a = 0; a < statements.size(); ++a) {
+            const Statement &s = statements[a];
+            for (size_t b = a + 1; b < statements.size(); ++b) {
+                const Statement &t = statements[b];
+                const size_t numLoops =
+                    std::min(s.schedule->numLoops, t.schedule->numLoops);
+                for (size_t l = 0; l < numLoops; ++l) {
+                    if (s.schedule->getOmega()[2 * l] !=
+                        t.schedule->getOmega()[2 * l])
+                        break;
+                    if (s.original != t.original)
+                        return false;
+                    for (size_t j = 0; j < s.schedule->numLoops; ++j)
+                        if (s.schedule->getPhi()(j, l) !=
+                            t.schedule->getPhi()(j, l))
+                            return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Emits the statements between `entry` and its successor; the terminator
+    // of `entry` must be an unconditional branch.
+    // Returns `true` on failure, leaving the IR unchanged.
+    bool emit(llvm::BasicBlock *entry) {
+        PhaseTimer phaseTimer(Phase::CodeGen);
+        llvm::BranchInst *br =
+            llvm::dyn_cast<llvm::BranchInst>(entry->getTerminator());
+        if (!br || br->isConditional() || !sharedLoopsAgree())
+            return true;
+        llvm::BasicBlock *successor = br->getSuccessor(0);
+        llvm::LLVMContext &ctx = entry->getContext();
+        llvm::Function *F = entry->getParent();
+        nestExit = successor;
+        llvm::BasicBlock *preheader =
+            llvm::BasicBlock::Create(ctx, "turboloop.preheader", F, successor);
+        llvm::IRBuilder<> b(preheader);
+        builder = &b;
+        invariantInsertPt = br;
+        llvm::SmallVector<unsigned> all;
+        for (unsigned i = 0; i < statements.size(); ++i)
+            all.push_back(i);
+        emitLevel(all, 0);
+        b.CreateBr(successor);
+        br->setSuccessor(0, preheader);
+        builder = nullptr;
+        ++NumLoopNestsEmitted;
+        return false;
+    }
+};
+
+// Replaces the loop `L` with the loops emitted by `codegen`.
+// Requires `L` to be in LCSSA form, with a preheader and a unique dedicated
+// exit block without `phi`s, i.e. `L` must not define values used after it.
+// `DT`, `SE` and `LI` are updated for the deletion of `L`, and `DT` for the
+// emitted blocks, but the emitted loops are not added to `LI`.
+// Returns `true` on failure, leaving the IR unchanged.
+bool spliceLoopNest(llvm::Loop *L, LoopNestCodeGen &codegen,
+                    llvm::DominatorTree &DT, llvm::ScalarEvolution &SE,
+                    llvm::LoopInfo &LI) {
+    llvm::BasicBlock *preheader = L->getLoopPreheader();
+    llvm::BasicBlock *exit = L->getExitBlock();
+    if (!preheader || !exit || !L->hasDedicatedExits() ||
+        llvm::isa<llvm::PHINode>(exit->front()) ||
+        !codegen.sharedLoopsAgree())
+        return true;
+    // the statements may read `L`'s instructions, so emit before deleting;
+    // the emitted loops then branch to `L`, whose preheader they end in
+    [[maybe_unused]] bool failed = codegen.emit(preheader);
+    assert(!failed);
+    DT.recalculate(*preheader->getParent());
+    llvm::deleteDeadLoop(L, &DT, &SE, &LI);
+    return false;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <limits>
+#include <string>
+
+// Limits on the work spent on a function, or on one of its loop nests, so
+// that one pathological loop nest cannot stall a build: Fourier-Motzkin
+// elimination may produce exponentially many constraints, and the
+// scheduler's search over loop permutations, or its ILPs, may take
+// exponentially long.
+//
+// Work is counted in constraint rows produced by elimination and by the ILP
+// scheduler, and in wall time. Budgets nest: rows are charged to the budget
+// installed on the thread (see `BudgetScope`) and to its parents, and it is
+// exhausted when any of them is. Once exhausted,
+//  - elimination stops combining bounds, so the polyhedra it produces are
+//    relaxations, only fit for conservative queries: `isEmpty` returns
+//    `false`, i.e. dependencies are assumed;
+//  - redundancy elimination keeps the remaining constraints; and
+//  - the scheduler fails.
+// Callers check `budgetExhausted()` after a phase and leave the loop nest
+// untouched if it returns `true`.
+
+// `0` means unlimited.
+struct BudgetLimits {
+    size_t maxRows = 0;
+    double maxSeconds = 0.0;
+};
+
+struct CompileBudget {
+    enum class Limit { None, Rows, Time };
+
+    // e.g. "function", used in `describe`
+    const char *name;
+    BudgetLimits limits;
+    CompileBudget *parent;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<size_t> rows{0};
+    // sticky, so that a budget stays exhausted once it is
+    std::atomic<Limit> exceeded{Limit::None};
+
+    CompileBudget(const char *name, BudgetLimits limits,
+                  CompileBudget *parent = nullptr)
+        : name(name), limits(limits), parent(parent),
+          start(std::chrono::steady_clock::now()) {}
+    CompileBudget(const CompileBudget &) = delete;
+    CompileBudget &operator=(const CompileBudget &) = delete;
+
+    double elapsedSeconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+            .count();
+    }
+    // Checks the limits of this budget, ignoring its parents.
+    Limit check() {
+        Limit l = exceeded.load(std::memory_order_relaxed);
+        if (l != Limit::None)
+            return l;
+        if (limits.maxRows && (rows.load(std::memory_order_relaxed) >
+                               limits.maxRows))
+            l = Limit::Rows;
+        else if ((limits.maxSeconds > 0.0) &&
+                 (elapsedSeconds() > limits.maxSeconds))
+            l = Limit::Time;
+        if (l != Limit::None)
+            exceeded.store(l, std::memory_order_relaxed);
+        return l;
+    }
+    // The first exhausted budget of this one and its parents, or `nullptr`.
+    CompileBudget *exhausted() {
+        for (CompileBudget *b = this; b; b = b->parent)
+            if (b->check() != Limit::None)
+                return b;
+        return nullptr;
+    }
+    // Charges `n` rows to this budget and its parents.
+    // Returns `true` if the budget is exhausted.
+    bool charge(size_t n) {
+        for (CompileBudget *b = this; b; b = b->parent)
+            b->rows.fetch_add(n, std::memory_order_relaxed);
+        return exhausted();
+    }
+    // Seconds until the first time limit of this budget and its parents.
+    double remainingSeconds() const {
+        double remaining = std::numeric_limits<double>::infinity();
+        for (const CompileBudget *b = this; b; b = b->parent)
+            if (b->limits.maxSeconds > 0.0)
+                remaining = std::min(remaining, b->limits.maxSeconds -
+                                                    b->elapsedSeconds());
+        return std::max(remaining, 0.0);
+    }
+    // e.g. "loop nest budget of 100000 constraint rows", naming the limit
+    // that was exceeded.
+    std::string describe() const {
+        std::string s = std::string(name) + " budget of ";
+        if (exceeded.load(std::memory_order_relaxed) == Limit::Time) {
+            char seconds[32];
+            std::snprintf(seconds, sizeof(seconds), "%g", limits.maxSeconds);
+            return s + seconds + " seconds";
+        }
+        return s + std::to_string(limits.maxRows) + " constraint rows";
+    }
+};
+
+// The budget charged on this thread, if any.
+inline thread_local CompileBudget *currentBudget = nullptr;
+
+// Installs `budget` as the current budget of this thread for its lifetime.
+struct BudgetScope {
+    CompileBudget *previous;
+    BudgetScope(CompileBudget *budget) : previous(currentBudget) {
+        currentBudget = budget;
+    }
+    BudgetScope(const BudgetScope &) = delete;
+    BudgetScope &operator=(const BudgetScope &) = delete;
+    ~BudgetScope() { currentBudget = previous; }
+};
+
+// Charges `n` rows to the current budget.
+// Returns `true` if it is exhausted.
+bool chargeBudget(size_t n) {
+    return currentBudget && currentBudget->charge(n);
+}
+bool budgetExhausted() { return currentBudget && currentBudget->exhausted(); }
@@ -0,0 +1,511 @@
+#pragma once
+
+#include "./ArrayReference.hpp"
+#include "./DependencyPolyhedra.hpp"
+#include "./LoopBlock.hpp"
+#include "./Math.hpp"
+#include "./NormalForm.hpp"
+#include "./Schedule.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/Debug.h>
+
+#define DEBUG_TYPE "turbo-loop"
+
+// Register tiling search (step 3. in the README).
+// For each set of memory accesses sharing a loop nest, we enumerate legal
+// choices of
+//  - one loop to vectorize,
+//  - up to two loops to unroll (and jam), with their unroll factors,
+// estimate the register pressure and the number of loads, stores, and
+// arithmetic operations of the unrolled loop body from the `ArrayReference`
+// index matrices, and pick the choice with the fewest estimated cycles per
+// iteration of the original loop nest, subject to fitting in registers.
+// Similar to `LoopVectorization.jl`, memory accesses that do not depend on
+// the inner most loop are hoisted out of it, and thus occupy registers but do
+// not cost loads or stores per iteration.
+namespace CostModeling {
+
+struct RegisterFile {
+    unsigned numScalar;
+    unsigned numVector;
+    // width of a vector register, in bits
+    unsigned vectorBits;
+    static RegisterFile get(const llvm::TargetTransformInfo &TTI) {
+        // ClassID 0: ScalarRC
+        // ClassID 1: RegisterRC
+        return RegisterFile{
+            TTI.getNumberOfRegisters(0), TTI.getNumberOfRegisters(1),
+            unsigned(TTI.getRegisterBitWidth(
+                            llvm::TargetTransformInfo::RGK_FixedWidthVector)
+                         .getFixedSize())};
+    }
+};
+// throughputs, in instructions per cycle
+struct Throughput {
+    double loads = 2.0;
+    double stores = 1.0;
+    double arithmetic = 2.0;
+    // cycles before the result of an arithmetic operation is available
+    double latency = 4.0;
+};
+
+// Loops are identified by their schedule level.
+struct RegisterTile {
+    int8_t vectorized = -1;
+    uint8_t vectorWidth = 1;
+    int8_t unrolledInnerLoop = -1;
+    uint8_t unrolledInner = 1;
+    int8_t unrolledOuterLoop = -1;
+    uint8_t unrolledOuter = 1;
+    size_t registers = 0;
+    double cost = std::numeric_limits<double>::infinity();
+};
+
+static constexpr unsigned maxUnroll = 8;
+// the widest vector `RegisterTile::vectorWidth` (and `Schedule::vectorWidth`)
+// can hold, rounded down to a power of two; e.g. 8-bit elements of 2048-bit
+// registers would otherwise wrap to `0` lanes
+static constexpr size_t maxVectorWidth = 128;
+
+// type of the element loaded or stored by `ma`; `nullptr` if unknown
+llvm::Type *elementType(const MemoryAccess &ma) {
+    if (auto *load = llvm::dyn_cast_or_null<llvm::LoadInst>(ma.user))
+        return load->getType();
+    if (auto *store = llvm::dyn_cast_or_null<llvm::StoreInst>(ma.user))
+        return store->getValueOperand()->getType();
+    return nullptr;
+}
+// size of the element loaded or stored by `ma`, from its `user`, else its
+// `elementBits`; defaults to 64 bits if unknown
+size_t elementBits(const MemoryAccess &ma) {
+    if (llvm::Type *T = elementType(ma))
+        if (size_t bits = T->getPrimitiveSizeInBits().getFixedSize())
+            return bits;
+    return ma.elementBits ? ma.elementBits : 64;
+}
+
+// Returns the loop corresponding to schedule level `level` of `ma`, or `-1`
+// if that level is not a single loop (e.g., it has been skewed).
+int64_t levelToLoop(const MemoryAccess &ma, size_t level) {
+    SquarePtrMatrix<const int64_t> Phi = ma.schedule.getPhi();
+    int64_t loop = -1;
+    for (size_t j = 0; j < Phi.numRow(); ++j) {
+        if (int64_t p = Phi(j, level)) {
+            if ((loop >= 0) || (p != 1))
+                return -1;
+            loop = j;
+        }
+    }
+    return loop;
+}
+
+// does the address of `ma` depend on `loop`?
+bool dependsOn(const MemoryAccess &ma, size_t loop) {
+    PtrMatrix<const int64_t> indMat = ma.ref.indexMatrix();
+    for (size_t d = 0; d < indMat.numCol(); ++d)
+        if (indMat(loop, d))
+            return true;
+    return false;
+}
+// is `ma` contiguous along `loop`, i.e. unit stride in the first dimension
+// and independent of `loop` in all others?
+bool isContiguous(const MemoryAccess &ma, size_t loop) {
+    PtrMatrix<const int64_t> indMat = ma.ref.indexMatrix();
+    if ((indMat.numCol() == 0) || (indMat(loop, 0) != 1) ||
+        !isOne(ma.ref.stridesOffsets[0].first))
+        return false;
+    for (size_t d = 1; d < indMat.numCol(); ++d)
+        if (indMat(loop, d))
+            return false;
+    return true;
+}
+
+// The row `t` such that `t * v` is the difference along `level` of the
+// schedules of `d.out` and `d.in`, where `v` are the variables of
+// `d.depPoly`; empty if either has no such level.
+llvm::SmallVector<int64_t> levelRow(const Dependence &d, size_t level) {
+    const DependencePolyhedra &dp = d.depPoly;
+    const Schedule &schIn = d.in->schedule;
+    const Schedule &schOut = d.out->schedule;
+    if ((level >= schIn.numLoops) || (level >= schOut.numLoops))
+        return {};
+    const size_t offIn = d.forward ? 0 : dp.getDim0();
+    const size_t offOut = d.forward ? dp.getDim0() : 0;
+    llvm::SmallVector<int64_t> t(dp.getNumVar());
+    SquarePtrMatrix<const int64_t> PhiIn = schIn.getPhi();
+    SquarePtrMatrix<const int64_t> PhiOut = schOut.getPhi();
+    for (size_t j = 0; j < schIn.numLoops; ++j)
+        t[offIn + j] -= PhiIn(j, level);
+    for (size_t j = 0; j < schOut.numLoops; ++j)
+        t[offOut + j] += PhiOut(j, level);
+    return t;
+}
+
+// Does the dependence polyhedron of `d` imply `t * v == 0`?
+// We check whether `t` is in the row space of the equality constraints with
+// a zero right hand side.
+bool zeroDistance(const Dependence &d, llvm::ArrayRef<int64_t> t) {
+    if (allZero(t))
+        return true;
+    const DependencePolyhedra &dp = d.depPoly;
+    const size_t numVar = dp.getNumVar();
+    size_t numRows = 0;
+    for (size_t c = 0; c < dp.getNumEqualityConstraints(); ++c)
+        numRows += isZero(dp.q[c]);
+    IntMatrix S(numRows + 1, numVar);
+    size_t r = 0;
+    for (size_t c = 0; c < dp.getNumEqualityConstraints(); ++c) {
+        if (!isZero(dp.q[c]))
+            continue;
+        for (size_t v = 0; v < numVar; ++v)
+            S(r, v) = dp.E(c, v);
+        ++r;
+    }
+    for (size_t v = 0; v < numVar; ++v)
+        S(numRows, v) = t[v];
+    // rows of `N` satisfy `N * S == 0`; if any uses the last row of `S`,
+    // then it is a linear combination of the others.
+    IntMatrix N = NormalForm::nullSpace(S);
+    for (size_t i = 0; i < N.numRow(); ++i)
+        if (N(i, numRows))
+            return true;
+    return false;
+}
+// Does the dependence polyhedron of `d` imply `in[loopIn] == out[loopOut]`,
+// i.e. is the dependence distance along this loop zero?
+bool zeroDistance(const Dependence &d, size_t loopIn, size_t loopOut) {
+    const DependencePolyhedra &dp = d.depPoly;
+    llvm::SmallVector<int64_t> t(dp.getNumVar());
+    t[(d.forward ? 0 : dp.getDim0()) + loopIn] += 1;
+    t[(d.forward ? dp.getDim0() : 0) + loopOut] -= 1;
+    return zeroDistance(d, t);
+}
+
+// The value of `t * v` implied by the equality constraints of `d.depPoly`,
+// if it is a compile time constant, e.g. the distance of a uniform
+// dependence.
+llvm::Optional<int64_t> distance(const Dependence &d,
+                                 llvm::ArrayRef<int64_t> t) {
+    if (allZero(t))
+        return 0;
+    const DependencePolyhedra &dp = d.depPoly;
+    const size_t numVar = dp.getNumVar();
+    const size_t numRows = dp.getNumEqualityConstraints();
+    IntMatrix S(numRows + 1, numVar);
+    for (size_t c = 0; c < numRows; ++c)
+        for (size_t v = 0; v < numVar; ++v)
+            S(c, v) = dp.E(c, v);
+    for (size_t v = 0; v < numVar; ++v)
+        S(numRows, v) = t[v];
+    // `N(i, :) * S == 0` means
+    // `N(i, numRows) * t * v == -sum(N(i, c) * q[c] for c < numRows)`
+    IntMatrix N = NormalForm::nullSpace(S);
+    for (size_t i = 0; i < N.numRow(); ++i) {
+        int64_t n = N(i, numRows);
+        if (!n)
+            continue;
+        int64_t x = 0;
+        bool isConstant = true;
+        for (size_t c = 0; c < numRows && isConstant; ++c) {
+            if (!N(i, c))
+                continue;
+            llvm::Optional<int64_t> qc = dp.q[c].getCompileTimeConstant();
+            if ((isConstant = qc.hasValue()))
+                x -= N(i, c) * qc.getValue();
+        }
+        if (isConstant && (x % n == 0))
+            return x / n;
+    }
+    return {};
+}
+// Distance of `d` along schedule level `level`, if constant.
+llvm::Optional<int64_t> levelDistance(const Dependence &d, size_t level) {
+    llvm::SmallVector<int64_t> t = levelRow(d, level);
+    if (t.empty())
+        return {};
+    return distance(d, t);
+}
+// Is `d` carried by a schedule level outside of `level`, i.e. is its
+// distance along an outer level a positive constant?
+bool carriedOutside(const Dependence &d, size_t level) {
+    for (size_t l = 0; l < level; ++l) {
+        llvm::Optional<int64_t> dist = levelDistance(d, l);
+        if (!dist || (*dist < 0))
+            return false;
+        if (*dist > 0)
+            return true;
+    }
+    return false;
+}
+// Does `d` cross iterations of the loop at schedule level `level`?
+bool carriedBy(const Dependence &d, size_t level) {
+    llvm::SmallVector<int64_t> t = levelRow(d, level);
+    return t.empty() || !(zeroDistance(d, t) || carriedOutside(d, level));
+}
+
+// Register tiling for `members`, the indices of memory accesses within
+// `lblock` that share a loop nest of depth `numLoops`.
+struct RegisterTiling {
+    const LoopBlock &lblock;
+    llvm::SmallVector<unsigned> members;
+    size_t numLoops;
+    RegisterFile registers;
+    Throughput throughput;
+    // `loops(m, l)` is the loop of `members[m]` at level `l`
+    IntMatrix loops;
+    // unroll and jam (and vectorization) of a level is legal if no
+    // dependence between members is carried by it; see `carriedBy`
+    llvm::SmallVector<bool, 4> carriesDependence;
+
+    RegisterTiling(const LoopBlock &lblock, llvm::ArrayRef<unsigned> members,
+                   RegisterFile registers, Throughput throughput = {})
+        : lblock(lblock), members(members.begin(), members.end()),
+          numLoops(lblock.memory[members.front()].schedule.numLoops),
+          registers(registers), throughput(throughput),
+          loops(members.size(), numLoops), carriesDependence(numLoops) {
+        for (size_t m = 0; m < members.size(); ++m)
+            for (size_t l = 0; l < numLoops; ++l)
+                loops(m, l) = levelToLoop(lblock.memory[members[m]], l);
+        for (size_t e = 0; e < lblock.edges.size(); ++e) {
+            const Dependence &d = lblock.edges[e];
+            size_t in = memberIndex(d.in), out = memberIndex(d.out);
+            if ((in == members.size()) || (out == members.size()))
+                continue;
+            for (size_t l = 0; l < numLoops; ++l)
+                carriesDependence[l] = carriesDependence[l] || carriedBy(d, l);
+        }
+    }
+    size_t memberIndex(const MemoryAccess *ma) const {
+        size_t i = lblock.memoryIndex(ma);
+        return std::find(members.begin(), members.end(), i) - members.begin();
+    }
+    bool dependsOnLevel(size_t m, int64_t level) const {
+        if (level < 0)
+            return false;
+        int64_t loop = loops(m, level);
+        // conservatively assume skewed levels touch everything
+        return (loop < 0) || dependsOn(lblock.memory[members[m]], loop);
+    }
+    // Estimated cycles per iteration of the original loop nest;
+    // `tile.registers` is set to the number of registers needed.
+    double cost(RegisterTile &tile) const {
+        const size_t inner = numLoops - 1;
+        const size_t W = tile.vectorWidth;
+        double loads = 0, stores = 0, arithmetic = 0;
+        size_t regs = 0;
+        bool reduction = false;
+        for (size_t m = 0; m < members.size(); ++m) {
+            const MemoryAccess &ma = lblock.memory[members[m]];
+            size_t copies = 1;
+            if (dependsOnLevel(m, tile.unrolledInnerLoop))
+                copies *= tile.unrolledInner;
+            if (dependsOnLevel(m, tile.unrolledOuterLoop))
+                copies *= tile.unrolledOuter;
+            regs += copies;
+            // one operation per value stored, e.g. the `fma` of a GEMM
+            if (!ma.isLoad)
+                arithmetic += copies;
+            // hoisted out of the inner most loop; a store hoisted this way
+            // accumulates across the inner most loop's iterations
+            if (!dependsOnLevel(m, inner)) {
+                reduction |= !ma.isLoad;
+                continue;
+            }
+            double c = copies;
+            // gather/scatter if vectorized along a non-contiguous loop
+            if (dependsOnLevel(m, tile.vectorized) &&
+                !isContiguous(ma, loops(m, tile.vectorized)))
+                c *= W;
+            if (ma.isLoad)
+                loads += c;
+            else
+                stores += c;
+        }
+        tile.registers = regs;
+        double cycles = std::max(std::max(loads / throughput.loads,
+                                          stores / throughput.stores),
+                                 arithmetic / throughput.arithmetic);
+        // each accumulator is a dependency chain through the inner most
+        // loop, so we need enough of them to hide the latency
+        if (reduction)
+            cycles = std::max(cycles, throughput.latency);
+        return cycles / double(W * tile.unrolledInner * tile.unrolledOuter);
+    }
+    size_t availableRegisters(const RegisterTile &tile) const {
+        return tile.vectorized >= 0 ? registers.numVector : registers.numScalar;
+    }
+    // the level may be unrolled and jammed; unrolling the inner most loop
+    // is always legal.
+    bool canUnroll(size_t level) const {
+        return (level + 1 == numLoops) || !carriesDependence[level];
+    }
+    // Enumerates all legal tiles, returning the cheapest.
+    RegisterTile search() const {
+        size_t elBits = 8;
+        for (auto m : members)
+            elBits = std::max(elBits, elementBits(lblock.memory[m]));
+        const size_t width =
+            std::min(size_t(registers.vectorBits) / elBits, maxVectorWidth);
+        RegisterTile best;
+        for (int64_t v = -1; v < int64_t(numLoops); ++v) {
+            if ((v >= 0) && ((width <= 1) || carriesDependence[v]))
+                continue;
+            for (int64_t ui = -1; ui < int64_t(numLoops); ++ui) {
+                if ((ui >= 0) && !canUnroll(ui))
+                    continue;
+                for (int64_t uo = -1; uo < int64_t(numLoops); ++uo) {
+                    if ((uo >= 0) && ((ui < 0) || (uo == ui) || !canUnroll(uo)))
+                        continue;
+                    for (size_t fi = (ui >= 0) + 1;
+                         fi <= ((ui >= 0) ? maxUnroll : 1); ++fi) {
+                        for (size_t fo = (uo >= 0) + 1;
+                             fo <= ((uo >= 0) ? maxUnroll : 1); ++fo) {
+                            RegisterTile tile;
+                            tile.vectorized = v;
+                            tile.vectorWidth = v >= 0 ? width : 1;
+                            tile.unrolledInnerLoop = ui;
+                            tile.unrolledInner = fi;
+                            tile.unrolledOuterLoop = uo;
+                            tile.unrolledOuter = fo;
+                            tile.cost = cost(tile);
+                            if ((tile.registers <= availableRegisters(tile)) &&
+                                (tile.cost < best.cost))
+                                best = tile;
+                        }
+                    }
+                }
+            }
+        }
+        return best;
+    }
+};
+
+void apply(LoopBlock &lblock, llvm::ArrayRef<unsigned> members,
+           const RegisterTile &tile) {
+    for (auto m : members) {
+        Schedule &sch = lblock.memory[m].schedule;
+        sch.vectorized = tile.vectorized;
+        sch.vectorWidth = tile.vectorWidth;
+        sch.unrolledInnerLoop = tile.unrolledInnerLoop;
+        sch.unrolledInner = tile.unrolledInnerLoop >= 0 ? tile.unrolledInner : -1;
+        sch.unrolledOuterLoop = tile.unrolledOuterLoop;
+        sch.unrolledOuter = tile.unrolledOuterLoop >= 0 ? tile.unrolledOuter : -1;
+    }
+}
+
+// Groups the memory accesses of `lblock` by loop nest; accesses are in the
+// same nest if they share an `AffineLoopNest` and are fused through all of
+// their loops.
+llvm::SmallVector<llvm::SmallVector<unsigned>>
+loopNests(const LoopBlock &lblock) {
+    llvm::SmallVector<llvm::SmallVector<unsigned>> nests;
+    for (unsigned i = 0; i < lblock.memory.size(); ++i) {
+        const MemoryAccess &mi = lblock.memory[i];
+        bool found = false;
+        for (auto &nest : nests) {
+            const MemoryAccess &mj = lblock.memory[nest.front()];
+            if ((mi.ref.loop == mj.ref.loop) &&
+                (mi.schedule.numLoops == mj.schedule.numLoops) &&
+                mi.schedule.fusedThrough(mj.schedule)) {
+                nest.push_back(i);
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            nests.emplace_back().push_back(i);
+    }
+    return nests;
+}
+
+// Chooses and applies a register tile for every loop nest in `lblock`.
+// Requires `lblock.fillEdges()` to have been called.
+void optimizeRegisterTiling(LoopBlock &lblock, RegisterFile registers,
+                            Throughput throughput = {}) {
+    for (auto &nest : loopNests(lblock)) {
+        RegisterTiling rt(lblock, nest, registers, throughput);
+        RegisterTile tile = rt.search();
+        LLVM_DEBUG(llvm::dbgs()
+                   << "Register tile: vectorized = " << int(tile.vectorized)
+                   << " x " << int(tile.vectorWidth)
+                   << "; unrolled inner = " << int(tile.unrolledInnerLoop)
+                   << " x " << int(tile.unrolledInner)
+                   << "; unrolled outer = " << int(tile.unrolledOuterLoop)
+                   << " x " << int(tile.unrolledOuter)
+                   << "; registers = " << tile.registers
+                   << "; cost = " << tile.cost << "\n");
+        apply(lblock, nest, tile);
+    }
+}
+
+// Should the remainder of a loop vectorized by `width` run as a single
+// masked iteration, rather than as scalar iterations?
+// `numLoads` and `numStores` are the accesses of elements of type `T` per
+// iteration. Scalar remainders average `(width - 1) / 2` iterations; masked
+// accesses must be legal, and cheap enough (e.g., with AVX512 predication).
+bool preferMaskedTail(const llvm::TargetTransformInfo &TTI, llvm::Type *T,
+                      unsigned width, unsigned numLoads, unsigned numStores) {
+    if (width <= 1)
+        return false;
+    llvm::Type *VT = llvm::FixedVectorType::get(T, width);
+    llvm::Align align(std::max(T->getPrimitiveSizeInBits().getFixedSize() / 8,
+                               uint64_t(1)));
+    if ((numLoads && !TTI.isLegalMaskedLoad(VT, align)) ||
+        (numStores && !TTI.isLegalMaskedStore(VT, align)))
+        return false;
+    auto cost = [](llvm::InstructionCost c) {
+        return double(c.getValue().getValueOr(1 << 16));
+    };
+    double scalar =
+        numLoads * cost(TTI.getMemoryOpCost(llvm::Instruction::Load, T, align,
+                                            0)) +
+        numStores * cost(TTI.getMemoryOpCost(llvm::Instruction::Store, T,
+                                             align, 0));
+    // the mask costs a compare
+    double masked =
+        numLoads * cost(TTI.getMaskedMemoryOpCost(llvm::Instruction::Load, VT,
+                                                  align, 0)) +
+        numStores * cost(TTI.getMaskedMemoryOpCost(llvm::Instruction::Store,
+                                                   VT, align, 0)) +
+        1.0;
+    return masked < 0.5 * (width - 1) * scalar;
+}
+
+// Sets `Schedule::maskedTail` of the accesses in each vectorized loop nest
+// of `lblock`, using the widest element type accessed in the nest.
+void chooseVectorTails(LoopBlock &lblock,
+                       const llvm::TargetTransformInfo &TTI) {
+    for (auto &nest : loopNests(lblock)) {
+        const Schedule &sch = lblock.memory[nest.front()].schedule;
+        bool masked = false;
+        if ((sch.vectorized >= 0) && (sch.vectorWidth > 1)) {
+            llvm::Type *T = nullptr;
+            unsigned numLoads = 0, numStores = 0;
+            for (auto m : nest) {
+                const MemoryAccess &ma = lblock.memory[m];
+                llvm::Type *U = elementType(ma);
+                if (!U)
+                    continue;
+                if (!T || (U->getPrimitiveSizeInBits().getFixedSize() >
+                           T->getPrimitiveSizeInBits().getFixedSize()))
+                    T = U;
+                ++(ma.isLoad ? numLoads : numStores);
+            }
+            masked = T && preferMaskedTail(TTI, T, sch.vectorWidth, numLoads,
+                                           numStores);
+        }
+        for (auto m : nest)
+            lblock.memory[m].schedule.maskedTail = masked;
+    }
+}
+
+} // namespace CostModeling
+
+#undef DEBUG_TYPE
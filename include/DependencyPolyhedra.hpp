@@ -2,6 +2,7 @@
 
 #include "./AbstractEqualityPolyhedra.hpp"
 #include "./ArrayReference.hpp"
+#include "./Instrumentation.hpp"
 #include "./Loops.hpp"
 #include "./Math.hpp"
 #include "./NormalForm.hpp"
@@ -10,13 +11,17 @@
 #include "./Schedule.hpp"
 #include "./Symbolics.hpp"
 #include "Orthogonalize.hpp"
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/Optional.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Debug.h>
 #include <utility>
 
+#define DEBUG_TYPE "turbo-loop"
+
 // for i = 1:N, j = 1:i
 //     A[i,j] = foo(A[i,i])
 // labels: 0           1
@@ -40,9 +45,9 @@ struct DependencePolyhedra : SymbolicEqPolyhedra {
     static llvm::Optional<llvm::SmallVector<std::pair<int, int>, 4>>
     matchingStrideConstraintPairs(const ArrayReference &ar0,
                                   const ArrayReference &ar1) {
-#ifndef NDEBUG
-        std::cout << "ar0 = \n" << ar0 << "\nar1 = " << ar1 << std::endl;
-#endif
+        LLVM_DEBUG(llvm::dbgs() << "ar0 = \n"
+                                << stdPrint(ar0) << "\nar1 = " << stdPrint(ar1)
+                                << "\n");
         // fast path; most common case
         if (ar0.stridesMatch(ar1)) {
             llvm::SmallVector<std::pair<int, int>, 4> dims;
@@ -157,7 +162,13 @@ struct DependencePolyhedra : SymbolicEqPolyhedra {
                 }
             }
             // returns rank x num loops
-            return orthogonalNullSpace(std::move(A));
+            return orthogonalize(dispatchSize<Schedule::maxStackLoops>(
+                numLoopsCommon, [&](auto NumLoopsCommon) {
+                    if constexpr (NumLoopsCommon())
+                        return NormalForm::nullSpace<NumLoopsCommon()>(A);
+                    else
+                        return NormalForm::nullSpace(std::move(A));
+                }));
         } else {
             return A;
         }
@@ -185,7 +196,7 @@ struct DependencePolyhedra : SymbolicEqPolyhedra {
         : SymbolicEqPolyhedra(IntMatrix(), llvm::SmallVector<MPoly, 8>(),
                               IntMatrix(), llvm::SmallVector<MPoly, 8>(),
                               ma0.ref.loop->poset) {
-
+        ++NumDependencePolyhedra;
         const ArrayReference &ar0 = ma0.ref;
         const ArrayReference &ar1 = ma1.ref;
         const llvm::Optional<llvm::SmallVector<std::pair<int, int>, 4>>
@@ -259,13 +270,13 @@ struct DependencePolyhedra : SymbolicEqPolyhedra {
             }
             E(indexDim + i, nv0 + nv1 + i) = 1;
         }
-#ifndef NDEBUG
-        std::cout << "Assembling constraint matrices:" << std::endl;
-        printConstraints(printConstraints(std::cout, A, b, true), E, q, false)
-            << std::endl;
-        std::cout << "Done printing assembled, pre-pruned, matrices."
-                  << std::endl;
-#endif
+        LLVM_DEBUG(llvm::dbgs()
+                   << "Assembling constraint matrices:\n"
+                   << stdPrint([&](std::ostream &os) {
+                          printConstraints(printConstraints(os, A, b, true), E,
+                                           q, false);
+                      })
+                   << "\nDone printing assembled, pre-pruned, matrices.\n");
         if (pruneBounds()) {
             A.clear();
             b.clear();
@@ -276,6 +287,29 @@ struct DependencePolyhedra : SymbolicEqPolyhedra {
     inline size_t getNumScheduleCoefficients() const {
         return 1 + getNumVar() - getTimeDim();
     }
+    // The pairs of iterations, over the first `numVar` variables; the other
+    // variables are zero, except for `timeVar` (if `< getNumVar()`), which is
+    // `1`.
+    SymbolicEqPolyhedra iterations(size_t numVar, size_t timeVar) const {
+        const bool timed = timeVar < getNumVar();
+        const size_t numIneq = getNumInequalityConstraints();
+        const size_t numEq = getNumEqualityConstraints();
+        SymbolicEqPolyhedra p(IntMatrix(numIneq, numVar), b,
+                              IntMatrix(numEq, numVar), q, poset);
+        for (size_t r = 0; r < numIneq; ++r) {
+            for (size_t v = 0; v < numVar; ++v)
+                p.A(r, v) = A(r, v);
+            if (timed)
+                p.b[r] -= A(r, timeVar);
+        }
+        for (size_t r = 0; r < numEq; ++r) {
+            for (size_t v = 0; v < numVar; ++v)
+                p.E(r, v) = E(r, v);
+            if (timed)
+                p.q[r] -= E(r, timeVar);
+        }
+        return p;
+    }
     // `direction = true` means second dep follow first
     // order of variables:
     // [ schedule coefs on loops, const schedule coef, bounding coefs ]
@@ -288,7 +322,8 @@ struct DependencePolyhedra : SymbolicEqPolyhedra {
     //
     // Time parameters are carried over into faras polys
     std::pair<IntegerEqPolyhedra, IntegerEqPolyhedra> farkasPair() const {
-
+        PhaseTimer phaseTimer(Phase::Farkas);
+        NumFarkasPolyhedra += 2;
         llvm::DenseMap<Polynomial::Monomial, unsigned> constantTerms;
         for (auto &bi : b) {
             for (auto &t : bi) {
@@ -590,25 +625,56 @@ struct Dependence {
     //                               y.schedule.getOmega()) >>
     //             1);
     // }
-    // emplaces dependencies without any repeat accesses to the same memory
-    // returns
-    static bool
-    checkDirection(std::pair<IntegerEqPolyhedra, IntegerEqPolyhedra> &p,
-                   const MemoryAccess &x, const MemoryAccess &y) {
-        IntegerEqPolyhedra &fxy = p.first;
-        IntegerEqPolyhedra &fyx = p.second;
-        const size_t numLoopsX = x.ref.getNumLoops();
-        const size_t numLoopsY = y.ref.getNumLoops();
-        const size_t numLoopsCommon = std::min(numLoopsX, numLoopsY);
-        const size_t numLoopsTotal = numLoopsX + numLoopsY;
-        SquarePtrMatrix<const int64_t> xPhi = x.schedule.getPhi();
-        SquarePtrMatrix<const int64_t> yPhi = y.schedule.getPhi();
-        llvm::ArrayRef<int64_t> xOmega = x.schedule.getOmega();
-        llvm::ArrayRef<int64_t> yOmega = y.schedule.getOmega();
-        llvm::SmallVector<int64_t, 16> sch;
-        sch.resize_for_overwrite(numLoopsTotal + 1);
+    // `p` with the constraint `t * v <= c`.
+    static SymbolicEqPolyhedra appendConstraint(SymbolicEqPolyhedra p,
+                                                llvm::ArrayRef<int64_t> t,
+                                                int64_t c) {
+        const size_t row = p.A.numRow();
+        p.A.resize(row + 1, p.getNumVar());
+        for (size_t v = 0; v < t.size(); ++v)
+            p.A(row, v) = t[v];
+        p.b.push_back(c);
+        return p;
+    }
+    // Is `p` known to be empty? Substitutes its equalities, and then
+    // eliminates the remaining variables.
+    static bool knownEmpty(SymbolicEqPolyhedra p) {
+        for (size_t v = 0; (v < p.getNumVar()) && p.E.numRow(); ++v)
+            substituteEquality(p.A, p.b, p.E, p.q, v);
+        // the equalities left are `0 == q`
+        for (auto &qc : p.q)
+            if (p.knownLessEqualZero(qc + 1) ||
+                p.knownGreaterEqualZero(qc - 1))
+                return true;
+        return SymbolicPolyhedra(std::move(p.A), std::move(p.b),
+                                 std::move(p.poset))
+            .isEmpty();
+    }
+    // Does `out` execute after `in` for each pair of iterations of `p`, whose
+    // variables are the loops of `in` followed by those of `out` if
+    // `inFirst`, else those of `out` followed by those of `in`?
+    // Compares the schedules lexicographically: pairs where `out` may be at
+    // an earlier level fail, pairs where it is at a later one are ordered,
+    // and those that tie go on to the next level.
+    // Fourier-Motzkin elimination is exact over the rationals, so unlike the
+    // projected Farkas polyhedra, the answer does not depend on the order of
+    // the constraints; it only misses integer emptiness, failing instead.
+    static bool executesAfter(SymbolicEqPolyhedra p, const MemoryAccess &in,
+                              const MemoryAccess &out, bool inFirst) {
+        const size_t numLoopsIn = in.ref.getNumLoops();
+        const size_t numLoopsOut = out.ref.getNumLoops();
+        const size_t numLoopsCommon = std::min(numLoopsIn, numLoopsOut);
+        const size_t numVar = numLoopsIn + numLoopsOut;
+        const size_t offIn = inFirst ? 0 : numLoopsOut;
+        const size_t offOut = inFirst ? numLoopsIn : 0;
+        SquarePtrMatrix<const int64_t> inPhi = in.schedule.getPhi();
+        SquarePtrMatrix<const int64_t> outPhi = out.schedule.getPhi();
+        llvm::ArrayRef<int64_t> inOmega = in.schedule.getOmega();
+        llvm::ArrayRef<int64_t> outOmega = out.schedule.getOmega();
+        // `d * v + o` is the schedule of `out` minus that of `in` at a level
+        llvm::SmallVector<int64_t, 16> d(numVar);
         for (size_t i = 0; i <= numLoopsCommon; ++i) {
-            if (int64_t o2idiff = yOmega[2 * i] - xOmega[2 * i])
+            if (int64_t o2idiff = outOmega[2 * i] - inOmega[2 * i])
                 return o2idiff > 0;
             // we should not be able to reach `numLoopsCommon`
             // because at the very latest, this last schedule value
@@ -622,32 +688,42 @@ struct Dependence {
             //   at that level
             // }
             assert(i != numLoopsCommon);
-            for (size_t j = 0; j < numLoopsX; ++j) {
-                sch[j] = xPhi(i, j);
-            }
-            for (size_t j = 0; j < numLoopsY; ++j) {
-                sch[j + numLoopsX] = yPhi(i, j);
-            }
-            int64_t yO = yOmega[2 * i + 1], xO = xOmega[2 * i + 1];
-            // forward means offset is 2nd - 1st
-            sch[numLoopsTotal] = yO - xO;
-#ifndef NDEBUG
-            printVector(std::cout << "fxy =\n"
-                                  << fxy << "Schedule = ",
-                        sch)
-                << std::endl
-                << std::endl;
-#endif
-            if (!fxy.knownSatisfied(sch))
+            for (size_t j = 0; j < numLoopsIn; ++j)
+                d[j + offIn] = -inPhi(j, i);
+            for (size_t j = 0; j < numLoopsOut; ++j)
+                d[j + offOut] = outPhi(j, i);
+            int64_t o = outOmega[2 * i + 1] - inOmega[2 * i + 1];
+            LLVM_DEBUG(llvm::dbgs() << "iterations =\n"
+                                    << stdPrint(p) << "Schedule = "
+                                    << stdPrint([&](std::ostream &os) {
+                                           llvm::ArrayRef<int64_t> s = d;
+                                           printVector(os, s);
+                                       })
+                                    << " + " << o << "\n\n");
+            // may `out` be earlier, i.e. `d * v + o <= -1`?
+            if (!knownEmpty(appendConstraint(p, d, -1 - o)))
                 return false;
-            // backward means offset is 1st - 2nd
-            sch[numLoopsTotal] = xO - yO;
-            if (!fyx.knownSatisfied(sch))
+            // the ties, `d * v + o <= 0`
+            p = appendConstraint(std::move(p), d, -o);
+            if (knownEmpty(p))
                 return true;
         }
         assert(false);
         return false;
     }
+    // Returns `true` if `y` executes after `x` for the pairs of iterations of
+    // `dxy`, the dependence polyhedron of `x` and `y`, with its time
+    // dimensions zero, except for `time` (if `< dxy.getTimeDim()`), which is
+    // `1`.
+    static bool checkDirection(const DependencePolyhedra &dxy,
+                               const MemoryAccess &x, const MemoryAccess &y,
+                               size_t time) {
+        const size_t numVar = dxy.getNumVar() - dxy.getTimeDim();
+        return executesAfter(dxy.iterations(numVar, numVar + time), x, y,
+                             true);
+    }
+    // emplaces dependencies without any repeat accesses to the same memory
+    // returns
     static void timelessCheck(llvm::SmallVectorImpl<Dependence> &deps,
                               DependencePolyhedra dxy, MemoryAccess &x,
                               MemoryAccess &y) {
@@ -658,7 +734,7 @@ struct Dependence {
         const size_t numVarKeep = pair.first.getNumVar() - numLambda;
         pair.first.removeExtraVariables(numVarKeep);
         pair.second.removeExtraVariables(numVarKeep);
-        if (checkDirection(pair, x, y)) {
+        if (checkDirection(dxy, x, y, dxy.getTimeDim())) {
             pair.first.removeExtraVariables(dxy.getNumScheduleCoefficients());
             deps.emplace_back(std::move(dxy), std::move(pair.first),
                               std::move(pair.second), &x, &y, true);
@@ -685,7 +761,7 @@ struct Dependence {
         pair.first.removeExtraVariables(numVarKeep);
         pair.second.removeExtraVariables(numVarKeep);
         MemoryAccess *in = &x, *out = &y;
-        const bool isFwd = checkDirection(pair, x, y);
+        const bool isFwd = checkDirection(dxy, x, y, dxy.getTimeDim());
         if (isFwd) {
             std::swap(farkasBackups.first, farkasBackups.second);
         } else {
@@ -708,61 +784,14 @@ struct Dependence {
         // now we need to check the time direction for all times
         // anything approaching 16 time dimensions would be absolutely insane
         llvm::SmallVector<bool, 16> timeDirection(timeDim);
+        // with the `t`th time dimension `1`, does `out` execute before `in`?
         size_t t = 0;
         do {
-            // set `t`th timeDim to +1/-1
-            size_t v = numVar + t;
-            for (size_t c = 0; c < numInequalityConstraintsOld; ++c) {
-                size_t lambdaInd = numVarKeep + c + 1;
-                int64_t Acv = dxy.A(c, v);
-                farkasBackups.first.E(0, lambdaInd) -= Acv;  // *1
-                farkasBackups.second.E(0, lambdaInd) -= Acv; // *1
-            }
-            for (size_t c = 0; c < numEqualityConstraintsOld; ++c) {
-                // each of these actually represents 2 inds
-                size_t lambdaInd =
-                    numVarKeep + numInequalityConstraintsOld + 2 * c;
-                int64_t Ecv = dxy.E(c, v);
-#ifndef NDEBUG
-                if (Ecv) {
-                    std::cout << "Found non-0: E(" << c << ", " << v
-                              << ") = " << Ecv << std::endl;
-                }
-#endif
-                farkasBackups.first.E(0, lambdaInd + 1) -= Ecv;
-                farkasBackups.first.E(0, lambdaInd + 2) += Ecv;
-                farkasBackups.second.E(0, lambdaInd + 1) -= Ecv;
-                farkasBackups.second.E(0, lambdaInd + 2) += Ecv;
-            }
-            pair = farkasBackups;
-            pair.first.removeExtraVariables(numVarKeep);
-            pair.second.removeExtraVariables(numVarKeep);
-            // farkasBackups is swapped with respect to
-            // checkDirection(..., *in, *out);
-            timeDirection[t] = checkDirection(pair, *out, *in);
-            // fix
-            for (size_t c = 0; c < numInequalityConstraintsOld; ++c) {
-                size_t lambdaInd = numVarKeep + c + 1;
-                int64_t Acv = dxy.A(c, v);
-                farkasBackups.first.E(0, lambdaInd) += Acv;
-                farkasBackups.second.E(0, lambdaInd) += Acv;
-            }
-            for (size_t c = 0; c < numEqualityConstraintsOld; ++c) {
-                // each of these actually represents 2 inds
-                size_t lambdaInd =
-                    numVarKeep + numInequalityConstraintsOld + 2 * c;
-                int64_t Ecv = dxy.E(c, v);
-                farkasBackups.first.E(0, lambdaInd + 1) += Ecv;
-                farkasBackups.first.E(0, lambdaInd + 2) -= Ecv;
-                farkasBackups.second.E(0, lambdaInd + 1) += Ecv;
-                farkasBackups.second.E(0, lambdaInd + 2) -= Ecv;
-            }
+            timeDirection[t] = checkDirection(dxy, x, y, t) != isFwd;
         } while (++t < timeDim);
         t = 0;
         do {
-            // checkDirection(farkasBackups, x, y) == false
-            // correct time direction would make it return true
-            // thus sign = timeDirection[t] ? 1 : -1
+            // step in the direction in which `out` executes before `in`
             int64_t step = (2 * timeDirection[t] - 1) * dxy.nullStep[t];
             size_t v = numVar + t;
             for (size_t c = 0; c < numInequalityConstraintsOld; ++c) {
@@ -784,13 +813,10 @@ struct Dependence {
                 farkasBackups.second.E(0, lambdaInd + 2) += Ecv;
             }
         } while (++t < timeDim);
-#ifndef NDEBUG
-        std::cout << "time dxy = \n" << dxy << std::endl;
-#endif
+        LLVM_DEBUG(llvm::dbgs() << "time dxy = \n" << stdPrint(dxy) << "\n");
         dxy.zeroExtraVariables(numVar);
-#ifndef NDEBUG
-        std::cout << "after 0ing, time dxy = \n" << dxy << std::endl;
-#endif
+        LLVM_DEBUG(llvm::dbgs()
+                   << "after 0ing, time dxy = \n" << stdPrint(dxy) << "\n");
         // farkasBackups.first.removeExtraVariables(numScheduleCoefs);
         farkasBackups.first.removeExtraThenZeroExtraVariables(numVarKeep,
                                                               numScheduleCoefs);
@@ -804,31 +830,30 @@ struct Dependence {
         // static void check(llvm::SmallVectorImpl<Dependence> deps,
         //                   const ArrayReference &x, const Schedule &sx,
         //                   const ArrayReference &y, const Schedule &sy) {
+        PhaseTimer phaseTimer(Phase::DependenceConstruction);
         if (x.ref.gcdKnownIndependent(y.ref))
             return 0;
-#ifndef NDEBUG
-        std::cout << "&x = " << &x << std::endl;
-        std::cout << "&x.ref = " << &x.ref << std::endl;
-        std::cout << "x.ref.loop = " << *(x.ref.loop) << std::endl;
-        std::cout << "x.ref.loop.get() = " << x.ref.loop.get() << std::endl;
-        std::cout << "x.ref.loop->poset.delta.size() = "
-                  << x.ref.loop->poset.delta.size() << std::endl;
-#endif
+        LLVM_DEBUG(llvm::dbgs() << "&x = " << &x << "\n&x.ref = " << &x.ref
+                                << "\nx.ref.loop = " << stdPrint(*(x.ref.loop))
+                                << "\nx.ref.loop.get() = " << x.ref.loop.get()
+                                << "\nx.ref.loop->poset.delta.size() = "
+                                << x.ref.loop->poset.delta.size() << "\n");
         DependencePolyhedra dxy(x, y);
         if (dxy.isEmpty())
             return 0;
             // note that we set boundAbove=true, so we reverse the dependence
             // direction for the dependency we week, we'll discard the program
             // variables x then y
-#ifndef NDEBUG
-        std::cout << "x = " << x.ref << "\ny = " << y.ref << "\ndxy = \n"
-                  << dxy << std::endl;
-#endif
+        LLVM_DEBUG(llvm::dbgs() << "x = " << stdPrint(x.ref) << "\ny = "
+                                << stdPrint(y.ref) << "\ndxy = \n"
+                                << stdPrint(dxy) << "\n");
         if (dxy.getTimeDim()) {
             timeCheck(deps, std::move(dxy), x, y);
+            NumDependences += 2;
             return 2;
         } else {
             timelessCheck(deps, std::move(dxy), x, y);
+            ++NumDependences;
             return 1;
         }
         // auto [R, nullDim] = transformationMatrix(x, y);
@@ -852,3 +877,5 @@ struct Dependence {
                   << d.dependenceBounding << std::endl;
     }
 };
+
+#undef DEBUG_TYPE
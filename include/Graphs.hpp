@@ -4,12 +4,11 @@
 #include <tuple>
 
 template <typename G>
-void visit(llvm::SmallVector<int64_t> sorted, G &graph, size_t idx) {
-    auto outs = outNeighbors(graph, idx);
+void visit(llvm::SmallVector<int64_t> &sorted, G &graph, size_t idx) {
     visited(graph, idx) = true;
-    for (size_t j = 0; j < length(outs); ++j) {
+    for (auto j : outNeighbors(graph, idx)) {
         if (!visited(graph, j)) {
-            visit(sorted, graph, outs(j));
+            visit(sorted, graph, j);
         }
     }
     sorted.push_back(idx);
@@ -53,9 +52,9 @@ void strongConnect(
     indexLowLinkOnStack[v] = std::make_tuple(index, index, true);
     index += 1;
     stack.push_back(v);
+    visited(graph, v) = true;
 
-    auto outN = outNeighbors(graph, v);
-    for (size_t w = 0; w < length(outN); ++w) {
+    for (size_t w : outNeighbors(graph, v)) {
         if (visited(graph, w)) {
             auto [wIndex, wLowLink, wOnStack] = indexLowLinkOnStack[w];
             if (wOnStack) {
@@ -105,6 +104,18 @@ stronglyConnectedComponents(G &graph) {
     return components;
 }
 
+// Components are returned in reverse topological order, i.e. if there is an
+// edge from component `a` to component `b`, then `b` precedes `a`.
+// This wrapper returns them in topological order instead.
+template <typename G>
+llvm::SmallVector<llvm::SmallVector<int64_t>>
+topologicallySortedComponents(G &graph) {
+    llvm::SmallVector<llvm::SmallVector<int64_t>> components =
+        stronglyConnectedComponents(graph);
+    std::reverse(components.begin(), components.end());
+    return components;
+}
+
 // Naive algorithm that looks like it may work to identify cycles:
 // 0 -> 1 -> 3 -> 5
 //  \            /
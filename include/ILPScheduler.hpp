@@ -0,0 +1,504 @@
+#pragma once
+#include "./CompileBudget.hpp"
+#include "./DependencyPolyhedra.hpp"
+#include "./Instrumentation.hpp"
+#include "./LoopBlock.hpp"
+#include "./Math.hpp"
+#include "./NormalForm.hpp"
+#include "./Symbolics.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <interfaces/highs_c_api.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Debug.h>
+#include <utility>
+
+#define DEBUG_TYPE "turbo-loop"
+
+// Finds the schedule of a strongly connected component of a `LoopBlock` one
+// hyperplane (schedule level) at a time.
+// Requires HiGHS; it is only built with `TURBOLOOP_HIGHS`, which meson
+// defines when it finds HiGHS.
+//
+// Each level solves the same ILP, except that
+// 1. dependences strongly satisfied by an earlier level are dropped, and
+// 2. the linear independence constraints change.
+// Thus, rather than rebuilding the model for each level, we keep a single
+// live HiGHS model, delete and add only the rows that change, and solve
+// each level starting from the basis of the previous one. The LP relaxation
+// is solved first; only if its schedule coefficients are fractional is the
+// ILP solved.
+//
+// Each dependence must be weakly satisfied, `f(v) >= 0`, where `f` is the
+// schedule of `out` minus that of `in` at this level, over the pairs of
+// iterations `v` of its dependence polyhedron `A * v <= b, E * v == q`.
+// By Farkas' lemma, that is
+// `f(v) == l_0 + l' * (b - A * v) + m' * (q - E * v)`, for some `l_0, l >= 0`
+// and `m`. Matching the coefficients of `v`, of `1`, and of each symbol in `b`
+// and `q` gives linear equalities in the schedule coefficients and the
+// multipliers, which we add as rows. The projected Farkas polyhedra of
+// `Dependence` are not used, as projecting out the multipliers loses
+// constraints. In the same way, `f(v) <= w + u' * N` bounds the distance of
+// the dependence by its bounding coefficients `w` and `u`.
+//
+// Columns:
+//  - for each member, one schedule coefficient per loop (a column of `Phi`),
+//    integers in `0:maxCoefficient`
+//  - for each dependence, its multipliers and bounding coefficients
+// Offsets (`omega[2*level+1]`) are `0`; code generation ignores them.
+// Rows:
+//  - per active dependence, the Farkas equalities of its satisfaction and
+//    its bounding
+//  - per member with loops left to schedule, one linear independence row
+//    (sum of the null space of the previously found hyperplanes, as in
+//    Pluto)
+//
+// The objective minimizes the bounding coefficients, followed by the sum of
+// schedule coefficients.
+struct ILPScheduler {
+    // counters for a single `solveLevel`
+    struct LevelStatistics {
+        double seconds;
+        size_t numRows;
+        size_t numCols;
+        size_t rowsAdded;
+        size_t rowsRemoved;
+        size_t edgesSatisfied;
+        int64_t simplexIterations;
+        // the level started from the basis of the previous one
+        bool warmStarted;
+        // the LP relaxation's schedule coefficients were integers, so no
+        // ILP was solved
+        bool relaxationIntegral;
+    };
+    // schedule coefficients are integers in `0:maxCoefficient`
+    static constexpr int64_t maxCoefficient = 16;
+    // weight of the bounding coefficients relative to the schedule
+    // coefficients in the objective
+    static constexpr double boundingWeight = 1024.0;
+
+    // a dependence not yet strongly satisfied
+    struct ActiveEdge {
+        unsigned id;
+        // the pairs of iterations the levels found so far leave tied
+        SymbolicEqPolyhedra ties;
+        // the first of its `numCols` multiplier and bounding columns
+        HighsInt col0;
+        HighsInt numCols;
+    };
+
+    void *highs;
+    LoopBlock &lblock;
+    llvm::SmallVector<int64_t> component;
+    llvm::SmallVector<ActiveEdge, 0> activeEdges;
+    // the schedules of `component` before solving, restored on failure
+    llvm::SmallVector<llvm::SmallVector<int64_t, Schedule::maxStackStorage>,
+                      4>
+        oldData;
+    // first `Phi` column of each member; they are the first `numPhiCols`
+    llvm::SmallVector<HighsInt> phiCols;
+    HighsInt numPhiCols = 0;
+    // `rowOwner[r]` is the edge a row belongs to, or `-1` for linear
+    // independence rows; kept in sync with row deletions.
+    llvm::SmallVector<int64_t> rowOwner;
+    // the basis of the last LP solved, kept in sync with the rows
+    llvm::SmallVector<HighsInt> colStatus;
+    llvm::SmallVector<HighsInt> rowStatus;
+    bool hasBasis = false;
+    llvm::SmallVector<LevelStatistics> statistics;
+    size_t level = 0;
+
+    ILPScheduler(LoopBlock &lblock, llvm::ArrayRef<int64_t> component,
+                 llvm::ArrayRef<unsigned> internalEdges)
+        : highs(Highs_create()), lblock(lblock),
+          component(component.begin(), component.end()) {
+        Highs_setBoolOptionValue(highs, "output_flag", false);
+        Highs_changeObjectiveSense(highs, kHighsObjSenseMinimize);
+        for (auto m : component) {
+            const Schedule &sch = lblock.memory[m].schedule;
+            phiCols.push_back(numPhiCols);
+            numPhiCols += sch.numLoops;
+            oldData.push_back(sch.data);
+        }
+        for (HighsInt c = 0; c < numPhiCols; ++c)
+            addColumn(0, maxCoefficient, 1.0);
+        for (auto e : internalEdges)
+            addEdge(e);
+        chargeBudget(rowOwner.size());
+    }
+    ILPScheduler(const ILPScheduler &) = delete;
+    ILPScheduler &operator=(const ILPScheduler &) = delete;
+    ~ILPScheduler() { Highs_destroy(highs); }
+
+    size_t memberIndex(const MemoryAccess *ma) const {
+        size_t m = lblock.memoryIndex(ma);
+        return std::find(component.begin(), component.end(), int64_t(m)) -
+               component.begin();
+    }
+    HighsInt addColumn(double lower, double upper, double cost) {
+        Highs_addVar(highs, lower, upper);
+        HighsInt col = Highs_getNumCol(highs) - 1;
+        Highs_changeColCost(highs, col, cost);
+        if (hasBasis)
+            colStatus.push_back(kHighsBasisStatusLower);
+        return col;
+    }
+    // appends `lower <= sum(values .* x[indices]) <= upper`
+    void addRow(llvm::ArrayRef<HighsInt> indices, llvm::ArrayRef<double> values,
+                double lower, double upper, int64_t owner) {
+        Highs_addRow(highs, lower, upper, indices.size(), indices.data(),
+                     values.data());
+        rowOwner.push_back(owner);
+        if (hasBasis)
+            rowStatus.push_back(kHighsBasisStatusBasic);
+    }
+    // The `Phi` column that variable `v` of the iterations of `d` is
+    // multiplied by in the schedule of `out` minus that of `in`, and its
+    // sign. The variables follow the layout used by `Dependence::iterations`.
+    std::pair<HighsInt, double> scheduleColumn(const Dependence &d,
+                                               size_t v) const {
+        const size_t numLoopsIn = d.in->ref.getNumLoops();
+        const size_t numLoopsOut = d.out->ref.getNumLoops();
+        const size_t offIn = d.forward ? 0 : numLoopsOut;
+        const size_t offOut = d.forward ? numLoopsIn : 0;
+        if ((v >= offIn) && (v < offIn + numLoopsIn))
+            return {phiCols[memberIndex(d.in)] + (v - offIn), -1.0};
+        return {phiCols[memberIndex(d.out)] + (v - offOut), 1.0};
+    }
+    // Adds the multiplier and bounding columns of edge `e`, and the rows
+    // of its Farkas equalities.
+    void addEdge(unsigned e) {
+        const Dependence &d = lblock.edges[e];
+        const DependencePolyhedra &dp = d.depPoly;
+        const size_t numVar =
+            d.in->ref.getNumLoops() + d.out->ref.getNumLoops();
+        SymbolicEqPolyhedra p = dp.iterations(numVar, dp.getNumVar());
+        const size_t numIneq = p.getNumInequalityConstraints();
+        const size_t numEq = p.getNumEqualityConstraints();
+        const size_t numConstraints = numIneq + numEq;
+        // `B(0, c)` is the constant of `b` or `q` of constraint `c`, and
+        // `B(1 + t, c)` the coefficient of its `t`th symbol
+        llvm::DenseMap<Polynomial::Monomial, unsigned> symbols;
+        auto forEachTerm = [&](auto f) {
+            for (size_t c = 0; c < numConstraints; ++c)
+                for (auto &t : c < numIneq ? p.b[c] : p.q[c - numIneq])
+                    f(c, t);
+        };
+        forEachTerm([&](size_t, auto &t) {
+            if (!t.isCompileTimeConstant())
+                symbols.insert(std::make_pair(t.exponent, symbols.size()));
+        });
+        const size_t numSymbols = symbols.size();
+        IntMatrix B(1 + numSymbols, numConstraints);
+        forEachTerm([&](size_t c, auto &t) {
+            if (auto x = t.getCompileTimeConstant())
+                B(0, c) = x.getValue();
+            else
+                B(1 + symbols[t.exponent], c) = t.coefficient;
+        });
+        auto coefficient = [&](size_t c, size_t v) {
+            return c < numIneq ? p.A(c, v) : p.E(c - numIneq, v);
+        };
+        // satisfaction: `l_0`, `l`, `m`
+        const double inf = Highs_getInfinity(highs);
+        const HighsInt col0 = addColumn(0, inf, 0.0);
+        for (size_t c = 0; c < numConstraints; ++c)
+            addColumn(c < numIneq ? 0 : -inf, inf, 0.0);
+        // bounding: `w`, `u`, `l_0`, `l`, `m`
+        const HighsInt boundCol0 = addColumn(0, inf, boundingWeight);
+        for (size_t t = 0; t < numSymbols; ++t)
+            addColumn(0, inf, boundingWeight);
+        const HighsInt boundLambda0 = addColumn(0, inf, 0.0);
+        for (size_t c = 0; c < numConstraints; ++c)
+            addColumn(c < numIneq ? 0 : -inf, inf, 0.0);
+        const HighsInt numCols = Highs_getNumCol(highs) - col0;
+        llvm::SmallVector<HighsInt, 16> indices;
+        llvm::SmallVector<double, 16> values;
+        auto push = [&](HighsInt col, double x) {
+            if (x == 0)
+                return;
+            indices.push_back(col);
+            values.push_back(x);
+        };
+        // `sign = 1` for satisfaction, `-1` for bounding
+        for (double sign : {1.0, -1.0}) {
+            const HighsInt lambda0 = sign > 0 ? col0 : boundLambda0;
+            for (size_t v = 0; v < numVar; ++v) {
+                indices.clear();
+                values.clear();
+                auto [col, s] = scheduleColumn(d, v);
+                push(col, sign * s);
+                for (size_t c = 0; c < numConstraints; ++c)
+                    push(lambda0 + 1 + c, coefficient(c, v));
+                addRow(indices, values, 0, 0, e);
+            }
+            for (size_t t = 0; t <= numSymbols; ++t) {
+                indices.clear();
+                values.clear();
+                if (sign < 0)
+                    push(boundCol0 + t, 1.0);
+                if (t == 0)
+                    push(lambda0, -1.0);
+                for (size_t c = 0; c < numConstraints; ++c)
+                    push(lambda0 + 1 + c, -sign * B(t, c));
+                addRow(indices, values, 0, 0, e);
+            }
+        }
+        activeEdges.push_back(ActiveEdge{e, std::move(p), col0, numCols});
+    }
+    // deletes all rows for which `pred(owner)` is true, returns the count
+    template <typename F> size_t deleteRows(F pred) {
+        llvm::SmallVector<HighsInt> set;
+        size_t kept = 0;
+        for (size_t r = 0; r < rowOwner.size(); ++r) {
+            if (pred(rowOwner[r])) {
+                set.push_back(r);
+                continue;
+            }
+            rowOwner[kept] = rowOwner[r];
+            if (hasBasis)
+                rowStatus[kept] = rowStatus[r];
+            ++kept;
+        }
+        if (set.empty())
+            return 0;
+        Highs_deleteRowsBySet(highs, set.size(), set.data());
+        rowOwner.truncate(kept);
+        if (hasBasis)
+            rowStatus.truncate(kept);
+        return set.size();
+    }
+    // Drops the edges for which `pred(edge)` is true: deletes their rows,
+    // and fixes their columns to `0`. `pred` is called once per edge.
+    // Returns the number of rows deleted.
+    template <typename F> size_t dropEdges(F pred) {
+        llvm::SmallVector<int64_t, 8> dropped;
+        llvm::SmallVector<ActiveEdge, 0> kept;
+        for (auto &edge : activeEdges) {
+            if (!pred(edge)) {
+                kept.push_back(std::move(edge));
+                continue;
+            }
+            dropped.push_back(edge.id);
+            for (HighsInt c = 0; c < edge.numCols; ++c)
+                Highs_changeColBounds(highs, edge.col0 + c, 0, 0);
+        }
+        activeEdges = std::move(kept);
+        return deleteRows([&](int64_t owner) {
+            return std::find(dropped.begin(), dropped.end(), owner) !=
+                   dropped.end();
+        });
+    }
+    // Replaces the linear independence rows of the previous level.
+    // At level 0, the null space is everything, so the row asks for a
+    // non-zero hyperplane. Members with all their levels found have their
+    // remaining coefficients fixed to `0`.
+    // Returns the number of rows added.
+    size_t updateIndependenceRows() {
+        size_t added = 0;
+        for (size_t i = 0; i < component.size(); ++i) {
+            Schedule &sch = lblock.memory[component[i]].schedule;
+            const size_t numLoops = sch.numLoops;
+            if (level >= numLoops) {
+                if (level == numLoops)
+                    for (size_t l = 0; l < numLoops; ++l)
+                        Highs_changeColBounds(highs, phiCols[i] + l, 0, 0);
+                continue;
+            }
+            IntMatrix N = IntMatrix::identity(numLoops);
+            if (level) {
+                IntMatrix H(level, numLoops);
+                SquarePtrMatrix<int64_t> Phi = sch.getPhi();
+                for (size_t h = 0; h < level; ++h)
+                    for (size_t l = 0; l < numLoops; ++l)
+                        H(h, l) = Phi(l, h);
+                // rows of `N` satisfy `H * n == 0`
+                N = NormalForm::nullSpace(H.transpose());
+            }
+            llvm::SmallVector<HighsInt, 8> indices;
+            llvm::SmallVector<double, 8> values;
+            for (size_t l = 0; l < numLoops; ++l) {
+                int64_t s = 0;
+                for (size_t r = 0; r < N.numRow(); ++r)
+                    s += N(r, l);
+                if (s) {
+                    indices.push_back(phiCols[i] + l);
+                    values.push_back(s);
+                }
+            }
+            addRow(indices, values, 1, Highs_getInfinity(highs), -1);
+            ++added;
+        }
+        return added;
+    }
+    // The schedule of `d.out` minus that of `d.in` at the current level,
+    // as coefficients of the iterations of `d`.
+    llvm::SmallVector<int64_t, 16> levelDifference(const Dependence &d) const {
+        const size_t numLoopsIn = d.in->ref.getNumLoops();
+        const size_t numLoopsOut = d.out->ref.getNumLoops();
+        const size_t offIn = d.forward ? 0 : numLoopsOut;
+        const size_t offOut = d.forward ? numLoopsIn : 0;
+        SquarePtrMatrix<const int64_t> inPhi = d.in->schedule.getPhi();
+        SquarePtrMatrix<const int64_t> outPhi = d.out->schedule.getPhi();
+        llvm::SmallVector<int64_t, 16> diff(numLoopsIn + numLoopsOut);
+        for (size_t j = 0; j < numLoopsIn; ++j)
+            diff[j + offIn] = -inPhi(j, level);
+        for (size_t j = 0; j < numLoopsOut; ++j)
+            diff[j + offOut] = outPhi(j, level);
+        return diff;
+    }
+    bool phiIntegral() const {
+        llvm::SmallVector<double, 16> x(Highs_getNumCol(highs));
+        Highs_getSolution(highs, x.data(), nullptr, nullptr, nullptr);
+        for (HighsInt c = 0; c < numPhiCols; ++c)
+            if (std::abs(x[c] - std::round(x[c])) > 1e-6)
+                return false;
+        return true;
+    }
+    int64_t simplexIterations() const {
+        HighsInt iterations = 0;
+        Highs_getIntInfoValue(highs, "simplex_iteration_count", &iterations);
+        return iterations;
+    }
+    bool optimal() const {
+        return Highs_getModelStatus(highs) == kHighsModelStatusOptimal;
+    }
+    // Solves the LP relaxation, starting from the basis of the previous
+    // level, and, if its `Phi` are fractional, the ILP.
+    // Returns `true` if no solution was found.
+    bool run(LevelStatistics &stats) {
+        Highs_clearIntegrality(highs);
+        if (hasBasis)
+            stats.warmStarted = Highs_setBasis(highs, colStatus.data(),
+                                               rowStatus.data()) ==
+                                kHighsStatusOk;
+        ++NumSchedulerSolverCalls;
+        if ((Highs_run(highs) == kHighsStatusError) || !optimal())
+            return true;
+        stats.simplexIterations = simplexIterations();
+        colStatus.resize(Highs_getNumCol(highs));
+        rowStatus.resize(Highs_getNumRow(highs));
+        Highs_getBasis(highs, colStatus.data(), rowStatus.data());
+        hasBasis = true;
+        stats.relaxationIntegral = phiIntegral();
+        if (stats.relaxationIntegral)
+            return false;
+        llvm::SmallVector<HighsInt, 16> integer(numPhiCols,
+                                                kHighsVarTypeInteger);
+        Highs_changeColsIntegralityByRange(highs, 0, numPhiCols - 1,
+                                           integer.data());
+        ++NumSchedulerSolverCalls;
+        return (Highs_run(highs) == kHighsStatusError) || !optimal();
+    }
+    // Solves for hyperplane `level`, writes it into the members' schedules,
+    // and drops the dependences it strongly satisfies.
+    // Returns `true` on failure, including when the compile budget is
+    // exhausted.
+    bool solveLevel() {
+        ScheduleLevelTimer levelTimer(level);
+        auto start = std::chrono::steady_clock::now();
+        LevelStatistics stats{};
+        // dependences between statements this level places in different
+        // loops are satisfied, or violated, by that order
+        bool failed = false;
+        stats.rowsRemoved = dropEdges([&](const ActiveEdge &edge) {
+            const Dependence &d = lblock.edges[edge.id];
+            int64_t o = d.out->schedule.getOmega()[2 * level] -
+                        d.in->schedule.getOmega()[2 * level];
+            if ((o == 0) && (level >= std::min(d.in->ref.getNumLoops(),
+                                               d.out->ref.getNumLoops())))
+                o = -1;
+            failed |= o < 0;
+            stats.edgesSatisfied += o > 0;
+            return o != 0;
+        });
+        stats.rowsRemoved +=
+            deleteRows([](int64_t owner) { return owner < 0; });
+        stats.rowsAdded = updateIndependenceRows();
+        failed = failed || chargeBudget(stats.rowsAdded) || budgetExhausted() ||
+                 run(stats);
+        if (!failed) {
+            llvm::SmallVector<double, 16> x(Highs_getNumCol(highs));
+            Highs_getSolution(highs, x.data(), nullptr, nullptr, nullptr);
+            for (size_t i = 0; i < component.size(); ++i) {
+                Schedule &sch = lblock.memory[component[i]].schedule;
+                if (level >= sch.numLoops)
+                    continue;
+                SquarePtrMatrix<int64_t> Phi = sch.getPhi();
+                for (size_t l = 0; l < sch.numLoops; ++l)
+                    Phi(l, level) = std::llround(x[phiCols[i] + l]);
+                sch.getOmega()[2 * level + 1] = 0;
+            }
+            // dependences whose ties this level breaks are strongly
+            // satisfied; the rows keep the others weakly satisfied
+            stats.rowsRemoved += dropEdges([&](ActiveEdge &edge) {
+                edge.ties = Dependence::appendConstraint(
+                    std::move(edge.ties),
+                    levelDifference(lblock.edges[edge.id]), 0);
+                bool satisfied = Dependence::knownEmpty(edge.ties);
+                stats.edgesSatisfied += satisfied;
+                return satisfied;
+            });
+        }
+        stats.numRows = Highs_getNumRow(highs);
+        stats.numCols = Highs_getNumCol(highs);
+        stats.seconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+        statistics.push_back(stats);
+        LLVM_DEBUG(llvm::dbgs()
+                   << "ILP level " << level << ": " << stats.seconds
+                   << " s, rows = " << stats.numRows
+                   << ", cols = " << stats.numCols << ", +" << stats.rowsAdded
+                   << "/-" << stats.rowsRemoved
+                   << " rows, simplex iterations = " << stats.simplexIterations
+                   << (stats.warmStarted ? " (warm)" : " (cold)")
+                   << ", satisfied dependences = " << stats.edgesSatisfied
+                   << ", remaining dependences = " << activeEdges.size()
+                   << "\n");
+        ++level;
+        return failed;
+    }
+    // Restores the schedules the component had before solving.
+    void restore() {
+        for (size_t i = 0; i < component.size(); ++i)
+            lblock.memory[component[i]].schedule.data = oldData[i];
+    }
+    // Solves levels until every member is fully scheduled. Dependences
+    // still active at that point are carried by the statement order,
+    // i.e. the final `omega`, which is left unchanged.
+    // Returns `true` on failure, in which case the schedules are restored.
+    bool solve() {
+        size_t depth = 0;
+        for (auto m : component)
+            depth = std::max(depth, size_t(lblock.memory[m].schedule.numLoops));
+        while (level < depth) {
+            if (solveLevel()) {
+                restore();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Schedules `component` with an `ILPScheduler`, as
+// `LoopBlock::scheduleComponent` does when no permutation of its loops
+// satisfies `internalEdges`.
+// Returns `true` on failure, in which case the schedules are unchanged.
+bool scheduleComponentILP(LoopBlock &lblock, llvm::ArrayRef<int64_t> component,
+                          llvm::ArrayRef<unsigned> internalEdges) {
+    ILPScheduler ilp(lblock, component, internalEdges);
+    if (ilp.solve())
+        return true;
+    if (lblock.isSatisfied(internalEdges))
+        return false;
+    ilp.restore();
+    return true;
+}
+
+#undef DEBUG_TYPE
@@ -0,0 +1,546 @@
+#pragma once
+
+#include "./ArrayReference.hpp"
+#include "./BoundsChecks.hpp"
+#include "./CompileBudget.hpp"
+#include "./Instrumentation.hpp"
+#include "./IntegerMap.hpp"
+#include "./LoopBlock.hpp"
+#include "./Loops.hpp"
+#include "./Math.hpp"
+#include "./POSet.hpp"
+#include "./Remarks.hpp"
+#include "./Schedule.hpp"
+#include "./Symbolics.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/LoopIterator.h>
+#include <llvm/Analysis/OptimizationRemarkEmitter.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/Debug.h>
+#include <memory>
+
+#define DEBUG_TYPE "turbo-loop"
+
+// Extracting the internal representation from LLVM IR.
+// Loop `d` of a nest is represented by its iteration count, `x_d`, running
+// from `0` through its backedge taken count, which must be affine in the
+// outer `x`s, so that an `SCEVAddRecExpr` `{a,+,s}` of loop `d` is
+// `a + s * x_d`. Loop invariant `SCEVUnknown`s are symbols, numbered by the
+// `ValueToPosetMap`, so that facts in the `PartiallyOrderedSet` apply to
+// them, and `toSCEV` converts back. Extensions of symbols are assumed not
+// to overflow, as elsewhere in the symbolic representation; truncations are
+// rejected, as they need not preserve the value.
+// The byte offset of a memory access from its base pointer is split into
+// dimensions by its symbolic strides, delinearizing e.g. `A[i + M*j]` into
+// a two dimensional reference with strides `1` and `M`, if the poset and
+// loop bounds prove `0 <= i < M`; otherwise the nest is rejected, as one
+// dimension would need the symbolic coefficient `M`.
+
+// `S` as a polynomial of symbols; `None` if `S` is not a sum of products,
+// or truncates.
+llvm::Optional<MPoly> toMPoly(const llvm::SCEV *S, ValueToPosetMap &symbols) {
+    if (auto *C = llvm::dyn_cast<llvm::SCEVConstant>(S)) {
+        if (C->getAPInt().getMinSignedBits() > 64)
+            return {};
+        return MPoly(C->getAPInt().getSExtValue());
+    }
+    if (auto *U = llvm::dyn_cast<llvm::SCEVUnknown>(S))
+        return MPoly(Polynomial::Monomial(
+            Polynomial::ID{IDType(symbols.push(U->getValue()))}));
+    if (llvm::isa<llvm::SCEVTruncateExpr>(S))
+        return {};
+    if (auto *cast = llvm::dyn_cast<llvm::SCEVCastExpr>(S))
+        return toMPoly(cast->getOperand(0), symbols);
+    if (auto *add = llvm::dyn_cast<llvm::SCEVAddExpr>(S)) {
+        MPoly p;
+        for (auto op : add->operands()) {
+            llvm::Optional<MPoly> q = toMPoly(op, symbols);
+            if (!q)
+                return {};
+            p += *q;
+        }
+        return p;
+    }
+    if (auto *mul = llvm::dyn_cast<llvm::SCEVMulExpr>(S)) {
+        MPoly p(1);
+        for (auto op : mul->operands()) {
+            llvm::Optional<MPoly> q = toMPoly(op, symbols);
+            if (!q)
+                return {};
+            p *= *q;
+        }
+        return p;
+    }
+    return {};
+}
+
+// Decomposes `S` into `sum(coefs[d] * x_d) + offset`, where `x_d` is the
+// iteration count of `loops[d]` (outermost first), and the coefficients
+// and offset are polynomials of symbols; adds to `coefs` and `offset`.
+// Returns `true` on failure.
+bool affineInLoops(const llvm::SCEV *S, llvm::ArrayRef<llvm::Loop *> loops,
+                   llvm::MutableArrayRef<MPoly> coefs, MPoly &offset,
+                   llvm::ScalarEvolution &SE, ValueToPosetMap &symbols) {
+    if (loops.empty() || SE.isLoopInvariant(S, loops.front())) {
+        llvm::Optional<MPoly> p = toMPoly(S, symbols);
+        if (!p)
+            return true;
+        offset += *p;
+        return false;
+    }
+    if (auto *AR = llvm::dyn_cast<llvm::SCEVAddRecExpr>(S)) {
+        auto it = std::find(loops.begin(), loops.end(), AR->getLoop());
+        const llvm::SCEV *step = AR->getStepRecurrence(SE);
+        if (!AR->isAffine() || (it == loops.end()) ||
+            !SE.isLoopInvariant(step, loops.front()))
+            return true;
+        llvm::Optional<MPoly> s = toMPoly(step, symbols);
+        if (!s)
+            return true;
+        coefs[it - loops.begin()] += *s;
+        return affineInLoops(AR->getStart(), loops, coefs, offset, SE,
+                             symbols);
+    }
+    if (auto *add = llvm::dyn_cast<llvm::SCEVAddExpr>(S)) {
+        for (auto op : add->operands())
+            if (affineInLoops(op, loops, coefs, offset, SE, symbols))
+                return true;
+        return false;
+    }
+    return true;
+}
+
+// The domain of the loops `loops[0]` (outermost) through `loops.back()`:
+// `0 <= x_d <= btc_d` for each loop `d`, where `btc_d` is the backedge
+// taken count, which must be affine in the outer loops with integer
+// coefficients. `nullptr` on failure.
+llvm::IntrusiveRefCntPtr<AffineLoopNest>
+extractLoopNest(llvm::ArrayRef<llvm::Loop *> loops, llvm::ScalarEvolution &SE,
+                ValueToPosetMap &symbols, const PartiallyOrderedSet &poset) {
+    const size_t numLoops = loops.size();
+    IntMatrix A(2 * numLoops, numLoops);
+    llvm::SmallVector<MPoly, 8> b(2 * numLoops);
+    for (size_t d = 0; d < numLoops; ++d) {
+        const llvm::SCEV *btc = SE.getBackedgeTakenCount(loops[d]);
+        if (llvm::isa<llvm::SCEVCouldNotCompute>(btc))
+            return nullptr;
+        llvm::SmallVector<MPoly> coefs(d);
+        MPoly offset;
+        if (affineInLoops(btc, loops.take_front(d), coefs, offset, SE,
+                          symbols))
+            return nullptr;
+        // `-x_d <= 0`
+        A(2 * d, d) = -1;
+        // `x_d - sum(coefs[k] * x_k) <= offset`
+        A(2 * d + 1, d) = 1;
+        for (size_t k = 0; k < d; ++k) {
+            llvm::Optional<int64_t> c = coefs[k].getCompileTimeConstant();
+            if (!c)
+                return nullptr;
+            A(2 * d + 1, k) = -*c;
+        }
+        b[2 * d + 1] = std::move(offset);
+    }
+    ++NumLoopNestPolyhedra;
+    return llvm::makeIntrusiveRefCnt<AffineLoopNest>(std::move(A), std::move(b),
+                                                     poset);
+}
+
+// A dimension of a delinearized array reference: the element offset is
+// `sum(stride * (sum(coefs[d] * x_d) + offset))` over the dimensions.
+struct ArrayDimension {
+    MPoly stride;
+    llvm::SmallVector<int64_t> coefs;
+    MPoly offset;
+};
+
+// Splits the byte offset `sum(coefs[d] * x_d) + offset` of an access to
+// elements of `elementBytes` into dimensions, one per distinct monomial of
+// the coefficients; the remaining terms of `offset` go to the dimension of
+// stride `1`. Returns `true` on failure, i.e. if a term is not a multiple of
+// `elementBytes`.
+bool delinearize(llvm::SmallVectorImpl<ArrayDimension> &dims,
+                 llvm::ArrayRef<MPoly> coefs, const MPoly &offset,
+                 int64_t elementBytes) {
+    const size_t numLoops = coefs.size();
+    auto dimension = [&](const Polynomial::Monomial &m) -> ArrayDimension & {
+        MPoly stride(m);
+        for (auto &dim : dims)
+            if (dim.stride == stride)
+                return dim;
+        return dims.emplace_back(ArrayDimension{
+            std::move(stride), llvm::SmallVector<int64_t>(numLoops), MPoly()});
+    };
+    for (size_t d = 0; d < numLoops; ++d) {
+        for (auto &t : coefs[d].terms) {
+            if (t.coefficient % elementBytes)
+                return true;
+            dimension(t.exponent).coefs[d] += t.coefficient / elementBytes;
+        }
+    }
+    for (auto &t : offset.terms) {
+        if (t.coefficient % elementBytes)
+            return true;
+        MPoly stride(t.exponent);
+        auto it = std::find_if(dims.begin(), dims.end(), [&](auto &dim) {
+            return dim.stride == stride;
+        });
+        if (it != dims.end())
+            it->offset += t.coefficient / elementBytes;
+        else
+            dimension(Polynomial::Monomial(One()))
+                .offset += MPoly(Polynomial::Term<int64_t, Polynomial::Monomial>(
+                t.coefficient / elementBytes, t.exponent));
+    }
+    if (dims.empty())
+        dimension(Polynomial::Monomial(One()));
+    return false;
+}
+
+// A `LoopBlock` extracted from the loop nest `root`.
+// `basePointers[arrayID]` is the base of the accesses to `arrayID`.
+struct ExtractedLoopBlock {
+    llvm::Loop *root;
+    LoopBlock lblock;
+    llvm::SmallVector<llvm::Value *> basePointers;
+};
+
+struct LoopBlockExtractor {
+    llvm::LoopInfo &LI;
+    llvm::ScalarEvolution &SE;
+    const llvm::DataLayout &DL;
+    ValueToPosetMap &symbols;
+    const PartiallyOrderedSet &poset;
+
+    // An access, before its dimensions are reconciled with the other
+    // accesses to the same array.
+    struct Access {
+        llvm::Instruction *I;
+        llvm::Loop *L;
+        size_t arrayID;
+        llvm::SmallVector<ArrayDimension> dims;
+        llvm::SmallVector<int64_t> omega;
+    };
+    llvm::SmallVector<Access, 0> accesses{};
+    llvm::SmallVector<llvm::Value *> basePointers{};
+    llvm::DenseMap<llvm::Loop *, llvm::IntrusiveRefCntPtr<AffineLoopNest>>
+        nests{};
+    llvm::SmallVector<llvm::Loop *> path{};
+    // `positions[l]` is the position within loop `l - 1` of loop `l`
+    llvm::SmallVector<int64_t> positions{};
+
+    llvm::IntrusiveRefCntPtr<AffineLoopNest> loopNest(llvm::Loop *L) {
+        auto it = nests.find(L);
+        if (it != nests.end())
+            return it->second;
+        llvm::IntrusiveRefCntPtr<AffineLoopNest> aln =
+            extractLoopNest(path, SE, symbols, poset);
+        nests.insert(std::make_pair(L, aln));
+        return aln;
+    }
+    // Returns `true` on failure.
+    bool addAccess(llvm::Instruction *I, llvm::Value *ptr, llvm::Type *T,
+                   int64_t position) {
+        llvm::Loop *L = path.back();
+        if (!loopNest(L))
+            return true;
+        const llvm::SCEV *S = SE.getSCEV(ptr);
+        auto *base = llvm::dyn_cast<llvm::SCEVUnknown>(SE.getPointerBase(S));
+        if (!base || !SE.isLoopInvariant(base, path.front()))
+            return true;
+        const llvm::SCEV *bytes = SE.getMinusSCEV(S, base);
+        if (llvm::isa<llvm::SCEVCouldNotCompute>(bytes))
+            return true;
+        llvm::SmallVector<MPoly> coefs(path.size());
+        MPoly offset;
+        if (affineInLoops(bytes, path, coefs, offset, SE, symbols))
+            return true;
+        Access a{I, L, 0, {}, {}};
+        if (delinearize(a.dims, coefs, offset,
+                        int64_t(DL.getTypeAllocSize(T).getFixedSize())))
+            return true;
+        llvm::Value *basePtr = base->getValue();
+        a.arrayID = std::find(basePointers.begin(), basePointers.end(),
+                              basePtr) -
+                    basePointers.begin();
+        if (a.arrayID == basePointers.size())
+            basePointers.push_back(basePtr);
+        a.omega.resize(2 * path.size() + 1);
+        for (size_t l = 0; l < path.size(); ++l)
+            a.omega[2 * l] = positions[l];
+        a.omega[2 * path.size()] = position;
+        accesses.push_back(std::move(a));
+        return false;
+    }
+    // Visits the blocks of `L` in program order, numbering the statements
+    // and subloops directly within it. Returns `true` on failure.
+    bool visit(llvm::Loop *L) {
+        path.push_back(L);
+        int64_t position = 0;
+        llvm::LoopBlocksRPO RPO(L);
+        RPO.perform(&LI);
+        for (llvm::BasicBlock *BB : RPO) {
+            llvm::Loop *inner = LI.getLoopFor(BB);
+            if (inner != L) {
+                if ((inner->getParentLoop() != L) ||
+                    (inner->getHeader() != BB))
+                    continue;
+                positions.push_back(position++);
+                bool failed = visit(inner);
+                positions.pop_back();
+                if (failed)
+                    return true;
+                continue;
+            }
+            for (auto &I : *BB) {
+                if (auto *load = llvm::dyn_cast<llvm::LoadInst>(&I)) {
+                    if (!load->isSimple() ||
+                        addAccess(load, load->getPointerOperand(),
+                                  load->getType(), position++))
+                        return true;
+                } else if (auto *store = llvm::dyn_cast<llvm::StoreInst>(&I)) {
+                    if (!store->isSimple() ||
+                        addAccess(store, store->getPointerOperand(),
+                                  store->getValueOperand()->getType(),
+                                  position++))
+                        return true;
+                } else if (I.mayReadOrWriteMemory()) {
+                    auto *II = llvm::dyn_cast<llvm::IntrinsicInst>(&I);
+                    if (!II || !II->isAssumeLikeIntrinsic())
+                        return true;
+                }
+            }
+        }
+        path.pop_back();
+        return false;
+    }
+    // Whether the subscripts of `a`, with dimensions sorted by stride, are
+    // unique: each but the outermost, i.e. the last, must be non-negative,
+    // and, unless it is `0`, its maximum times its stride must be less than
+    // the next larger stride, so that distinct subscripts address distinct
+    // elements.
+    bool separable(const Access &a) {
+        const AffineLoopNest &aln = *nests[a.L];
+        llvm::Optional<llvm::SmallVector<std::pair<MPoly, MPoly>>> ranges =
+            loopRanges(aln);
+        if (!ranges)
+            return false;
+        for (size_t d = 0; d + 1 < a.dims.size(); ++d) {
+            const ArrayDimension &dim = a.dims[d];
+            MPoly lo = dim.offset, hi = dim.offset;
+            for (size_t l = 0; l < dim.coefs.size(); ++l) {
+                int64_t c = dim.coefs[l];
+                if (c == 0)
+                    continue;
+                MPoly x = c > 0 ? (*ranges)[l].first : (*ranges)[l].second;
+                MPoly y = c > 0 ? (*ranges)[l].second : (*ranges)[l].first;
+                x *= c;
+                y *= c;
+                lo += x;
+                hi += y;
+            }
+            if (!aln.knownGreaterEqualZero(lo))
+                return false;
+            if (isZero(hi))
+                continue;
+            // `stride_{d+1} - hi * stride_d - 1 >= 0`
+            hi *= dim.stride;
+            MPoly gap = a.dims[d + 1].stride;
+            gap -= hi;
+            gap -= 1;
+            if (!aln.knownGreaterEqualZero(gap))
+                return false;
+        }
+        return true;
+    }
+    // Gives each access to an array the union of the dimensions of all
+    // accesses to it, sorted by stride, so that they are comparable.
+    // Returns `true` on failure, i.e. if the subscripts of an access are
+    // not `separable`.
+    bool reconcileDimensions() {
+        for (size_t id = 0; id < basePointers.size(); ++id) {
+            llvm::SmallVector<MPoly> strides;
+            for (auto &a : accesses)
+                if (a.arrayID == id)
+                    for (auto &dim : a.dims)
+                        if (std::find(strides.begin(), strides.end(),
+                                      dim.stride) == strides.end())
+                            strides.push_back(dim.stride);
+            // smallest first, so that the stride `1` is the first dimension
+            // as `isContiguous` and the cache tiling expect
+            std::sort(strides.begin(), strides.end(),
+                      [](const MPoly &x, const MPoly &y) {
+                          return y.leadingTerm().exponent.lexGreater(
+                              x.leadingTerm().exponent);
+                      });
+            for (auto &a : accesses) {
+                if (a.arrayID != id)
+                    continue;
+                llvm::SmallVector<ArrayDimension> dims;
+                for (auto &stride : strides) {
+                    auto it = std::find_if(
+                        a.dims.begin(), a.dims.end(),
+                        [&](auto &dim) { return dim.stride == stride; });
+                    if (it != a.dims.end())
+                        dims.push_back(std::move(*it));
+                    else
+                        dims.push_back(ArrayDimension{
+                            stride,
+                            llvm::SmallVector<int64_t>(
+                                nests[a.L]->getNumLoops()),
+                            MPoly()});
+                }
+                a.dims = std::move(dims);
+                if (!separable(a))
+                    return true;
+            }
+        }
+        return false;
+    }
+    // Returns `true` on failure, leaving `eb.lblock` empty.
+    bool extract(ExtractedLoopBlock &eb, llvm::Loop *root) {
+        eb.root = root;
+        positions.push_back(0);
+        if (visit(root))
+            return true;
+        if (reconcileDimensions())
+            return true;
+        for (auto &a : accesses) {
+            llvm::IntrusiveRefCntPtr<AffineLoopNest> aln = nests[a.L];
+            const size_t numLoops = aln->getNumLoops();
+            ArrayReference ref(a.arrayID, aln, a.dims.size());
+            for (size_t d = 0; d < a.dims.size(); ++d) {
+                ref.stridesOffsets[d] =
+                    std::make_pair(a.dims[d].stride, a.dims[d].offset);
+                for (size_t l = 0; l < numLoops; ++l)
+                    ref.indexMatrix()(l, d) = a.dims[d].coefs[l];
+            }
+            Schedule sch(numLoops);
+            llvm::MutableArrayRef<int64_t> omega = sch.getOmega();
+            for (size_t k = 0; k < omega.size(); ++k)
+                omega[k] = a.omega[k];
+            eb.lblock.memory.emplace_back(std::move(ref), a.I, std::move(sch),
+                                          llvm::isa<llvm::LoadInst>(a.I));
+        }
+        for (auto &ma : eb.lblock.memory)
+            eb.lblock.userToMemory.insert(std::make_pair(ma.user, &ma));
+        fillValueFlow(eb.lblock, root);
+        eb.basePointers = std::move(basePointers);
+        return false;
+    }
+    // Fills `lblock.valueFlow`, following the operands of each stored value
+    // within `root` back to the loads they were computed from; `phi`s end
+    // the search, as they carry values across iterations.
+    static void fillValueFlow(LoopBlock &lblock, llvm::Loop *root) {
+        llvm::SmallVector<llvm::Value *> worklist;
+        llvm::SmallPtrSet<llvm::Instruction *, 16> seen;
+        for (size_t s = 0; s < lblock.memory.size(); ++s) {
+            auto *store =
+                llvm::dyn_cast<llvm::StoreInst>(lblock.memory[s].user);
+            if (!store)
+                continue;
+            seen.clear();
+            worklist.assign(1, store->getValueOperand());
+            while (!worklist.empty()) {
+                auto *I = llvm::dyn_cast<llvm::Instruction>(
+                    worklist.pop_back_val());
+                if (!I || llvm::isa<llvm::PHINode>(I) ||
+                    !root->contains(I) || !seen.insert(I).second)
+                    continue;
+                if (llvm::isa<llvm::LoadInst>(I)) {
+                    lblock.valueFlow.emplace_back(
+                        lblock.memoryIndex(lblock.userToMemory[I]), s);
+                    continue;
+                }
+                for (llvm::Value *op : I->operands())
+                    worklist.push_back(op);
+            }
+        }
+    }
+};
+
+// Extracts the `LoopBlock` of the loop nest `root`, whose accesses must all
+// be affine, and whose other instructions must not access memory.
+// Returns `true` on failure.
+bool extractLoopBlock(ExtractedLoopBlock &eb, llvm::Loop *root,
+                      llvm::LoopInfo &LI, llvm::ScalarEvolution &SE,
+                      const llvm::DataLayout &DL, ValueToPosetMap &symbols,
+                      const PartiallyOrderedSet &poset) {
+    LoopBlockExtractor extractor{LI, SE, DL, symbols, poset};
+    return extractor.extract(eb, root);
+}
+
+// Walks `LI` top-down, extracting a `LoopBlock` from each loop nest, or,
+// failing that, from each of its subloops. Loops keeping bounds checks
+// (see `BoundsChecks.hpp`) are skipped, as their fast versions are
+// extracted instead. Each nest is extracted with the poset holding within
+// it, i.e. with the facts of the bounds checks hoisted out of it, given by
+// `nestPosets`, if any.
+// Each loop nest gets a budget with `limits`, nested in the current one; if
+// it is exhausted, the nest is left untouched, and a remark is emitted to
+// `ORE`, if given.
+void extractLoopBlocks(
+    llvm::SmallVectorImpl<std::unique_ptr<ExtractedLoopBlock>> &blocks,
+    llvm::ArrayRef<llvm::Loop *> loops, llvm::LoopInfo &LI,
+    llvm::ScalarEvolution &SE, const llvm::DataLayout &DL,
+    ValueToPosetMap &symbols, const PartiallyOrderedSet &poset,
+    BudgetLimits limits, llvm::OptimizationRemarkEmitter *ORE,
+    const NestPosets *nestPosets) {
+    for (llvm::Loop *L : loops) {
+        if (llvm::getBooleanLoopAttribute(L, boundsCheckedLoop))
+            continue;
+        auto eb = std::make_unique<ExtractedLoopBlock>();
+        CompileBudget budget("loop nest", limits, currentBudget);
+        bool failed;
+        {
+            BudgetScope scope(&budget);
+            failed = extractLoopBlock(
+                *eb, L, LI, SE, DL, symbols,
+                nestPosets ? posetWithin(*nestPosets, L, poset) : poset);
+        }
+        if (CompileBudget *exhausted = budget.exhausted()) {
+            ++NumLoopNestsOverBudget;
+            if (ORE)
+                emitOverBudgetRemark(*ORE, L, *exhausted);
+            continue;
+        }
+        if (failed) {
+            ++NumLoopNestsRejected;
+            LLVM_DEBUG(llvm::dbgs()
+                       << "Could not extract an affine loop nest of depth "
+                       << L->getLoopDepth() << ".\n");
+            extractLoopBlocks(blocks, L->getSubLoops(), LI, SE, DL, symbols,
+                              poset, limits, ORE, nestPosets);
+        } else {
+            ++NumLoopNestsExtracted;
+            blocks.push_back(std::move(eb));
+        }
+    }
+}
+void extractLoopBlocks(
+    llvm::SmallVectorImpl<std::unique_ptr<ExtractedLoopBlock>> &blocks,
+    llvm::LoopInfo &LI, llvm::ScalarEvolution &SE, const llvm::DataLayout &DL,
+    ValueToPosetMap &symbols, const PartiallyOrderedSet &poset,
+    BudgetLimits limits = {}, llvm::OptimizationRemarkEmitter *ORE = nullptr,
+    const NestPosets *nestPosets = nullptr) {
+    PhaseTimer phaseTimer(Phase::IRExtraction);
+    llvm::SmallVector<llvm::Loop *> roots(LI.begin(), LI.end());
+    // `LI` lists top level loops in reverse program order
+    std::reverse(roots.begin(), roots.end());
+    extractLoopBlocks(blocks, roots, LI, SE, DL, symbols, poset, limits, ORE,
+                      nestPosets);
+}
+
+#undef DEBUG_TYPE
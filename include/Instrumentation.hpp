@@ -0,0 +1,440 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/Timer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <string>
+#ifdef TURBOLOOP_TRACK_ALLOCATIONS
+#include <malloc.h>
+#endif
+
+// Compile time instrumentation of the phases of the `TurboLoopPass`.
+//
+// Each phase is timed by a `PhaseTimer`, which reports to `-time-passes`,
+// in the "turbo-loop" timer group, and adds a scope to `-ftime-trace`
+// profiles. Counters are printed with `-stats`. They are
+// `TrackingStatistic`s, rather than `STATISTIC`s, so that they also count in
+// release builds of LLVM, where `STATISTIC` is a no-op; there,
+// `printPhaseStatistics` reports them. The time spent in each phase is also
+// accumulated in `phaseNanoseconds`, for benchmarks, and the time spent
+// searching for each schedule level in `scheduleLevelNanoseconds`.
+//
+// Allocations are counted by phase when building with
+// `TURBOLOOP_TRACK_ALLOCATIONS` (the `track_allocations` build option); see
+// `allocationCounts`.
+
+enum class Phase {
+    IRExtraction,
+    POSetIngestion,
+    DependenceConstruction,
+    Farkas,
+    RedundancyElimination,
+    Scheduling,
+    CodeGen,
+};
+constexpr size_t numPhases = size_t(Phase::CodeGen) + 1;
+
+constexpr const char *phaseTimerGroup = "turbo-loop";
+// timer names, as used by `-time-passes`
+constexpr const char *phaseNames[numPhases] = {
+    "turbo-loop-ir-extraction",
+    "turbo-loop-poset-ingestion",
+    "turbo-loop-dependences",
+    "turbo-loop-farkas",
+    "turbo-loop-redundancy-elimination",
+    "turbo-loop-scheduling",
+    "turbo-loop-codegen"};
+// descriptions, also the names of the `-ftime-trace` scopes
+constexpr const char *phaseDescriptions[numPhases] = {
+    "TurboLoop IR Extraction",
+    "TurboLoop POSet Ingestion",
+    "TurboLoop Dependence Construction",
+    "TurboLoop Farkas",
+    "TurboLoop Redundancy Elimination",
+    "TurboLoop Scheduling",
+    "TurboLoop CodeGen"};
+
+// Whether each phase is being timed.
+// An LLVM `Timer` may not be started while running, but phases recurse,
+// e.g. redundancy elimination while eliminating redundant constraints, and
+// may run on several threads at once, e.g. scheduling of independent
+// components. Thus, only the first live scope of a phase is timed.
+inline std::atomic<bool> phaseRunning[numPhases] = {};
+// Wall time spent in each phase, in nanoseconds, including the time spent in
+// other phases it runs, e.g. redundancy elimination while building Farkas
+// polyhedra.
+inline std::atomic<uint64_t> phaseNanoseconds[numPhases] = {};
+
+// The innermost phase running on this thread, which allocations are
+// attributed to, or `numPhases` outside of any.
+// The allocation functions read it, so it must not be allocated lazily, as
+// the thread locals of `dlopen`ed libraries otherwise are.
+[[gnu::tls_model("initial-exec")]] inline thread_local size_t
+    allocationPhase = numPhases;
+
+// Times the scope it lives in as phase `p`.
+struct PhaseTimer {
+    llvm::Optional<llvm::TimeTraceScope> trace;
+    llvm::Optional<llvm::NamedRegionTimer> timer;
+    std::chrono::steady_clock::time_point start;
+    Phase phase;
+    size_t outerPhase;
+    bool timing;
+    PhaseTimer(Phase p)
+        : phase(p), outerPhase(allocationPhase),
+          timing(!phaseRunning[size_t(p)].exchange(true)) {
+        allocationPhase = size_t(p);
+        if (!timing)
+            return;
+        start = std::chrono::steady_clock::now();
+        trace.emplace(phaseDescriptions[size_t(p)]);
+        timer.emplace(phaseNames[size_t(p)], phaseDescriptions[size_t(p)],
+                      phaseTimerGroup, "TurboLoop Phases",
+                      llvm::TimePassesIsEnabled);
+    }
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+    ~PhaseTimer() {
+        allocationPhase = outerPhase;
+        // stop the timer before another scope of the phase may start one
+        timer.reset();
+        trace.reset();
+        if (!timing)
+            return;
+        phaseNanoseconds[size_t(phase)] +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+        phaseRunning[size_t(phase)] = false;
+    }
+};
+
+// The scheduler finds schedules one level, i.e. hyperplane, at a time;
+// each level searched is timed, to find the levels it spends its time on.
+// Levels past the last entry share it.
+constexpr size_t numTimedScheduleLevels = 8;
+inline std::atomic<uint64_t> scheduleLevelNanoseconds[numTimedScheduleLevels] =
+    {};
+inline std::atomic<uint64_t> scheduleLevelSearches[numTimedScheduleLevels] =
+    {};
+
+// Times the scope it lives in as a search for schedule level `level`.
+struct ScheduleLevelTimer {
+    std::chrono::steady_clock::time_point start;
+    size_t level;
+    ScheduleLevelTimer(size_t l)
+        : start(std::chrono::steady_clock::now()),
+          level(std::min(l, numTimedScheduleLevels - 1)) {}
+    ScheduleLevelTimer(const ScheduleLevelTimer &) = delete;
+    ScheduleLevelTimer &operator=(const ScheduleLevelTimer &) = delete;
+    ~ScheduleLevelTimer() {
+        scheduleLevelNanoseconds[level] +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+        ++scheduleLevelSearches[level];
+    }
+};
+
+// IR extraction
+inline llvm::TrackingStatistic NumLoopNestsExtracted = {
+    "turbo-loop", "NumLoopNestsExtracted",
+    "Number of loop nests converted to loop blocks"};
+inline llvm::TrackingStatistic NumLoopNestsRejected = {
+    "turbo-loop", "NumLoopNestsRejected",
+    "Number of loop nests that could not be converted to loop blocks"};
+inline llvm::TrackingStatistic NumLoopNestsOverBudget = {
+    "turbo-loop", "NumLoopNestsOverBudget",
+    "Number of loop nests left untouched for exceeding the compile budget"};
+inline llvm::TrackingStatistic NumLoopNestPolyhedra = {
+    "turbo-loop", "NumLoopNestPolyhedra",
+    "Number of loop nest polyhedra built from IR"};
+inline llvm::TrackingStatistic NumAnalysisCacheHits = {
+    "turbo-loop", "NumAnalysisCacheHits",
+    "Number of loop nests whose schedules were found in the analysis cache"};
+inline llvm::TrackingStatistic NumAnalysisCacheMisses = {
+    "turbo-loop", "NumAnalysisCacheMisses",
+    "Number of loop nests missing from the analysis cache"};
+// POSet ingestion
+inline llvm::TrackingStatistic NumPOSetFacts = {
+    "turbo-loop", "NumPOSetFacts",
+    "Number of relations between symbols added to the POSet"};
+// dependence construction
+inline llvm::TrackingStatistic NumDependencePolyhedra = {
+    "turbo-loop", "NumDependencePolyhedra",
+    "Number of dependence polyhedra built"};
+inline llvm::TrackingStatistic NumDependences = {
+    "turbo-loop", "NumDependences", "Number of dependences found"};
+// Farkas
+inline llvm::TrackingStatistic NumFarkasPolyhedra = {
+    "turbo-loop", "NumFarkasPolyhedra",
+    "Number of Farkas polyhedra built"};
+// redundancy elimination
+inline llvm::TrackingStatistic NumRedundancyChecks = {
+    "turbo-loop", "NumRedundancyChecks",
+    "Number of constraints checked for redundancy"};
+inline llvm::TrackingStatistic NumConstraintsEliminated = {
+    "turbo-loop", "NumConstraintsEliminated",
+    "Number of redundant constraints eliminated"};
+inline llvm::TrackingStatistic NumRedundancySolves = {
+    "turbo-loop", "NumRedundancySolves",
+    "Number of auxiliary systems eliminated to check for redundancy"};
+// Fourier-Motzkin elimination
+inline llvm::TrackingStatistic NumVariablesEliminated = {
+    "turbo-loop", "NumVariablesEliminated",
+    "Number of variables eliminated by Fourier-Motzkin"};
+// scheduling
+inline llvm::TrackingStatistic NumScheduledComponents = {
+    "turbo-loop", "NumScheduledComponents",
+    "Number of strongly connected components scheduled"};
+inline llvm::TrackingStatistic NumSchedulerSolverCalls = {
+    "turbo-loop", "NumSchedulerSolverCalls",
+    "Number of ILP solves finding a schedule level"};
+// codegen
+inline llvm::TrackingStatistic NumLoopNestsEmitted = {
+    "turbo-loop", "NumLoopNestsEmitted", "Number of loop nests emitted"};
+inline llvm::TrackingStatistic NumParallelLoops = {
+    "turbo-loop", "NumParallelLoops",
+    "Number of loops outlined to run in parallel"};
+inline llvm::TrackingStatistic NumTileLoops = {
+    "turbo-loop", "NumTileLoops", "Number of loops over cache tiles emitted"};
+inline llvm::TrackingStatistic NumUnrolledLoops = {
+    "turbo-loop", "NumUnrolledLoops", "Number of loops unrolled and jammed"};
+
+inline llvm::TrackingStatistic *const phaseStatistics[] = {
+    &NumLoopNestsExtracted,    &NumLoopNestsRejected,
+    &NumLoopNestsOverBudget,   &NumLoopNestPolyhedra,
+    &NumAnalysisCacheHits,     &NumAnalysisCacheMisses,
+    &NumPOSetFacts,            &NumDependencePolyhedra,
+    &NumDependences,           &NumFarkasPolyhedra,
+    &NumRedundancyChecks,      &NumConstraintsEliminated,
+    &NumRedundancySolves,      &NumVariablesEliminated,
+    &NumScheduledComponents,   &NumSchedulerSolverCalls,
+    &NumLoopNestsEmitted,      &NumParallelLoops,
+    &NumTileLoops,             &NumUnrolledLoops};
+
+// Prints the non-zero counters in the format of `-stats`, which prints
+// nothing in release builds of LLVM.
+void printPhaseStatistics(llvm::raw_ostream &os) {
+    os << "===" << std::string(73, '-') << "===\n"
+       << "                          ... TurboLoop Statistics ...\n"
+       << "===" << std::string(73, '-') << "===\n\n";
+    for (auto s : phaseStatistics)
+        if (unsigned v = s->getValue())
+            os << llvm::format("%8u %s - %s\n", v, s->getDebugType(),
+                               s->getDesc());
+    for (size_t l = 0; l < numTimedScheduleLevels; ++l)
+        if (uint64_t n = scheduleLevelSearches[l])
+            os << llvm::format(
+                "%8llu turbo-loop - Searches for schedule level %zu%s, "
+                "%.3f ms\n",
+                (unsigned long long)n, l,
+                l + 1 == numTimedScheduleLevels ? " or deeper" : "",
+                scheduleLevelNanoseconds[l] * 1e-6);
+    os << '\n';
+}
+
+// Allocation accounting.
+// Building with `TURBOLOOP_TRACK_ALLOCATIONS` replaces `malloc` and the
+// functions related to it, in the executable or library including this
+// header, with ones counting the bytes and allocations of each phase, and
+// the bytes live. Replacements in a library only take precedence over the C
+// library's when it is preloaded, so, to count the allocations of the pass
+// plugin, run e.g. `LD_PRELOAD=libTurboLoop.so opt -load-pass-plugin ...`.
+// Otherwise, and in other builds, the counts stay zero.
+// Bytes are those usable by the caller, as reported by `malloc_usable_size`,
+// so they include the rounding of the allocator.
+// `MemoryUse.hpp` reports the memory held by a `LoopBlock`, by kind of
+// object, in any build.
+#ifdef TURBOLOOP_TRACK_ALLOCATIONS
+constexpr bool trackingAllocations = true;
+#else
+constexpr bool trackingAllocations = false;
+#endif
+
+struct AllocationCounter {
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> count{0};
+};
+// Allocations by phase; the last entry counts those outside of any phase.
+inline AllocationCounter phaseAllocations[numPhases + 1] = {};
+inline std::atomic<uint64_t> liveBytes = 0;
+inline std::atomic<uint64_t> peakLiveBytes = 0;
+
+// A snapshot of the allocation counters; the difference of two gives the
+// allocations between them.
+struct AllocationCounts {
+    uint64_t bytes[numPhases + 1] = {};
+    uint64_t count[numPhases + 1] = {};
+    // the most bytes live, since the last `resetPeakLiveBytes`
+    uint64_t peakLiveBytes = 0;
+
+    uint64_t totalBytes() const {
+        uint64_t total = 0;
+        for (uint64_t b : bytes)
+            total += b;
+        return total;
+    }
+    uint64_t totalCount() const {
+        uint64_t total = 0;
+        for (uint64_t c : count)
+            total += c;
+        return total;
+    }
+    // The allocations since `start`; keeps the peak of `this`.
+    AllocationCounts operator-(const AllocationCounts &start) const {
+        AllocationCounts d = *this;
+        for (size_t p = 0; p <= numPhases; ++p) {
+            d.bytes[p] -= start.bytes[p];
+            d.count[p] -= start.count[p];
+        }
+        return d;
+    }
+};
+
+AllocationCounts allocationCounts() {
+    AllocationCounts counts;
+    for (size_t p = 0; p <= numPhases; ++p) {
+        counts.bytes[p] =
+            phaseAllocations[p].bytes.load(std::memory_order_relaxed);
+        counts.count[p] =
+            phaseAllocations[p].count.load(std::memory_order_relaxed);
+    }
+    counts.peakLiveBytes = peakLiveBytes.load(std::memory_order_relaxed);
+    return counts;
+}
+// Restarts the peak from the bytes live now, e.g. before analyzing a loop
+// nest.
+void resetPeakLiveBytes() {
+    peakLiveBytes.store(liveBytes.load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+}
+
+// Prints the bytes and allocations of each phase, in the format of
+// `printPhaseStatistics`.
+void printAllocationStatistics(llvm::raw_ostream &os) {
+    os << "===" << std::string(73, '-') << "===\n"
+       << "                         ... TurboLoop Allocations ...\n"
+       << "===" << std::string(73, '-') << "===\n\n";
+    AllocationCounts counts = allocationCounts();
+    for (size_t p = 0; p <= numPhases; ++p)
+        if (counts.count[p])
+            os << llvm::format("%12llu bytes %10llu allocations - %s\n",
+                               (unsigned long long)counts.bytes[p],
+                               (unsigned long long)counts.count[p],
+                               p < numPhases ? phaseDescriptions[p]
+                                             : "outside of TurboLoop phases");
+    os << llvm::format("%12llu bytes peak live\n\n",
+                       (unsigned long long)counts.peakLiveBytes);
+}
+
+#ifdef TURBOLOOP_TRACK_ALLOCATIONS
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+void *__libc_memalign(size_t, size_t);
+void *__libc_valloc(size_t);
+void *__libc_pvalloc(size_t);
+void __libc_free(void *);
+}
+
+void countAllocation(void *p) {
+    if (!p)
+        return;
+    uint64_t n = malloc_usable_size(p);
+    AllocationCounter &c = phaseAllocations[allocationPhase];
+    c.bytes.fetch_add(n, std::memory_order_relaxed);
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    uint64_t live = liveBytes.fetch_add(n, std::memory_order_relaxed) + n;
+    uint64_t peak = peakLiveBytes.load(std::memory_order_relaxed);
+    while ((live > peak) && !peakLiveBytes.compare_exchange_weak(
+                                peak, live, std::memory_order_relaxed))
+        ;
+}
+
+// Subtracts the `n` bytes of a released block from `liveBytes`, stopping at
+// `0`: blocks allocated before these overrides were bound, e.g. by the
+// dynamic loader, are released without having been counted.
+void countRelease(uint64_t n) {
+    uint64_t live = liveBytes.load(std::memory_order_relaxed);
+    while (!liveBytes.compare_exchange_weak(live, live - std::min(live, n),
+                                            std::memory_order_relaxed))
+        ;
+}
+
+extern "C" {
+void *malloc(size_t n) {
+    void *p = __libc_malloc(n);
+    countAllocation(p);
+    return p;
+}
+void *calloc(size_t n, size_t size) {
+    void *p = __libc_calloc(n, size);
+    countAllocation(p);
+    return p;
+}
+void *realloc(void *p, size_t n) {
+    uint64_t old = p ? malloc_usable_size(p) : 0;
+    void *q = __libc_realloc(p, n);
+    // on failure, `p` is still live, unless `n == 0` freed it
+    if (q || !n)
+        countRelease(old);
+    countAllocation(q);
+    return q;
+}
+void *reallocarray(void *p, size_t n, size_t size) {
+    size_t bytes;
+    if (__builtin_mul_overflow(n, size, &bytes)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return realloc(p, bytes);
+}
+void *aligned_alloc(size_t alignment, size_t n) {
+    void *p = __libc_memalign(alignment, n);
+    countAllocation(p);
+    return p;
+}
+void *memalign(size_t alignment, size_t n) {
+    void *p = __libc_memalign(alignment, n);
+    countAllocation(p);
+    return p;
+}
+void *valloc(size_t n) {
+    void *p = __libc_valloc(n);
+    countAllocation(p);
+    return p;
+}
+void *pvalloc(size_t n) {
+    void *p = __libc_pvalloc(n);
+    countAllocation(p);
+    return p;
+}
+int posix_memalign(void **p, size_t alignment, size_t n) {
+    if (!alignment || (alignment & (alignment - 1)) ||
+        (alignment % sizeof(void *)))
+        return EINVAL;
+    if (!(*p = __libc_memalign(alignment, n)))
+        return ENOMEM;
+    countAllocation(*p);
+    return 0;
+}
+void free(void *p) {
+    if (p)
+        countRelease(malloc_usable_size(p));
+    __libc_free(p);
+}
+}
+#endif
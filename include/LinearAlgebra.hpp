@@ -1,147 +1,215 @@
 #pragma once
 #include "./Math.hpp"
 
+// Fraction-free (Bareiss) LU factorization of an integer matrix,
+//   P*A = L * D^{-1} * U,
+// with `P` a permutation, `L` lower and `U` upper triangular, and
+// `D = diag(p_{k-1} * p_k)`, where `p_k = U(k, k) = L(k, k)` is the
+// determinant of the leading `k+1 x k+1` block of `P*A`, and `p_{-1} = 1`.
+// `L` and `U` are stored in `F`, sharing their diagonal. Every entry is a
+// minor of `A`, so the factorization and the solves below run in `int64_t`,
+// with exact divisions; intermediate products are computed in 128 bits, and
+// only results that do not fit in `int64_t` fail. Solutions are integer
+// multiples of `1/det(A)`, made `Rational` only at the end.
 struct LU {
-    SquareMatrix<Rational> F;
+    SquareMatrix<int64_t> F;
     llvm::SmallVector<unsigned> ipiv;
 
-    bool ldiv(PtrMatrix<Rational> rhs) const {
-        auto [M, N] = rhs.size();
-        auto FM = F.numRow();
-        assert(FM == M);
-        // // check unimodularity
-        // Rational unit = 1;
-        // for (size_t i = 0; i < FM; ++i)
-        //     unit *= F(i, i);
-        // assert(unit == 1);
-
-        // permute rhs
-        for (size_t i = 0; i < M; ++i) {
-            unsigned ip = ipiv[i];
-            if (i != ip) {
-                for (size_t j = 0; j < M; ++j) {
-                    std::swap(rhs(ip, j), rhs(i, j));
-                }
-            }
-        }
-        // printMatrix(std::cout << "Permuted =\n", rhs) << std::endl;
-        // LU x = rhs
-        // L y = rhs // L is UnitLowerTriangular
-        for (size_t n = 0; n < N; ++n) {
-            for (size_t m = 0; m < M; ++m) {
-                Rational Ymn = rhs(m, n);
-                for (size_t k = 0; k < m; ++k) {
-                    if (Ymn.fnmadd(F(m, k), rhs(k, n))) {
-                        return true;
-                    }
-                }
-                rhs(m, n) = Ymn;
-            }
-        }
-        // printMatrix(std::cout << "Div LT =\n", rhs) << std::endl;
-        /*
-        for (size_t k = 0; k < N; ++k) {
-            for (size_t j = 0; j < M; ++j) {
-                Rational rhsj = rhs(j, k);
-                for (size_t i = j + 1; i < M; ++i) {
-                    rhs(i, k) -= (F(i, j) * rhsj).getValue();
-                }
+    // `(a*b - c*d) / e`, which must be exact; `None` on overflow
+    static llvm::Optional<int64_t> crossDiv(int64_t a, int64_t b, int64_t c,
+                                            int64_t d, int64_t e) {
+        __int128_t x;
+        if (__builtin_sub_overflow(widen(a) * widen(b), widen(c) * widen(d),
+                                   &x))
+            return {};
+        assert(x % e == 0);
+        x /= e;
+        if ((x > std::numeric_limits<int64_t>::max()) ||
+            (x < std::numeric_limits<int64_t>::min()))
+            return {};
+        return int64_t(x);
+    }
+    // `L(i, k)` and `U(k, j)`, of `P*A`, or with `Trans`, of `(P*A)'`, whose
+    // factors are `U'` and `L'`.
+    template <bool Trans> int64_t lower(size_t i, size_t k) const {
+        return Trans ? F(k, i) : F(i, k);
+    }
+    template <bool Trans> int64_t upper(size_t k, size_t j) const {
+        return Trans ? F(j, k) : F(k, j);
+    }
+    // `x = p_{M-1} * ((P*A) \ x)`, or with `Trans`, `(P*A)'`.
+    // Returns `true` on overflow.
+    template <bool Trans>
+    bool solveScaled(llvm::MutableArrayRef<int64_t> x) const {
+        const size_t M = F.numRow();
+        // L * D^{-1} * y = x, eliminating `[P*A x]` as `fact` eliminates `P*A`
+        int64_t prev = 1;
+        for (size_t k = 0; k < M; ++k) {
+            const int64_t pk = F(k, k);
+            const int64_t xk = x[k];
+            for (size_t i = k + 1; i < M; ++i) {
+                if (llvm::Optional<int64_t> xi =
+                        crossDiv(pk, x[i], lower<Trans>(i, k), xk, prev))
+                    x[i] = *xi;
+                else
+                    return true;
             }
+            prev = pk;
         }
-        */
-        // U x = y
-        for (size_t n = 0; n < N; ++n) {
-            for (int64_t m = M - 1; m >= 0; --m) {
-                Rational Ymn = rhs(m, n);
-                for (size_t k = m + 1; k < M; ++k) {
-                    if (Ymn.fnmadd(F(m, k), rhs(k, n))) {
-                        return true;
-                    }
-                }
-                if (auto div = Ymn / F(m, m)) {
-                    rhs(m, n) = div.getValue();
-                } else {
+        // U * x = p_{M-1} * y, which is integral as `p_{M-1} = +/-det(A)`
+        for (size_t i = M; i--;) {
+            __int128_t s = widen(prev) * widen(x[i]);
+            for (size_t j = i + 1; j < M; ++j)
+                if (__builtin_sub_overflow(
+                        s, widen(upper<Trans>(i, j)) * widen(x[j]), &s))
                     return true;
-                }
-            }
+            assert(s % F(i, i) == 0);
+            s /= F(i, i);
+            if ((s > std::numeric_limits<int64_t>::max()) ||
+                (s < std::numeric_limits<int64_t>::min()))
+                return true;
+            x[i] = int64_t(s);
         }
-        // printMatrix(std::cout << "Div UT =\n", rhs) << std::endl;
         return false;
     }
+    // `-1` if `P` is an odd permutation, else `1`
+    int64_t permSign() const {
+        int64_t sign = 1;
+        for (size_t i = 0; i < ipiv.size(); ++i)
+            sign = ipiv[i] == i ? sign : -sign;
+        return sign;
+    }
 
-    bool rdiv(PtrMatrix<Rational> rhs) const {
+    // `rhs = det(A) * (A \ rhs)`, i.e. `adj(A) * rhs`, in integers.
+    // Returns `true` on overflow.
+    bool ldivScaled(PtrMatrix<int64_t> rhs) const {
+        auto [M, N] = rhs.size();
+        assert(F.numRow() == M);
+        const int64_t sign = permSign();
+        llvm::SmallVector<int64_t, 16> x(M);
+        for (size_t n = 0; n < N; ++n) {
+            for (size_t m = 0; m < M; ++m)
+                x[m] = rhs(m, n);
+            // permute rhs
+            for (size_t m = 0; m < M; ++m)
+                std::swap(x[m], x[ipiv[m]]);
+            if (solveScaled<false>(x))
+                return true;
+            for (size_t m = 0; m < M; ++m)
+                rhs(m, n) = sign * x[m];
+        }
+        return false;
+    }
+    // `rhs = det(A) * (rhs / A)`, i.e. `rhs * adj(A)`, in integers.
+    // Returns `true` on overflow.
+    bool rdivScaled(PtrMatrix<int64_t> rhs) const {
         auto [M, N] = rhs.size();
-        auto FN = F.numCol();
-        assert(FN == N);
-        // // check unimodularity
-        // Rational unit = 1;
-        // for (size_t i = 0; i < FN; ++i)
-        //     unit *= F(i, i);
-        // assert(unit == 1);
+        assert(F.numCol() == N);
+        const int64_t sign = permSign();
+        llvm::SmallVector<int64_t, 16> x(N);
+        for (size_t m = 0; m < M; ++m) {
+            // x * A = rhs  <=>  (P*A)' * (P*x') = rhs'
+            for (size_t n = 0; n < N; ++n)
+                x[n] = rhs(m, n);
+            if (solveScaled<true>(x))
+                return true;
+            // permute rhs
+            for (size_t n = N; n--;)
+                std::swap(x[n], x[ipiv[n]]);
+            for (size_t n = 0; n < N; ++n)
+                rhs(m, n) = sign * x[n];
+        }
+        return false;
+    }
 
-        // PA = LU
-        // x LU = rhs
-        // y U = rhs
+    // Scales `r` to integers `x` with a common denominator, which is
+    // returned, or `0` on overflow.
+    static int64_t commonDenominator(llvm::ArrayRef<Rational> r,
+                                     llvm::MutableArrayRef<int64_t> x) {
+        int64_t l = 1;
+        for (const Rational &ri : r) {
+            int64_t g = gcd(l, ri.denominator);
+            if (__builtin_mul_overflow(l, ri.denominator / g, &l))
+                return 0;
+        }
+        for (size_t i = 0; i < r.size(); ++i)
+            if (__builtin_mul_overflow(r[i].numerator, l / r[i].denominator,
+                                       &x[i]))
+                return 0;
+        return l;
+    }
+    // `x / (d * l)`
+    static llvm::Optional<Rational> ratio(int64_t x, int64_t d, int64_t l) {
+        Rational r = Rational::create(x, d);
+        return l == 1 ? r : r / Rational(l);
+    }
+
+    bool ldiv(PtrMatrix<Rational> rhs) const {
+        auto [M, N] = rhs.size();
+        const int64_t d = det();
+        IntMatrix X(M, N);
+        llvm::SmallVector<int64_t, 16> l(N);
+        llvm::SmallVector<Rational, 16> r(M);
+        llvm::SmallVector<int64_t, 16> x(M);
+        for (size_t n = 0; n < N; ++n) {
+            for (size_t m = 0; m < M; ++m)
+                r[m] = rhs(m, n);
+            if (!(l[n] = commonDenominator(r, x)))
+                return true;
+            for (size_t m = 0; m < M; ++m)
+                X(m, n) = x[m];
+        }
+        if (ldivScaled(X))
+            return true;
         for (size_t n = 0; n < N; ++n) {
             for (size_t m = 0; m < M; ++m) {
-                Rational Ymn = rhs(m, n);
-                for (size_t k = 0; k < n; ++k) {
-                    if (Ymn.fnmadd(rhs(m, k), F(k, n))) {
-                        return true;
-                    }
-                }
-                if (auto div = Ymn / F(n, n)) {
-                    rhs(m, n) = div.getValue();
-                } else {
+                if (llvm::Optional<Rational> y = ratio(X(m, n), d, l[n]))
+                    rhs(m, n) = *y;
+                else
                     return true;
-                }
             }
         }
-        // x L = y
-        for (int64_t n = N - 1; n >= 0; --n) {
-            // for (size_t n = 0; n < N; ++n) {
-            for (size_t m = 0; m < M; ++m) {
-                Rational Xmn = rhs(m, n);
-                for (size_t k = n + 1; k < N; ++k) {
-                    if (Xmn.fnmadd(rhs(m, k), F(k, n))) {
-                        return true;
-                    }
-                }
-                rhs(m, n) = Xmn;
-            }
+        return false;
+    }
+
+    bool rdiv(PtrMatrix<Rational> rhs) const {
+        auto [M, N] = rhs.size();
+        const int64_t d = det();
+        IntMatrix X(M, N);
+        llvm::SmallVector<int64_t, 16> l(M);
+        for (size_t m = 0; m < M; ++m) {
+            llvm::ArrayRef<Rational> r = rhs.getRow(m);
+            if (!(l[m] = commonDenominator(r, X.getRow(m))))
+                return true;
         }
-        // permute rhs
-        for (int64_t j = N - 1; j >= 0; --j) {
-            unsigned jp = ipiv[j];
-            if (j != jp) {
-                for (size_t i = 0; i < M; ++i)
-                    std::swap(rhs(i, jp), rhs(i, j));
+        if (rdivScaled(X))
+            return true;
+        for (size_t m = 0; m < M; ++m) {
+            for (size_t n = 0; n < N; ++n) {
+                if (llvm::Optional<Rational> y = ratio(X(m, n), d, l[m]))
+                    rhs(m, n) = *y;
+                else
+                    return true;
             }
         }
-
         return false;
     }
 
+    // `adj(A) / det(A)`
     llvm::Optional<SquareMatrix<Rational>> inv() const {
-        SquareMatrix<Rational> A = SquareMatrix<Rational>::identity(F.numCol());
-        // printMatrix(std::cout << "F =\n", F) << std::endl;
-        // printVector(std::cout << "perm =\n", ipiv) << std::endl;
-        if (!ldiv(A)) {
-            return A;
-        } else {
+        const size_t M = F.numCol();
+        IntMatrix X = IntMatrix::identity(M);
+        if (ldivScaled(X))
             return {};
-        }
+        const int64_t d = det();
+        SquareMatrix<Rational> A(M);
+        for (size_t i = 0; i < M * M; ++i)
+            A[i] = Rational::create(X[i], d);
+        return A;
     }
-    llvm::Optional<Rational> det() {
-        Rational d = F(0, 0);
-        for (size_t i = 1; i < F.numCol(); ++i) {
-            if (auto di = d * F(i, i)) {
-                d = di.getValue();
-            } else {
-                return {};
-            }
-        }
-        return d;
+    int64_t det() const {
+        const size_t M = F.numCol();
+        return M ? permSign() * F(M - 1, M - 1) : 1;
     }
     llvm::SmallVector<unsigned> perm() const {
         size_t M = F.numCol();
@@ -154,57 +222,54 @@ struct LU {
         }
         return perm;
     }
+    // Fails if `B` is singular, or if a minor of `B` overflows.
     static llvm::Optional<LU> fact(const SquareMatrix<int64_t> &B) {
         size_t M = B.M;
-        SquareMatrix<Rational> A(M);
-        for (size_t m = 0; m < M * M; ++m)
-            A[m] = B[m];
-        // printMatrix(std::cout << "in lu, initial A =\n", A) << std::endl;
+        SquareMatrix<int64_t> A(B);
         llvm::SmallVector<unsigned> ipiv(M);
-        for (size_t i = 0; i < M; ++i) {
-            ipiv[i] = i;
-        }
+        int64_t prev = 1;
         for (size_t k = 0; k < M; ++k) {
             size_t kp = k;
-            for (; kp < M; ++kp) {
-                if (A(kp, k) != 0) {
-                    ipiv[k] = kp;
-                    break;
-                }
-            }
-            if (kp != k) {
-                for (size_t j = 0; j < M; ++j)
-                    std::swap(A(kp, j), A(k, j));
-            }
-            // std::cout << "A(k=" << k << ",k=" << k << ") = " << A(k, k)
-            //           << std::endl;
-            Rational Akkinv = A(k, k).inv();
-            // std::cout << "1/A(k=" << k << ",k=" << k << ") = " << Akkinv
-            // << std::endl;
+            while ((kp < M) && (A(kp, k) == 0))
+                ++kp;
+            if (kp == M)
+                return {};
+            ipiv[k] = kp;
+            swapRows(A, k, kp);
+            const int64_t Akk = A(k, k);
+            // A(i, k), i > k, are kept as `L`
             for (size_t i = k + 1; i < M; ++i) {
-                if (llvm::Optional<Rational> Aik = A(i, k) * Akkinv) {
-                    A(i, k) = Aik.getValue();
-                    // std::cout << "A(i=" << i << ",k=" << k << ") = " << A(i,
-                    // k)
-                    // << " = Aik = " << Aik.getValue() << std::endl;
-                    // assert(A.data() + M * i + k == &(A(i, k)));
-                } else {
-                    return {};
-                }
-            }
-            for (size_t j = k + 1; j < M; ++j) {
-                for (size_t i = k + 1; i < M; ++i) {
-                    if (llvm::Optional<Rational> Aikj = A(i, k) * A(k, j)) {
-                        if (llvm::Optional<Rational> Aij =
-                                A(i, j) - Aikj.getValue()) {
-                            A(i, j) = Aij.getValue();
-                            continue;
-                        }
-                    }
-                    return {};
+                const int64_t Aik = A(i, k);
+                for (size_t j = k + 1; j < M; ++j) {
+                    if (llvm::Optional<int64_t> Aij =
+                            crossDiv(Akk, A(i, j), Aik, A(k, j), prev))
+                        A(i, j) = *Aij;
+                    else
+                        return {};
                 }
             }
+            prev = Akk;
         }
         return LU{std::move(A), std::move(ipiv)};
     }
 };
+
+// The inverse of `B`, if it is integral, i.e. if `B` is unimodular.
+llvm::Optional<SquareMatrix<int64_t>>
+integerInverse(const SquareMatrix<int64_t> &B) {
+    llvm::Optional<LU> lu = LU::fact(B);
+    if (!lu)
+        return {};
+    const int64_t d = lu->det();
+    if ((d != 1) && (d != -1))
+        return {};
+    const size_t N = B.numCol();
+    SquareMatrix<int64_t> C = SquareMatrix<int64_t>::identity(N);
+    // `inv(B) = adj(B) / d = adj(B) * d`
+    if (lu->ldivScaled(C))
+        return {};
+    if (d == -1)
+        for (auto &c : C)
+            c = -c;
+    return C;
+}
@@ -1,17 +1,27 @@
 #pragma once
 
 #include "./ArrayReference.hpp"
+#include "./CompileBudget.hpp"
 #include "./DependencyPolyhedra.hpp"
+#include "./Instrumentation.hpp"
 #include "./Loops.hpp"
 #include "./Math.hpp"
+#include "./Parallel.hpp"
 #include "./Polyhedra.hpp"
 #include "./Schedule.hpp"
 #include "./Symbolics.hpp"
 #include "LinearAlgebra.hpp"
 #include "Orthogonalize.hpp"
+#include <algorithm>
+#include <array>
 #include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/User.h>
+#include <llvm/Support/Debug.h>
+#include <limits>
+#include <numeric>
+
+#define DEBUG_TYPE "turbo-loop"
 
 // A loop block is a block of the program that may include multiple loops.
 // These loops are either all executed (note iteration count may be 0, or
@@ -66,6 +76,20 @@
 // for (i = eachindex(y)){
 //   f(m, ...); // Omega = [2, _, 0]
 // }
+struct LoopBlock;
+#ifdef TURBOLOOP_HIGHS
+// defined in `ILPScheduler.hpp`
+bool scheduleComponentILP(LoopBlock &lblock, llvm::ArrayRef<int64_t> component,
+                          llvm::ArrayRef<unsigned> internalEdges);
+#endif
+// graph interface used by `Graphs.hpp`; vertices are `memory`, and
+// edges are `edges`, directed from `in` to `out`, and `valueFlow`, in both
+// directions.
+size_t nv(const LoopBlock &lblock);
+llvm::SmallVector<unsigned> outNeighbors(const LoopBlock &lblock, size_t v);
+bool &visited(LoopBlock &lblock, size_t v);
+void clearVisited(LoopBlock &lblock);
+
 struct LoopBlock {
     // llvm::SmallVector<ArrayReference, 0> refs;
     // TODO: figure out how to handle the graph's dependencies based on
@@ -81,6 +105,12 @@ struct LoopBlock {
     llvm::SmallVector<Dependence, 0> edges;
     llvm::SmallVector<bool> visited; // visited, for traversing graph
     llvm::DenseMap<llvm::User *, MemoryAccess *> userToMemory;
+    // `(l, s)`: the value loaded by `memory[l]` flows into the store
+    // `memory[s]` of the same iteration. This is not a dependence between
+    // memory accesses, so `fillEdges` does not find it, but the load and the
+    // store are one statement: they are placed in the same strongly
+    // connected component, and fused or distributed together.
+    llvm::SmallVector<std::pair<unsigned, unsigned>> valueFlow;
 
     // ArrayReference &ref(MemoryAccess &x) { return refs[x.ref]; }
     // ArrayReference &ref(MemoryAccess *x) { return refs[x->ref]; }
@@ -90,69 +120,194 @@ struct LoopBlock {
     // const ArrayReference &ref(const MemoryAccess *x) const {
     //     return refs[x->ref];
     // }
+    // Does `e.out` execute after `e.in`, under their current schedules, for
+    // each pair of iterations of the dependence?
     bool isSatisfied(const Dependence &e) const {
-        const IntegerEqPolyhedra &sat = e.dependenceSatisfaction;
-        Schedule &schIn = e.in->schedule;
-        Schedule &schOut = e.out->schedule;
-        const ArrayReference &refIn = e.in->ref;
-        const ArrayReference &refOut = e.out->ref;
-        size_t numLoopsIn = refIn.getNumLoops();
-        size_t numLoopsOut = refOut.getNumLoops();
-        size_t numLoopsCommon = std::min(numLoopsIn, numLoopsOut);
-        size_t numLoopsTotal = numLoopsIn + numLoopsOut;
-        llvm::SmallVector<int64_t, 16> schv;
-        schv.resize_for_overwrite(sat.getNumVar());
-        const SquarePtrMatrix<int64_t> inPhi = schIn.getPhi();
-        const SquarePtrMatrix<int64_t> outPhi = schOut.getPhi();
-        llvm::ArrayRef<int64_t> inOmega = schIn.getOmega();
-        llvm::ArrayRef<int64_t> outOmega = schOut.getOmega();
-
-        // when i == numLoopsCommon, we've passed the last loop
-        for (size_t i = 0; i <= numLoopsCommon; ++i) {
-            if (int64_t o2idiff = outOmega[2 * i] - inOmega[2 * i]) {
-                return (o2idiff > 0);
-            }
+        const DependencePolyhedra &dp = e.depPoly;
+        const size_t numVar =
+            e.in->ref.getNumLoops() + e.out->ref.getNumLoops();
+        return Dependence::executesAfter(dp.iterations(numVar, dp.getNumVar()),
+                                         *e.in, *e.out, e.forward);
+    }
 
-            // we should not be able to reach `numLoopsCommon`
-            // because at the very latest, this last schedule value
-            // should be different, because either:
-            // if (numLoopsX == numLoopsY){
-            //   we're at the inner most loop, where one of the instructions
-            //   must have appeared before the other.
-            // } else {
-            //   the loop nests differ in depth, in which case the deeper
-            //   loop must appear either above or below the instructions
-            //   present at that level
-            // }
-            assert(i != numLoopsCommon);
-            const size_t offIn = e.forward ? 0 : numLoopsOut;
-            const size_t offOut = e.forward ? numLoopsIn : 0;
-            for (size_t j = 0; j < numLoopsIn; ++j) {
-                schv[j + offIn] = inPhi(j, i);
-            }
-            for (size_t j = 0; j < numLoopsOut; ++j) {
-                schv[j + offOut] = outPhi(j, i);
+    bool isSatisfied(llvm::ArrayRef<unsigned> edgeIds) const {
+        for (auto e : edgeIds)
+            if (!isSatisfied(edges[e]))
+                return false;
+        return true;
+    }
+    size_t memoryIndex(const MemoryAccess *ma) const {
+        return ma - memory.data();
+    }
+    // Sets level `i` of each schedule in `component` to level `perm[i]` of
+    // the corresponding schedule in `oldData`.
+    void permuteSchedules(
+        llvm::ArrayRef<int64_t> component,
+        llvm::ArrayRef<llvm::SmallVector<int64_t, Schedule::maxStackStorage>>
+            oldData,
+        llvm::ArrayRef<unsigned> perm) {
+        for (size_t c = 0; c < component.size(); ++c) {
+            Schedule &sch = memory[component[c]].schedule;
+            SquarePtrMatrix<int64_t> Phi = sch.getPhi();
+            const size_t numLoops = sch.numLoops;
+            for (size_t i = 0; i < perm.size(); ++i)
+                for (size_t j = 0; j < numLoops; ++j)
+                    Phi(j, i) = oldData[c][j * numLoops + perm[i]];
+        }
+    }
+    // Schedules a single strongly connected component, i.e. finds `Phi`s
+    // satisfying all `internalEdges`.
+    // We search over permutations of the schedule levels shared by all
+    // members of the component, starting with the current schedule. Each
+    // candidate is timed as a search for the outermost level it changes.
+    // When built with HiGHS (`TURBOLOOP_HIGHS`), if no permutation
+    // satisfies the edges, `ILPScheduler` solves for the schedules.
+    // The program's own loop order is legal, so if it violates an edge, the
+    // dependences are wrong; we fail rather than permute the loops to
+    // satisfy them.
+    // Only `Phi` of members of `component` are read or written, so distinct
+    // components may be scheduled concurrently.
+    // Gives up once the compile budget is exhausted.
+    // Returns `true` on failure, in which case the schedules are unchanged.
+    bool scheduleComponent(llvm::ArrayRef<int64_t> component,
+                           llvm::ArrayRef<unsigned> internalEdges) {
+        ++NumScheduledComponents;
+        if (isSatisfied(internalEdges))
+            return false;
+        if (std::all_of(component.begin(), component.end(), [&](int64_t m) {
+                return memory[m].schedule.inLoopOrder();
+            }))
+            return true;
+        size_t depth = std::numeric_limits<size_t>::max();
+        llvm::SmallVector<llvm::SmallVector<int64_t, Schedule::maxStackStorage>,
+                          4>
+            oldData;
+        for (auto m : component) {
+            const Schedule &sch = memory[m].schedule;
+            depth = std::min(depth, size_t(sch.numLoops));
+            oldData.push_back(sch.data);
+        }
+        llvm::SmallVector<unsigned, 4> perm;
+        for (unsigned i = 0; i < depth; ++i)
+            perm.push_back(i);
+        llvm::SmallVector<unsigned, 4> previous = perm;
+        while (std::next_permutation(perm.begin(), perm.end())) {
+            if (budgetExhausted()) {
+                std::iota(perm.begin(), perm.end(), 0);
+                break;
             }
-            int64_t inO = inOmega[2 * i + 1], outO = outOmega[2 * i + 1];
-            // forward means offset is 2nd - 1st
-            schv[numLoopsTotal] = outO - inO;
-            // dependenceSatisfaction is phi_t - phi_s >= 0
-            // dependenceBounding is w + u'N - (phi_t - phi_s) >= 0
-            // we implicitly 0-out `w` and `u` here,
-            if (sat.knownSatisfied(schv)) {
-                if (!e.dependenceBounding.knownSatisfied(schv)) {
-                    // if zerod-out bounding not >= 0, then that means
-                    // phi_t - phi_s > 0, so the dependence is satisfied
-                    return true;
-                }
-            } else {
-                // if not satisfied, false
+            ScheduleLevelTimer levelTimer(
+                std::mismatch(perm.begin(), perm.end(), previous.begin())
+                    .first -
+                perm.begin());
+            previous = perm;
+            permuteSchedules(component, oldData, perm);
+            if (isSatisfied(internalEdges))
                 return false;
+        }
+        // `perm` is the identity again, so this restores the schedules
+        permuteSchedules(component, oldData, perm);
+#ifdef TURBOLOOP_HIGHS
+        if (!budgetExhausted() &&
+            !scheduleComponentILP(*this, component, internalEdges))
+            return false;
+#endif
+        return true;
+    }
+    // The inter-component problem: `components` are in topological order,
+    // and `componentIds[i]` gives the component of `memory[i]`.
+    // Components keep the outer-most loop (`omega[0]`) they were assigned,
+    // and stay fused unless an edge between two of them is violated, in
+    // which case the destination (and everything depending on it) is
+    // distributed into a following loop.
+    // Returns `true` if the result does not satisfy all edges.
+    bool fuseComponents(llvm::ArrayRef<llvm::SmallVector<int64_t>> components,
+                        llvm::ArrayRef<unsigned> componentIds) {
+        const size_t numComponents = components.size();
+        llvm::SmallVector<int64_t> shift(numComponents);
+        for (size_t c = 0; c < numComponents; ++c) {
+            for (auto m : components[c]) {
+                for (auto e : memory[m].edgesIn) {
+                    const Dependence &d = edges[e];
+                    unsigned src = componentIds[memoryIndex(d.in)];
+                    if (src == c)
+                        continue;
+                    int64_t inO = d.in->schedule.getOmega()[0];
+                    int64_t outO = d.out->schedule.getOmega()[0];
+                    // if `inO > outO`, no shift can repair the order
+                    if (inO != outO)
+                        continue;
+                    shift[c] =
+                        std::max(shift[c], shift[src] + (!isSatisfied(d)));
+                }
             }
         }
-        assert(false);
+        // omega[0] <- omega[0] * (numComponents + 1) + shift, renumbered
+        // densely; `shift <= numComponents`, so the original order of loops
+        // is preserved.
+        const int64_t scale = numComponents + 1;
+        llvm::SmallVector<int64_t> keys;
+        keys.reserve(memory.size());
+        for (size_t m = 0; m < memory.size(); ++m)
+            keys.push_back(memory[m].schedule.getOmega()[0] * scale +
+                           shift[componentIds[m]]);
+        llvm::SmallVector<int64_t> uniqueKeys(keys);
+        std::sort(uniqueKeys.begin(), uniqueKeys.end());
+        uniqueKeys.erase(std::unique(uniqueKeys.begin(), uniqueKeys.end()),
+                         uniqueKeys.end());
+        for (size_t m = 0; m < memory.size(); ++m)
+            memory[m].schedule.getOmega()[0] =
+                std::lower_bound(uniqueKeys.begin(), uniqueKeys.end(),
+                                 keys[m]) -
+                uniqueKeys.begin();
+        for (auto &e : edges)
+            if (!isSatisfied(e))
+                return true;
         return false;
     }
+    // Splits the dependence graph into strongly connected components and
+    // schedules each of them independently, using up to `maxThreads`
+    // threads. Then, `fuseComponents` orders the components.
+    // Requires `fillEdges()` to have been called, and `valueFlow` filled.
+    // Returns `true` on failure.
+    bool optimizeSchedules(size_t maxThreads = 1) {
+        PhaseTimer phaseTimer(Phase::Scheduling);
+        llvm::SmallVector<llvm::SmallVector<int64_t>> components =
+            topologicallySortedComponents(*this);
+        llvm::SmallVector<unsigned> componentIds(memory.size());
+        for (size_t c = 0; c < components.size(); ++c)
+            for (auto m : components[c])
+                componentIds[m] = c;
+        llvm::SmallVector<llvm::SmallVector<unsigned>> internalEdges(
+            components.size());
+        for (size_t e = 0; e < edges.size(); ++e) {
+            unsigned c = componentIds[memoryIndex(edges[e].in)];
+            if (c == componentIds[memoryIndex(edges[e].out)])
+                internalEdges[c].push_back(e);
+        }
+        // singletons without self-edges need no scheduling
+        llvm::SmallVector<unsigned> toSchedule;
+        for (size_t c = 0; c < components.size(); ++c)
+            if (internalEdges[c].size())
+                toSchedule.push_back(c);
+        std::atomic<bool> failed{false};
+        CompileBudget *budget = currentBudget;
+        parallelFor(
+            toSchedule.size(),
+            [&](size_t i) {
+                // charge the caller's budget from the worker threads
+                BudgetScope scope(budget);
+                unsigned c = toSchedule[i];
+                if (scheduleComponent(components[c], internalEdges[c]))
+                    failed = true;
+            },
+            maxThreads);
+        LLVM_DEBUG(llvm::dbgs()
+                   << "Scheduled " << toSchedule.size() << " of "
+                   << components.size() << " strongly connected components.\n");
+        bool fuseFailed = fuseComponents(components, componentIds);
+        return fuseFailed || failed;
+    }
 
     // NOTE: this relies on two important assumptions:
     // 1. Code has been fully delinearized, so that axes all match
@@ -266,15 +421,9 @@ struct LoopBlock {
                     A(k, j) = aln->A(k, j);
                 }
             }
-            for (size_t j = numPeeled; j < numVar; ++j) {
-                for (size_t k = 0; k < numConstraints; ++k) {
-                    int64_t Akj = 0;
-                    for (size_t l = 0; l < numTransformed; ++l) {
-                        Akj += aln->A(k, l) * K(j - numPeeled, l);
-                    }
-                    A(k, j) = Akj;
-                }
-            }
+            A.view(0, numConstraints, numPeeled, numVar) =
+                aln->A.view(0, numConstraints, 0, numTransformed) *
+                transpose(PtrMatrix<const int64_t>(K));
             auto alshr = llvm::makeIntrusiveRefCnt<AffineLoopNest>(
                 std::move(A), aln->b, aln->poset);
             map.insert(std::make_pair(aln, alshr));
@@ -372,7 +521,7 @@ struct LoopBlock {
                 // S*L = (S*K)*J
                 // Schedule:
                 // Phi*L = (Phi*K)*J
-                IntMatrix KS(matmul(K, S));
+                PtrMatrix<const int64_t> Kv = K;
                 llvm::DenseMap<const AffineLoopNest *,
                                llvm::IntrusiveRefCntPtr<AffineLoopNest>>
                     loopMap;
@@ -393,12 +542,14 @@ struct LoopBlock {
                     // refs.emplace_back(
                     size_t row = maj.isLoad ? rowLoad : rowStore;
                     auto indMatJ = oldRef.indexMatrix();
-                    for (size_t l = peelOuter; l < indMatJ.numRow(); ++l) {
-                        for (size_t k = 0; k < indMatJ.numCol(); ++k) {
-                            indMatJ(l, k) = KS(l - peelOuter, row + k);
-                        }
-                    }
-                    row += indMatJ.numCol();
+                    const size_t numLoopsJ = indMatJ.numRow();
+                    const size_t dimJ = indMatJ.numCol();
+                    // rows `peelOuter:numLoopsJ` of `K*S`
+                    if (numLoopsJ > peelOuter)
+                        indMatJ.view(peelOuter, numLoopsJ, 0, dimJ) =
+                            Kv.view(0, numLoopsJ - peelOuter, 0, Kv.numCol()) *
+                            S.view(0, S.numRow(), row, row + dimJ);
+                    row += dimJ;
                     rowLoad = maj.isLoad ? row : rowLoad;
                     rowStore = maj.isLoad ? rowStore : row;
                     // set maj's schedule to rotation
@@ -418,6 +569,25 @@ struct LoopBlock {
     }
 };
 
+size_t nv(const LoopBlock &lblock) { return lblock.memory.size(); }
+llvm::SmallVector<unsigned> outNeighbors(const LoopBlock &lblock, size_t v) {
+    llvm::SmallVector<unsigned> outs;
+    for (auto e : lblock.memory[v].edgesOut)
+        outs.push_back(lblock.memoryIndex(lblock.edges[e].out));
+    for (auto [l, s] : lblock.valueFlow) {
+        if (l == v)
+            outs.push_back(s);
+        else if (s == v)
+            outs.push_back(l);
+    }
+    return outs;
+}
+bool &visited(LoopBlock &lblock, size_t v) { return lblock.visited[v]; }
+void clearVisited(LoopBlock &lblock) {
+    lblock.visited.clear();
+    lblock.visited.resize(lblock.memory.size());
+}
+
 std::ostream &operator<<(std::ostream &os, const MemoryAccess &m) {
     if (m.isLoad) {
         os << "= ";
@@ -428,3 +598,9 @@ std::ostream &operator<<(std::ostream &os, const MemoryAccess &m) {
     }
     return os;
 }
+
+#undef DEBUG_TYPE
+
+#ifdef TURBOLOOP_HIGHS
+#include "./ILPScheduler.hpp"
+#endif
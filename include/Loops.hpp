@@ -9,7 +9,9 @@
 #include <cstdint>
 #include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/Optional.h>
 #include <llvm/ADT/SmallVector.h>
+#include <utility>
 
 // A' * i <= b
 // l are the lower bounds
@@ -343,3 +345,59 @@ struct AffineLoopNest : SymbolicPolyhedra,
     }
     void dump() const { std::cout << *this; }
 };
+
+// Symbolic `[min, max]` of each loop of `aln` over its domain, indexed by
+// original loop; `None` if a loop lacks a bound with unit coefficient.
+// Bounds are conservative: of several lower (or upper) bounds, one is used.
+llvm::Optional<llvm::SmallVector<std::pair<MPoly, MPoly>>>
+loopRanges(const AffineLoopNest &aln) {
+    const size_t numLoops = aln.getNumLoops();
+    llvm::SmallVector<std::pair<MPoly, MPoly>> ranges(numLoops);
+    llvm::SmallVector<bool> known(numLoops);
+    // `sum(A(r, k) * x_k, k != i)` at its min (or max)
+    auto extreme = [&](PtrMatrix<const int64_t> A, size_t r, size_t i,
+                       bool max) -> llvm::Optional<MPoly> {
+        MPoly s;
+        for (size_t k = 0; k < numLoops; ++k) {
+            int64_t a = A(r, k);
+            if ((k == i) || (a == 0))
+                continue;
+            if (!known[k])
+                return {};
+            MPoly x = ((a > 0) == max) ? ranges[k].second : ranges[k].first;
+            x *= a;
+            s += x;
+        }
+        return s;
+    };
+    for (size_t _i = 0; _i < numLoops; ++_i) {
+        const size_t i = aln.currentToOriginalPerm(_i);
+        bool foundLower = false, foundUpper = false;
+        // `-x_i + sum(A(r, k) * x_k) <= b_r`, so
+        // `x_i >= sum(A(r, k) * x_k) - b_r`
+        for (size_t r = 0; (r < aln.lowerA[i].numRow()) && !foundLower; ++r) {
+            if (aln.lowerA[i](r, i) != -1)
+                continue;
+            if (llvm::Optional<MPoly> s = extreme(aln.lowerA[i], r, i, false)) {
+                ranges[i].first = std::move(*s);
+                ranges[i].first -= aln.lowerb[i][r];
+                foundLower = true;
+            }
+        }
+        // `x_i + sum(A(r, k) * x_k) <= b_r`, so
+        // `x_i <= b_r - sum(A(r, k) * x_k)`
+        for (size_t r = 0; (r < aln.upperA[i].numRow()) && !foundUpper; ++r) {
+            if (aln.upperA[i](r, i) != 1)
+                continue;
+            if (llvm::Optional<MPoly> s = extreme(aln.upperA[i], r, i, false)) {
+                ranges[i].second = aln.upperb[i][r];
+                ranges[i].second -= *s;
+                foundUpper = true;
+            }
+        }
+        if (!(foundLower && foundUpper))
+            return {};
+        known[i] = true;
+    }
+    return ranges;
+}
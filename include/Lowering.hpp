@@ -0,0 +1,522 @@
+#pragma once
+
+#include "./AliasChecks.hpp"
+#include "./ArrayReference.hpp"
+#include "./CodeGen.hpp"
+#include "./IRExtraction.hpp"
+#include "./IntegerMap.hpp"
+#include "./LoopBlock.hpp"
+#include "./Schedule.hpp"
+#include "./Symbolics.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Transforms/Utils/ScalarEvolutionExpander.h>
+
+// Lowering a scheduled `LoopBlock` back to LLVM IR.
+// Each store of the loop nest is a statement: the store, and the tree of
+// instructions computing the stored value, whose leaves are loads of the
+// block, loop invariants, and integers affine in the loops, such as
+// induction variables. `LoopNestCodeGen` emits each statement with the
+// schedule of its store; addresses and affine integers are recomputed from
+// their `ArrayReference`s or `SCEV`s, and the other instructions of the
+// tree are cloned, lane-wise if vectorized. The rest of the nest, i.e. its
+// loop control, is deleted with the original loops.
+// Only nests whose statements can be recovered this way are lowered: every
+// block of a loop runs once per iteration, and loops exit at their latch;
+// no value escapes the nest; and a statement's loads are scheduled with its
+// store, with no other access in between. Nests accessing several arrays
+// are versioned on `emitNoAliasCheck`, unless all are `noalias` arguments.
+
+// `sum(coefs[l] * x_l) + offset` over the original loops `x` of a
+// statement, and the values of its parts, expanded before the nest.
+struct AffineIndex {
+    llvm::SmallVector<MPoly> coefs;
+    MPoly offset;
+    // the change from one vector lane to the next
+    int64_t laneStep = 0;
+    llvm::SmallVector<const llvm::SCEV *> coefSCEVs;
+    const llvm::SCEV *offsetSCEV = nullptr;
+    llvm::SmallVector<llvm::Value *> coefValues;
+    llvm::Value *offsetValue = nullptr;
+};
+
+// A load or store of a statement, indexing elements from `base`, or, if
+// `ma` is `nullptr`, an affine integer.
+struct StatementLeaf {
+    const MemoryAccess *ma;
+    AffineIndex index;
+    llvm::Value *base = nullptr;
+};
+
+struct LoweredStatement {
+    const MemoryAccess *store;
+    // a copy, as vectorization may be dropped for the statement
+    Schedule schedule;
+    llvm::DenseMap<llvm::Value *, StatementLeaf> leaves;
+    // the instructions of the tree that are cloned
+    llvm::SmallPtrSet<llvm::Instruction *, 16> cloned;
+    LoweredStatement(const MemoryAccess &store)
+        : store(&store), schedule(store.schedule) {}
+};
+
+class LoopNestLowering {
+    ExtractedLoopBlock &eb;
+    llvm::LoopInfo &LI;
+    llvm::ScalarEvolution &SE;
+    ValueToPosetMap &symbols;
+    llvm::SmallVectorImpl<const llvm::SCEV *> &symbolSCEVs;
+    const llvm::DataLayout &DL;
+    llvm::IntegerType *indexType;
+    llvm::SmallVector<LoweredStatement, 0> statements;
+    llvm::SmallPtrSet<llvm::Value *, 16> claimedLoads;
+
+    static bool sameLoop(const MemoryAccess &x, const MemoryAccess &y) {
+        if ((x.ref.loop.get() != y.ref.loop.get()) ||
+            (x.schedule.numLoops != y.schedule.numLoops))
+            return false;
+        const size_t numLoops = x.schedule.numLoops;
+        for (size_t l = 0; l < numLoops; ++l)
+            if (x.schedule.getOmega()[2 * l] != y.schedule.getOmega()[2 * l])
+                return false;
+        return true;
+    }
+    static bool sameSchedule(const MemoryAccess &x, const MemoryAccess &y) {
+        if (!sameLoop(x, y))
+            return false;
+        const size_t numLoops = x.schedule.numLoops;
+        for (size_t i = 0; i < numLoops; ++i)
+            for (size_t j = 0; j < numLoops; ++j)
+                if (x.schedule.getPhi()(i, j) != y.schedule.getPhi()(i, j))
+                    return false;
+        return true;
+    }
+    static bool vectorizableType(llvm::Type *T) {
+        return T->isIntegerTy() || T->isFloatingPointTy();
+    }
+    static bool cloneable(llvm::Instruction *I) {
+        return llvm::isa<llvm::BinaryOperator, llvm::UnaryOperator,
+                         llvm::CastInst, llvm::CmpInst, llvm::SelectInst,
+                         llvm::FreezeInst>(I);
+    }
+    // Every block of every loop runs once per iteration, loops exit at
+    // their latch, and nothing but stores has side effects; no value
+    // escapes `eb.root`, whose exit is dedicated and free of `phi`s.
+    bool checkStructure() const {
+        llvm::Loop *root = eb.root;
+        llvm::BasicBlock *preheader = root->getLoopPreheader();
+        llvm::BasicBlock *exit = root->getExitBlock();
+        if (!preheader || !exit || !root->hasDedicatedExits() ||
+            llvm::isa<llvm::PHINode>(exit->front()))
+            return true;
+        auto *br = llvm::dyn_cast<llvm::BranchInst>(preheader->getTerminator());
+        if (!br || br->isConditional())
+            return true;
+        for (llvm::Loop *L : root->getLoopsInPreorder())
+            if (!L->getLoopLatch() ||
+                (L->getExitingBlock() != L->getLoopLatch()))
+                return true;
+        for (llvm::BasicBlock *BB : root->blocks()) {
+            auto *term = llvm::dyn_cast<llvm::BranchInst>(BB->getTerminator());
+            if (!term || (term->isConditional() &&
+                          (LI.getLoopFor(BB)->getLoopLatch() != BB)))
+                return true;
+            for (auto &I : *BB) {
+                for (llvm::User *U : I.users()) {
+                    auto *J = llvm::dyn_cast<llvm::Instruction>(U);
+                    if (!J || !root->contains(J))
+                        return true;
+                }
+                if (!I.mayHaveSideEffects() || llvm::isa<llvm::StoreInst>(I))
+                    continue;
+                auto *II = llvm::dyn_cast<llvm::IntrinsicInst>(&I);
+                if (!II || !II->isAssumeLikeIntrinsic())
+                    return true;
+            }
+        }
+        return false;
+    }
+    // The element offset of `ma` from its base.
+    static AffineIndex accessIndex(const MemoryAccess &ma) {
+        const ArrayReference &ref = ma.ref;
+        PtrMatrix<const int64_t> indMat = ref.indexMatrix();
+        AffineIndex index;
+        index.coefs.resize(ref.getNumLoops());
+        for (size_t d = 0; d < ref.arrayDim(); ++d) {
+            auto &[stride, offset] = ref.stridesOffsets[d];
+            MPoly o = offset;
+            o *= stride;
+            index.offset += o;
+            for (size_t l = 0; l < indMat.numRow(); ++l) {
+                if (int64_t a = indMat(l, d)) {
+                    MPoly c = stride;
+                    c *= a;
+                    index.coefs[l] += c;
+                }
+            }
+        }
+        return index;
+    }
+    // Adds the statement of `store`. Returns `true` on failure.
+    bool addStatement(const MemoryAccess &store) {
+        llvm::Loop *root = eb.root;
+        auto *S = llvm::cast<llvm::StoreInst>(store.user);
+        llvm::SmallVector<llvm::Loop *> path;
+        for (llvm::Loop *L = LI.getLoopFor(S->getParent()); L;
+             L = L->getParentLoop()) {
+            path.insert(path.begin(), L);
+            if (L == root)
+                break;
+        }
+        if (path.empty() || (path.front() != root) ||
+            (path.size() != store.schedule.numLoops))
+            return true;
+        LoweredStatement &st = statements.emplace_back(store);
+        st.leaves.insert(
+            std::make_pair(S, StatementLeaf{&store, accessIndex(store)}));
+        const size_t n = store.schedule.numLoops;
+        llvm::SmallVector<llvm::Value *> worklist{S->getValueOperand()};
+        while (!worklist.empty()) {
+            auto *I =
+                llvm::dyn_cast<llvm::Instruction>(worklist.pop_back_val());
+            // loop invariants are used as they are
+            if (!I || !root->contains(I) || st.leaves.count(I) ||
+                st.cloned.count(I))
+                continue;
+            if (llvm::isa<llvm::LoadInst>(I)) {
+                MemoryAccess *ma = eb.lblock.userToMemory.lookup(I);
+                if (!ma || !claimedLoads.insert(I).second ||
+                    !sameSchedule(*ma, store) ||
+                    (ma->schedule.getOmega()[2 * n] >=
+                     store.schedule.getOmega()[2 * n]))
+                    return true;
+                st.leaves.insert(
+                    std::make_pair(I, StatementLeaf{ma, accessIndex(*ma)}));
+                continue;
+            }
+            if (I->getType()->isIntegerTy() &&
+                (I->getType()->getIntegerBitWidth() <= 64)) {
+                AffineIndex index;
+                index.coefs.resize(n);
+                if (!affineInLoops(SE.getSCEV(I), path, index.coefs,
+                                   index.offset, SE, symbols)) {
+                    st.leaves.insert(std::make_pair(
+                        I, StatementLeaf{nullptr, std::move(index)}));
+                    continue;
+                }
+            }
+            if (!cloneable(I))
+                return true;
+            st.cloned.insert(I);
+            for (llvm::Value *op : I->operands())
+                worklist.push_back(op);
+        }
+        return false;
+    }
+    // No access outside of `st` is scheduled between its first load and
+    // its store.
+    bool interleaved(const LoweredStatement &st) const {
+        const size_t n = st.schedule.numLoops;
+        int64_t first = st.store->schedule.getOmega()[2 * n];
+        for (auto &leaf : st.leaves)
+            if (leaf.second.ma)
+                first = std::min(first,
+                                 leaf.second.ma->schedule.getOmega()[2 * n]);
+        for (auto &ma : eb.lblock.memory) {
+            if (st.leaves.count(ma.user) || !sameLoop(ma, *st.store))
+                continue;
+            int64_t position = ma.schedule.getOmega()[2 * n];
+            if ((first < position) &&
+                (position < st.store->schedule.getOmega()[2 * n]))
+                return true;
+        }
+        return false;
+    }
+    // Drops the vectorization of `st` unless each access steps by `0` or
+    // `1` element per lane (the store by `1`), every affine integer steps
+    // by a constant, and the cloned instructions are arithmetic on
+    // integers or floating point that cannot trap.
+    void checkVectorization(LoweredStatement &st) {
+        Schedule &sch = st.schedule;
+        if ((sch.vectorized < 0) || (sch.vectorWidth <= 1))
+            return;
+        auto dropVectorization = [&] {
+            sch.vectorized = -1;
+            sch.vectorWidth = 1;
+            sch.maskedTail = false;
+        };
+        auto scheduled = scheduledLoopNest(*st.store->ref.loop, sch);
+        if (!scheduled)
+            return dropVectorization();
+        for (auto &[V, leaf] : st.leaves) {
+            MPoly step;
+            for (size_t l = 0; l < sch.numLoops; ++l) {
+                MPoly c = leaf.index.coefs[l];
+                c *= scheduled->second(l, sch.vectorized);
+                step += c;
+            }
+            llvm::Optional<int64_t> c = step.getCompileTimeConstant();
+            if (!c)
+                return dropVectorization();
+            leaf.index.laneStep = *c;
+            if (!leaf.ma)
+                continue;
+            llvm::Type *T = leaf.ma->isLoad
+                                ? V->getType()
+                                : llvm::cast<llvm::StoreInst>(V)
+                                      ->getValueOperand()
+                                      ->getType();
+            if (!vectorizableType(T) ||
+                ((*c != 1) && (!leaf.ma->isLoad || (*c != 0))))
+                return dropVectorization();
+        }
+        for (llvm::Instruction *I : st.cloned) {
+            if (!vectorizableType(I->getType()) || I->isIntDivRem())
+                return dropVectorization();
+            for (llvm::Value *op : I->operands())
+                if (!vectorizableType(op->getType()))
+                    return dropVectorization();
+        }
+    }
+    // The `SCEV`s of each index; returns `true` if one uses an unknown
+    // symbol.
+    bool indexSCEVs() {
+        // symbols pushed since `symbolSCEVs` was last extended are values
+        // of the nest's function, and still alive
+        for (size_t i = symbolSCEVs.size(); i <= symbols.backward.size();
+             ++i) {
+            llvm::Value *V = i ? symbols.backward[i - 1] : nullptr;
+            symbolSCEVs.push_back(V && SE.isSCEVable(V->getType())
+                                      ? SE.getSCEV(V)
+                                      : nullptr);
+        }
+        for (auto &st : statements) {
+            for (auto &[V, leaf] : st.leaves) {
+                AffineIndex &index = leaf.index;
+                index.offsetSCEV =
+                    toSCEV(SE, index.offset, symbolSCEVs, indexType);
+                if (!index.offsetSCEV)
+                    return true;
+                for (auto &c : index.coefs) {
+                    const llvm::SCEV *S =
+                        c == 0 ? nullptr
+                               : toSCEV(SE, c, symbolSCEVs, indexType);
+                    if ((c != 0) && !S)
+                        return true;
+                    index.coefSCEVs.push_back(S);
+                }
+            }
+        }
+        return false;
+    }
+    // Expands the indices and base pointers before `insertPt`.
+    void expandIndices(llvm::Instruction *insertPt) {
+        llvm::SCEVExpander expander(SE, DL, "turboloop.index");
+        llvm::IRBuilder<> builder(insertPt);
+        for (auto &st : statements) {
+            for (auto &[V, leaf] : st.leaves) {
+                AffineIndex &index = leaf.index;
+                index.offsetValue = expander.expandCodeFor(
+                    index.offsetSCEV, indexType, insertPt);
+                for (auto S : index.coefSCEVs)
+                    index.coefValues.push_back(
+                        S ? expander.expandCodeFor(S, indexType, insertPt)
+                          : nullptr);
+                if (!leaf.ma)
+                    continue;
+                llvm::Value *base = eb.basePointers[leaf.ma->ref.arrayID];
+                leaf.base = builder.CreatePointerCast(
+                    base, elementType(V)->getPointerTo(
+                              base->getType()->getPointerAddressSpace()));
+            }
+        }
+    }
+    static llvm::Type *elementType(llvm::Value *V) {
+        if (auto *S = llvm::dyn_cast<llvm::StoreInst>(V))
+            return S->getValueOperand()->getType();
+        return V->getType();
+    }
+    static llvm::Type *laneType(llvm::Type *T, const VectorLanes &lanes) {
+        if (lanes.isScalar())
+            return T;
+        return llvm::FixedVectorType::get(T, lanes.width);
+    }
+    llvm::Value *emitIndex(llvm::IRBuilder<> &builder, const AffineIndex &index,
+                           llvm::ArrayRef<llvm::Value *> ivs) {
+        llvm::Value *x = index.offsetValue;
+        auto *offset = llvm::dyn_cast<llvm::ConstantInt>(x);
+        if (offset && offset->isZero())
+            x = nullptr;
+        for (size_t l = 0; l < ivs.size(); ++l) {
+            llvm::Value *c = index.coefValues[l];
+            if (!c)
+                continue;
+            auto *C = llvm::dyn_cast<llvm::ConstantInt>(c);
+            llvm::Value *t =
+                C && C->isOne() ? ivs[l] : builder.CreateMul(c, ivs[l]);
+            x = x ? builder.CreateAdd(x, t) : t;
+        }
+        return x ? x : index.offsetValue;
+    }
+    llvm::Value *emitValue(llvm::IRBuilder<> &builder,
+                           const LoweredStatement &st, llvm::Value *V,
+                           llvm::ArrayRef<llvm::Value *> ivs,
+                           const VectorLanes &lanes,
+                           llvm::DenseMap<llvm::Value *, llvm::Value *> &vmap) {
+        if (llvm::Value *x = vmap.lookup(V))
+            return x;
+        llvm::Value *x;
+        auto leaf = st.leaves.find(V);
+        auto *I = llvm::dyn_cast<llvm::Instruction>(V);
+        if (leaf != st.leaves.end()) {
+            const StatementLeaf &l = leaf->second;
+            x = emitIndex(builder, l.index, ivs);
+            if (!l.ma) {
+                x = builder.CreateSExtOrTrunc(
+                    laneValues(builder, x, l.index.laneStep, lanes),
+                    laneType(V->getType(), lanes));
+            } else {
+                llvm::Type *T = V->getType();
+                llvm::Value *ptr = builder.CreateGEP(T, l.base, x);
+                if (!lanes.isScalar() && (l.index.laneStep == 0))
+                    x = broadcast(builder, builder.CreateLoad(T, ptr), lanes);
+                else
+                    x = emitLoad(builder, T, ptr, lanes);
+            }
+        } else if (!I || !st.cloned.count(I)) {
+            x = broadcast(builder, V, lanes);
+        } else {
+            llvm::SmallVector<llvm::Value *> ops;
+            for (llvm::Value *op : I->operands())
+                ops.push_back(emitValue(builder, st, op, ivs, lanes, vmap));
+            if (auto *BO = llvm::dyn_cast<llvm::BinaryOperator>(I))
+                x = builder.CreateBinOp(BO->getOpcode(), ops[0], ops[1]);
+            else if (auto *UO = llvm::dyn_cast<llvm::UnaryOperator>(I))
+                x = builder.CreateUnOp(UO->getOpcode(), ops[0]);
+            else if (auto *C = llvm::dyn_cast<llvm::CastInst>(I))
+                x = builder.CreateCast(C->getOpcode(), ops[0],
+                                       laneType(C->getType(), lanes));
+            else if (auto *C = llvm::dyn_cast<llvm::CmpInst>(I))
+                x = builder.CreateCmp(C->getPredicate(), ops[0], ops[1]);
+            else if (llvm::isa<llvm::SelectInst>(I))
+                x = builder.CreateSelect(ops[0], ops[1], ops[2]);
+            else
+                x = builder.CreateFreeze(ops[0]);
+            if (auto *J = llvm::dyn_cast<llvm::Instruction>(x))
+                J->copyIRFlags(I);
+        }
+        vmap.insert(std::make_pair(V, x));
+        return x;
+    }
+    void emitStatement(llvm::IRBuilder<> &builder, const LoweredStatement &st,
+                       llvm::ArrayRef<llvm::Value *> ivs,
+                       const VectorLanes &lanes) {
+        llvm::DenseMap<llvm::Value *, llvm::Value *> vmap;
+        auto *S = llvm::cast<llvm::StoreInst>(st.store->user);
+        llvm::Value *x =
+            emitValue(builder, st, S->getValueOperand(), ivs, lanes, vmap);
+        const StatementLeaf &l = st.leaves.find(S)->second;
+        llvm::Value *ptr = builder.CreateGEP(elementType(S), l.base,
+                                             emitIndex(builder, l.index, ivs));
+        emitStore(builder, x, ptr, lanes);
+    }
+
+    // Do two of the arrays possibly overlap, i.e. are there several, not
+    // all of them `noalias` arguments?
+    bool mayAlias() const {
+        if (eb.basePointers.size() <= 1)
+            return false;
+        for (llvm::Value *base : eb.basePointers) {
+            auto *A = llvm::dyn_cast<llvm::Argument>(base);
+            if (!A || !A->hasNoAliasAttr())
+                return true;
+        }
+        return false;
+    }
+
+  public:
+    // `symbolSCEVs[id]` is the `SCEV` of `symbols.backward[id - 1]`, as in
+    // `toSCEV`; it is extended for the symbols pushed since.
+    LoopNestLowering(ExtractedLoopBlock &eb, llvm::LoopInfo &LI,
+                     llvm::ScalarEvolution &SE, ValueToPosetMap &symbols,
+                     llvm::SmallVectorImpl<const llvm::SCEV *> &symbolSCEVs)
+        : eb(eb), LI(LI), SE(SE), symbols(symbols), symbolSCEVs(symbolSCEVs),
+          DL(eb.root->getHeader()->getModule()->getDataLayout()),
+          indexType(
+              llvm::Type::getInt64Ty(eb.root->getHeader()->getContext())) {}
+
+    // Replaces `eb.root` by the loops of its schedules, or, if it accesses
+    // more than one array, versions it on their overlap. With `parallel`,
+    // parallel loops are outlined (see `LoopNestCodeGen`).
+    // Returns `true` on failure, leaving the IR unchanged.
+    bool lower(llvm::DominatorTree &DT, bool parallel) {
+        if (checkStructure())
+            return true;
+        for (auto &ma : eb.lblock.memory)
+            if (!ma.isLoad && addStatement(ma))
+                return true;
+        if (statements.empty())
+            return true;
+        for (auto &st : statements) {
+            if (interleaved(st))
+                return true;
+            checkVectorization(st);
+        }
+        if (indexSCEVs())
+            return true;
+        LoopNestCodeGen codegen(SE, DL, symbolSCEVs, indexType, parallel);
+        for (auto &st : statements) {
+            if (codegen.addStatement(
+                    *st.store->ref.loop, st.schedule,
+                    [this, &st](llvm::IRBuilder<> &builder,
+                                llvm::ArrayRef<llvm::Value *> ivs,
+                                const VectorLanes &lanes) {
+                        emitStatement(builder, st, ivs, lanes);
+                    }))
+                return true;
+        }
+        if (!codegen.sharedLoopsAgree())
+            return true;
+        if (mayAlias())
+            return versionLoopNest(
+                eb.root, codegen,
+                [&](llvm::Instruction *insertPt) -> llvm::Value * {
+                    llvm::Value *check = emitNoAliasCheck(
+                        insertPt, SE, eb.lblock, eb.basePointers, symbolSCEVs);
+                    if (check)
+                        expandIndices(insertPt);
+                    return check;
+                },
+                DT);
+        expandIndices(eb.root->getLoopPreheader()->getTerminator());
+        [[maybe_unused]] bool failed =
+            spliceLoopNest(eb.root, codegen, DT, SE, LI);
+        assert(!failed);
+        return false;
+    }
+};
+
+// Lowers `eb`, see `LoopNestLowering::lower`; `symbolSCEVs` are the
+// `SCEV`s of `symbols`, as in `toSCEV`, and are extended as needed.
+// Returns `true` on failure, leaving the IR unchanged.
+bool lowerLoopBlock(ExtractedLoopBlock &eb, llvm::LoopInfo &LI,
+                    llvm::ScalarEvolution &SE, llvm::DominatorTree &DT,
+                    ValueToPosetMap &symbols,
+                    llvm::SmallVectorImpl<const llvm::SCEV *> &symbolSCEVs,
+                    bool parallel = false) {
+    return LoopNestLowering(eb, LI, SE, symbols, symbolSCEVs)
+        .lower(DT, parallel);
+}
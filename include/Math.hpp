@@ -2,6 +2,7 @@
 // We'll follow Julia style, so anything that's not a constructor, destructor,
 // nor an operator will be outside of the struct/class.
 #include "./Macro.hpp"
+#include <algorithm>
 #include <bit>
 #include <cassert>
 #include <cmath>
@@ -12,8 +13,10 @@
 #include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/Optional.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/raw_ostream.h>
 // #include <mlir/Analysis/Presburger/Matrix.h>
 #include <numeric>
+#include <sstream>
 #include <string>
 #include <tuple>
 #include <type_traits>
@@ -438,7 +441,7 @@ template <typename T, typename A> struct BaseMatrix {
     auto getRow(size_t i) {
         constexpr size_t N = getConstCol();
         if constexpr (N) {
-            return PtrVector<T, N>(data() + i * N);
+            return llvm::MutableArrayRef<T>(data() + i * N, N);
         } else {
             const size_t _N = numCol();
             return llvm::MutableArrayRef<T>(data() + i * rowStride(), _N);
@@ -448,7 +451,7 @@ template <typename T, typename A> struct BaseMatrix {
     auto getRow(size_t i) const {
         constexpr size_t N = getConstCol();
         if constexpr (N) {
-            return PtrVector<const T, N>(data() + i * N);
+            return llvm::ArrayRef<T>(data() + i * N, N);
         } else {
             const size_t _N = numCol();
             return llvm::ArrayRef<T>(data() + i * rowStride(), _N);
@@ -463,6 +466,7 @@ template <typename T, typename A> struct BaseMatrix {
     }
 };
 template <typename T> struct SparseMatrix;
+template <typename A, typename B> struct MatMul;
 template <typename T> struct PtrMatrix : BaseMatrix<T, PtrMatrix<T>> {
     T *mem;
     const size_t M, N, X;
@@ -489,6 +493,27 @@ template <typename T> struct PtrMatrix : BaseMatrix<T, PtrMatrix<T>> {
     operator PtrMatrix<const T>() const {
         return PtrMatrix<const T>(mem, M, N, X);
     }
+    PtrMatrix<T> view(size_t rowStart, size_t rowEnd, size_t colStart,
+                      size_t colEnd) const {
+        assert(rowEnd >= rowStart);
+        assert(colEnd >= colStart);
+        assert((rowEnd <= M) && (colEnd <= N));
+        return PtrMatrix<T>(mem + colStart + rowStart * X, rowEnd - rowStart,
+                            colEnd - colStart, X);
+    }
+    // evaluates the product into this matrix, e.g. `C = A * transpose(B)`
+    template <typename A, typename B>
+    PtrMatrix<T> operator=(const MatMul<A, B> &P) {
+        for (size_t m = 0; m < M; ++m)
+            std::fill_n(mem + m * X, N, T(0));
+        P.addTo(*this);
+        return *this;
+    }
+    template <typename A, typename B>
+    PtrMatrix<T> operator+=(const MatMul<A, B> &P) {
+        P.addTo(*this);
+        return *this;
+    }
     PtrMatrix<T> operator=(SparseMatrix<T> &A) {
         assert(M == A.numRow());
         assert(N == A.numCol());
@@ -512,7 +537,8 @@ template <typename T> struct PtrMatrix : BaseMatrix<T, PtrMatrix<T>> {
 // Matrix
 //
 template <typename T, size_t M = 0, size_t N = 0,
-          size_t S = std::max(M, size_t(3)) * std::max(N, size_t(3))>
+          size_t S = (M && N) ? M * N
+                              : std::max(M, size_t(3)) * std::max(N, size_t(3))>
 struct Matrix : BaseMatrix<T, Matrix<T, M, N, S>> {
     static_assert(M * N == S,
                   "if specifying non-zero M and N, we should have M*N == S");
@@ -520,9 +546,9 @@ struct Matrix : BaseMatrix<T, Matrix<T, M, N, S>> {
     inline T &getLinearElement(size_t i) { return mem[i]; }
     inline const T &getLinearElement(size_t i) const { return mem[i]; }
     T *begin() { return mem; }
-    T *end() { return begin() + M; }
+    T *end() { return begin() + S; }
     const T *begin() const { return mem; }
-    const T *end() const { return begin() + M; }
+    const T *end() const { return begin() + S; }
     static constexpr size_t numRow() { return M; }
     static constexpr size_t numCol() { return N; }
     static constexpr size_t rowStride() { return N; }
@@ -532,6 +558,18 @@ struct Matrix : BaseMatrix<T, Matrix<T, M, N, S>> {
     const T *data() const { return mem; }
 
     static constexpr size_t getConstCol() { return N; }
+
+    operator PtrMatrix<T>() { return PtrMatrix<T>(mem, M, N, N); }
+    operator PtrMatrix<const T>() const {
+        return PtrMatrix<const T>(mem, M, N, N);
+    }
+    static Matrix<T, M, N, S> identity() {
+        static_assert(M == N);
+        Matrix<T, M, N, S> A;
+        for (size_t i = 0; i < S; ++i)
+            A.mem[i] = (i % (N + 1)) == 0;
+        return A;
+    }
 };
 
 template <typename T, size_t M, size_t S>
@@ -679,6 +717,10 @@ struct Matrix<T, 0, 0, S> : BaseMatrix<T, Matrix<T, 0, 0, S>> {
         : mem(std::move(A.mem)), M(A.M), N(A.M), X(A.M){};
     Matrix(const SquareMatrix<T> &A)
         : mem(A.mem.begin(), A.mem.end()), M(A.M), N(A.M), X(A.M){};
+    template <typename A, typename B>
+    Matrix(const MatMul<A, B> &P) : Matrix(P.numRow(), P.numCol()) {
+        P.addTo(*this);
+    }
 
     operator PtrMatrix<T>() { return PtrMatrix<T>(mem.data(), M, N, X); }
     operator PtrMatrix<const T>() const {
@@ -801,11 +843,18 @@ struct Matrix<T, 0, 0, S> : BaseMatrix<T, Matrix<T, 0, 0, S>> {
 
     PtrMatrix<T> view(size_t rowStart, size_t rowEnd, size_t colStart,
                       size_t colEnd) {
-        assert(rowEnd > rowStart);
-        assert(colEnd > colStart);
+        assert(rowEnd >= rowStart);
+        assert(colEnd >= colStart);
         return PtrMatrix<T>(mem.data() + colStart + rowStart * X,
                             rowEnd - rowStart, colEnd - colStart, X);
     }
+    PtrMatrix<const T> view(size_t rowStart, size_t rowEnd, size_t colStart,
+                            size_t colEnd) const {
+        assert(rowEnd >= rowStart);
+        assert(colEnd >= colStart);
+        return PtrMatrix<const T>(mem.data() + colStart + rowStart * X,
+                                  rowEnd - rowStart, colEnd - colStart, X);
+    }
 
     PtrMatrix<T> operator=(PtrMatrix<T> A) {
         assert(M == A.numRow());
@@ -817,6 +866,21 @@ struct Matrix<T, 0, 0, S> : BaseMatrix<T, Matrix<T, 0, 0, S>> {
     }
 };
 template <typename T> using DynamicMatrix = Matrix<T, 0, 0, 64>;
+
+// Calls `f(std::integral_constant<size_t, n>{})`, with `n` as a compile time
+// constant if `0 < n <= MaxN`, so that `f` may be specialized for, and fully
+// unrolled over, small sizes, e.g. loop depths. Other sizes are passed as
+// `std::integral_constant<size_t, 0>{}`, `0` meaning a size only known at
+// runtime, as for the dimensions of `Matrix`.
+template <size_t MaxN, typename F> auto dispatchSize(size_t n, F &&f) {
+    if constexpr (MaxN == 0) {
+        return f(std::integral_constant<size_t, 0>{});
+    } else {
+        if (n == MaxN)
+            return f(std::integral_constant<size_t, MaxN>{});
+        return dispatchSize<MaxN - 1>(n, std::forward<F>(f));
+    }
+}
 typedef DynamicMatrix<int64_t> IntMatrix;
 static_assert(std::copyable<Matrix<int64_t, 4, 4>>);
 static_assert(std::copyable<Matrix<int64_t, 4, 0>>);
@@ -860,6 +924,23 @@ std::ostream &operator<<(std::ostream &os, SquareMatrix<T> const &A) {
     return printMatrix(os, A);
 }
 
+// Writes `x` with its `std::ostream` printer to an `llvm::raw_ostream`, e.g.
+// `LLVM_DEBUG(llvm::dbgs() << "A =\n" << stdPrint(A));`. `x` may also be a
+// callable, writing to the `std::ostream &` it is passed.
+template <typename T> struct StdPrinter {
+    const T &x;
+};
+template <typename T> StdPrinter<T> stdPrint(const T &x) { return {x}; }
+template <typename T>
+llvm::raw_ostream &operator<<(llvm::raw_ostream &os, StdPrinter<T> p) {
+    std::ostringstream s;
+    if constexpr (std::invocable<const T &, std::ostream &>)
+        p.x(s);
+    else
+        s << p.x;
+    return os << s.str();
+}
+
 template <typename T0, typename T1> bool allMatch(T0 const &x0, T1 const &x1) {
     size_t N = length(x0);
     if (N != length(x1)) {
@@ -872,19 +953,33 @@ template <typename T0, typename T1> bool allMatch(T0 const &x0, T1 const &x1) {
     return true;
 }
 
+// The products accumulate into `C`, `C += A * B`. All but `matmultt` are
+// evaluated in tiles of `matmulBlock x matmulBlock` elements of `B`, 32 KiB
+// of `int64_t`, that stay in cache while every row of `A` is multiplied with
+// them.
+constexpr size_t matmulBlock = 64;
 MULTIVERSION void matmul(PtrMatrix<int64_t> C, PtrMatrix<const int64_t> A,
                          PtrMatrix<const int64_t> B) {
-    unsigned M = A.numRow();
-    unsigned K = A.numCol();
-    unsigned N = B.numCol();
+    const size_t M = A.numRow();
+    const size_t K = A.numCol();
+    const size_t N = B.numCol();
     assert(K == B.numRow());
     assert(M == C.numRow());
     assert(N == C.numCol());
-    for (size_t m = 0; m < M; ++m) {
-        for (size_t k = 0; k < K; ++k) {
-            VECTORIZE
-            for (size_t n = 0; n < N; ++n) {
-                C(m, n) += A(m, k) * B(k, n);
+    for (size_t k0 = 0; k0 < K; k0 += matmulBlock) {
+        const size_t k1 = std::min(k0 + matmulBlock, K);
+        for (size_t n0 = 0; n0 < N; n0 += matmulBlock) {
+            const size_t n1 = std::min(n0 + matmulBlock, N);
+            for (size_t m = 0; m < M; ++m) {
+                int64_t *Cm = C.data() + m * C.rowStride();
+                for (size_t k = k0; k < k1; ++k) {
+                    const int64_t Amk = A(m, k);
+                    const int64_t *Bk = B.data() + k * B.rowStride();
+                    VECTORIZE
+                    for (size_t n = n0; n < n1; ++n) {
+                        Cm[n] += Amk * Bk[n];
+                    }
+                }
             }
         }
     }
@@ -897,19 +992,30 @@ MULTIVERSION IntMatrix matmul(PtrMatrix<const int64_t> A,
     matmul(C, A, B);
     return C;
 }
+// rows of `A` and `B` are contiguous, so each element of `C` is a dot product
 MULTIVERSION void matmulnt(PtrMatrix<int64_t> C, PtrMatrix<const int64_t> A,
                            PtrMatrix<const int64_t> B) {
-    unsigned M = A.numRow();
-    unsigned K = A.numCol();
-    unsigned N = B.numRow();
+    const size_t M = A.numRow();
+    const size_t K = A.numCol();
+    const size_t N = B.numRow();
     assert(K == B.numCol());
     assert(M == C.numRow());
     assert(N == C.numCol());
-    for (size_t m = 0; m < M; ++m) {
-        for (size_t k = 0; k < K; ++k) {
-            VECTORIZE
-            for (size_t n = 0; n < N; ++n) {
-                C(m, n) += A(m, k) * B(n, k);
+    for (size_t k0 = 0; k0 < K; k0 += matmulBlock) {
+        const size_t k1 = std::min(k0 + matmulBlock, K);
+        for (size_t n0 = 0; n0 < N; n0 += matmulBlock) {
+            const size_t n1 = std::min(n0 + matmulBlock, N);
+            for (size_t m = 0; m < M; ++m) {
+                const int64_t *Am = A.data() + m * A.rowStride();
+                for (size_t n = n0; n < n1; ++n) {
+                    const int64_t *Bn = B.data() + n * B.rowStride();
+                    int64_t Cmn = 0;
+                    VECTORIZE
+                    for (size_t k = k0; k < k1; ++k) {
+                        Cmn += Am[k] * Bn[k];
+                    }
+                    C(m, n) += Cmn;
+                }
             }
         }
     }
@@ -924,17 +1030,26 @@ MULTIVERSION IntMatrix matmulnt(PtrMatrix<const int64_t> A,
 }
 MULTIVERSION void matmultn(PtrMatrix<int64_t> C, PtrMatrix<const int64_t> A,
                            PtrMatrix<const int64_t> B) {
-    unsigned M = A.numCol();
-    unsigned K = A.numRow();
-    unsigned N = B.numCol();
+    const size_t M = A.numCol();
+    const size_t K = A.numRow();
+    const size_t N = B.numCol();
     assert(K == B.numRow());
     assert(M == C.numRow());
     assert(N == C.numCol());
-    for (size_t m = 0; m < M; ++m) {
-        for (size_t k = 0; k < K; ++k) {
-            VECTORIZE
-            for (size_t n = 0; n < N; ++n) {
-                C(m, n) += A(k, m) * B(k, n);
+    for (size_t k0 = 0; k0 < K; k0 += matmulBlock) {
+        const size_t k1 = std::min(k0 + matmulBlock, K);
+        for (size_t n0 = 0; n0 < N; n0 += matmulBlock) {
+            const size_t n1 = std::min(n0 + matmulBlock, N);
+            for (size_t m = 0; m < M; ++m) {
+                int64_t *Cm = C.data() + m * C.rowStride();
+                for (size_t k = k0; k < k1; ++k) {
+                    const int64_t Akm = A(k, m);
+                    const int64_t *Bk = B.data() + k * B.rowStride();
+                    VECTORIZE
+                    for (size_t n = n0; n < n1; ++n) {
+                        Cm[n] += Akm * Bk[n];
+                    }
+                }
             }
         }
     }
@@ -949,9 +1064,9 @@ MULTIVERSION IntMatrix matmultn(PtrMatrix<const int64_t> A,
 }
 MULTIVERSION void matmultt(PtrMatrix<int64_t> C, PtrMatrix<const int64_t> A,
                            PtrMatrix<const int64_t> B) {
-    unsigned M = A.numCol();
-    unsigned K = A.numRow();
-    unsigned N = B.numRow();
+    const size_t M = A.numCol();
+    const size_t K = A.numRow();
+    const size_t N = B.numRow();
     assert(K == B.numCol());
     assert(M == C.numRow());
     assert(N == C.numCol());
@@ -973,6 +1088,91 @@ MULTIVERSION IntMatrix matmultt(PtrMatrix<const int64_t> A,
     return C;
 }
 
+// Lazy matrix expressions. `transpose(A)` is a view of `A'`, and `A * B` of a
+// product, of matrices, slices (`view`s) or transposes. Neither allocates or
+// computes anything until evaluated straight into its destination, e.g.
+//   C.view(0, M, 1, N + 1) = A * transpose(B);
+//   IntMatrix D{A * B};
+// with the kernels above. The destination must not alias the operands.
+template <typename T> struct Transpose {
+    PtrMatrix<const T> A;
+    size_t numRow() const { return A.numCol(); }
+    size_t numCol() const { return A.numRow(); }
+    T operator()(size_t i, size_t j) const { return A(j, i); }
+};
+Transpose<int64_t> transpose(PtrMatrix<const int64_t> A) { return {A}; }
+
+template <typename A, typename B> struct MatMul {
+    A a;
+    B b;
+    static constexpr bool transA = std::is_same_v<A, Transpose<int64_t>>;
+    static constexpr bool transB = std::is_same_v<B, Transpose<int64_t>>;
+    size_t numRow() const { return a.numRow(); }
+    size_t numCol() const { return b.numCol(); }
+    // `C += a * b`
+    void addTo(PtrMatrix<int64_t> C) const {
+        if constexpr (transA && transB)
+            matmultt(C, a.A, b.A);
+        else if constexpr (transA)
+            matmultn(C, a.A, b);
+        else if constexpr (transB)
+            matmulnt(C, a, b.A);
+        else
+            matmul(C, a, b);
+    }
+};
+MatMul<PtrMatrix<const int64_t>, PtrMatrix<const int64_t>>
+operator*(PtrMatrix<const int64_t> A, PtrMatrix<const int64_t> B) {
+    assert(A.numCol() == B.numRow());
+    return {A, B};
+}
+MatMul<PtrMatrix<const int64_t>, Transpose<int64_t>>
+operator*(PtrMatrix<const int64_t> A, Transpose<int64_t> B) {
+    assert(A.numCol() == B.numRow());
+    return {A, B};
+}
+MatMul<Transpose<int64_t>, PtrMatrix<const int64_t>>
+operator*(Transpose<int64_t> A, PtrMatrix<const int64_t> B) {
+    assert(A.numCol() == B.numRow());
+    return {A, B};
+}
+MatMul<Transpose<int64_t>, Transpose<int64_t>>
+operator*(Transpose<int64_t> A, Transpose<int64_t> B) {
+    assert(A.numCol() == B.numRow());
+    return {A, B};
+}
+
+// Scaled row sums, in place: `A(i, :) = a * A(i, :) + b * A(j, :)`
+MULTIVERSION inline void scaleAddRow(PtrMatrix<int64_t> A, size_t i,
+                                     int64_t a, size_t j, int64_t b) {
+    assert(i != j);
+    assert((i < A.numRow()) & (j < A.numRow()));
+    const size_t N = A.numCol();
+    int64_t *__restrict Ai = A.data() + i * A.rowStride();
+    const int64_t *__restrict Aj = A.data() + j * A.rowStride();
+    VECTORIZE
+    for (size_t n = 0; n < N; ++n) {
+        Ai[n] = a * Ai[n] + b * Aj[n];
+    }
+}
+// and `[A(i, :); A(j, :)] = [p q; -s r] * [A(i, :); A(j, :)]`
+MULTIVERSION inline void combineRows(PtrMatrix<int64_t> A, size_t i, size_t j,
+                                     int64_t p, int64_t q, int64_t r,
+                                     int64_t s) {
+    assert(i != j);
+    assert((i < A.numRow()) & (j < A.numRow()));
+    const size_t N = A.numCol();
+    int64_t *__restrict Ai = A.data() + i * A.rowStride();
+    int64_t *__restrict Aj = A.data() + j * A.rowStride();
+    VECTORIZE
+    for (size_t n = 0; n < N; ++n) {
+        int64_t Ain = Ai[n];
+        int64_t Ajn = Aj[n];
+        Ai[n] = p * Ain + q * Ajn;
+        Aj[n] = r * Ajn - s * Ain;
+    }
+}
+
 MULTIVERSION inline void swapRows(PtrMatrix<int64_t> A, size_t i, size_t j) {
     if (i == j)
         return;
@@ -984,6 +1184,14 @@ MULTIVERSION inline void swapRows(PtrMatrix<int64_t> A, size_t i, size_t j) {
         std::swap(A(i, n), A(j, n));
     }
 }
+MULTIVERSION inline void swapRows(PtrMatrix<double> A, size_t i, size_t j) {
+    if (i == j)
+        return;
+    assert((i < A.numRow()) & (j < A.numRow()));
+    VECTORIZE
+    for (size_t n = 0; n < A.numCol(); ++n)
+        std::swap(A(i, n), A(j, n));
+}
 MULTIVERSION inline void swapCols(PtrMatrix<int64_t> A, size_t i, size_t j) {
     if (i == j) {
         return;
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "./ArrayReference.hpp"
+#include "./DependencyPolyhedra.hpp"
+#include "./LoopBlock.hpp"
+#include "./Loops.hpp"
+#include "./Math.hpp"
+#include "./POSet.hpp"
+#include "./Schedule.hpp"
+#include "./Symbolics.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+
+// The heap memory held by a `LoopBlock`, by kind of object: the buffers of
+// its matrices, of the terms and monomials of its polynomials, of its
+// `PartiallyOrderedSet`s, and of everything else (schedules, edges, ...).
+// Buffers stored inline, in a `SmallVector`'s own storage, are not counted.
+// Unlike the allocation counters of `Instrumentation.hpp`, which count by
+// phase and need a build with `TURBOLOOP_TRACK_ALLOCATIONS`, this walks the
+// objects, so it works in any build, but only sees what is still live.
+
+enum class ObjectKind { Matrix, Polynomial, POSet, Other };
+constexpr size_t numObjectKinds = size_t(ObjectKind::Other) + 1;
+constexpr const char *objectKindNames[numObjectKinds] = {
+    "Matrix", "Polynomial", "POSet", "Other"};
+
+struct MemoryUse {
+    size_t bytes[numObjectKinds] = {};
+    size_t buffers[numObjectKinds] = {};
+    // loop nests are shared by the references into them; each is counted once
+    llvm::SmallPtrSet<const AffineLoopNest *, 4> loops;
+
+    size_t totalBytes() const {
+        size_t total = 0;
+        for (size_t b : bytes)
+            total += b;
+        return total;
+    }
+    size_t totalBuffers() const {
+        size_t total = 0;
+        for (size_t b : buffers)
+            total += b;
+        return total;
+    }
+
+    // Counts the buffer of `v`, if it is on the heap.
+    template <typename T, unsigned N>
+    void addBuffer(ObjectKind kind, const llvm::SmallVector<T, N> &v) {
+        const char *obj = reinterpret_cast<const char *>(&v);
+        const char *data = reinterpret_cast<const char *>(v.data());
+        // with `N == 0`, the empty inline storage is just past the object
+        if (!v.capacity() || ((data >= obj) && (data <= obj + sizeof(v))))
+            return;
+        bytes[size_t(kind)] += v.capacity() * sizeof(T);
+        ++buffers[size_t(kind)];
+    }
+    template <typename T, size_t M, size_t N, size_t S>
+    void add(const Matrix<T, M, N, S> &A) {
+        addBuffer(ObjectKind::Matrix, A.mem);
+    }
+    void add(const MPoly &p) {
+        addBuffer(ObjectKind::Polynomial, p.terms);
+        for (auto &t : p.terms)
+            addBuffer(ObjectKind::Polynomial, t.exponent.prodIDs);
+    }
+    template <unsigned N> void add(const llvm::SmallVector<MPoly, N> &b) {
+        addBuffer(ObjectKind::Polynomial, b);
+        for (auto &p : b)
+            add(p);
+    }
+    void add(const PartiallyOrderedSet &poset) {
+        addBuffer(ObjectKind::POSet, poset.delta);
+    }
+    void add(const AffineLoopNest &aln) {
+        if (!loops.insert(&aln).second)
+            return;
+        add(aln.A);
+        add(aln.b);
+        add(aln.poset);
+        add(aln.perm.data);
+        addBuffer(ObjectKind::Other, aln.remainingA);
+        addBuffer(ObjectKind::Other, aln.lowerA);
+        addBuffer(ObjectKind::Other, aln.upperA);
+        for (auto &A : aln.remainingA)
+            add(A);
+        for (auto &A : aln.lowerA)
+            add(A);
+        for (auto &A : aln.upperA)
+            add(A);
+        addBuffer(ObjectKind::Other, aln.remainingB);
+        addBuffer(ObjectKind::Other, aln.lowerb);
+        addBuffer(ObjectKind::Other, aln.upperb);
+        for (auto &b : aln.remainingB)
+            add(b);
+        for (auto &b : aln.lowerb)
+            add(b);
+        for (auto &b : aln.upperb)
+            add(b);
+    }
+    void add(const ArrayReference &ref) {
+        if (ref.loop)
+            add(*ref.loop);
+        addBuffer(ObjectKind::Other, ref.stridesOffsets);
+        for (auto &[stride, offset] : ref.stridesOffsets) {
+            add(stride);
+            add(offset);
+        }
+        addBuffer(ObjectKind::Matrix, ref.indices);
+    }
+    void add(const MemoryAccess &ma) {
+        add(ma.ref);
+        addBuffer(ObjectKind::Other, ma.schedule.data);
+        addBuffer(ObjectKind::Other, ma.schedule.tileL1);
+        addBuffer(ObjectKind::Other, ma.schedule.tileL2);
+        addBuffer(ObjectKind::Other, ma.edgesIn);
+        addBuffer(ObjectKind::Other, ma.edgesOut);
+    }
+    void add(const IntegerEqPolyhedra &p) {
+        add(p.A);
+        addBuffer(ObjectKind::Other, p.b);
+        add(p.E);
+        addBuffer(ObjectKind::Other, p.q);
+    }
+    void add(const Dependence &d) {
+        add(d.depPoly.A);
+        add(d.depPoly.b);
+        add(d.depPoly.E);
+        add(d.depPoly.q);
+        add(d.depPoly.poset);
+        addBuffer(ObjectKind::Other, d.depPoly.nullStep);
+        add(d.dependenceSatisfaction);
+        add(d.dependenceBounding);
+    }
+    void add(const LoopBlock &lblock) {
+        addBuffer(ObjectKind::Other, lblock.memory);
+        addBuffer(ObjectKind::Other, lblock.edges);
+        addBuffer(ObjectKind::Other, lblock.visited);
+        addBuffer(ObjectKind::Other, lblock.valueFlow);
+        if (size_t n = lblock.userToMemory.getMemorySize()) {
+            bytes[size_t(ObjectKind::Other)] += n;
+            ++buffers[size_t(ObjectKind::Other)];
+        }
+        for (auto &ma : lblock.memory)
+            add(ma);
+        for (auto &d : lblock.edges)
+            add(d);
+    }
+};
+
+MemoryUse memoryUse(const LoopBlock &lblock) {
+    MemoryUse use;
+    use.add(lblock);
+    return use;
+}
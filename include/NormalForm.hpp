@@ -2,8 +2,11 @@
 #include "./Macro.hpp"
 #include "./Math.hpp"
 #include "./Symbolics.hpp"
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <limits>
 // #include <llvm/ADT/APInt.h> // llvm::Optional
 #include <llvm/ADT/SmallVector.h>
@@ -238,13 +241,7 @@ MULTIVERSION inline void zeroSupDiagonal(PtrMatrix<int64_t> A, size_t r,
         int64_t Aii = A(c, r);
         if (int64_t Aij = A(j, r)) {
             const auto [p, q, Aiir, Aijr] = gcdxScale(Aii, Aij);
-            VECTORIZE
-            for (size_t k = 0; k < N; ++k) {
-                int64_t Aki = A(c, k);
-                int64_t Akj = A(j, k);
-                A(c, k) = p * Aki + q * Akj;
-                A(j, k) = Aiir * Akj - Aijr * Aki;
-            }
+            combineRows(A, c, j, p, q, Aiir, Aijr);
         }
     }
 }
@@ -256,13 +253,7 @@ MULTIVERSION inline void zeroSupDiagonal(PtrMatrix<int64_t> A,
         int64_t Aii = A(c, r);
         if (int64_t Aij = A(j, r)) {
             const auto [p, q, Aiir, Aijr] = gcdxScale(Aii, Aij);
-            VECTORIZE
-            for (size_t k = 0; k < N; ++k) {
-                int64_t Aki = A(c, k);
-                int64_t Akj = A(j, k);
-                A(c, k) = p * Aki + q * Akj;
-                A(j, k) = Aiir * Akj - Aijr * Aki;
-            }
+            combineRows(A, c, j, p, q, Aiir, Aijr);
             int64_t bi = b[c];
             int64_t bj = b[j];
             b[c] = p * bi + q * bj;
@@ -273,27 +264,14 @@ MULTIVERSION inline void zeroSupDiagonal(PtrMatrix<int64_t> A,
 MULTIVERSION inline void zeroSupDiagonal(PtrMatrix<int64_t> A,
                                          PtrMatrix<int64_t> B, size_t r,
                                          size_t c) {
-    auto [M, N] = A.size();
-    const size_t K = B.numCol();
+    const size_t M = A.numRow();
     assert(M == B.numRow());
     for (size_t j = c + 1; j < M; ++j) {
         int64_t Aii = A(c, r);
         if (int64_t Aij = A(j, r)) {
             const auto [p, q, Aiir, Aijr] = gcdxScale(Aii, Aij);
-            VECTORIZE
-            for (size_t k = 0; k < N; ++k) {
-                int64_t Ack = A(c, k);
-                int64_t Ajk = A(j, k);
-                A(c, k) = p * Ack + q * Ajk;
-                A(j, k) = Aiir * Ajk - Aijr * Ack;
-            }
-            VECTORIZE
-            for (size_t k = 0; k < K; ++k) {
-                int64_t Bck = B(c, k);
-                int64_t Bjk = B(j, k);
-                B(c, k) = p * Bck + q * Bjk;
-                B(j, k) = Aiir * Bjk - Aijr * Bck;
-            }
+            combineRows(A, c, j, p, q, Aiir, Aijr);
+            combineRows(B, c, j, p, q, Aiir, Aijr);
         }
     }
 }
@@ -330,10 +308,7 @@ MULTIVERSION inline void reduceSubDiagonal(PtrMatrix<int64_t> A, size_t r,
             if (AkzOld < 0) {
                 Akz -= (AkzOld != (Akz * Akk));
             }
-            VECTORIZE
-            for (size_t i = 0; i < N; ++i) {
-                A(z, i) -= Akz * A(c, i);
-            }
+            scaleAddRow(A, z, 1, c, -Akz);
         }
     }
 }
@@ -372,10 +347,7 @@ MULTIVERSION inline void reduceSubDiagonal(PtrMatrix<int64_t> A,
             if (AkzOld < 0) {
                 Akz -= (AkzOld != (Akz * Akk));
             }
-            VECTORIZE
-            for (size_t i = 0; i < N; ++i) {
-                A(z, i) -= Akz * A(c, i);
-            }
+            scaleAddRow(A, z, 1, c, -Akz);
             Polynomial::fnmadd(b[z], b[c], Akz);
         }
     }
@@ -389,13 +361,7 @@ MULTIVERSION inline void zeroSupDiagonal(PtrMatrix<int64_t> A,
         int64_t Aii = A(c, rr);
         if (int64_t Aij = A(j, rr)) {
             const auto [p, q, Aiir, Aijr] = gcdxScale(Aii, Aij);
-            VECTORIZE
-            for (size_t k = 0; k < N; ++k) {
-                int64_t Aki = A(c, k);
-                int64_t Akj = A(j, k);
-                A(c, k) = p * Aki + q * Akj;
-                A(j, k) = Aiir * Akj - Aijr * Aki;
-            }
+            combineRows(A, c, j, p, q, Aiir, Aijr);
             MPoly bi = std::move(b[c]);
             MPoly bj = std::move(b[j]);
             b[c] = p * bi + q * bj;
@@ -440,10 +406,7 @@ MULTIVERSION inline void reduceSubDiagonal(PtrMatrix<int64_t> A,
                     Akz -= (AkzOld != (Akz * Akk));
                 }
             }
-            VECTORIZE
-            for (size_t i = 0; i < N; ++i) {
-                A(z, i) -= Akz * A(c, i);
-            }
+            scaleAddRow(A, z, 1, c, -Akz);
             Polynomial::fnmadd(b[z], b[c], Akz);
         }
     }
@@ -489,14 +452,8 @@ MULTIVERSION inline void reduceSubDiagonal(PtrMatrix<int64_t> A,
                     Akz -= (AkzOld != (Akz * Akk));
                 }
             }
-            VECTORIZE
-            for (size_t i = 0; i < N; ++i) {
-                A(z, i) -= Akz * A(c, i);
-            }
-            VECTORIZE
-            for (size_t i = 0; i < K; ++i) {
-                B(z, i) -= Akz * B(c, i);
-            }
+            scaleAddRow(A, z, 1, c, -Akz);
+            scaleAddRow(B, z, 1, c, -Akz);
         }
     }
 }
@@ -598,8 +555,324 @@ MULTIVERSION static void simplifyEqualityConstraints(IntMatrix &A,
     B.truncateRows(Mnew);
     return;
 }
+
+// Multi-modular Hermite normal form.
+//
+// Integer row reduction, as in `simplifyEqualityConstraintsImpl`, can grow
+// intermediate coefficients far beyond those of `A` or of its normal form,
+// and silently overflow. For `A` with full row rank, `modularHermite`
+//  1. picks the pivot columns of `A`, and computes the determinant and
+//     inverse of the square `As` they form modulo several primes below
+//     2^26, whose products of residues are exact in `double`, so that the
+//     eliminations need no integer division and vectorize;
+//  2. reconstructs `D = |det(As)|` with the Chinese remainder theorem, and
+//     computes `Hs = hermite(As)` modulo `D`, as the lattice of the rows of
+//     `As` contains `D * e_i` for every `i`;
+//  3. reconstructs `U = Hs * inv(As)` from its residues the same way; and
+//  4. checks that `H = U * A` has `Hs` in the pivot columns and zeros before
+//     them, which with `|det(U)| == det(Hs) / D == 1` proves it is the
+//     Hermite normal form.
+// Coefficients stay below `D` throughout, and anything that would overflow
+// returns `None`.
+
+constexpr int64_t modularPrimes[] = {67108859, 67108837, 67108819, 67108777,
+                                     67108763, 67108757, 67108753, 67108747};
+// `log2` of the smallest of `modularPrimes`
+constexpr double modularPrimeBits = 25.99;
+
+// Arithmetic modulo a prime `p < 2^26`, in `double`. Products of residues
+// are below 2^52, so exact, and reducing them needs no integer division.
+struct ModP {
+    double p, pinv;
+    ModP(int64_t p) : p(p), pinv(1.0 / p) {}
+    // `x mod p` in `[0, p)`, for `|x| < 2^53`
+    double operator()(double x) const {
+        double r = x - p * std::floor(x * pinv);
+        r = r < 0 ? r + p : r;
+        return r >= p ? r - p : r;
+    }
+    double operator()(int64_t x) const {
+        int64_t r = x % int64_t(p);
+        return r < 0 ? r + p : r;
+    }
+    double inv(double x) const {
+        auto [g, s, t] = gcdx(int64_t(x), int64_t(p));
+        assert(g == 1);
+        return (*this)(s);
+    }
+};
+
+// Eliminates column `c` of the rows of `W` other than `i`, or below `i` with
+// `Below`, after scaling row `i` so that `W(i, c) == 1`.
+template <bool Below>
+MULTIVERSION void eliminateModP(PtrMatrix<double> W, size_t i, size_t c,
+                                const ModP &mp) {
+    const size_t M = W.numRow();
+    const size_t N = W.numCol();
+    double *Wi = W.data() + i * W.rowStride();
+    const double s = mp.inv(Wi[c]);
+    VECTORIZE
+    for (size_t n = 0; n < N; ++n)
+        Wi[n] = mp(Wi[n] * s);
+    for (size_t j = Below ? i + 1 : 0; j < M; ++j) {
+        double *Wj = W.data() + j * W.rowStride();
+        const double f = Wj[c];
+        if ((j == i) || (f == 0))
+            continue;
+        VECTORIZE
+        for (size_t n = 0; n < N; ++n)
+            Wj[n] = mp(Wj[n] - f * Wi[n]);
+    }
+}
+// The first `M` linearly independent columns of `A` modulo `p`, if it has
+// full row rank modulo `p`.
+llvm::Optional<llvm::SmallVector<unsigned>>
+pivotColsModP(PtrMatrix<const int64_t> A, const ModP &mp) {
+    auto [M, N] = A.size();
+    DynamicMatrix<double> W(M, N);
+    for (size_t i = 0; i < M; ++i)
+        for (size_t j = 0; j < N; ++j)
+            W(i, j) = mp(A(i, j));
+    llvm::SmallVector<unsigned> cols;
+    for (size_t c = 0; (c < N) && (cols.size() < M); ++c) {
+        const size_t r = cols.size();
+        size_t piv = r;
+        while ((piv < M) && (W(piv, c) == 0))
+            ++piv;
+        if (piv == M)
+            continue;
+        swapRows(W, r, piv);
+        eliminateModP<true>(W, r, c, mp);
+        cols.push_back(c);
+    }
+    if (cols.size() < M)
+        return {};
+    return cols;
+}
+// Gauss-Jordan elimination of `W = [A I]` modulo `p`, leaving `inv(A)` in
+// its right half. Returns `det(A) mod p`, `0` if `A` is singular mod `p`.
+double gaussJordanModP(PtrMatrix<double> W, const ModP &mp) {
+    const size_t M = W.numRow();
+    double det = 1;
+    for (size_t i = 0; i < M; ++i) {
+        size_t piv = i;
+        while (W(piv, i) == 0)
+            if (++piv == M)
+                return 0;
+        if (piv != i) {
+            swapRows(W, i, piv);
+            det = mp(-det);
+        }
+        det = mp(det * W(i, i));
+        eliminateModP<false>(W, i, i, mp);
+    }
+    return det;
+}
+
+// Chinese remainder reconstruction of an integer in `(-m/2, m/2]` from its
+// residues modulo primes `p` with product `m`, added one at a time.
+struct CRT {
+    __int128_t x = 0, m = 1;
+    void push(int64_t r, int64_t p) {
+        const ModP mp(p);
+        int64_t xp = int64_t(x % p);
+        double t = mp(mp(r - xp) * mp.inv(mp(int64_t(m % p))));
+        x += m * int64_t(t);
+        m *= p;
+    }
+    llvm::Optional<int64_t> get() const {
+        __int128_t y = x > m / 2 ? x - m : x;
+        if ((y > std::numeric_limits<int64_t>::max()) ||
+            (y < std::numeric_limits<int64_t>::min()))
+            return {};
+        return int64_t(y);
+    }
+};
+
+// `hermite(As)` of square `As`, computed modulo `D = |det(As)| > 0`.
+// With `R` the product of the pivots yet to be found, times `D*e_i`, which
+// the lattice of the rows of `As` contains, every row can be reduced
+// modulo `R` (Domich, Kannan and Trotter).
+IntMatrix hermiteModD(PtrMatrix<const int64_t> As, int64_t D) {
+    const size_t M = As.numRow();
+    auto mod = [](__int128_t x, int64_t R) -> int64_t {
+        x %= R;
+        return int64_t(x < 0 ? x + R : x);
+    };
+    IntMatrix W(M, M);
+    for (size_t i = 0; i < M; ++i)
+        for (size_t j = 0; j < M; ++j)
+            W(i, j) = mod(As(i, j), D);
+    int64_t R = D;
+    for (size_t i = 0; i < M; ++i) {
+        for (size_t j = i + 1; j < M; ++j) {
+            if (W(j, i) == 0)
+                continue;
+            auto [g, p, q] = gcdx(W(i, i), W(j, i));
+            const int64_t a = W(i, i) / g, b = W(j, i) / g;
+            for (size_t k = i; k < M; ++k) {
+                const int64_t x = W(i, k), y = W(j, k);
+                W(i, k) = mod(widen(p) * x + widen(q) * y, R);
+                W(j, k) = mod(widen(a) * y - widen(b) * x, R);
+            }
+        }
+        // `gcd(W(i, i), R) * e_i + ...` is in the lattice
+        auto [g, u, v] = gcdx(W(i, i), R);
+        for (size_t k = i + 1; k < M; ++k)
+            W(i, k) = mod(widen(u) * W(i, k), R);
+        W(i, i) = g;
+        R /= g;
+    }
+    // reduce above the pivots; adding `D*e_k`, for `k > i`, to a row keeps
+    // the rows a basis, so the other columns can be kept modulo `D`
+    for (size_t i = 0; i < M; ++i) {
+        const int64_t Wii = W(i, i);
+        for (size_t k = 0; k < i; ++k) {
+            int64_t q = W(k, i) / Wii;
+            if (W(k, i) < 0)
+                q -= (W(k, i) != q * Wii);
+            if (q == 0)
+                continue;
+            W(k, i) -= q * Wii;
+            for (size_t n = i + 1; n < M; ++n)
+                W(k, n) = mod(W(k, n) - widen(q) * W(i, n), D);
+        }
+    }
+    return W;
+}
+
+// `log2` of the product of the norms of the rows of `A`, Hadamard's bound
+// on `|det(A)|` if `A` is square, and on its maximal minors if not.
+double hadamardBits(PtrMatrix<const int64_t> A) {
+    double bits = 0;
+    for (size_t i = 0; i < A.numRow(); ++i) {
+        double norm2 = 0;
+        for (size_t j = 0; j < A.numCol(); ++j)
+            norm2 += double(A(i, j)) * double(A(i, j));
+        bits += 0.5 * std::log2(norm2);
+    }
+    return bits;
+}
+
+// `(H, U)` with `H = U * A` in Hermite normal form, if `A` has full row
+// rank and nothing overflows.
+llvm::Optional<std::pair<IntMatrix, SquareMatrix<int64_t>>>
+modularHermite(PtrMatrix<const int64_t> A) {
+    auto [M, N] = A.size();
+    constexpr size_t numPrimes = std::size(modularPrimes);
+    llvm::Optional<llvm::SmallVector<unsigned>> cols =
+        pivotColsModP(A, ModP(modularPrimes[0]));
+    if (!cols)
+        return {};
+    IntMatrix As(M, M);
+    for (size_t i = 0; i < M; ++i)
+        for (size_t j = 0; j < M; ++j)
+            As(i, j) = A(i, (*cols)[j]);
+    // `|D| <= hadamard(As)`, and `|U(i, j)| <= M * max|adj(As)|`, which is
+    // at most `M * hadamard(As)`; the primes' product must exceed twice that
+    const double bits = hadamardBits(As);
+    if (bits > 61)
+        return {};
+    const double needBits = bits + std::log2(double(M)) + 2;
+    // the residues of `det(As)` and `inv(As)`, skipping primes dividing
+    // `det(As)`, which is not `0` as it is not modulo `modularPrimes[0]`
+    llvm::SmallVector<size_t, 4> primes;
+    llvm::SmallVector<DynamicMatrix<double>, 4> invs;
+    CRT det;
+    for (size_t k = 0;
+         (k < numPrimes) && (primes.size() * modularPrimeBits < needBits);
+         ++k) {
+        const ModP mp(modularPrimes[k]);
+        DynamicMatrix<double> W(M, 2 * M);
+        for (size_t i = 0; i < M; ++i) {
+            for (size_t j = 0; j < M; ++j)
+                W(i, j) = mp(As(i, j));
+            W(i, M + i) = 1;
+        }
+        double d = gaussJordanModP(W, mp);
+        if (d == 0)
+            continue;
+        det.push(int64_t(d), modularPrimes[k]);
+        primes.push_back(k);
+        invs.push_back(std::move(W));
+    }
+    llvm::Optional<int64_t> D = det.get();
+    if ((primes.size() * modularPrimeBits < needBits) || !D || (*D == 0))
+        return {};
+    IntMatrix Hs = hermiteModD(As, std::abs(*D));
+    // `U = Hs * inv(As)`, from its residues
+    SquareMatrix<int64_t> U(M);
+    DynamicMatrix<double> Up(M, M);
+    llvm::SmallVector<CRT, 16> crts(M * M);
+    for (size_t l = 0; l < primes.size(); ++l) {
+        const ModP mp(modularPrimes[primes[l]]);
+        PtrMatrix<double> Ainv = invs[l].view(0, M, M, 2 * M);
+        std::fill(Up.begin(), Up.end(), 0.0);
+        for (size_t i = 0; i < M; ++i) {
+            double *Ui = Up.data() + i * M;
+            for (size_t k = 0; k < M; ++k) {
+                const double h = mp(Hs(i, k));
+                const double *Ak = Ainv.data() + k * Ainv.rowStride();
+                VECTORIZE
+                for (size_t j = 0; j < M; ++j)
+                    Ui[j] = mp(Ui[j] + h * Ak[j]);
+            }
+        }
+        for (size_t i = 0; i < M * M; ++i)
+            crts[i].push(int64_t(Up[i]), modularPrimes[primes[l]]);
+    }
+    for (size_t i = 0; i < M * M; ++i) {
+        if (llvm::Optional<int64_t> u = crts[i].get())
+            U[i] = *u;
+        else
+            return {};
+    }
+    // check `H = U * A`
+    IntMatrix H(M, N);
+    for (size_t i = 0; i < M; ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            __int128_t h = 0;
+            for (size_t k = 0; k < M; ++k)
+                if (__builtin_add_overflow(h, widen(U(i, k)) * A(k, j), &h))
+                    return {};
+            if ((h > std::numeric_limits<int64_t>::max()) ||
+                (h < std::numeric_limits<int64_t>::min()))
+                return {};
+            H(i, j) = int64_t(h);
+        }
+    }
+    __int128_t detHs = 1;
+    for (size_t i = 0; i < M; ++i) {
+        for (size_t j = 0; j < (*cols)[i]; ++j)
+            if (H(i, j))
+                return {};
+        for (size_t j = 0; j < M; ++j)
+            if (H(i, (*cols)[j]) != Hs(i, j))
+                return {};
+        detHs *= Hs(i, i);
+    }
+    if (detHs != std::abs(*D))
+        return {};
+    return std::make_pair(std::move(H), std::move(U));
+}
+
+// `hermite` uses `modularHermite` for `A` with at least two rows, no more
+// rows than columns, and a Hadamard bound, combining its size and the
+// magnitude of its coefficients, of at least 2^modularHermiteMinBits.
+// Integer row reduction is several times faster, but on random matrices
+// starts to overflow from bounds of around 2^24; `modularHermite` falls
+// back to it if `A` does not have full row rank, or its bound is too large.
+constexpr double modularHermiteMinBits = 24;
+bool useModularHermite(PtrMatrix<const int64_t> A) {
+    auto [M, N] = A.size();
+    return (M >= 2) && (M <= N) && (hadamardBits(A) >= modularHermiteMinBits);
+}
+
 llvm::Optional<std::pair<IntMatrix, SquareMatrix<int64_t>>>
 hermite(IntMatrix A) {
+    if (useModularHermite(A))
+        if (auto HU = modularHermite(A))
+            return HU;
     auto [M, N] = A.size();
     SquareMatrix<int64_t> U = SquareMatrix<int64_t>::identity(M);
     simplifyEqualityConstraintsImpl(A, U);
@@ -608,26 +881,14 @@ hermite(IntMatrix A) {
 
 MULTIVERSION static void zeroSubDiagonal(IntMatrix &A, IntMatrix &B, size_t rr,
                                          size_t c) {
-    const size_t N = A.numCol();
-    const size_t K = B.numCol();
     for (size_t j = 0; j < c; ++j) {
         int64_t Aic = A(c, rr);
         if (int64_t Aij = A(j, rr)) {
             int64_t g = gcd(Aic, Aij);
             int64_t Aicr = Aic / g;
             int64_t Aijr = Aij / g;
-            VECTORIZE
-            for (size_t k = 0; k < N; ++k) {
-                int64_t Ack = A(c, k) * Aijr;
-                int64_t Ajk = A(j, k) * Aicr;
-                A(j, k) = Ajk - Ack;
-            }
-            VECTORIZE
-            for (size_t k = 0; k < K; ++k) {
-                int64_t Bck = B(c, k) * Aijr;
-                int64_t Bjk = B(j, k) * Aicr;
-                B(j, k) = Bjk - Bck;
-            }
+            scaleAddRow(A, j, Aicr, c, -Aijr);
+            scaleAddRow(B, j, Aicr, c, -Aijr);
         }
     }
 }
@@ -695,5 +956,73 @@ MULTIVERSION IntMatrix nullSpace(IntMatrix A) {
     }
     return B;
 }
+// `nullSpace` of `A` with `M` rows, known at compile time, e.g. the loops
+// shared by two memory accesses: the elimination of `simplifySystem`, with
+// the `M x M` multiplier in a fixed size matrix, so that its row operations
+// are fully unrolled and nothing is allocated for it.
+template <size_t M> IntMatrix nullSpace(PtrMatrix<int64_t> A) {
+    assert(A.numRow() == M);
+    const size_t N = A.numCol();
+    Matrix<int64_t, M, M> B = Matrix<int64_t, M, M>::identity();
+    size_t dec = 0;
+    for (size_t m = 0; m < N; ++m) {
+        const size_t c = m - dec;
+        if (c >= M)
+            break;
+        size_t piv = c;
+        while ((piv < M) && (A(piv, m) == 0))
+            ++piv;
+        if (piv == M) {
+            ++dec;
+            continue;
+        }
+        if (piv != c) {
+            swapRows(A, c, piv);
+            for (size_t k = 0; k < M; ++k)
+                std::swap(B(c, k), B(piv, k));
+        }
+        // zero the rows below `c`
+        for (size_t j = c + 1; j < M; ++j) {
+            int64_t Aii = A(c, m);
+            if (int64_t Aij = A(j, m)) {
+                const auto [p, q, Aiir, Aijr] = gcdxScale(Aii, Aij);
+                for (size_t k = 0; k < N; ++k) {
+                    int64_t Ack = A(c, k);
+                    int64_t Ajk = A(j, k);
+                    A(c, k) = p * Ack + q * Ajk;
+                    A(j, k) = Aiir * Ajk - Aijr * Ack;
+                }
+                for (size_t k = 0; k < M; ++k) {
+                    int64_t Bck = B(c, k);
+                    int64_t Bjk = B(j, k);
+                    B(c, k) = p * Bck + q * Bjk;
+                    B(j, k) = Aiir * Bjk - Aijr * Bck;
+                }
+            }
+        }
+        // and those above
+        for (size_t j = 0; j < c; ++j) {
+            int64_t Aic = A(c, m);
+            if (int64_t Aij = A(j, m)) {
+                int64_t g = gcd(Aic, Aij);
+                int64_t Aicr = Aic / g;
+                int64_t Aijr = Aij / g;
+                for (size_t k = 0; k < N; ++k)
+                    A(j, k) = A(j, k) * Aicr - A(c, k) * Aijr;
+                for (size_t k = 0; k < M; ++k)
+                    B(j, k) = B(j, k) * Aicr - B(c, k) * Aijr;
+            }
+        }
+    }
+    size_t R = M;
+    while ((R > 0) && allZero(A.getRow(R - 1)))
+        --R;
+    // the last `M - R` rows of `B`
+    IntMatrix NS(M - R, M);
+    for (size_t d = 0; d < M - R; ++d)
+        for (size_t k = 0; k < M; ++k)
+            NS(d, k) = B(d + R, k);
+    return NS;
+}
 
 } // namespace NormalForm
@@ -84,8 +84,8 @@ orthogonalize(llvm::SmallVectorImpl<ArrayReference *> const &ai) {
         // now, we have (A = alnp.aln->A, r = alnp.aln->r)
         // (A*K')*J <= r
         llvm::IntrusiveRefCntPtr<AffineLoopNest> alnNew =
-            llvm::makeIntrusiveRefCnt<AffineLoopNest>(matmulnt(alnp.A, K),
-                                                      alnp.b, alnp.poset);
+            llvm::makeIntrusiveRefCnt<AffineLoopNest>(
+                IntMatrix(alnp.A * transpose(K)), alnp.b, alnp.poset);
         // auto alnNew = std::make_shared<AffineLoopNest>();
         // matmultn(alnNew->A, K, alnp.A);
         // alnNew->b = alnp.aln->b;
@@ -95,8 +95,6 @@ orthogonalize(llvm::SmallVectorImpl<ArrayReference *> const &ai) {
         // S'*L = I
         // now, we have
         // (S'*K')*J = (K*S)'*J  = I
-        IntMatrix KS(matmul(K, S));
-        // auto KS = matmul(K, S);
         // llvm::SmallVector<ArrayReference*> aiNew;
         llvm::SmallVector<ArrayReference, 0> newArrayRefs;
         newArrayRefs.reserve(numRow);
@@ -104,11 +102,8 @@ orthogonalize(llvm::SmallVectorImpl<ArrayReference *> const &ai) {
         for (auto a : ai) {
             newArrayRefs.emplace_back(a->arrayID, alnNew, a->arrayDim());
             PtrMatrix<int64_t> A = newArrayRefs.back().indexMatrix();
-            for (size_t j = 0; j < numLoops; ++j) {
-                for (size_t k = 0; k < A.numCol(); ++k) {
-                    A(j, k) = KS(j, k + i);
-                }
-            }
+            // columns `i:i+A.numCol()` of `K*S`
+            A = K * S.view(0, numLoops, i, i + A.numCol());
             i += A.numCol();
             llvm::SmallVector<std::pair<MPoly, MPoly>> &stridesOffsets =
                 newArrayRefs.back().stridesOffsets;
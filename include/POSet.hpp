@@ -24,8 +24,9 @@ int64_t saturatedAdd(int64_t a, int64_t b) {
 int64_t saturatedSub(int64_t a, int64_t b) {
     int64_t c;
     if (__builtin_sub_overflow(a, b, &c)) {
-        c = ((a > 0) & (b < 0)) ? std::numeric_limits<int64_t>::max()
-                                : std::numeric_limits<int64_t>::min();
+        // `a - b` overflows upwards iff `b < 0`, e.g. `0 - typemin(Int)`
+        c = (b < 0) ? std::numeric_limits<int64_t>::max()
+                    : std::numeric_limits<int64_t>::min();
     }
     return c;
 }
@@ -232,11 +233,27 @@ struct PartiallyOrderedSet {
     }
 
     // transitive closure of a graph
-    Interval update(size_t i, size_t j, Interval ji) {
+    // Sets `j - i` to `ji`, with `i < j`, and tightens the differences to
+    // every other variable until none changes significantly. Changed pairs
+    // are queued on a worklist rather than recursed into, as chains of
+    // updates can be as long as the number of relations.
+    void update(size_t i, size_t j, Interval ji) {
+        delta[i + bin2(j)] = ji;
+        llvm::SmallVector<std::pair<size_t, size_t>> worklist;
+        worklist.emplace_back(i, j);
+        while (!worklist.empty()) {
+            auto [u, v] = worklist.pop_back_val();
+            propagate(u, v, worklist);
+        }
+    }
+    // Tightens the differences of `i` and `j`, with `i < j`, to each other
+    // variable `k` through `j - i`, queuing those that changed.
+    void propagate(size_t i, size_t j,
+                   llvm::SmallVectorImpl<std::pair<size_t, size_t>> &worklist) {
         // bin2s here are for indexing columns
         size_t iOff = bin2(i);
         size_t jOff = bin2(j);
-        // we require that i < j
+        Interval ji = delta[i + jOff];
         for (size_t k = 0; k < i; ++k) {
             Interval ik = delta[k + iOff];
             Interval jk = delta[k + jOff];
@@ -244,16 +261,10 @@ struct PartiallyOrderedSet {
             auto [jkt, ikt] = ji.restrictSub(jk, ik);
             delta[k + iOff] = ikt;
             delta[k + jOff] = jkt;
-            if (ikt.significantlyDifferent(ik)) {
-                delta[i + jOff] = ji;
-                delta[k + iOff] = update(k, i, ikt);
-                ji = delta[i + jOff];
-            }
-            if (jkt.significantlyDifferent(jk)) {
-                delta[i + jOff] = ji;
-                delta[k + jOff] = update(k, j, jkt);
-                ji = delta[i + jOff];
-            }
+            if (ikt.significantlyDifferent(ik))
+                worklist.emplace_back(k, i);
+            if (jkt.significantlyDifferent(jk))
+                worklist.emplace_back(k, j);
         }
         size_t kOff = iOff;
         for (size_t k = i + 1; k < j; ++k) {
@@ -263,16 +274,10 @@ struct PartiallyOrderedSet {
             auto [kit, jkt] = ji.restrictAdd(ki, jk);
             delta[i + kOff] = kit;
             delta[k + jOff] = jkt;
-            if (kit.significantlyDifferent(ki)) {
-                delta[i + jOff] = ji;
-                delta[i + kOff] = update(i, k, kit);
-                ji = delta[i + jOff];
-            }
-            if (jkt.significantlyDifferent(jk)) {
-                delta[i + jOff] = ji;
-                delta[k + jOff] = update(k, j, jkt);
-                ji = delta[i + jOff];
-            }
+            if (kit.significantlyDifferent(ki))
+                worklist.emplace_back(i, k);
+            if (jkt.significantlyDifferent(jk))
+                worklist.emplace_back(k, j);
         }
         kOff = jOff;
         for (size_t k = j + 1; k < nVar; ++k) {
@@ -282,18 +287,15 @@ struct PartiallyOrderedSet {
             auto [kit, kjt] = ji.restrictSub(ki, kj);
             delta[i + kOff] = kit;
             delta[j + kOff] = kjt;
-            if (kit.significantlyDifferent(ki)) {
-                delta[i + jOff] = ji;
-                delta[i + kOff] = update(i, k, kit);
-                ji = delta[i + jOff];
-            }
-            if (kjt.significantlyDifferent(kj)) {
-                delta[i + jOff] = ji;
-                delta[j + kOff] = update(j, k, kjt);
-                ji = delta[i + jOff];
-            }
+            if (kit.significantlyDifferent(ki))
+                worklist.emplace_back(i, k);
+            if (kjt.significantlyDifferent(kj))
+                worklist.emplace_back(j, k);
         }
-        return ji;
+        // `ji` was tightened by the other differences
+        if (ji.significantlyDifferent(delta[i + jOff]))
+            worklist.emplace_back(i, j);
+        delta[i + jOff] = ji;
     }
     // j - i = itv
     void push(size_t i, size_t j, Interval itv) {
@@ -313,19 +315,19 @@ struct PartiallyOrderedSet {
             // }
         } else {
             Interval itvNew = itv.intersect(delta[l]);
-            if (itvNew.equivalentRange(itv)) {
+            if (itvNew.equivalentRange(delta[l])) {
                 return;
             }
             itv = itvNew;
         }
-        delta[l] = update(i, j, itv);
+        update(i, j, itv);
     }
     Interval operator()(size_t i, size_t j) const {
         if (i == j) {
             return Interval::zero();
         }
         auto [l, f] = checkedLinearIndex(i, j);
-        if (l > delta.size()) {
+        if (l >= delta.size()) {
             return Interval::unconstrained();
         }
         Interval d = delta[l];
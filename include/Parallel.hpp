@@ -0,0 +1,50 @@
+#pragma once
+
+#include "./ThreadPool.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+// Runs `body` on `[0, N)` in the pool of `numThreads` threads kept for
+// `parallelFor`. The pool is created on first use and reused by later
+// calls, as `optimizeSchedules` runs once per loop nest; it is only
+// recreated when `numThreads` changes.
+inline void parallelForPool(size_t N, TurboLoopBody body, void *context,
+                            size_t numThreads) {
+    static std::mutex poolMutex;
+    static std::unique_ptr<ThreadPool> pool;
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!pool || (pool->size() != numThreads))
+        pool = std::make_unique<ThreadPool>(numThreads);
+    pool->parallelFor(body, context, 0, int64_t(N), 1);
+}
+
+// Calls `f(i)` for each `i` in `0:N-1`, spreading the calls over at most
+// `maxThreads` threads (including the calling thread) of a persistent
+// `ThreadPool`.
+// Iterations are claimed one at a time, so a few expensive iterations do
+// not leave the other threads idle.
+// Calls from inside of a pool's job run serially.
+// `f` must be safe to call concurrently for distinct `i`.
+template <typename F>
+void parallelFor(size_t N, F &&f,
+                 size_t maxThreads = std::thread::hardware_concurrency()) {
+    if ((std::min(N, maxThreads) <= 1) || ThreadPool::inside()) {
+        for (size_t i = 0; i < N; ++i)
+            f(i);
+        return;
+    }
+    using G = std::remove_reference_t<F>;
+    parallelForPool(
+        N,
+        [](void *context, int64_t begin, int64_t end) {
+            G &g = *static_cast<G *>(context);
+            for (int64_t i = begin; i < end; ++i)
+                g(size_t(i));
+        },
+        const_cast<std::remove_const_t<G> *>(&f), maxThreads);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "./CostModeling.hpp"
+#include "./LoopBlock.hpp"
+#include "./Schedule.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+// Outer loop parallelization.
+// A loop may run its iterations in parallel if no dependence between the
+// memory accesses it contains is carried by it, i.e. every such dependence
+// has distance `0` along it, or is carried by an outer loop. We mark the
+// outer most such loop of each loop nest in `Schedule::parallel`; code
+// generation outlines its body into a function called through
+// `turboloop_parallel_for` (see `Runtime.hpp`).
+
+// Is the loop at schedule level `level` shared by the accesses in `group`
+// free of carried dependencies?
+// `inGroup[i]` indicates whether `lblock.memory[i]` is in `group`.
+bool isParallel(const LoopBlock &lblock, llvm::ArrayRef<bool> inGroup,
+                size_t level) {
+    for (auto &d : lblock.edges) {
+        if (!(inGroup[lblock.memoryIndex(d.in)] &&
+              inGroup[lblock.memoryIndex(d.out)]))
+            continue;
+        if (CostModeling::carriedBy(d, level))
+            return false;
+    }
+    return true;
+}
+
+// `group` are the accesses sharing all loops outside of `level`; split them
+// by the loop they are in at `level`, and mark each loop that is parallel,
+// or else recurse into it.
+void markParallel(LoopBlock &lblock, llvm::ArrayRef<unsigned> group,
+                  size_t level) {
+    llvm::SmallVector<llvm::SmallVector<unsigned>> loops;
+    llvm::SmallVector<int64_t> omegas;
+    for (auto i : group) {
+        const Schedule &sch = lblock.memory[i].schedule;
+        if (sch.numLoops <= level)
+            continue;
+        int64_t o = sch.getOmega()[2 * level];
+        size_t j = std::find(omegas.begin(), omegas.end(), o) - omegas.begin();
+        if (j == omegas.size()) {
+            omegas.push_back(o);
+            loops.emplace_back();
+        }
+        loops[j].push_back(i);
+    }
+    llvm::SmallVector<bool> inGroup(lblock.memory.size());
+    for (auto &loop : loops) {
+        std::fill(inGroup.begin(), inGroup.end(), false);
+        for (auto i : loop)
+            inGroup[i] = true;
+        if (isParallel(lblock, inGroup, level)) {
+            for (auto i : loop)
+                lblock.memory[i].schedule.parallel = level;
+        } else {
+            markParallel(lblock, loop, level + 1);
+        }
+    }
+}
+
+// Sets `Schedule::parallel` of every memory access in `lblock` to the outer
+// most parallel loop containing it, or `-1` if none is.
+// Requires `lblock.fillEdges()` to have been called.
+void optimizeParallelism(LoopBlock &lblock) {
+    llvm::SmallVector<unsigned> all;
+    for (unsigned i = 0; i < lblock.memory.size(); ++i) {
+        lblock.memory[i].schedule.parallel = -1;
+        all.push_back(i);
+    }
+    markParallel(lblock, all, 0);
+}
+
+// The runtime's interface, as seen from generated code.
+// `void body(i8 *context, i64 begin, i64 end)`
+llvm::FunctionType *parallelBodyType(llvm::LLVMContext &ctx) {
+    llvm::Type *i64 = llvm::Type::getInt64Ty(ctx);
+    return llvm::FunctionType::get(llvm::Type::getVoidTy(ctx),
+                                   {llvm::Type::getInt8PtrTy(ctx), i64, i64},
+                                   false);
+}
+// `void turboloop_parallel_for(body *, i8 *context, i64 begin, i64 end,
+//                              i64 grain)`
+llvm::FunctionCallee getParallelFor(llvm::Module &M) {
+    llvm::LLVMContext &ctx = M.getContext();
+    llvm::Type *i64 = llvm::Type::getInt64Ty(ctx);
+    llvm::FunctionType *FT = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(ctx),
+        {llvm::PointerType::getUnqual(parallelBodyType(ctx)),
+         llvm::Type::getInt8PtrTy(ctx), i64, i64, i64},
+        false);
+    return M.getOrInsertFunction("turboloop_parallel_for", FT);
+}
+// Emits a call running the outlined loop `body` over `[begin, end)`.
+// `context` is cast to `i8*`; `grain` may be `0` to let the runtime choose.
+llvm::CallInst *emitParallelFor(llvm::IRBuilder<> &builder,
+                                llvm::Function *body, llvm::Value *context,
+                                llvm::Value *begin, llvm::Value *end,
+                                llvm::Value *grain) {
+    llvm::Module &M = *builder.GetInsertBlock()->getModule();
+    llvm::LLVMContext &ctx = M.getContext();
+    llvm::Type *i64 = llvm::Type::getInt64Ty(ctx);
+    return builder.CreateCall(
+        getParallelFor(M),
+        {body,
+         builder.CreatePointerCast(context, llvm::Type::getInt8PtrTy(ctx)),
+         builder.CreateSExtOrTrunc(begin, i64),
+         builder.CreateSExtOrTrunc(end, i64),
+         builder.CreateSExtOrTrunc(grain, i64)});
+}
@@ -1,16 +1,22 @@
 #pragma once
 
+#include "./CompileBudget.hpp"
 #include "./Constraints.hpp"
+#include "./Instrumentation.hpp"
 #include "./Macro.hpp"
 #include "./Math.hpp"
 #include "./NormalForm.hpp"
 #include "./POSet.hpp"
 #include "./Symbolics.hpp"
 #include <algorithm>
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Debug.h>
+
+#define DEBUG_TYPE "turbo-loop"
 
 // the AbstractPolyhedra defines methods we reuse across Polyhedra with known
 // (`Int`) bounds, as well as with unknown (symbolic) bounds.
@@ -131,9 +137,9 @@ template <class P, typename T> struct AbstractPolyhedra {
                                IntMatrix &Asrc, llvm::SmallVectorImpl<T> &bsrc,
                                IntMatrix &E0, llvm::SmallVectorImpl<T> &q0,
                                const size_t i) const {
-        std::cout << "Asrc0 =\n" << Asrc << std::endl;
+        LLVM_DEBUG(llvm::dbgs() << "Asrc0 =\n" << stdPrint(Asrc) << "\n");
         if (!substituteEquality(Asrc, bsrc, E0, q0, i)) {
-            std::cout << "Asrc1 =\n" << Asrc << std::endl;
+            LLVM_DEBUG(llvm::dbgs() << "Asrc1 =\n" << stdPrint(Asrc) << "\n");
             const size_t numAuxVar = Asrc.numCol() - getNumVar();
             size_t c = Asrc.numRow();
             while (c-- > 0) {
@@ -362,6 +368,9 @@ template <class P, typename T> struct AbstractPolyhedra {
                             Polynomial::Val<CheckEmpty>) const {
         const size_t numNeg = lB.size();
         const size_t numPos = uB.size();
+        // over budget, drop the bounds, relaxing the polyhedron
+        if (chargeBudget(numNeg * numPos))
+            return false;
         auto [numConstraints, numLoops] = A.size();
         A.reserve(numConstraints + numNeg * numPos, numLoops);
         b.reserve(numConstraints + numNeg * numPos);
@@ -401,6 +410,9 @@ template <class P, typename T> struct AbstractPolyhedra {
                       Polynomial::Val<CheckEmpty>) const {
         const size_t numNeg = lB.size();
         const size_t numPos = uB.size();
+        // over budget, drop the bounds, relaxing the polyhedron
+        if (chargeBudget(numNeg * numPos))
+            return false;
         auto [numConstraints, numLoops] = A.size();
         A.reserve(numConstraints + numNeg * numPos, numLoops);
         b.reserve(numConstraints + numNeg * numPos);
@@ -443,6 +455,9 @@ template <class P, typename T> struct AbstractPolyhedra {
                       Polynomial::Val<CheckEmpty>) const {
         const size_t numNeg = lB.size();
         const size_t numPos = uB.size();
+        // over budget, drop the bounds, relaxing the polyhedron
+        if (chargeBudget(numNeg * numPos))
+            return false;
         auto [numConstraints, numLoops] = A.size();
         A.reserve(numConstraints + numNeg * numPos, numLoops);
         b.reserve(numConstraints + numNeg * numPos);
@@ -476,14 +491,19 @@ template <class P, typename T> struct AbstractPolyhedra {
                      llvm::SmallVectorImpl<T> &btmp1,
                      llvm::SmallVectorImpl<T> &q, IntMatrix &Aold,
                      llvm::SmallVectorImpl<T> &bold) const {
-
+        PhaseTimer phaseTimer(Phase::RedundancyElimination);
         for (size_t i = 0; i + 1 <= Aold.numRow(); ++i) {
+            // each check copies the constraints into an auxiliary system
+            if (chargeBudget(Aold.numRow()))
+                break;
             size_t c = Aold.numRow() - 1 - i;
             assert(Aold.numRow() == bold.size());
+            ++NumRedundancyChecks;
             if (removeRedundantConstraints(Atmp0, Atmp1, E, btmp0, btmp1, q,
                                            Aold, bold, c)) {
                 // drop `c`
                 eraseConstraint(Aold, bold, c);
+                ++NumConstraintsEliminated;
             }
         }
     }
@@ -539,6 +559,7 @@ template <class P, typename T> struct AbstractPolyhedra {
                      llvm::SmallVectorImpl<T> &qtmp1, IntMatrix &Aold,
                      llvm::SmallVectorImpl<T> &bold, IntMatrix &Eold,
                      llvm::SmallVectorImpl<T> &qold) const {
+        PhaseTimer phaseTimer(Phase::RedundancyElimination);
         moveEqualities(Aold, bold, Eold, qold);
         NormalForm::simplifyEqualityConstraints(Eold, qold);
         // printConstraints(
@@ -572,14 +593,19 @@ template <class P, typename T> struct AbstractPolyhedra {
         }
         assert(Aold.numRow() == bold.size());
         for (size_t i = 0; i + 1 <= Aold.numRow(); ++i) {
+            // each check copies the constraints into an auxiliary system
+            if (chargeBudget(Aold.numRow()))
+                break;
             size_t c = Aold.numRow() - 1 - i;
             assert(Aold.numRow() == bold.size());
+            ++NumRedundancyChecks;
             if (removeRedundantConstraints(Atmp0, Atmp1, Etmp0, Etmp1, btmp0,
                                            btmp1, qtmp0, qtmp1, Aold, bold,
                                            Eold, qold, Aold.getRow(c), bold[c],
                                            c, false)) {
                 // drop `c`
                 eraseConstraint(Aold, bold, c);
+                ++NumConstraintsEliminated;
             }
         }
         return false;
@@ -655,6 +681,7 @@ template <class P, typename T> struct AbstractPolyhedra {
                 boundDiffs.erase(boundDiffs.begin() + i);
                 eraseConstraint(Aold, bold, c);
                 eraseConstraint(Etmp, qtmp, i);
+                ++NumConstraintsEliminated;
             }
             constraintsToErase.clear();
         }
@@ -674,7 +701,7 @@ template <class P, typename T> struct AbstractPolyhedra {
             int c = boundDiffs[i];
             int64_t dte = -1;
             T *bc;
-            int64_t sign = (c > 0) ? 1 : -1;
+            int64_t sign = (c < 0) ? -1 : 1;
             if ((0 <= c) && (size_t(c) < Aold.numRow())) {
                 for (size_t v = 0; v < numVar; ++v) {
                     int64_t Evi = a[v] - Aold(c, v);
@@ -683,7 +710,7 @@ template <class P, typename T> struct AbstractPolyhedra {
                 }
                 bc = &(bold[c]);
             } else {
-                size_t cc = std::abs(c) - A.numRow();
+                size_t cc = std::abs(c) - Aold.numRow();
                 for (size_t v = 0; v < numVar; ++v) {
                     int64_t Evi = a[v] - sign * Eold(cc, v);
                     Etmp(i, v + numAuxVar) = Evi;
@@ -693,7 +720,8 @@ template <class P, typename T> struct AbstractPolyhedra {
             }
             if (dte == -1) {
                 T delta = (*bc) * sign - b;
-                if (AbIsEq ? knownLessEqualZero(delta - 1)
+                // an equality is only violated by a strictly tighter bound
+                if (AbIsEq ? knownLessEqualZero(delta + 1)
                            : knownLessEqualZero(delta)) {
                     // bold[c] - b <= 0
                     // bold[c] <= b
@@ -723,6 +751,7 @@ template <class P, typename T> struct AbstractPolyhedra {
                 boundDiffs.erase(boundDiffs.begin() + i);
                 if (c < Aold.numRow()) {
                     eraseConstraint(Aold, bold, c);
+                    ++NumConstraintsEliminated;
                 }
                 eraseConstraint(Etmp, qtmp, i);
             }
@@ -758,6 +787,7 @@ template <class P, typename T> struct AbstractPolyhedra {
         if (numAuxVar == 0) {
             return false;
         }
+        ++NumRedundancySolves;
         const size_t numVarAugment = numVar + numAuxVar;
         size_t AtmpCol = Aold.numRow() - (C < Aold.numRow());
         Atmp0.resizeForOverwrite(AtmpCol, numVarAugment);
@@ -839,6 +869,7 @@ template <class P, typename T> struct AbstractPolyhedra {
         if (colsToErase.size()) {
             size_t c = colsToErase.front();
             eraseConstraint(Aold, bold, c);
+            ++NumConstraintsEliminated;
         }
         return false;
     }
@@ -850,12 +881,14 @@ template <class P, typename T> struct AbstractPolyhedra {
         llvm::SmallVectorImpl<T> &qold, llvm::ArrayRef<int64_t> a, const T &b,
         const size_t C, const bool AbIsEq) const {
 
-        printConstraints(
-            printConstraints(std::cout << "Constraints, eliminating C=" << C
-                                       << ":\n",
-                             Aold, bold, true),
-            Eold, qold, false)
-            << std::endl;
+        LLVM_DEBUG(llvm::dbgs() << "Constraints, eliminating C=" << C << ":\n"
+                                << stdPrint([&](std::ostream &os) {
+                                       printConstraints(
+                                           printConstraints(os, Aold, bold,
+                                                            true),
+                                           Eold, qold, false);
+                                   })
+                                << "\n");
         const size_t numVar = getNumVar();
         // simple mapping of `k` to particular bounds
         // we'll have C - other bound
@@ -898,6 +931,7 @@ template <class P, typename T> struct AbstractPolyhedra {
             }
         }
         const size_t numAuxVar = boundDiffs.size();
+        ++NumRedundancySolves;
         const size_t numVarAugment = numVar + numAuxVar;
         bool CinA = C < Aold.numRow();
         size_t AtmpC = Aold.numRow() - CinA;
@@ -921,6 +955,9 @@ template <class P, typename T> struct AbstractPolyhedra {
             btmp0[j] = bold[i];
         }
         llvm::SmallVector<unsigned, 32> constraintsToErase;
+        // `C` indexes the equalities from `Aold.numRow()` before any
+        // redundant inequalities are erased
+        const size_t numIneqOld = Aold.numRow();
         int64_t dependencyToEliminate = checkForTrivialRedundancies(
             constraintsToErase, boundDiffs, Etmp0, qtmp0, Aold, bold, Eold,
             qold, a, b, AbIsEq);
@@ -932,9 +969,9 @@ template <class P, typename T> struct AbstractPolyhedra {
         qtmp0.resize(EtmpC + numEtmpAuxVar);
         // fill Etmp0 with Eold
         for (size_t i = 0; i < Eold.numRow(); ++i) {
-            if (i + Aold.numRow() == C)
+            if (i + numIneqOld == C)
                 continue;
-            size_t j = i - ((i + Aold.numRow() > C) && (C >= Aold.numRow())) +
+            size_t j = i - ((i + numIneqOld > C) && (C >= numIneqOld)) +
                        numEtmpAuxVar;
             for (size_t v = 0; v < numAuxVar; ++v) {
                 Etmp0(j, v) = 0;
@@ -970,13 +1007,16 @@ template <class P, typename T> struct AbstractPolyhedra {
             for (auto &a : Atmp0.mem) {
                 assert(std::abs(a) < 100);
             }
-            printConstraints(
-                printConstraints(std::cout << "dependencyToEliminate = "
-                                           << dependencyToEliminate
-                                           << "; Temporary Constraints:\n",
-                                 Atmp0, btmp0, true, numAuxVar),
-                Etmp0, qtmp0, false, numAuxVar)
-                << std::endl;
+            LLVM_DEBUG(llvm::dbgs()
+                       << "dependencyToEliminate = " << dependencyToEliminate
+                       << "; Temporary Constraints:\n"
+                       << stdPrint([&](std::ostream &os) {
+                              printConstraints(
+                                  printConstraints(os, Atmp0, btmp0, true,
+                                                   numAuxVar),
+                                  Etmp0, qtmp0, false, numAuxVar);
+                          })
+                       << "\n");
             // std::cout << "dependencyToEliminate = " << dependencyToEliminate
             // << std::endl;
             assert(btmp1.size() == Atmp1.numRow());
@@ -1012,8 +1052,8 @@ template <class P, typename T> struct AbstractPolyhedra {
                             if (c < Aold.numRow())
                                 constraintsToErase.push_back(c);
                         } else if ((!AbIsEq) ||
-                                   knownLessEqualZero(btmp0[c] - 1)) {
-                            // lower bound
+                                   knownLessEqualZero(btmp0[c] + 1)) {
+                            // lower bound; an equality needs `delta > 0`
                             return true;
                         }
                     }
@@ -1036,6 +1076,7 @@ template <class P, typename T> struct AbstractPolyhedra {
             // std::cout << "Erasing Inequality Constraint c = " << c <<
             // std::endl;
             eraseConstraint(Aold, bold, c);
+            ++NumConstraintsEliminated;
         }
         return false;
     }
@@ -1077,6 +1118,7 @@ template <class P, typename T> struct AbstractPolyhedra {
                         llvm::SmallVectorImpl<T> &btmp1,
                         llvm::SmallVectorImpl<T> &q, IntMatrix &A,
                         llvm::SmallVectorImpl<T> &b, const size_t i) {
+        ++NumVariablesEliminated;
         categorizeBounds(lA, uA, lb, ub, A, b, i);
         deleteBounds(A, b, i);
         appendBounds(lA, uA, lb, ub, Atmp0, Atmp1, E, btmp0, btmp1, q, A, b, i,
@@ -1124,6 +1166,7 @@ template <class P, typename T> struct AbstractPolyhedra {
         IntMatrix Atmp0, Atmp1;
         llvm::SmallVector<T, 16> btmp0, btmp1;
 
+        ++NumVariablesEliminated;
         categorizeBounds(lA, uA, lb, ub, A, b, i);
         deleteBounds(A, b, i);
         appendBoundsSimple(lA, uA, lb, ub, A, b, i, Polynomial::Val<false>());
@@ -1171,9 +1214,21 @@ template <class P, typename T> struct AbstractPolyhedra {
                                   Polynomial::Val<true>())) {
                 return true;
             }
+            if (copy.hasContradiction())
+                return true;
+            if (budgetExhausted())
+                return false;
         }
         return false;
     }
+    // Is there a constraint `0 <= b` with `b` known to be negative?
+    // Combining a lower and an upper bound that cross yields one.
+    bool hasContradiction() const {
+        for (size_t c = 0; c < A.numRow(); ++c)
+            if (allZero(A.getRow(c)) && knownLessEqualZero(b[c] + 1))
+                return true;
+        return false;
+    }
     bool knownSatisfied(llvm::ArrayRef<int64_t> x) const {
         T bc;
         size_t numVar = std::min(x.size(), getNumVar());
@@ -1188,6 +1243,21 @@ template <class P, typename T> struct AbstractPolyhedra {
         }
         return true;
     }
+    // `knownSatisfied` for `N` values, known at compile time, e.g. the
+    // schedules of loop nests of known depths, fully unrolled over them.
+    template <size_t N>
+    bool knownSatisfied(const std::array<int64_t, N> &x) const {
+        if (N > getNumVar())
+            return knownSatisfied(llvm::ArrayRef<int64_t>(x));
+        for (size_t c = 0; c < getNumInequalityConstraints(); ++c) {
+            T bc = b[c];
+            for (size_t v = 0; v < N; ++v)
+                bc -= A(c, v) * x[v];
+            if (!knownGreaterEqualZero(bc))
+                return false;
+        }
+        return true;
+    }
 };
 
 struct IntegerPolyhedra : public AbstractPolyhedra<IntegerPolyhedra, int64_t> {
@@ -1214,3 +1284,5 @@ struct SymbolicPolyhedra : public AbstractPolyhedra<SymbolicPolyhedra, MPoly> {
         return poset.knownGreaterEqualZero(x);
     }
 };
+
+#undef DEBUG_TYPE
@@ -0,0 +1,225 @@
+#pragma once
+
+#include "./CacheTiling.hpp"
+#include "./CompileBudget.hpp"
+#include "./CostModeling.hpp"
+#include "./DependencyPolyhedra.hpp"
+#include "./Instrumentation.hpp"
+#include "./LoopBlock.hpp"
+#include "./MemoryUse.hpp"
+#include "./Schedule.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/OptimizationRemarkEmitter.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/Value.h>
+#include <llvm/Support/raw_ostream.h>
+#include <string>
+
+// Optimization remarks describing the decisions taken for a `LoopBlock`.
+// They are emitted through an `OptimizationRemarkEmitter`, so they are shown
+// with `-pass-remarks*=turbo-loop`, and written to the YAML or bitstream
+// files of `-pass-remarks-output`. Values are named arguments (`ore::NV`),
+// e.g. `VectorWidth`, so remarks can be aggregated across many functions.
+//
+// The chosen schedule is reported as an analysis remark per loop nest, and
+// what blocked a transform (a dependence, the compile budget, or the lack of
+// a legal schedule) as a missed remark on the outermost loop. The memory
+// the analysis of a loop nest used is reported as an analysis remark.
+
+constexpr const char *remarkPassName = "turbo-loop";
+
+// `(l_0, l_1, ...)`: the loop, numbered outermost first, at each schedule
+// level of `ma`; `?` for levels that are not a single loop, e.g. skewed.
+std::string loopOrder(const MemoryAccess &ma) {
+    std::string s;
+    llvm::raw_string_ostream os(s);
+    os << '(';
+    for (size_t l = 0; l < ma.schedule.numLoops; ++l) {
+        if (l)
+            os << ", ";
+        int64_t loop = CostModeling::levelToLoop(ma, l);
+        if (loop < 0)
+            os << '?';
+        else
+            os << loop;
+    }
+    os << ')';
+    return os.str();
+}
+
+// `[t_0, t_1, ...]`, tile sizes by schedule level; empty if not tiled.
+std::string tileSizes(llvm::ArrayRef<uint32_t> tile) {
+    bool tiled = false;
+    for (auto t : tile)
+        tiled |= t > 1;
+    if (!tiled)
+        return "";
+    std::string s;
+    llvm::raw_string_ostream os(s);
+    os << '[';
+    for (size_t l = 0; l < tile.size(); ++l)
+        os << (l ? ", " : "") << std::max(tile[l], uint32_t(1));
+    os << ']';
+    return os.str();
+}
+
+// The first dependence between `members` of `lblock` carried by schedule
+// level `level`, or `nullptr`.
+const Dependence *carriedDependence(const LoopBlock &lblock,
+                                    llvm::ArrayRef<unsigned> members,
+                                    size_t level) {
+    auto isMember = [&](const MemoryAccess *ma) {
+        return llvm::is_contained(members, lblock.memoryIndex(ma));
+    };
+    for (auto &d : lblock.edges)
+        if (isMember(d.in) && isMember(d.out) &&
+            CostModeling::carriedBy(d, level))
+            return &d;
+    return nullptr;
+}
+
+// Appends `d` to `remark`: its source and destination, with their debug
+// locations, and the array they access, named by `basePointers[arrayID]`
+// if given.
+template <typename R>
+void describeDependence(R &remark, const Dependence &d,
+                        llvm::ArrayRef<llvm::Value *> basePointers) {
+    auto access = [&](const char *key, const MemoryAccess *ma) {
+        if (ma->user)
+            remark << llvm::ore::NV(key, (const llvm::Value *)ma->user);
+        else
+            remark << llvm::ore::NV(key, ma->isLoad ? "load" : "store");
+    };
+    remark << "dependence from ";
+    access("Source", d.in);
+    remark << " to ";
+    access("Sink", d.out);
+    const size_t arrayID = d.in->ref.arrayID;
+    if ((arrayID < basePointers.size()) && basePointers[arrayID])
+        remark << " on " << llvm::ore::NV("Array", basePointers[arrayID]);
+}
+
+// Emits, for each loop nest of `lblock`, which was extracted from `root`,
+// an analysis remark with the chosen loop order and vectorized level and
+// width, and the planned unroll factors and cache tiles, which are applied
+// only when the nest is lowered with `-turbo-loop-codegen`, and a missed
+// remark for each level that could not be vectorized or unrolled and jammed,
+// naming a dependence it carries.
+void emitScheduleRemarks(llvm::OptimizationRemarkEmitter &ORE,
+                         const LoopBlock &lblock, llvm::Loop *root,
+                         llvm::ArrayRef<llvm::Value *> basePointers = {}) {
+    using llvm::ore::NV;
+    for (auto &nest : CostModeling::loopNests(lblock)) {
+        const MemoryAccess &ma = lblock.memory[nest.front()];
+        const Schedule &sch = ma.schedule;
+        if (!sch.numLoops)
+            continue;
+        llvm::OptimizationRemarkAnalysis R(remarkPassName, "Schedule",
+                                           root->getStartLoc(),
+                                           root->getHeader());
+        R << "loop nest of depth " << NV("Depth", unsigned(sch.numLoops))
+          << " with " << NV("Accesses", unsigned(nest.size()))
+          << " memory accesses: loop order " << NV("LoopOrder", loopOrder(ma));
+        if (sch.vectorized >= 0)
+            R << ", vectorized level " << NV("VectorizedLevel", sch.vectorized)
+              << " by " << NV("VectorWidth", unsigned(sch.vectorWidth))
+              << (sch.maskedTail ? " with a masked" : " with a scalar")
+              << " remainder";
+        // `LoopNestCodeGen` unrolls and strip-mines only where it can, so
+        // these are reported as the plan
+        if (sch.unrolledInnerLoop >= 0)
+            R << ", planned unroll of level "
+              << NV("PlannedUnrolledInnerLevel", sch.unrolledInnerLoop)
+              << " by " << NV("PlannedUnrollInner", sch.unrolledInner);
+        if (sch.unrolledOuterLoop >= 0)
+            R << ", planned unroll and jam of level "
+              << NV("PlannedUnrolledOuterLevel", sch.unrolledOuterLoop)
+              << " by " << NV("PlannedUnrollOuter", sch.unrolledOuter);
+        std::string l1 = tileSizes(sch.tileL1), l2 = tileSizes(sch.tileL2);
+        if (!l1.empty())
+            R << ", planned L1 tile " << NV("PlannedL1Tile", l1);
+        if (!l2.empty())
+            R << ", planned L2 tile " << NV("PlannedL2Tile", l2);
+        ORE.emit(R);
+        for (size_t l = 0; l < sch.numLoops; ++l) {
+            if ((int64_t(l) == sch.vectorized) ||
+                (int64_t(l) == sch.unrolledInnerLoop) ||
+                (int64_t(l) == sch.unrolledOuterLoop))
+                continue;
+            const Dependence *d = carriedDependence(lblock, nest, l);
+            if (!d)
+                continue;
+            llvm::OptimizationRemarkMissed M(remarkPassName,
+                                             "CarriedDependence",
+                                             root->getStartLoc(),
+                                             root->getHeader());
+            M << "level " << NV("Level", unsigned(l))
+              << " not vectorized or unrolled and jammed: it carries the ";
+            describeDependence(M, *d, basePointers);
+            ORE.emit(M);
+        }
+    }
+}
+
+// Emits a missed remark naming a dependence of `lblock` that its schedules
+// violate, e.g. after `LoopBlock::optimizeSchedules` failed.
+void emitScheduleFailureRemark(llvm::OptimizationRemarkEmitter &ORE,
+                               const LoopBlock &lblock, llvm::Loop *root,
+                               llvm::ArrayRef<llvm::Value *> basePointers =
+                                   {}) {
+    llvm::OptimizationRemarkMissed M(remarkPassName, "NoLegalSchedule",
+                                     root->getStartLoc(), root->getHeader());
+    M << "loop nest left untouched: no legal schedule found";
+    for (auto &d : lblock.edges) {
+        if (lblock.isSatisfied(d))
+            continue;
+        M << " satisfying the ";
+        describeDependence(M, d, basePointers);
+        break;
+    }
+    ORE.emit(M);
+}
+
+// Emits a missed remark for the loop nest `root`, left untouched for
+// exceeding `budget`.
+void emitOverBudgetRemark(llvm::OptimizationRemarkEmitter &ORE,
+                          llvm::Loop *root, const CompileBudget &budget) {
+    ORE.emit(llvm::OptimizationRemarkMissed(remarkPassName, "CompileBudget",
+                                            root->getStartLoc(),
+                                            root->getHeader())
+             << "loop nest left untouched: exceeded the "
+             << llvm::ore::NV("Budget", budget.describe()));
+}
+
+// Emits an analysis remark with the heap memory held by the loop block of
+// `root` by kind of object, `use`, and, when tracking allocations, the bytes
+// `allocated` for it by each phase and the peak bytes live.
+void emitMemoryUseRemark(llvm::OptimizationRemarkEmitter &ORE,
+                         llvm::Loop *root, const MemoryUse &use,
+                         const AllocationCounts &allocated) {
+    using llvm::ore::NV;
+    llvm::OptimizationRemarkAnalysis R(remarkPassName, "MemoryUse",
+                                       root->getStartLoc(), root->getHeader());
+    R << "loop block holds " << NV("Bytes", uint64_t(use.totalBytes()))
+      << " bytes in " << NV("Buffers", uint64_t(use.totalBuffers()))
+      << " buffers:";
+    for (size_t k = 0; k < numObjectKinds; ++k)
+        R << (k ? ", " : " ") << objectKindNames[k] << " "
+          << NV((std::string(objectKindNames[k]) + "Bytes").c_str(),
+                uint64_t(use.bytes[k]));
+    if (trackingAllocations) {
+        R << "; allocated " << NV("AllocatedBytes", allocated.totalBytes())
+          << " bytes in " << NV("Allocations", allocated.totalCount())
+          << " allocations, peaking at "
+          << NV("PeakLiveBytes", allocated.peakLiveBytes) << " bytes live";
+        for (size_t p = 0; p < numPhases; ++p)
+            if (allocated.count[p])
+                R << ", " << phaseDescriptions[p] << " "
+                  << NV((std::string(phaseNames[p]) + "-bytes").c_str(),
+                        allocated.bytes[p]);
+    }
+    ORE.emit(R);
+}
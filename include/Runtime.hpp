@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The runtime interface called by code generated by `TurboLoop` for loops
+// scheduled as parallel (see `Parallelization.hpp`).
+// It is deliberately small, and C-compatible, so that generated code only
+// needs to declare these functions, and so that the implementation can be
+// swapped (e.g., for the host's OpenMP runtime; see `lib/Runtime.cpp`).
+extern "C" {
+
+// The outlined loop body; executes iterations `[begin, end)` of the parallel
+// loop, with `context` pointing to the values captured from the enclosing
+// function.
+typedef void (*TurboLoopBody)(void *context, int64_t begin, int64_t end);
+
+// Calls `body` on disjoint subranges covering `[begin, end)`, possibly
+// concurrently, returning once all have completed.
+// When run in parallel, subranges are at most `grain` iterations long;
+// `grain <= 0` lets the runtime choose.
+// With a single thread, or when called from inside of a
+// `turboloop_parallel_for`, `body` is called once on the whole range.
+void turboloop_parallel_for(TurboLoopBody body, void *context, int64_t begin,
+                            int64_t end, int64_t grain);
+
+// Number of threads (including the caller) used by `turboloop_parallel_for`.
+// Defaults to the value of the environment variable `TURBOLOOP_NUM_THREADS`,
+// or the number of hardware threads if unset.
+size_t turboloop_num_threads();
+
+// Sets the number of threads; `0` restores the default.
+// Must not be called concurrently with `turboloop_parallel_for`.
+void turboloop_set_num_threads(size_t numThreads);
+}
@@ -24,15 +24,22 @@ struct Schedule {
     // even rows give offsets indicating fusion (0-indexed)
     // However, all odd columns of `Phi` are structually zero,
     // so we represent it with an `N x N` matrix instead.
-    static constexpr unsigned maxStackLoops = 3;
+    // Schedules of up to `maxStackLoops` loops, almost all loop nests, are
+    // stored inline, and the checks of dependences between them are
+    // specialized for their depths (see `dispatchSize`).
+    static constexpr unsigned maxStackLoops = 4;
     static constexpr unsigned maxStackStorage =
         maxStackLoops * (maxStackLoops + 2) + 1;
-    // 3*3+ 2*3+1 = 16
+    // 4*4 + 2*4+1 = 25
     llvm::SmallVector<int64_t, maxStackStorage> data;
     const uint8_t numLoops;
-    // -1 indicates not vectorized
+    // schedule level of the vectorized loop; -1 indicates not vectorized
     int8_t vectorized = -1;
-    // -1 indicates not unrolled
+    uint8_t vectorWidth = 1;
+    // run the remainder of the vectorized loop as one masked iteration,
+    // rather than as scalar iterations
+    bool maskedTail = false;
+    // unroll factors; -1 indicates not unrolled
     // inner unroll means either the only unrolled loop, or if outer unrolled,
     // then the inner unroll is nested inside of the outer unroll.
     // if unrolledInner=3, unrolledOuter=2
@@ -41,6 +48,15 @@ struct Schedule {
     int8_t unrolledInner = -1;
     // -1 indicates not unrolled
     int8_t unrolledOuter = -1;
+    // schedule levels of the unrolled loops; -1 indicates not unrolled
+    int8_t unrolledInnerLoop = -1;
+    int8_t unrolledOuterLoop = -1;
+    // cache tile sizes, indexed by schedule level; empty or `0` indicates
+    // that the level is not tiled for that cache level.
+    llvm::SmallVector<uint32_t, maxStackLoops> tileL1;
+    llvm::SmallVector<uint32_t, maxStackLoops> tileL2;
+    // schedule level of the loop run in parallel; -1 indicates none
+    int8_t parallel = -1;
     Schedule(size_t nLoops)
         : data(llvm::SmallVector<int64_t, maxStackStorage>(
               nLoops * (nLoops + 2) + 1)),
@@ -63,6 +79,16 @@ struct Schedule {
     llvm::ArrayRef<int64_t> getOmega() const {
         return {data.data() + numLoops * numLoops, 2 * size_t(numLoops) + 1};
     }
+    // Are the loops scheduled in their original order, i.e. is `Phi` the
+    // identity?
+    bool inLoopOrder() const {
+        SquarePtrMatrix<const int64_t> Phi = getPhi();
+        for (size_t i = 0; i < numLoops; ++i)
+            for (size_t j = 0; j < numLoops; ++j)
+                if (Phi(i, j) != (i == j))
+                    return false;
+        return true;
+    }
     bool fusedThrough(const Schedule &y, const size_t numLoopsCommon) const {
         llvm::ArrayRef<int64_t> o0 = getOmega();
         llvm::ArrayRef<int64_t> o1 = y.getOmega();
@@ -90,6 +116,9 @@ struct MemoryAccess {
     llvm::SmallVector<unsigned> edgesIn;
     llvm::SmallVector<unsigned> edgesOut;
     const bool isLoad;
+    // bits of the element loaded or stored, for accesses without a `user`,
+    // e.g. replayed from a serialized loop block; `0` if unknown
+    uint32_t elementBits = 0;
     MemoryAccess(ArrayReference ref, llvm::User *user, Schedule schedule,
                  bool isLoad)
         : ref(std::move(ref)), user(user), schedule(schedule),
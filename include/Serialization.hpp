@@ -0,0 +1,482 @@
+#pragma once
+
+#include "./ArrayReference.hpp"
+#include "./CostModeling.hpp"
+#include "./LoopBlock.hpp"
+#include "./Loops.hpp"
+#include "./Math.hpp"
+#include "./POSet.hpp"
+#include "./Schedule.hpp"
+#include "./Symbolics.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <ostream>
+#include <string>
+#include <utility>
+
+// A compact, versioned binary format for `LoopBlock`s, so that the loop
+// blocks of slow compiles can be captured, without their LLVM module, and
+// replayed offline, e.g. as regression benchmarks.
+//
+// A serialized loop block holds its loop nests, i.e. the constraints and
+// `PartiallyOrderedSet` of each `AffineLoopNest`, and its memory accesses,
+// i.e. their `ArrayReference`s, `Schedule`s and element sizes. The
+// `llvm::User`s of the accesses and the dependence edges are not
+// serialized; replaying calls `fillEdges` again. All integers are little
+// endian, and matrices are stored row major, 8 byte aligned, so that they
+// can be read in place: `LoopBlockView` parses a mapped buffer without
+// copying the matrices, and `LoopBlockView::materialize` builds the
+// `LoopBlock`.
+//
+// Loop blocks are self delimiting, so a corpus is their concatenation, e.g.
+// as written by `appendToCorpus`, and read with `forEachLoopBlock`.
+//
+// Layout:
+//  - header: `magic`, `uint32_t version`, `uint32_t` reserved, `uint64_t`
+//    size in bytes, including the header and padding to a multiple of 8;
+//  - `uint32_t` number of loop nests, then for each: its constraints `A`
+//    (a matrix) and `b` (polynomials), and its poset (`nVar`, then the
+//    bounds of each interval of `delta`);
+//  - `uint32_t` number of memory accesses, then for each: `isLoad`,
+//    `arrayID`, index of its loop nest, array dimension, strides and
+//    offsets, index matrix, schedule, `uint32_t` element size in bits;
+//  - `uint32_t` number of `LoopBlock::valueFlow` pairs, then for each the
+//    `uint32_t` indices of its load and store.
+// Matrices are `uint64_t` rows and columns followed by the padded
+// elements; polynomials are their number of terms, then for each term its
+// coefficient and the ids of the symbols multiplied.
+
+template <typename T> void appendBytes(std::string &s, T x) {
+    char buf[sizeof(T)];
+    llvm::support::endian::write<T, llvm::support::little,
+                                 llvm::support::unaligned>(buf, x);
+    s.append(buf, sizeof(T));
+}
+template <typename T> T readBytes(const char *p) {
+    return llvm::support::endian::read<T, llvm::support::little,
+                                       llvm::support::unaligned>(p);
+}
+// Pads `s` to a multiple of 8 bytes.
+void appendPadding(std::string &s) { s.append((8 - (s.size() & 7)) & 7, 0); }
+
+// Reads values appended with `appendBytes`, checking bounds.
+struct ByteReader {
+    llvm::StringRef bytes;
+    bool failed = false;
+    template <typename T> T read() {
+        if (failed || (bytes.size() < sizeof(T))) {
+            failed = true;
+            return T{};
+        }
+        T x = readBytes<T>(bytes.data());
+        bytes = bytes.drop_front(sizeof(T));
+        return x;
+    }
+    // Skips the padding of `appendPadding`, which requires the buffer to
+    // start 8 byte aligned.
+    void align() {
+        size_t pad = (8 - (reinterpret_cast<uintptr_t>(bytes.data()) & 7)) & 7;
+        if (bytes.size() < pad)
+            failed = true;
+        else
+            bytes = bytes.drop_front(pad);
+    }
+    // `n` elements of type `T`, in place.
+    template <typename T> const T *readArray(size_t n) {
+        if (failed || (bytes.size() / sizeof(T) < n)) {
+            failed = true;
+            return nullptr;
+        }
+        const T *p = reinterpret_cast<const T *>(bytes.data());
+        bytes = bytes.drop_front(n * sizeof(T));
+        return p;
+    }
+};
+
+void appendMPoly(std::string &s, const MPoly &p) {
+    appendBytes<uint32_t>(s, p.terms.size());
+    for (auto &t : p.terms) {
+        appendBytes<int64_t>(s, t.coefficient);
+        appendBytes<uint32_t>(s, t.exponent.prodIDs.size());
+        for (auto v : t.exponent.prodIDs)
+            appendBytes<uint32_t>(s, v.id);
+    }
+}
+// Returns `true` on failure.
+bool readMPoly(ByteReader &r, MPoly &p) {
+    p.terms.clear();
+    size_t numTerms = r.read<uint32_t>();
+    for (size_t i = 0; (i < numTerms) && !r.failed; ++i) {
+        int64_t coefficient = r.read<int64_t>();
+        size_t degree = r.read<uint32_t>();
+        if (r.bytes.size() / sizeof(uint32_t) < degree)
+            return true;
+        Polynomial::Monomial m;
+        for (size_t d = 0; d < degree; ++d)
+            m.prodIDs.push_back(VarID(r.read<uint32_t>()));
+        p.terms.emplace_back(coefficient, std::move(m));
+    }
+    return r.failed;
+}
+
+// Appends the elements of `A` row major, after padding, so that they can be
+// read in place.
+void appendMatrix(std::string &s, PtrMatrix<const int64_t> A) {
+    appendBytes<uint64_t>(s, A.numRow());
+    appendBytes<uint64_t>(s, A.numCol());
+    appendPadding(s);
+    for (size_t i = 0; i < A.numRow(); ++i)
+        for (size_t j = 0; j < A.numCol(); ++j)
+            appendBytes<int64_t>(s, A(i, j));
+}
+// A view of a matrix appended by `appendMatrix`, in place.
+// Requires a little endian host.
+llvm::Optional<PtrMatrix<const int64_t>> readMatrix(ByteReader &r) {
+    uint64_t M = r.read<uint64_t>(), N = r.read<uint64_t>();
+    r.align();
+    if (r.failed || (N > r.bytes.size() / sizeof(int64_t)) ||
+        (N && (M > r.bytes.size() / (N * sizeof(int64_t)))))
+        return {};
+    const int64_t *p = r.readArray<int64_t>(M * N);
+    if (!p)
+        return {};
+    return PtrMatrix<const int64_t>(p, M, N, N);
+}
+
+void appendPOSet(std::string &s, const PartiallyOrderedSet &poset) {
+    appendBytes<uint64_t>(s, poset.nVar);
+    appendBytes<uint64_t>(s, poset.delta.size());
+    for (auto itv : poset.delta) {
+        appendBytes<int64_t>(s, itv.lowerBound);
+        appendBytes<int64_t>(s, itv.upperBound);
+    }
+}
+// Returns `true` on failure.
+bool readPOSet(ByteReader &r, PartiallyOrderedSet &poset) {
+    poset.nVar = r.read<uint64_t>();
+    uint64_t n = r.read<uint64_t>();
+    // `bin2(nVar) >= nVar - 1`, unless it wraps
+    if (r.failed || (poset.nVar > n + 1) ||
+        (n != PartiallyOrderedSet::bin2(poset.nVar)) ||
+        (r.bytes.size() / (2 * sizeof(int64_t)) < n))
+        return true;
+    poset.delta.clear();
+    for (size_t i = 0; i < n; ++i) {
+        int64_t lb = r.read<int64_t>();
+        poset.delta.emplace_back(lb, r.read<int64_t>());
+    }
+    return false;
+}
+
+void appendSchedule(std::string &s, const Schedule &sch) {
+    appendBytes<uint8_t>(s, sch.numLoops);
+    for (auto x : sch.data)
+        appendBytes<int64_t>(s, x);
+    appendBytes<int8_t>(s, sch.vectorized);
+    appendBytes<uint8_t>(s, sch.vectorWidth);
+    appendBytes<uint8_t>(s, sch.maskedTail);
+    appendBytes<int8_t>(s, sch.unrolledInner);
+    appendBytes<int8_t>(s, sch.unrolledOuter);
+    appendBytes<int8_t>(s, sch.unrolledInnerLoop);
+    appendBytes<int8_t>(s, sch.unrolledOuterLoop);
+    for (auto *tile : {&sch.tileL1, &sch.tileL2}) {
+        appendBytes<uint8_t>(s, tile->size());
+        for (auto t : *tile)
+            appendBytes<uint32_t>(s, t);
+    }
+    appendBytes<int8_t>(s, sch.parallel);
+}
+// Reads a schedule written by `appendSchedule` into `sch`, which must have
+// the same number of loops.
+// Returns `true` on failure.
+bool readSchedule(ByteReader &r, Schedule &sch) {
+    if (r.read<uint8_t>() != sch.numLoops)
+        return true;
+    for (auto &x : sch.data)
+        x = r.read<int64_t>();
+    sch.vectorized = r.read<int8_t>();
+    sch.vectorWidth = r.read<uint8_t>();
+    sch.maskedTail = r.read<uint8_t>();
+    sch.unrolledInner = r.read<int8_t>();
+    sch.unrolledOuter = r.read<int8_t>();
+    sch.unrolledInnerLoop = r.read<int8_t>();
+    sch.unrolledOuterLoop = r.read<int8_t>();
+    for (auto *tile : {&sch.tileL1, &sch.tileL2}) {
+        size_t n = r.read<uint8_t>();
+        if (n > sch.numLoops)
+            return true;
+        tile->resize(n);
+        for (auto &t : *tile)
+            t = r.read<uint32_t>();
+    }
+    sch.parallel = r.read<int8_t>();
+    return r.failed;
+}
+
+namespace LoopBlockFormat {
+constexpr char magic[8] = {'T', 'L', 'B', 'L', 'O', 'C', 'K', '\0'};
+// bump whenever the layout changes
+constexpr uint32_t version = 3;
+constexpr size_t headerBytes = sizeof(magic) + 2 * sizeof(uint32_t) +
+                               sizeof(uint64_t);
+constexpr size_t sizeOffset = sizeof(magic) + 2 * sizeof(uint32_t);
+} // namespace LoopBlockFormat
+
+std::string serialize(const LoopBlock &lblock) {
+    using namespace LoopBlockFormat;
+    std::string s(magic, sizeof(magic));
+    appendBytes<uint32_t>(s, version);
+    appendBytes<uint32_t>(s, 0);
+    // the size, written last
+    appendBytes<uint64_t>(s, 0);
+    llvm::DenseMap<const AffineLoopNest *, uint32_t> loopIds;
+    llvm::SmallVector<const AffineLoopNest *> loops;
+    for (auto &ma : lblock.memory)
+        if (loopIds.try_emplace(ma.ref.loop.get(), loops.size()).second)
+            loops.push_back(ma.ref.loop.get());
+    appendBytes<uint32_t>(s, loops.size());
+    for (auto *aln : loops) {
+        appendMatrix(s, aln->A);
+        for (auto &b : aln->b)
+            appendMPoly(s, b);
+        appendPOSet(s, aln->poset);
+    }
+    appendBytes<uint32_t>(s, lblock.memory.size());
+    for (auto &ma : lblock.memory) {
+        appendBytes<uint8_t>(s, ma.isLoad);
+        appendBytes<uint64_t>(s, ma.ref.arrayID);
+        appendBytes<uint32_t>(s, loopIds[ma.ref.loop.get()]);
+        appendBytes<uint32_t>(s, ma.ref.arrayDim());
+        for (auto &[stride, offset] : ma.ref.stridesOffsets) {
+            appendMPoly(s, stride);
+            appendMPoly(s, offset);
+        }
+        appendMatrix(s, ma.ref.indexMatrix());
+        appendSchedule(s, ma.schedule);
+        appendBytes<uint32_t>(s, CostModeling::elementBits(ma));
+    }
+    appendBytes<uint32_t>(s, lblock.valueFlow.size());
+    for (auto [l, st] : lblock.valueFlow) {
+        appendBytes<uint32_t>(s, l);
+        appendBytes<uint32_t>(s, st);
+    }
+    appendPadding(s);
+    llvm::support::endian::write<uint64_t, llvm::support::little,
+                                 llvm::support::unaligned>(
+        s.data() + sizeOffset, s.size());
+    return s;
+}
+
+// A serialized loop block, parsed in place; its matrices point into the
+// serialized bytes, which must outlive it.
+struct LoopBlockView {
+    struct LoopNest {
+        PtrMatrix<const int64_t> A;
+        llvm::SmallVector<MPoly, 8> b;
+        PartiallyOrderedSet poset;
+    };
+    struct Access {
+        bool isLoad;
+        size_t arrayID;
+        size_t loop;
+        llvm::SmallVector<std::pair<MPoly, MPoly>> stridesOffsets;
+        // `numLoops x arrayDim`, as `ArrayReference::indexMatrix`
+        PtrMatrix<const int64_t> indices;
+        Schedule schedule;
+        uint32_t elementBits;
+    };
+    llvm::SmallVector<LoopNest, 0> loops;
+    llvm::SmallVector<Access, 0> memory;
+    llvm::SmallVector<std::pair<unsigned, unsigned>> valueFlow;
+    // the bytes of this loop block, including its header and padding
+    size_t size = 0;
+
+    // Parses the loop block at the start of `bytes`, which must be 8 byte
+    // aligned, e.g. a mapped file.
+    // Returns `true` on failure, e.g. for another version of the format.
+    bool parse(llvm::StringRef bytes) {
+        using namespace LoopBlockFormat;
+        loops.clear();
+        memory.clear();
+        valueFlow.clear();
+        if ((reinterpret_cast<uintptr_t>(bytes.data()) & 7) ||
+            (bytes.size() < headerBytes) ||
+            std::memcmp(bytes.data(), magic, sizeof(magic)) ||
+            (readBytes<uint32_t>(bytes.data() + sizeof(magic)) != version))
+            return true;
+        size = readBytes<uint64_t>(bytes.data() + sizeOffset);
+        if ((size < headerBytes) || (size > bytes.size()) || (size & 7))
+            return true;
+        ByteReader r{bytes.slice(headerBytes, size)};
+        size_t numLoops = r.read<uint32_t>();
+        for (size_t l = 0; (l < numLoops) && !r.failed; ++l) {
+            llvm::Optional<PtrMatrix<const int64_t>> A = readMatrix(r);
+            // `Schedule::numLoops` is a `uint8_t`, and each row of `A` has
+            // a polynomial of at least 4 bytes in `b`
+            if (!A || (A->numCol() > std::numeric_limits<uint8_t>::max()) ||
+                (A->numRow() > r.bytes.size() / sizeof(uint32_t)))
+                return true;
+            loops.push_back({*A, {}, {}});
+            LoopNest &nest = loops.back();
+            nest.b.resize(A->numRow());
+            for (auto &b : nest.b)
+                if (readMPoly(r, b))
+                    return true;
+            if (readPOSet(r, nest.poset))
+                return true;
+        }
+        size_t numAccesses = r.read<uint32_t>();
+        for (size_t m = 0; (m < numAccesses) && !r.failed; ++m) {
+            bool isLoad = r.read<uint8_t>();
+            size_t arrayID = r.read<uint64_t>();
+            size_t loop = r.read<uint32_t>();
+            size_t dim = r.read<uint32_t>();
+            if (r.failed || (loop >= loops.size()) ||
+                (r.bytes.size() / 8 < dim))
+                return true;
+            llvm::SmallVector<std::pair<MPoly, MPoly>> stridesOffsets(dim);
+            for (auto &[stride, offset] : stridesOffsets)
+                if (readMPoly(r, stride) || readMPoly(r, offset))
+                    return true;
+            llvm::Optional<PtrMatrix<const int64_t>> indices = readMatrix(r);
+            const size_t depth = loops[loop].A.numCol();
+            if (!indices || (indices->numRow() != depth) ||
+                (indices->numCol() != dim))
+                return true;
+            memory.push_back({isLoad, arrayID, loop,
+                              std::move(stridesOffsets), *indices,
+                              Schedule(depth), 0});
+            if (readSchedule(r, memory.back().schedule))
+                return true;
+            memory.back().elementBits = r.read<uint32_t>();
+        }
+        size_t numValueFlow = r.read<uint32_t>();
+        for (size_t f = 0; (f < numValueFlow) && !r.failed; ++f) {
+            unsigned l = r.read<uint32_t>();
+            unsigned st = r.read<uint32_t>();
+            if ((l >= memory.size()) || (st >= memory.size()))
+                return true;
+            valueFlow.emplace_back(l, st);
+        }
+        return r.failed;
+    }
+    // Appends the memory accesses, with their loop nests, to `lblock`.
+    void materialize(LoopBlock &lblock) const {
+        llvm::SmallVector<llvm::IntrusiveRefCntPtr<AffineLoopNest>> nests;
+        for (auto &nest : loops) {
+            IntMatrix A(nest.A.numRow(), nest.A.numCol());
+            for (size_t i = 0; i < A.numRow(); ++i)
+                for (size_t j = 0; j < A.numCol(); ++j)
+                    A(i, j) = nest.A(i, j);
+            nests.push_back(llvm::makeIntrusiveRefCnt<AffineLoopNest>(
+                std::move(A), nest.b, nest.poset));
+        }
+        const unsigned firstAccess = lblock.memory.size();
+        lblock.memory.reserve(firstAccess + memory.size());
+        for (auto &access : memory) {
+            ArrayReference ref(access.arrayID, nests[access.loop],
+                               access.stridesOffsets.size());
+            ref.stridesOffsets = access.stridesOffsets;
+            PtrMatrix<int64_t> indMat = ref.indexMatrix();
+            for (size_t i = 0; i < indMat.numRow(); ++i)
+                for (size_t j = 0; j < indMat.numCol(); ++j)
+                    indMat(i, j) = access.indices(i, j);
+            lblock.memory.emplace_back(std::move(ref), nullptr,
+                                       access.schedule, access.isLoad);
+            lblock.memory.back().elementBits = access.elementBits;
+        }
+        for (auto [l, st] : valueFlow)
+            lblock.valueFlow.emplace_back(firstAccess + l, firstAccess + st);
+    }
+};
+
+// Calls `f(const LoopBlockView &)` on each loop block of `corpus`, a
+// concatenation of serialized loop blocks, which must be 8 byte aligned.
+// Returns `true` if the corpus is malformed, after visiting the loop blocks
+// before the first malformed one.
+template <typename F> bool forEachLoopBlock(llvm::StringRef corpus, F &&f) {
+    LoopBlockView view;
+    while (!corpus.empty()) {
+        if (view.parse(corpus))
+            return true;
+        f(view);
+        corpus = corpus.drop_front(view.size);
+    }
+    return false;
+}
+
+// Appends `bytes`, e.g. a serialized loop block, to the corpus at `path`,
+// holding a lock on it, so that several processes may capture to the same
+// corpus.
+// Returns `true` on failure.
+bool appendToCorpus(llvm::StringRef path, llvm::StringRef bytes) {
+    int fd;
+    if (llvm::sys::fs::openFileForWrite(path, fd, llvm::sys::fs::CD_OpenAlways,
+                                        llvm::sys::fs::OF_Append))
+        return true;
+    if (llvm::sys::fs::lockFile(fd)) {
+        llvm::sys::fs::closeFile(fd);
+        return true;
+    }
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/false);
+    os << bytes;
+    os.flush();
+    bool failed = os.has_error();
+    os.clear_error();
+    llvm::sys::fs::unlockFile(fd);
+    llvm::sys::fs::closeFile(fd);
+    return failed;
+}
+
+// A human readable form of the serialized contents of `lblock`, for
+// inspecting captured loop blocks.
+void printLoopBlock(std::ostream &os, const LoopBlock &lblock) {
+    llvm::DenseMap<const AffineLoopNest *, size_t> loopIds;
+    for (auto &ma : lblock.memory) {
+        const AffineLoopNest *aln = ma.ref.loop.get();
+        auto [it, inserted] = loopIds.try_emplace(aln, loopIds.size());
+        if (!inserted)
+            continue;
+        os << "loop nest " << it->second << ": depth " << aln->getNumLoops()
+           << std::endl;
+        for (size_t r = 0; r < aln->A.numRow(); ++r) {
+            os << "  [";
+            for (size_t c = 0; c < aln->A.numCol(); ++c)
+                os << (c ? " " : "") << aln->A(r, c);
+            os << "] * i <= " << aln->b[r] << std::endl;
+        }
+    }
+    for (size_t m = 0; m < lblock.memory.size(); ++m) {
+        const MemoryAccess &ma = lblock.memory[m];
+        os << "access " << m << ": " << (ma.isLoad ? "load" : "store")
+           << " of array " << ma.ref.arrayID << " in loop nest "
+           << loopIds[ma.ref.loop.get()] << ", "
+           << CostModeling::elementBits(ma) << " bit elements" << std::endl;
+        PtrMatrix<const int64_t> indMat = ma.ref.indexMatrix();
+        for (size_t d = 0; d < ma.ref.arrayDim(); ++d) {
+            os << "  dim " << d << ": stride " << ma.ref.stridesOffsets[d].first
+               << ", offset " << ma.ref.stridesOffsets[d].second
+               << ", indices [";
+            for (size_t l = 0; l < indMat.numRow(); ++l)
+                os << (l ? " " : "") << indMat(l, d);
+            os << "]" << std::endl;
+        }
+        os << "  omega [";
+        llvm::ArrayRef<int64_t> omega = ma.schedule.getOmega();
+        for (size_t i = 0; i < omega.size(); ++i)
+            os << (i ? " " : "") << omega[i];
+        os << "]" << std::endl;
+    }
+    for (auto [l, s] : lblock.valueFlow)
+        os << "value flow: access " << l << " -> access " << s << std::endl;
+}
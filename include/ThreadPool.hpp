@@ -0,0 +1,150 @@
+#pragma once
+
+#include "./Runtime.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A persistent pool of threads with work stealing, shared by the parallel
+// loop runtime (`lib/Runtime.cpp`) and the scheduler (`Parallel.hpp`).
+// The iteration space of a job is split evenly among the threads, each
+// thread takes `grain` iterations at a time from the front of its own
+// range, and an idle thread steals the back half of another thread's
+// remaining range.
+class ThreadPool {
+    // remaining iterations of one thread; padded to avoid false sharing
+    struct alignas(64) Range {
+        std::mutex mutex;
+        int64_t begin = 0;
+        int64_t end = 0;
+    };
+    // `true` on a thread while it runs iterations of a job
+    static inline thread_local bool insideJob = false;
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<Range[]> ranges;
+    // serializes jobs started from different threads
+    std::mutex jobMutex;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    uint64_t generation = 0;
+    size_t active = 0;
+    bool stop = false;
+    // the current job
+    TurboLoopBody body = nullptr;
+    void *context = nullptr;
+    int64_t grain = 1;
+
+    // Runs iterations as thread `id` until no thread has any left.
+    void work(size_t id) {
+        const size_t n = size();
+        Range &own = ranges[id];
+        while (true) {
+            int64_t b, e;
+            {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                b = own.begin;
+                e = std::min(own.end, b + grain);
+                own.begin = e;
+            }
+            if (b < e) {
+                body(context, b, e);
+                continue;
+            }
+            bool stole = false;
+            for (size_t i = 1; i < n && !stole; ++i) {
+                Range &victim = ranges[(id + i) % n];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                int64_t remaining = victim.end - victim.begin;
+                if (remaining <= 0)
+                    continue;
+                // leave the victim at least its current chunk
+                int64_t mid = remaining > grain
+                                  ? victim.begin + remaining / 2
+                                  : victim.begin;
+                b = mid;
+                e = victim.end;
+                victim.end = mid;
+                stole = true;
+            }
+            if (!stole)
+                return;
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.begin = b;
+            own.end = e;
+        }
+    }
+    void workerLoop(size_t id) {
+        insideJob = true;
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start.wait(lock, [&] { return stop || (generation != seen); });
+                if (stop)
+                    return;
+                seen = generation;
+            }
+            work(id);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--active == 0)
+                done.notify_one();
+        }
+    }
+
+  public:
+    ThreadPool(size_t numThreads) : ranges(new Range[numThreads]) {
+        workers.reserve(numThreads - 1);
+        for (size_t id = 1; id < numThreads; ++id)
+            workers.emplace_back([this, id] { workerLoop(id); });
+    }
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        start.notify_all();
+        for (auto &t : workers)
+            t.join();
+    }
+    // Whether the calling thread is running iterations of a job of any
+    // pool, in which case starting another job would deadlock.
+    static bool inside() { return insideJob; }
+    size_t size() const { return workers.size() + 1; }
+    // Calls `f(ctx, b, e)` on chunks of at most `g` iterations covering
+    // `[begin, end)`, using every thread of the pool including the caller,
+    // and returns once all have completed.
+    void parallelFor(TurboLoopBody f, void *ctx, int64_t begin, int64_t end,
+                     int64_t g) {
+        std::lock_guard<std::mutex> jobLock(jobMutex);
+        const size_t n = size();
+        const int64_t N = end - begin;
+        for (size_t id = 0; id < n; ++id) {
+            ranges[id].begin = begin + int64_t(id) * N / int64_t(n);
+            ranges[id].end = begin + int64_t(id + 1) * N / int64_t(n);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            body = f;
+            context = ctx;
+            grain = g;
+            active = n - 1;
+            ++generation;
+        }
+        start.notify_all();
+        insideJob = true;
+        work(0);
+        insideJob = false;
+        // other threads may still be running their last chunk
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return active == 0; });
+    }
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "./CostModeling.hpp"
+#include "./LinearAlgebra.hpp"
+#include "./LoopBlock.hpp"
+#include "./Math.hpp"
+#include "./Schedule.hpp"
+#include "./Unimodularization.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Debug.h>
+#include <numeric>
+
+#define DEBUG_TYPE "turbo-loop"
+
+// Wavefront schedules via skewing.
+// Stencils such as `A(i,j) = f(A(i-1,j), A(i,j-1))` carry a dependence on
+// every loop, so no loop can be vectorized or run in parallel as written.
+// When all dependencies of a loop nest are uniform (constant distance
+// vectors `d`), we search for a hyperplane `h` with `h * d >= 1` for every
+// non-zero `d`, and complete it to a unimodular transform `T` with first row
+// `h`. Loop independent dependencies (`d == 0`) are ordered within each
+// iteration, which the transform preserves, so they do not constrain `h`.
+// The new outer loop, `h * i`, then carries every dependence, and the
+// iterations of the inner loops within each wavefront are independent: they
+// may be vectorized, or run in parallel with a barrier between wavefronts.
+
+// Distances between the accesses in `members` along each of the first
+// `numLoops` schedule levels, one row per dependence; `None` if any is not
+// a compile time constant.
+llvm::Optional<IntMatrix> dependenceDistances(const LoopBlock &lblock,
+                                              llvm::ArrayRef<unsigned> members,
+                                              size_t numLoops) {
+    llvm::SmallVector<bool> inNest(lblock.memory.size());
+    for (auto m : members)
+        inNest[m] = true;
+    llvm::SmallVector<const Dependence *> deps;
+    for (auto &d : lblock.edges)
+        if (inNest[lblock.memoryIndex(d.in)] &&
+            inNest[lblock.memoryIndex(d.out)])
+            deps.push_back(&d);
+    IntMatrix D(deps.size(), numLoops);
+    for (size_t i = 0; i < deps.size(); ++i) {
+        for (size_t l = 0; l < numLoops; ++l) {
+            llvm::Optional<int64_t> dist =
+                CostModeling::levelDistance(*deps[i], l);
+            if (!dist)
+                return {};
+            D(i, l) = *dist;
+        }
+    }
+    return D;
+}
+
+// Searches for the hyperplane `h`, with coefficients in `0:maxCoef` and a
+// `gcd` of `1`, satisfying `h * D(i, :) >= 1` for all non-zero rows `i`,
+// preferring the smallest sum of coefficients, and then outer levels.
+llvm::Optional<llvm::SmallVector<int64_t>>
+wavefrontHyperplane(PtrMatrix<const int64_t> D, int64_t maxCoef = 4) {
+    const size_t numLoops = D.numCol();
+    llvm::SmallVector<size_t> rows;
+    for (size_t i = 0; i < D.numRow(); ++i)
+        for (size_t l = 0; l < numLoops; ++l)
+            if (D(i, l)) {
+                rows.push_back(i);
+                break;
+            }
+    llvm::SmallVector<int64_t> h(numLoops), best;
+    int64_t bestSum = std::numeric_limits<int64_t>::max();
+    // enumerate `h` as the digits of a base `maxCoef + 1` counter
+    while (true) {
+        int64_t sum = 0, g = 0;
+        for (auto c : h) {
+            sum += c;
+            g = std::gcd(g, c);
+        }
+        if ((sum < bestSum) && (g == 1)) {
+            bool satisfies = true;
+            for (size_t k = 0; (k < rows.size()) && satisfies; ++k) {
+                int64_t hd = 0;
+                for (size_t l = 0; l < numLoops; ++l)
+                    hd += h[l] * D(rows[k], l);
+                satisfies = hd >= 1;
+            }
+            if (satisfies) {
+                best = h;
+                bestSum = sum;
+            }
+        }
+        size_t l = 0;
+        for (; l < numLoops; ++l) {
+            if (h[l] < maxCoef) {
+                ++h[l];
+                break;
+            }
+            h[l] = 0;
+        }
+        if (l == numLoops)
+            break;
+    }
+    if (best.empty())
+        return {};
+    return best;
+}
+
+// A unimodular matrix whose first row is `h`; requires `gcd(h...) == 1`.
+llvm::Optional<SquareMatrix<int64_t>>
+completeUnimodular(llvm::ArrayRef<int64_t> h) {
+    const size_t N = h.size();
+    IntMatrix A(N, 1);
+    for (size_t i = 0; i < N; ++i)
+        A(i, 0) = h[i];
+    // `U * A == [1; 0; ...]`, so `A` is the first column of `inv(U)`
+    llvm::Optional<SquareMatrix<int64_t>> U = unimodularize(std::move(A));
+    if (!U)
+        return {};
+    llvm::Optional<SquareMatrix<int64_t>> Uinv = integerInverse(*U);
+    if (!Uinv)
+        return {};
+    SquareMatrix<int64_t> T(N);
+    for (size_t i = 0; i < N; ++i)
+        for (size_t j = 0; j < N; ++j)
+            T(i, j) = (*Uinv)(j, i);
+    for (size_t j = 0; j < N; ++j)
+        if (T(0, j) != h[j])
+            return {};
+    return T;
+}
+
+// Skews the schedules of `members`, a loop nest of depth `numLoops` not
+// fused with any other accesses, into a wavefront.
+// Returns `true` on failure, leaving the schedules unchanged.
+bool skewToWavefront(LoopBlock &lblock, llvm::ArrayRef<unsigned> members) {
+    const size_t numLoops = lblock.memory[members.front()].schedule.numLoops;
+    if (numLoops < 2)
+        return true;
+    llvm::Optional<IntMatrix> D =
+        dependenceDistances(lblock, members, numLoops);
+    if (!D)
+        return true;
+    llvm::Optional<llvm::SmallVector<int64_t>> h = wavefrontHyperplane(*D);
+    if (!h)
+        return true;
+    llvm::Optional<SquareMatrix<int64_t>> T = completeUnimodular(*h);
+    if (!T)
+        return true;
+    // new level `l` is `sum(T(l, k) * level_k)`
+    for (auto m : members) {
+        Schedule &sch = lblock.memory[m].schedule;
+        SquarePtrMatrix<int64_t> Phi = sch.getPhi();
+        SquareMatrix<int64_t> old(numLoops);
+        for (size_t i = 0; i < numLoops * numLoops; ++i)
+            old[i] = Phi[i];
+        for (size_t j = 0; j < numLoops; ++j) {
+            for (size_t l = 0; l < numLoops; ++l) {
+                int64_t x = 0;
+                for (size_t k = 0; k < numLoops; ++k)
+                    x += old(j, k) * (*T)(l, k);
+                Phi(j, l) = x;
+            }
+        }
+    }
+    return false;
+}
+
+// Skews each loop nest of `lblock` in which every loop carries a
+// dependence into a wavefront, where possible.
+// Requires `lblock.fillEdges()` to have been called; vectorization and
+// parallelization (`optimizeParallelism`) should run afterwards.
+void optimizeWavefronts(LoopBlock &lblock) {
+    for (auto &nest : CostModeling::loopNests(lblock)) {
+        const Schedule &sch = lblock.memory[nest.front()].schedule;
+        const size_t numLoops = sch.numLoops;
+        if (numLoops < 2)
+            continue;
+        // the outer most loop must not be shared with other accesses
+        bool shared = false;
+        llvm::SmallVector<bool> inNest(lblock.memory.size());
+        for (auto m : nest)
+            inNest[m] = true;
+        for (size_t i = 0; i < lblock.memory.size(); ++i)
+            shared |= !inNest[i] && (lblock.memory[i].schedule.getOmega()[0] ==
+                                     sch.getOmega()[0]);
+        if (shared)
+            continue;
+        bool allCarried = true;
+        for (size_t l = 0; (l < numLoops) && allCarried; ++l) {
+            bool carried = false;
+            for (auto &d : lblock.edges)
+                if (inNest[lblock.memoryIndex(d.in)] &&
+                    inNest[lblock.memoryIndex(d.out)])
+                    carried |= CostModeling::carriedBy(d, l);
+            allCarried = carried;
+        }
+        if (!allCarried)
+            continue;
+        if (skewToWavefront(lblock, nest))
+            LLVM_DEBUG(llvm::dbgs()
+                       << "Could not find a wavefront for a loop nest carrying "
+                          "dependencies on every loop.\n");
+    }
+}
+
+#undef DEBUG_TYPE
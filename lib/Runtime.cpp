@@ -0,0 +1,121 @@
+#include "../include/Runtime.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#ifdef TURBOLOOP_OPENMP
+#include <omp.h>
+#else
+#include "../include/ThreadPool.hpp"
+#endif
+
+// Runtime support for parallel loops. By default, we use a `ThreadPool`
+// with work stealing (see `ThreadPool.hpp`).
+// Defining `TURBOLOOP_OPENMP` instead forwards to the host's OpenMP runtime.
+
+namespace {
+
+static size_t defaultNumThreads() {
+    if (const char *env = std::getenv("TURBOLOOP_NUM_THREADS"))
+        if (long n = std::strtol(env, nullptr, 10); n > 0)
+            return size_t(n);
+    return std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+}
+
+static int64_t chooseGrain(int64_t begin, int64_t end, int64_t grain,
+                           size_t numThreads) {
+    if (grain > 0)
+        return grain;
+    // a few chunks per thread, so that stealing can balance the load
+    return std::max((end - begin) / int64_t(8 * numThreads), int64_t(1));
+}
+
+#ifndef TURBOLOOP_OPENMP
+
+static std::mutex poolMutex;
+static std::unique_ptr<ThreadPool> pool;
+static size_t requestedThreads = 0;
+
+static ThreadPool &getPool() {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!pool)
+        pool = std::make_unique<ThreadPool>(
+            requestedThreads ? requestedThreads : defaultNumThreads());
+    return *pool;
+}
+
+#else
+
+static thread_local bool insideParallelFor = false;
+
+#endif
+
+} // namespace
+
+extern "C" {
+
+#ifndef TURBOLOOP_OPENMP
+
+void turboloop_parallel_for(TurboLoopBody body, void *context, int64_t begin,
+                            int64_t end, int64_t grain) {
+    if (end <= begin)
+        return;
+    if (ThreadPool::inside()) {
+        body(context, begin, end);
+        return;
+    }
+    ThreadPool &p = getPool();
+    grain = chooseGrain(begin, end, grain, p.size());
+    if ((p.size() == 1) || (end - begin <= grain)) {
+        body(context, begin, end);
+        return;
+    }
+    p.parallelFor(body, context, begin, end, grain);
+}
+
+size_t turboloop_num_threads() { return getPool().size(); }
+
+void turboloop_set_num_threads(size_t numThreads) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    requestedThreads = numThreads;
+    pool.reset();
+}
+
+#else
+
+void turboloop_parallel_for(TurboLoopBody body, void *context, int64_t begin,
+                            int64_t end, int64_t grain) {
+    if (end <= begin)
+        return;
+    if (insideParallelFor) {
+        body(context, begin, end);
+        return;
+    }
+    const size_t numThreads = size_t(omp_get_max_threads());
+    grain = chooseGrain(begin, end, grain, numThreads);
+    if ((numThreads == 1) || (end - begin <= grain)) {
+        body(context, begin, end);
+        return;
+    }
+    const int64_t numChunks = (end - begin + grain - 1) / grain;
+#pragma omp parallel
+    {
+        insideParallelFor = true;
+#pragma omp for schedule(dynamic, 1)
+        for (int64_t c = 0; c < numChunks; ++c) {
+            int64_t b = begin + c * grain;
+            body(context, b, std::min(b + grain, end));
+        }
+        insideParallelFor = false;
+    }
+}
+
+size_t turboloop_num_threads() { return size_t(omp_get_max_threads()); }
+
+void turboloop_set_num_threads(size_t numThreads) {
+    omp_set_num_threads(int(numThreads ? numThreads : defaultNumThreads()));
+}
+
+#endif
+}
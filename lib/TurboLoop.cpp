@@ -1,10 +1,24 @@
 #include "../include/TurboLoop.hpp"
+#include "../include/AnalysisCache.hpp"
+#include "../include/BoundsChecks.hpp"
+#include "../include/CacheTiling.hpp"
+#include "../include/CodeGen.hpp"
+#include "../include/CompileBudget.hpp"
+#include "../include/IRExtraction.hpp"
+#include "../include/Instrumentation.hpp"
+#include "../include/Lowering.hpp"
+#include "../include/MemoryUse.hpp"
+#include "../include/Parallelization.hpp"
+#include "../include/Remarks.hpp"
+#include "../include/Serialization.hpp"
+#include "../include/Wavefront.hpp"
 #include <llvm/ADT/APInt.h>
 #include <llvm/ADT/DepthFirstIterator.h>
 #include <llvm/ADT/Statistic.h>
 #include <llvm/Analysis/AssumptionCache.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/LoopNestAnalysis.h>
+#include <llvm/Analysis/OptimizationRemarkEmitter.h>
 #include <llvm/Analysis/ScalarEvolution.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/Analysis/TargetTransformInfo.h>
@@ -14,10 +28,13 @@
 #include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
 #include <llvm/IR/PassManager.h>
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Passes/PassPlugin.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Debug.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Scalar/IndVarSimplify.h>
 #include <llvm/Transforms/Scalar/LoopRotation.h>
@@ -26,6 +43,8 @@
 #include <llvm/Transforms/Utils/LoopUtils.h>
 #include <llvm/Transforms/Utils/ScalarEvolutionExpander.h>
 
+#define DEBUG_TYPE "turbo-loop"
+
 // The TurboLoopPass represents each loop in function `F` using its own loop
 // representation, suitable for more aggressive analysis. However, the remaining
 // aspects of the function are still represented with `F`, which can answer
@@ -33,32 +52,128 @@
 // directly leads to another, which would be important for whether two loops may
 // be fused.
 
+// Cache parameters default to those reported by the target; these allow
+// overriding them, e.g. when the target does not know its cache sizes.
+static llvm::cl::opt<unsigned>
+    L1CacheBytes("turbo-loop-l1-cache-size", llvm::cl::init(0),
+                 llvm::cl::desc("L1 data cache size in bytes used for tiling"));
+static llvm::cl::opt<unsigned>
+    L2CacheBytes("turbo-loop-l2-cache-size", llvm::cl::init(0),
+                 llvm::cl::desc("L2 cache size in bytes used for tiling"));
+static llvm::cl::opt<unsigned> CacheLineBytes(
+    "turbo-loop-cache-line-size", llvm::cl::init(0),
+    llvm::cl::desc("cache line size in bytes used for tiling"));
+static llvm::cl::opt<bool> HoistBoundsChecks(
+    "turbo-loop-hoist-bounds-checks", llvm::cl::init(true),
+    llvm::cl::desc("version loop nests on their bounds checks, checked at "
+                   "the extreme iterations"));
+// Compile time budgets, in constraint rows produced by elimination and the
+// scheduler, and in seconds; `0` means unlimited. A loop nest exceeding its
+// budget, or the function's, is left untouched.
+static llvm::cl::opt<unsigned> FunctionMaxRows(
+    "turbo-loop-function-max-rows", llvm::cl::init(1000000),
+    llvm::cl::desc("constraint rows TurboLoop may produce per function"));
+static llvm::cl::opt<double> FunctionMaxSeconds(
+    "turbo-loop-function-max-seconds", llvm::cl::init(10.0),
+    llvm::cl::desc("seconds TurboLoop may spend per function"));
+static llvm::cl::opt<unsigned> LoopNestMaxRows(
+    "turbo-loop-nest-max-rows", llvm::cl::init(100000),
+    llvm::cl::desc("constraint rows TurboLoop may produce per loop nest"));
+static llvm::cl::opt<double> LoopNestMaxSeconds(
+    "turbo-loop-nest-max-seconds", llvm::cl::init(2.0),
+    llvm::cl::desc("seconds TurboLoop may spend per loop nest"));
+// Strongly connected components of a loop nest may be scheduled
+// concurrently; the compiler driving the pass may already run functions in
+// parallel, so this is opt-in.
+static llvm::cl::opt<unsigned> SchedulerThreads(
+    "turbo-loop-scheduler-threads", llvm::cl::init(1),
+    llvm::cl::desc("threads scheduling the components of a loop nest"));
+// Replacing loop nests by their schedules is opt-in, as is running parallel
+// loops through the runtime library, which the program must then link.
+static llvm::cl::opt<bool> EmitLoopNests(
+    "turbo-loop-codegen", llvm::cl::init(false),
+    llvm::cl::desc("replace loop nests by the loops of their schedules, "
+                   "versioned on alias checks if they access several arrays"));
+static llvm::cl::opt<bool> ParallelLoops(
+    "turbo-loop-parallel", llvm::cl::init(false),
+    llvm::cl::desc("with -turbo-loop-codegen, run parallel loops through "
+                   "turboloop_parallel_for, from the TurboLoop runtime; "
+                   "only when run as a module pass"));
+static llvm::cl::opt<std::string> AnalysisCachePath(
+    "turbo-loop-cache", llvm::cl::init(""),
+    llvm::cl::desc("file caching the schedules of loop nests across "
+                   "processes; empty disables the cache"));
+static llvm::cl::opt<std::string> CapturePath(
+    "turbo-loop-capture", llvm::cl::init(""),
+    llvm::cl::desc("append the loop blocks extracted, before scheduling, to "
+                   "this corpus, to replay them offline"));
+static llvm::cl::opt<bool> PrintStatistics(
+    "turbo-loop-stats", llvm::cl::init(false),
+    llvm::cl::desc("print TurboLoop's counters on exit, also with release "
+                   "builds of LLVM, where -stats does not"));
+// `llvm::errs()` may be destroyed before the plugin's statics, so this
+// writes to its own stream.
+static struct StatisticsPrinter {
+    ~StatisticsPrinter() {
+        if (!PrintStatistics)
+            return;
+        llvm::raw_fd_ostream os(2, false);
+        printPhaseStatistics(os);
+        if (trackingAllocations)
+            printAllocationStatistics(os);
+    }
+} statisticsPrinter;
+
+// Everything besides the loop nest that decides its schedule, for
+// `fingerprint`.
+static std::string cacheTarget(llvm::Function &F,
+                               const CostModeling::CacheParameters &cache) {
+    std::string target;
+    llvm::raw_string_ostream os(target);
+    os << F.getParent()->getTargetTriple() << ';'
+       << F.getFnAttribute("target-cpu").getValueAsString() << ';'
+       << F.getFnAttribute("target-features").getValueAsString() << ';'
+       << cache.lineBytes << ';' << cache.l1Bytes << ';' << cache.l2Bytes
+       << ';' << cache.occupancy;
+    return os.str();
+}
+
 llvm::PreservedAnalyses TurboLoopPass::run(llvm::Function &F,
                                            llvm::FunctionAnalysisManager &FAM) {
+    // the bodies we outlined are already lowered
+    if (F.hasFnAttribute(outlinedParallelLoop))
+        return llvm::PreservedAnalyses::all();
+    // symbols and facts are those of `F`
+    valueToPosetMap = ValueToPosetMap();
+    poset = PartiallyOrderedSet();
+    nestPosets.clear();
+    CompileBudget functionBudget("function",
+                                 {FunctionMaxRows, FunctionMaxSeconds});
+    BudgetScope budgetScope(&functionBudget);
     llvm::AssumptionCache &AC = FAM.getResult<llvm::AssumptionAnalysis>(F);
-    std::cout << "Assumptions:" << std::endl;
+    LLVM_DEBUG(llvm::dbgs() << "Assumptions:\n");
+    llvm::Optional<PhaseTimer> posetTimer;
+    posetTimer.emplace(Phase::POSetIngestion);
     for (auto &a : AC.assumptions()) {
-        llvm::errs() << *a << "\n";
         llvm::CallInst *Call = llvm::cast<llvm::CallInst>(a);
         llvm::Value *val = (Call->arg_begin()->get());
-        llvm::errs() << *val << "\n";
-        llvm::errs() << "Value id: " << val->getValueID() << "\n";
-        llvm::errs() << "Value name: " << val->getValueName() << "\n";
-        llvm::errs() << "name: " << val->getName() << "\n";
+        LLVM_DEBUG(llvm::dbgs() << *a << "\n"
+                                << *val << "\n"
+                                << "Value id: " << val->getValueID() << "\n"
+                                << "name: " << val->getName() << "\n");
         llvm::ICmpInst *icmp = llvm::dyn_cast<llvm::ICmpInst>(val);
         if (icmp) {
-            llvm::errs() << "icmp: " << *icmp << "\n";
             llvm::Value *op0 = icmp->getOperand(0);
             llvm::Value *op1 = icmp->getOperand(1);
-            llvm::errs() << "op0: " << *op0 << "\nop1: " << *op1 << "\n";
-            llvm::errs() << "op0 valueID: " << op0->getValueID()
-                         << "\nop1 valueID: " << op1->getValueID() << "\n";
-            llvm::errs() << "op0 valueName: " << op0->getValueName()
-                         << "\nop1 valueName: " << op1->getValueName() << "\n";
             size_t op0posID = valueToPosetMap.push(op0);
             size_t op1posID = valueToPosetMap.push(op1);
-            llvm::errs() << "op0posID: " << op0posID
-                         << "\nop1posID: " << op1posID << "\n";
+            LLVM_DEBUG(llvm::dbgs()
+                       << "icmp: " << *icmp << "\n"
+                       << "op0: " << *op0 << "\nop1: " << *op1 << "\n"
+                       << "op0 valueID: " << op0->getValueID()
+                       << "\nop1 valueID: " << op1->getValueID() << "\n"
+                       << "op0posID: " << op0posID
+                       << "\nop1posID: " << op1posID << "\n");
             switch (icmp->getPredicate()) {
             case llvm::CmpInst::ICMP_ULT:
                 // op0 < op1
@@ -96,14 +211,16 @@ llvm::PreservedAnalyses TurboLoopPass::run(llvm::Function &F,
                 // this is icmp, not fcmp!!!
                 break;
             }
-            if (icmp->isEquality()) {
-                llvm::errs() << *op0 << "\nand\n" << *op1 << "\nare equal!\n";
-            }
+            if (icmp->getPredicate() != llvm::CmpInst::ICMP_NE)
+                ++NumPOSetFacts;
+            if (icmp->getPredicate() == llvm::CmpInst::ICMP_EQ)
+                LLVM_DEBUG(llvm::dbgs() << *op0 << "\nand\n"
+                                        << *op1 << "\nare equal!\n");
         } else {
-            llvm::errs() << "not an icmp.\n";
+            LLVM_DEBUG(llvm::dbgs() << "not an icmp.\n");
         }
-        llvm::errs() << *Call << "\n";
     }
+    posetTimer.reset();
     // llvm::TargetLibraryInfo &TLI =
     // FAM.getResult<llvm::TargetLibraryAnalysis>(F);
     llvm::DominatorTree &DT = FAM.getResult<llvm::DominatorTreeAnalysis>(F);
@@ -111,12 +228,26 @@ llvm::PreservedAnalyses TurboLoopPass::run(llvm::Function &F,
     // ClassID 1: RegisterRC
     // TLI = &FAM.getResult<llvm::TargetLibraryAnalysis>(F);
     TTI = &FAM.getResult<llvm::TargetIRAnalysis>(F);
-    llvm::errs() << "DataLayout: " << F.getParent()->getDataLayout().getStringRepresentation() << "\n";
-    std::cout << "Scalar registers: " << TTI->getNumberOfRegisters(0) << std::endl;
-    std::cout << "Vector registers: " << TTI->getNumberOfRegisters(1) << std::endl;
+    LLVM_DEBUG(llvm::dbgs()
+               << "DataLayout: "
+               << F.getParent()->getDataLayout().getStringRepresentation()
+               << "\nScalar registers: " << TTI->getNumberOfRegisters(0)
+               << "\nVector registers: " << TTI->getNumberOfRegisters(1)
+               << "\n");
+    CostModeling::CacheParameters cache = CostModeling::CacheParameters::get(
+        *TTI, {CacheLineBytes, L1CacheBytes, L2CacheBytes});
+    LLVM_DEBUG(llvm::dbgs() << "L1 cache: " << cache.l1Bytes
+                            << " bytes; L2 cache: " << cache.l2Bytes
+                            << " bytes; cache line: " << cache.lineBytes
+                            << " bytes\n");
 
     LI = &FAM.getResult<llvm::LoopAnalysis>(F);
     SE = &FAM.getResult<llvm::ScalarEvolutionAnalysis>(F);
+    // Version loop nests on their bounds checks first, so that the loops we
+    // analyze are free of them, with the facts they establish in the posets
+    // of the versioned nests.
+    if (HoistBoundsChecks)
+        hoistBoundsChecks(*LI, *SE, DT, valueToPosetMap, poset, nestPosets);
     // DL = &F.getParent()->getDataLayout();
 
     // llvm::SCEVExpander rewriter(*SE, F.getParent()->getDataLayout(),
@@ -157,130 +288,113 @@ llvm::PreservedAnalyses TurboLoopPass::run(llvm::Function &F,
     //     affs.clear();
     // }
     
-    llvm::InductionDescriptor ID;
-    for (llvm::Loop *LP : *LI) {
-        auto *inductOuter = LP->getInductionVariable(*SE);
-        const llvm::SCEV *backEdgeTaken = nullptr;
-        if (inductOuter) {
-            llvm::errs() << "Outer InductionVariable: " << *inductOuter << "\n";
-            backEdgeTaken = SE->getBackedgeTakenCount(LP);
-            if (backEdgeTaken) {
-                llvm::errs()
-                    << "Back edge taken count: " << *backEdgeTaken
-                    << "\n\ttrip count: "
-                    << *(SE->getAddExpr(backEdgeTaken,
-                                      SE->getOne(backEdgeTaken->getType())))
-                    << "\n";
-            } else {
-                std::cout << "couldn't find backedge taken?\n";
+    // Convert the loop nests to our internal representation.
+    loopBlocks.clear();
+    llvm::OptimizationRemarkEmitter &ORE =
+        FAM.getResult<llvm::OptimizationRemarkEmitterAnalysis>(F);
+    extractLoopBlocks(loopBlocks, *LI, *SE, F.getParent()->getDataLayout(),
+                      valueToPosetMap, poset,
+                      {LoopNestMaxRows, LoopNestMaxSeconds}, &ORE,
+                      &nestPosets);
+    LLVM_DEBUG({
+        for (auto &eb : loopBlocks)
+            llvm::dbgs() << "Extracted a loop nest of depth "
+                         << eb->root->getLoopDepth() << " with "
+                         << eb->lblock.memory.size() << " memory accesses.\n";
+    });
+    // Schedule each loop nest, and choose its register and cache tiles,
+    // reporting the decisions, or what prevented them, as remarks.
+    // With a cache, loop nests scheduled before, by any process, skip the
+    // analysis; as their dependences are not computed, the remarks do not
+    // name the dependences carried.
+    static AnalysisCache analysisCache(AnalysisCachePath);
+    std::string target;
+    if (!AnalysisCachePath.empty())
+        target = cacheTarget(F, cache);
+    CostModeling::RegisterFile registers = CostModeling::RegisterFile::get(*TTI);
+    llvm::SmallVector<ExtractedLoopBlock *> scheduled;
+    for (auto &eb : loopBlocks) {
+        LoopBlock &lblock = eb->lblock;
+        if (!CapturePath.empty() &&
+            appendToCorpus(CapturePath, serialize(lblock)))
+            llvm::errs() << "turbo-loop: failed to capture to " << CapturePath
+                         << "\n";
+        std::string key;
+        if (!AnalysisCachePath.empty()) {
+            key = fingerprint(lblock, target);
+            llvm::Optional<std::string> value = analysisCache.lookup(key);
+            if (value && !restoreSchedules(lblock, *value)) {
+                emitScheduleRemarks(ORE, lblock, eb->root, eb->basePointers);
+                scheduled.push_back(eb.get());
+                continue;
             }
-        } else {
-            std::cout << "no outer induction variable" << std::endl;
         }
-        auto obouter = LP->getBounds(*SE);
-        if (obouter.hasValue()) {
-            auto b = obouter.getValue();
-            llvm::errs() << "\nOuter loop bounds: " << b.getInitialIVValue()
-                         << " : " << *b.getStepValue() << " : "
-                         << b.getFinalIVValue() << "\n";
-        } else {
-            std::cout << "Could not find outer loop bounds. =(" << std::endl;
+        CompileBudget budget("loop nest", {LoopNestMaxRows, LoopNestMaxSeconds},
+                             &functionBudget);
+        BudgetScope nestScope(&budget);
+        AllocationCounts allocatedBefore = allocationCounts();
+        resetPeakLiveBytes();
+        lblock.fillEdges();
+        bool failed = lblock.optimizeSchedules(SchedulerThreads);
+        if (ORE.allowExtraAnalysis(remarkPassName))
+            emitMemoryUseRemark(ORE, eb->root, memoryUse(lblock),
+                                allocationCounts() - allocatedBefore);
+        if (CompileBudget *exhausted = budget.exhausted()) {
+            ++NumLoopNestsOverBudget;
+            emitOverBudgetRemark(ORE, eb->root, *exhausted);
+            continue;
         }
-        int i = 0;
-        for (llvm::Loop *SubLP : depth_first(LP)) {
-            auto *induct = SubLP->getInductionVariable(*SE);
-            if (induct) {
-                if (inductOuter) {
-                    llvm::errs()
-                        << "Loop " << i++
-                        << " in outer InductionVariable: " << *induct << "\n";
-                    llvm::errs()
-                        << "innerInduct > outerInduct: "
-                        << SE->isKnownPredicate(
-                               llvm::CmpInst::Predicate::ICMP_SGT,
-                               SE->getSCEV(induct), SE->getSCEV(inductOuter))
-                        << "\n";
-                    llvm::errs()
-                        << "innerInduct == outerInduct: "
-                        << SE->isKnownPredicate(
-                               llvm::CmpInst::Predicate::ICMP_EQ,
-                               SE->getSCEV(induct), SE->getSCEV(inductOuter))
-                        << "\n";
-                    llvm::errs()
-                        << "innerInduct < outerInduct: "
-                        << SE->isKnownPredicate(
-                               llvm::CmpInst::Predicate::ICMP_SLT,
-                               SE->getSCEV(induct), SE->getSCEV(inductOuter))
-                        << "\n";
-                }
-            } else {
-                std::cout << "no inner induction variable?" << std::endl;
-            }
-            if (SubLP->getInductionDescriptor(*SE, ID)) {
-                std::cout << "Found induction descriptor" << std::endl;
-            } else {
-                std::cout << "no induction description" << std::endl;
-            }
-
-            auto ob = SubLP->getBounds(*SE);
-            if (ob.hasValue()) {
-                auto b = ob.getValue();
-                auto &inner_LB = b.getInitialIVValue();
-                auto &inner_UB = b.getFinalIVValue();
-
-                llvm::errs() << "\nLoop Bounds: " << inner_LB << " : "
-                             << *b.getStepValue() << " : " << inner_UB << "\n";
-                if (obouter.hasValue()) {
-                    auto ob = obouter.getValue();
-                    auto oLB = SE->getSCEV(&ob.getInitialIVValue());
-                    auto oUB = SE->getSCEV(&ob.getFinalIVValue());
-                    auto iLB = SE->getSCEV(&inner_LB);
-                    auto iUB = SE->getSCEV(&inner_UB);
-
-                    // both ob and ib have values
-                    llvm::errs() << "Loop " << i++
-                                 << " in bounds cmp: " << *induct << "\n";
-                    llvm::errs()
-                        << "inner_LB > outer_UB: "
-                        << SE->isKnownPredicate(
-                               llvm::CmpInst::Predicate::ICMP_SGT, iLB, oUB)
-                        << "\n";
-                    llvm::errs()
-                        << "inner_LB == outer_UB: "
-                        << SE->isKnownPredicate(
-                               llvm::CmpInst::Predicate::ICMP_EQ, iLB, oUB)
-                        << "\n";
-                    llvm::errs()
-                        << "inner_LB < outer_UB: "
-                        << SE->isKnownPredicate(
-                               llvm::CmpInst::Predicate::ICMP_SLT, iLB, oUB)
-                        << "\n";
-                    llvm::errs()
-                        << "inner_UB > outer_LB: "
-                        << SE->isKnownPredicate(
-                               llvm::CmpInst::Predicate::ICMP_SGT, iUB, oLB)
-                        << "\n";
-                    llvm::errs()
-                        << "inner_UB == outer_LB: "
-                        << SE->isKnownPredicate(
-                               llvm::CmpInst::Predicate::ICMP_EQ, iUB, oLB)
-                        << "\n";
-                    llvm::errs()
-                        << "inner_UB < outer_LB: "
-                        << SE->isKnownPredicate(
-                               llvm::CmpInst::Predicate::ICMP_SLT, iUB, oLB)
-                        << "\n";
-                }
-            } else {
-                std::cout << "loop bound didn't have value!?" << std::endl;
-            }
-            std::cout << "\n";
+        if (failed) {
+            emitScheduleFailureRemark(ORE, lblock, eb->root, eb->basePointers);
+            continue;
         }
+        optimizeWavefronts(lblock);
+        optimizeParallelism(lblock);
+        CostModeling::optimizeRegisterTiling(lblock, registers);
+        CostModeling::chooseVectorTails(lblock, *TTI);
+        CostModeling::optimizeCacheTiling(lblock, registers, cache);
+        if (!AnalysisCachePath.empty())
+            analysisCache.insert(std::move(key), encodeSchedules(lblock));
+        emitScheduleRemarks(ORE, lblock, eb->root, eb->basePointers);
+        scheduled.push_back(eb.get());
     }
-    
+    if (!EmitLoopNests)
+        return llvm::PreservedAnalyses::none();
+    // Lower the scheduled loop nests. The symbols were pushed by the
+    // extraction, so they are all values of `F`, alive until we delete
+    // loop nests. The function's budget may be exhausted by now, but the
+    // loop nests were scheduled within it, and lowering needs exact bounds.
+    BudgetScope unbudgeted(nullptr);
+    llvm::SmallVector<const llvm::SCEV *> symbolSCEVs;
+    for (ExtractedLoopBlock *eb : scheduled)
+        lowerLoopBlock(*eb, *LI, *SE, DT, valueToPosetMap, symbolSCEVs,
+                       ParallelLoops && outlineParallelLoops);
     return llvm::PreservedAnalyses::none();
     // return llvm::PreservedAnalyses::all();
 }
+llvm::PreservedAnalyses
+TurboLoopModulePass::run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM) {
+    llvm::FunctionAnalysisManager &FAM =
+        MAM.getResult<llvm::FunctionAnalysisManagerModuleProxy>(M)
+            .getManager();
+    // outlining appends to the module's functions
+    llvm::SmallVector<llvm::Function *> functions;
+    for (llvm::Function &F : M)
+        if (!F.isDeclaration())
+            functions.push_back(&F);
+    TurboLoopPass pass;
+    pass.outlineParallelLoops = true;
+    llvm::PreservedAnalyses PA = llvm::PreservedAnalyses::all();
+    for (llvm::Function *F : functions) {
+        llvm::PreservedAnalyses passPA = pass.run(*F, FAM);
+        FAM.invalidate(*F, passPA);
+        PA.intersect(std::move(passPA));
+    }
+    // each function's analyses were invalidated above
+    PA.preserveSet<llvm::AllAnalysesOn<llvm::Function>>();
+    PA.preserve<llvm::FunctionAnalysisManagerModuleProxy>();
+    return PA;
+}
 bool PipelineParsingCB(llvm::StringRef Name, llvm::FunctionPassManager &FPM,
                        llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
     if (Name == "turbo-loop") {
@@ -292,9 +406,28 @@ bool PipelineParsingCB(llvm::StringRef Name, llvm::FunctionPassManager &FPM,
     }
     return false;
 }
+// At the top level of a pipeline, `turbo-loop` is the module pass, which
+// may outline parallel loops; within `function(...)`, it is not.
+bool PipelineParsingCB(llvm::StringRef Name, llvm::ModulePassManager &MPM,
+                       llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
+    if (Name == "turbo-loop") {
+        MPM.addPass(TurboLoopModulePass());
+        return true;
+    }
+    return false;
+}
 
 void RegisterCB(llvm::PassBuilder &PB) {
-    PB.registerPipelineParsingCallback(PipelineParsingCB);
+    PB.registerPipelineParsingCallback(
+        [](llvm::StringRef Name, llvm::FunctionPassManager &FPM,
+           llvm::ArrayRef<llvm::PassBuilder::PipelineElement> Elements) {
+            return PipelineParsingCB(Name, FPM, Elements);
+        });
+    PB.registerPipelineParsingCallback(
+        [](llvm::StringRef Name, llvm::ModulePassManager &MPM,
+           llvm::ArrayRef<llvm::PassBuilder::PipelineElement> Elements) {
+            return PipelineParsingCB(Name, MPM, Elements);
+        });
 }
 
 extern "C" ::llvm::PassPluginLibraryInfo LLVM_ATTRIBUTE_WEAK
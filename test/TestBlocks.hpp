@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../include/ArrayReference.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/Loops.hpp"
+#include "../include/Math.hpp"
+#include "../include/POSet.hpp"
+#include "../include/Schedule.hpp"
+#include "../include/Symbolics.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/SmallVector.h>
+
+// Loop blocks built by hand, without IR.
+
+// The domain of a loop nest, built one loop at a time, outermost first.
+// `extractLoopNest` lists the lower bound of each loop before its upper
+// bound, as `lowerFirst` does; the analysis must not depend on the order,
+// so tests may build both.
+struct LoopNestBuilder {
+    bool lowerFirst;
+    IntMatrix A;
+    llvm::SmallVector<MPoly, 8> b;
+    PartiallyOrderedSet poset;
+    LoopNestBuilder(size_t numLoops, bool lowerFirst = true)
+        : lowerFirst(lowerFirst), A(2 * numLoops, numLoops), b(2 * numLoops) {}
+    // Bounds loop `d` by
+    // `lower + sum(lowerOuter[k] * x_k) <= x_d <= upper + sum(upperOuter[k] *
+    // x_k)` over the outer loops `k < d`.
+    LoopNestBuilder &bound(size_t d, MPoly lower, MPoly upper,
+                           llvm::ArrayRef<int64_t> lowerOuter = {},
+                           llvm::ArrayRef<int64_t> upperOuter = {}) {
+        const size_t lo = 2 * d + !lowerFirst, up = 2 * d + lowerFirst;
+        A(lo, d) = -1;
+        for (size_t k = 0; k < lowerOuter.size(); ++k)
+            A(lo, k) = lowerOuter[k];
+        b[lo] = -std::move(lower);
+        A(up, d) = 1;
+        for (size_t k = 0; k < upperOuter.size(); ++k)
+            A(up, k) = -upperOuter[k];
+        b[up] = std::move(upper);
+        return *this;
+    }
+    llvm::IntrusiveRefCntPtr<AffineLoopNest> nest() const {
+        return llvm::makeIntrusiveRefCnt<AffineLoopNest>(A, b, poset);
+    }
+};
+
+// A reference to array `arrayID` within `loop`, where dimension `dim` has
+// stride `strides[dim]`, and is indexed by loop `loops[dim]` plus
+// `offsets[dim]`.
+inline ArrayReference arrayRef(size_t arrayID,
+                               llvm::IntrusiveRefCntPtr<AffineLoopNest> loop,
+                               llvm::ArrayRef<size_t> loops,
+                               llvm::ArrayRef<MPoly> strides,
+                               llvm::ArrayRef<int64_t> offsets = {}) {
+    const size_t arrayDim = loops.size();
+    ArrayReference r{arrayID, std::move(loop), arrayDim};
+    PtrMatrix<int64_t> IndMat = r.indexMatrix();
+    for (size_t dim = 0; dim < arrayDim; ++dim) {
+        IndMat(loops[dim], dim) = 1;
+        r.stridesOffsets[dim] = std::make_pair(
+            strides[dim], MPoly(dim < offsets.size() ? offsets[dim] : 0));
+    }
+    return r;
+}
+
+// Appends an access of `r` to `lblock`, at position `omegas[l]` among the
+// statements `l` loops deep; further positions are `0`.
+// `edges` point into `memory`, so it must not reallocate after
+// `fillEdges()`.
+inline void pushAccess(LoopBlock &lblock, const ArrayReference &r,
+                       bool isLoad, llvm::ArrayRef<int64_t> omegas) {
+    Schedule sch(r.getNumLoops());
+    llvm::MutableArrayRef<int64_t> omega = sch.getOmega();
+    for (size_t l = 0; l < omegas.size(); ++l)
+        omega[2 * l] = omegas[l];
+    lblock.memory.emplace_back(r, nullptr, sch, isLoad);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "../include/IntegerMap.hpp"
+#include "../include/POSet.hpp"
+#include <gtest/gtest.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Value.h>
+#include <llvm/Support/SourceMgr.h>
+#include <memory>
+
+// A module parsed from textual IR, owning the context it lives in.
+struct ParsedModule {
+    llvm::LLVMContext ctx;
+    std::unique_ptr<llvm::Module> mod;
+    ParsedModule(const char *ir) {
+        llvm::SMDiagnostic err;
+        mod = llvm::parseAssemblyString(ir, err, ctx);
+        EXPECT_TRUE(mod) << err.getMessage().str();
+    }
+};
+
+// The function analyses the pass obtains from the analysis manager.
+struct Analyses {
+    llvm::TargetLibraryInfoImpl TLII;
+    llvm::TargetLibraryInfo TLI;
+    llvm::AssumptionCache AC;
+    llvm::DominatorTree DT;
+    llvm::LoopInfo LI;
+    llvm::ScalarEvolution SE;
+    Analyses(llvm::Function &F)
+        : TLII(llvm::Triple(F.getParent()->getTargetTriple())), TLI(TLII),
+          AC(F), DT(F), LI(DT), SE(F, TLI, AC, DT, LI) {}
+};
+
+// `0 <= n <= m`, so that the columns of `A[i + m*j]`, for `i < n`, do not
+// overlap.
+inline void pushColumnFacts(ValueToPosetMap &symbols,
+                            PartiallyOrderedSet &poset, llvm::Value *m,
+                            llvm::Value *n) {
+    size_t mID = symbols.push(m), nID = symbols.push(n);
+    poset.push(0, nID, Interval::nonNegative());
+    poset.push(nID, mID, Interval::nonNegative());
+}
@@ -0,0 +1,263 @@
+#include "../include/AnalysisCache.hpp"
+#include "../include/IRExtraction.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/POSet.hpp"
+#include "./TestIR.hpp"
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
+#include <string>
+
+// `@scale` and `@scale2` are the same kernel, `A[i + m*j] *= 2` for
+// `j in 0:n-1, i in 0:j`, with their symbols in a different order;
+// `@scaleT` accesses `A[j + m*i]` instead, and `@scaleF` scales floats.
+static const char *kernelsIR = R"(
+define void @scale(double* %A, i64 %m, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %j = phi i64 [ 0, %entry ], [ %jnext, %outer.latch ]
+  %mj = mul nsw i64 %m, %j
+  br label %inner
+
+inner:
+  %i = phi i64 [ 0, %outer ], [ %inext, %inner ]
+  %idx = add nsw i64 %i, %mj
+  %p = getelementptr inbounds double, double* %A, i64 %idx
+  %x = load double, double* %p
+  %y = fmul double %x, 2.0
+  store double %y, double* %p
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp sle i64 %inext, %j
+  br i1 %ic, label %inner, label %outer.latch
+
+outer.latch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %outer, label %exit
+
+exit:
+  ret void
+}
+
+define void @scale2(i64 %n, i64 %m, double* %A) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %j = phi i64 [ 0, %entry ], [ %jnext, %outer.latch ]
+  %mj = mul nsw i64 %m, %j
+  br label %inner
+
+inner:
+  %i = phi i64 [ 0, %outer ], [ %inext, %inner ]
+  %idx = add nsw i64 %i, %mj
+  %p = getelementptr inbounds double, double* %A, i64 %idx
+  %x = load double, double* %p
+  %y = fmul double %x, 2.0
+  store double %y, double* %p
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp sle i64 %inext, %j
+  br i1 %ic, label %inner, label %outer.latch
+
+outer.latch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %outer, label %exit
+
+exit:
+  ret void
+}
+
+define void @scaleT(double* %A, i64 %m, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %j = phi i64 [ 0, %entry ], [ %jnext, %outer.latch ]
+  br label %inner
+
+inner:
+  %i = phi i64 [ 0, %outer ], [ %inext, %inner ]
+  %mi = mul nsw i64 %m, %i
+  %idx = add nsw i64 %j, %mi
+  %p = getelementptr inbounds double, double* %A, i64 %idx
+  %x = load double, double* %p
+  %y = fmul double %x, 2.0
+  store double %y, double* %p
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp sle i64 %inext, %j
+  br i1 %ic, label %inner, label %outer.latch
+
+outer.latch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %outer, label %exit
+
+exit:
+  ret void
+}
+
+define void @scaleF(float* %A, i64 %m, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %j = phi i64 [ 0, %entry ], [ %jnext, %outer.latch ]
+  %mj = mul nsw i64 %m, %j
+  br label %inner
+
+inner:
+  %i = phi i64 [ 0, %outer ], [ %inext, %inner ]
+  %idx = add nsw i64 %i, %mj
+  %p = getelementptr inbounds float, float* %A, i64 %idx
+  %x = load float, float* %p
+  %y = fmul float %x, 2.0
+  store float %y, float* %p
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp sle i64 %inext, %j
+  br i1 %ic, label %inner, label %outer.latch
+
+outer.latch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %outer, label %exit
+
+exit:
+  ret void
+}
+)";
+
+// The loop blocks of the functions of `kernelsIR`, sharing their symbols.
+struct Kernels : ParsedModule {
+    ValueToPosetMap symbols;
+    PartiallyOrderedSet poset;
+    // `m - n`, pushed to `poset` for each kernel
+    Interval columnGap = Interval::nonNegative();
+    Kernels() : ParsedModule(kernelsIR) {}
+    std::unique_ptr<ExtractedLoopBlock> extract(const char *name) {
+        llvm::Function *F = mod->getFunction(name);
+        Analyses an(*F);
+        // `0 <= n <= m`, so that `A`'s columns are delinearized, and
+        // `columnGap`
+        size_t m = 0, n = 0;
+        for (llvm::Argument &arg : F->args()) {
+            if (arg.getName() == "m")
+                m = symbols.push(&arg);
+            else if (arg.getName() == "n")
+                n = symbols.push(&arg);
+        }
+        poset.push(0, n, Interval::nonNegative());
+        poset.push(n, m, columnGap);
+        llvm::SmallVector<std::unique_ptr<ExtractedLoopBlock>> blocks;
+        extractLoopBlocks(blocks, an.LI, an.SE, mod->getDataLayout(), symbols,
+                          poset);
+        EXPECT_EQ(blocks.size(), size_t(1));
+        return std::move(blocks.front());
+    }
+};
+
+TEST(AnalysisCacheTest, Fingerprint) {
+    Kernels k;
+    auto scale = k.extract("scale");
+    auto scale2 = k.extract("scale2");
+    auto scaleT = k.extract("scaleT");
+    // the symbols of `@scale2` are numbered differently
+    EXPECT_NE(k.symbols.getForward(
+                  k.mod->getFunction("scale")->getArg(1)),
+              k.symbols.getForward(k.mod->getFunction("scale2")->getArg(1)));
+    std::string key = fingerprint(scale->lblock, "x86_64;skylake");
+    EXPECT_EQ(key, fingerprint(scale2->lblock, "x86_64;skylake"));
+    EXPECT_NE(key, fingerprint(scaleT->lblock, "x86_64;skylake"));
+    // the element type decides the vector width
+    auto scaleF = k.extract("scaleF");
+    EXPECT_NE(key, fingerprint(scaleF->lblock, "x86_64;skylake"));
+    EXPECT_NE(key, fingerprint(scale->lblock, "x86_64;znver3"));
+    // `m` is only seen in the strides, after the loop nest, yet its
+    // relations are part of the key
+    Kernels narrow;
+    narrow.columnGap = Interval{0, 8};
+    EXPECT_NE(key,
+              fingerprint(narrow.extract("scale")->lblock, "x86_64;skylake"));
+
+    // schedules found for `@scale` apply to `@scale2`
+    LoopBlock &lblock = scale->lblock;
+    lblock.fillEdges();
+    EXPECT_FALSE(lblock.optimizeSchedules(1));
+    for (auto &ma : lblock.memory) {
+        ma.schedule.vectorized = 1;
+        ma.schedule.vectorWidth = 8;
+        ma.schedule.tileL1 = {16, 64};
+    }
+    std::string value = encodeSchedules(lblock);
+    EXPECT_FALSE(restoreSchedules(scale2->lblock, value));
+    for (size_t i = 0; i < lblock.memory.size(); ++i) {
+        const Schedule &x = lblock.memory[i].schedule;
+        const Schedule &y = scale2->lblock.memory[i].schedule;
+        EXPECT_EQ(x.data, y.data);
+        EXPECT_EQ(y.vectorized, 1);
+        EXPECT_EQ(y.vectorWidth, 8);
+        EXPECT_EQ(x.tileL1, y.tileL1);
+        EXPECT_TRUE(y.tileL2.empty());
+    }
+    // truncated values are rejected, leaving the schedules untouched
+    EXPECT_TRUE(restoreSchedules(scaleT->lblock,
+                                 llvm::StringRef(value).drop_back()));
+    EXPECT_EQ(scaleT->lblock.memory[0].schedule.vectorized, -1);
+}
+
+TEST(AnalysisCacheTest, Persistence) {
+    llvm::SmallString<128> dir;
+    ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("analysis_cache", dir));
+    std::string path = (dir + "/schedules").str();
+    {
+        AnalysisCache a(path);
+        EXPECT_FALSE(a.lookup("k0"));
+        a.insert("k0", "v0");
+        EXPECT_EQ(a.lookup("k0"), std::string("v0"));
+        EXPECT_FALSE(a.flush());
+        // another process finds it, and adds its own entries
+        AnalysisCache b(path);
+        EXPECT_EQ(b.lookup("k0"), std::string("v0"));
+        for (size_t i = 1; i < 100; ++i)
+            b.insert("k" + std::to_string(i), "v" + std::to_string(i));
+        EXPECT_FALSE(b.flush());
+        // which are merged when the first writes again
+        a.insert("k100", "v100");
+        EXPECT_FALSE(a.flush());
+        EXPECT_EQ(a.lookup("k50"), std::string("v50"));
+    }
+    AnalysisCache c(path);
+    EXPECT_EQ(c.numEntries, size_t(101));
+    for (size_t i = 0; i <= 100; ++i)
+        EXPECT_EQ(c.lookup("k" + std::to_string(i)),
+                  "v" + std::to_string(i));
+    EXPECT_FALSE(c.lookup("k101"));
+    // a corrupt file, here with an index past its end, is ignored, and
+    // replaced on the next write
+    {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(path, ec);
+        os.write(AnalysisCacheFormat::magic, 8);
+        os.write("\x01\0\0\0\xff\xff\xff\xff", 8);
+    }
+    AnalysisCache d(path);
+    EXPECT_FALSE(d.lookup("k0"));
+    d.insert("k0", "w0");
+    EXPECT_FALSE(d.flush());
+    EXPECT_EQ(AnalysisCache(path).lookup("k0"), std::string("w0"));
+    llvm::sys::fs::remove_directories(dir);
+}
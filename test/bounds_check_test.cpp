@@ -0,0 +1,288 @@
+#include "../include/BoundsChecks.hpp"
+#include "../include/IntegerMap.hpp"
+#include "../include/POSet.hpp"
+#include "./TestIR.hpp"
+#include <csetjmp>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/TargetSelect.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// `for i in 0:n-1, j in 0:m-1; A[i*m+j] = i*m+j; end`, with a check of
+// `i*m+j < len` each iteration, as emitted for a linearly indexed array.
+// Failed checks call `@boundserror`, which does not return.
+static const char *linearIndexIR = R"(
+declare void @boundserror(i64) noreturn
+
+define void @fill(i64* %A, i64 %len, i64 %n, i64 %m) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  %guardm = icmp sgt i64 %m, 0
+  %g = and i1 %guard, %guardm
+  br i1 %g, label %outer.ph, label %exit
+
+outer.ph:
+  br label %outer
+
+outer:
+  %i = phi i64 [ 0, %outer.ph ], [ %inext, %outer.latch ]
+  %im = mul nsw i64 %i, %m
+  br label %inner
+
+inner:
+  %j = phi i64 [ 0, %outer ], [ %jnext, %inbounds ]
+  %idx = add nsw i64 %im, %j
+  %check = icmp ult i64 %idx, %len
+  br i1 %check, label %inbounds, label %oob
+
+inbounds:
+  %p = getelementptr inbounds i64, i64* %A, i64 %idx
+  store i64 %idx, i64* %p
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %m
+  br i1 %jc, label %inner, label %outer.latch
+
+outer.latch:
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp slt i64 %inext, %n
+  br i1 %ic, label %outer, label %exit.loopexit
+
+oob:
+  %idx.lcssa = phi i64 [ %idx, %inner ]
+  call void @boundserror(i64 %idx.lcssa)
+  unreachable
+
+exit.loopexit:
+  br label %exit
+
+exit:
+  ret void
+}
+)";
+
+static std::jmp_buf boundsErrorJump;
+static int64_t boundsErrorIndex;
+extern "C" void boundsErrorHook(int64_t idx) {
+    boundsErrorIndex = idx;
+    std::longjmp(boundsErrorJump, 1);
+}
+
+struct ParsedFunction : ParsedModule {
+    llvm::Function *F;
+    ParsedFunction(const char *ir, const char *name)
+        : ParsedModule(ir), F(mod ? mod->getFunction(name) : nullptr) {}
+};
+
+size_t countBranchesTo(llvm::Loop *L, llvm::StringRef prefix) {
+    size_t count = 0;
+    for (auto BB : L->blocks())
+        for (auto succ : llvm::successors(BB))
+            count += succ->getName().startswith(prefix);
+    return count;
+}
+
+TEST(BoundsCheckTest, FindAndExtremes) {
+    ParsedFunction pf(linearIndexIR, "fill");
+    ASSERT_TRUE(pf.F);
+    Analyses an(*pf.F);
+    ASSERT_EQ(an.LI.getTopLevelLoops().size(), size_t(1));
+    llvm::Loop *outer = an.LI.getTopLevelLoops().front();
+    llvm::Loop *inner = outer->getSubLoops().front();
+    llvm::SmallVector<BoundsCheck> checks = findBoundsChecks(outer, an.SE);
+    ASSERT_EQ(checks.size(), size_t(1));
+    EXPECT_EQ(checks[0].pred, llvm::CmpInst::ICMP_ULT);
+    EXPECT_EQ(checks[0].inBounds, 0u);
+    // `0`, `m-1`, `(n-1)*m`, `(n-1)*m + m-1`
+    llvm::Type *i128 = llvm::Type::getInt128Ty(pf.ctx);
+    llvm::SmallVector<const llvm::SCEV *> extremes =
+        extremeValues(checks[0].lhs, inner, outer, i128, an.SE);
+    EXPECT_EQ(extremes.size(), size_t(4));
+    for (auto e : extremes) {
+        EXPECT_TRUE(an.SE.isLoopInvariant(e, outer));
+        EXPECT_EQ(e->getType(), i128);
+    }
+    // the index is not invariant in the inner loop alone
+    EXPECT_EQ(extremeValues(checks[0].lhs, inner, inner, i128, an.SE).size(),
+              size_t(2));
+}
+
+TEST(BoundsCheckTest, HoistLinearIndex) {
+    ParsedFunction pf(linearIndexIR, "fill");
+    ASSERT_TRUE(pf.F);
+    ValueToPosetMap valueToPosetMap;
+    PartiallyOrderedSet poset;
+    NestPosets nestPosets;
+    llvm::Loop *fast;
+    {
+        Analyses an(*pf.F);
+        fast = an.LI.getTopLevelLoops().front();
+        EXPECT_TRUE(hoistBoundsChecks(an.LI, an.SE, an.DT, valueToPosetMap,
+                                      poset, nestPosets));
+        EXPECT_FALSE(llvm::verifyFunction(*pf.F, &llvm::errs()));
+        EXPECT_TRUE(an.DT.verify());
+        // the original nest is the fast version, without checks
+        ASSERT_EQ(an.LI.getTopLevelLoops().size(), size_t(2));
+        size_t checked = 0, unchecked = 0;
+        for (auto L : an.LI.getTopLevelLoops()) {
+            size_t n = countBranchesTo(L, "oob");
+            checked += n != 0;
+            unchecked += n == 0;
+        }
+        EXPECT_EQ(checked, size_t(1));
+        EXPECT_EQ(unchecked, size_t(1));
+        // the hoisted checks are now all outside of loops, and only the
+        // clone's remain, so nothing more is hoisted
+        Analyses again(*pf.F);
+        NestPosets none;
+        EXPECT_FALSE(hoistBoundsChecks(again.LI, again.SE, again.DT,
+                                       valueToPosetMap, poset, none));
+        EXPECT_TRUE(none.empty());
+    }
+    // within the fast version, `len`, compared to the constant first index,
+    // is known positive; this is not known outside of it
+    size_t len = valueToPosetMap.getForward(pf.F->getArg(1));
+    ASSERT_NE(len, size_t(0));
+    ASSERT_EQ(nestPosets.size(), size_t(1));
+    ASSERT_TRUE(nestPosets.count(fast));
+    EXPECT_TRUE(nestPosets[fast](0, len).lowerBound >= 1);
+    EXPECT_FALSE(poset(0, len).lowerBound >= 1);
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    std::string error;
+    std::unique_ptr<llvm::ExecutionEngine> EE(
+        llvm::EngineBuilder(std::move(pf.mod))
+            .setEngineKind(llvm::EngineKind::JIT)
+            .setErrorStr(&error)
+            .create());
+    ASSERT_TRUE(EE) << error;
+    EE->addGlobalMapping("boundserror",
+                         reinterpret_cast<uint64_t>(&boundsErrorHook));
+    auto *fill = reinterpret_cast<void (*)(int64_t *, int64_t, int64_t,
+                                           int64_t)>(
+        EE->getFunctionAddress("fill"));
+    ASSERT_TRUE(fill);
+    // in bounds: takes the unchecked version
+    std::vector<int64_t> A(64, -1);
+    if (!setjmp(boundsErrorJump)) {
+        fill(A.data(), 12, 3, 4);
+    } else {
+        ADD_FAILURE() << "unexpected bounds error at " << boundsErrorIndex;
+    }
+    for (int64_t k = 0; k < 12; ++k)
+        EXPECT_EQ(A[k], k);
+    EXPECT_EQ(A[12], -1);
+    // out of bounds: the error is raised at the first bad index, after all
+    // earlier iterations ran
+    std::fill(A.begin(), A.end(), -1);
+    boundsErrorIndex = -1;
+    if (!setjmp(boundsErrorJump)) {
+        fill(A.data(), 10, 3, 4);
+        ADD_FAILURE() << "expected a bounds error";
+    }
+    EXPECT_EQ(boundsErrorIndex, 10);
+    for (int64_t k = 0; k < 10; ++k)
+        EXPECT_EQ(A[k], k);
+    EXPECT_EQ(A[10], -1);
+}
+
+// `s = 0; for i in 0:n-1; s += A[i]; end; return s`, checking `i < len`.
+// Not in LCSSA form: `%snext` is used after the loop's exit block, and `%i`
+// in the block raising the error.
+static const char *sumIR = R"(
+declare void @boundserror(i64) noreturn
+
+define i64 @sum(i64* %A, i64 %len, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %loop.ph, label %empty
+
+loop.ph:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %loop.ph ], [ %inext, %inbounds ]
+  %s = phi i64 [ 0, %loop.ph ], [ %snext, %inbounds ]
+  %check = icmp ult i64 %i, %len
+  br i1 %check, label %inbounds, label %oob
+
+inbounds:
+  %p = getelementptr inbounds i64, i64* %A, i64 %i
+  %a = load i64, i64* %p
+  %snext = add i64 %s, %a
+  %inext = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %inext, %n
+  br i1 %c, label %loop, label %loop.exit
+
+oob:
+  call void @boundserror(i64 %i)
+  unreachable
+
+loop.exit:
+  br label %done
+
+done:
+  ret i64 %snext
+
+empty:
+  ret i64 0
+}
+)";
+
+TEST(BoundsCheckTest, HoistWithoutLCSSA) {
+    ParsedFunction pf(sumIR, "sum");
+    ASSERT_TRUE(pf.F);
+    ValueToPosetMap valueToPosetMap;
+    PartiallyOrderedSet poset;
+    NestPosets nestPosets;
+    {
+        Analyses an(*pf.F);
+        ASSERT_FALSE(an.LI.getTopLevelLoops().front()->isRecursivelyLCSSAForm(
+            an.DT, an.LI));
+        EXPECT_TRUE(hoistBoundsChecks(an.LI, an.SE, an.DT, valueToPosetMap,
+                                      poset, nestPosets));
+        ASSERT_FALSE(llvm::verifyFunction(*pf.F, &llvm::errs()));
+        EXPECT_TRUE(an.DT.verify());
+        EXPECT_EQ(an.LI.getTopLevelLoops().size(), size_t(2));
+    }
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    std::string error;
+    std::unique_ptr<llvm::ExecutionEngine> EE(
+        llvm::EngineBuilder(std::move(pf.mod))
+            .setEngineKind(llvm::EngineKind::JIT)
+            .setErrorStr(&error)
+            .create());
+    ASSERT_TRUE(EE) << error;
+    EE->addGlobalMapping("boundserror",
+                         reinterpret_cast<uint64_t>(&boundsErrorHook));
+    auto *sum = reinterpret_cast<int64_t (*)(int64_t *, int64_t, int64_t)>(
+        EE->getFunctionAddress("sum"));
+    ASSERT_TRUE(sum);
+    std::vector<int64_t> A(16);
+    for (int64_t k = 0; k < 16; ++k)
+        A[k] = k + 1;
+    // both versions return the sum computed in their loop
+    if (!setjmp(boundsErrorJump)) {
+        EXPECT_EQ(sum(A.data(), 16, 10), 55);
+        EXPECT_EQ(sum(A.data(), 16, 0), 0);
+    } else {
+        ADD_FAILURE() << "unexpected bounds error at " << boundsErrorIndex;
+    }
+    boundsErrorIndex = -1;
+    if (!setjmp(boundsErrorJump)) {
+        sum(A.data(), 4, 10);
+        ADD_FAILURE() << "expected a bounds error";
+    }
+    EXPECT_EQ(boundsErrorIndex, 4);
+}
@@ -0,0 +1,751 @@
+#include "../include/AliasChecks.hpp"
+#include "../include/ArrayReference.hpp"
+#include "../include/CodeGen.hpp"
+#include "../include/CompileBudget.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/Loops.hpp"
+#include "../include/Math.hpp"
+#include "../include/POSet.hpp"
+#include "../include/Schedule.hpp"
+#include "../include/Symbolics.hpp"
+#include "./TestBlocks.hpp"
+#include "./TestIR.hpp"
+#include <array>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/TargetSelect.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// `void scan(i64 N, i64 *trace, i64 *arrays...)`; statements append to
+// `trace[1:]`, with `trace[0]` the number of entries written.
+struct ScanFunction {
+    llvm::LLVMContext ctx;
+    std::unique_ptr<llvm::Module> mod;
+    llvm::Function *F;
+    llvm::IntegerType *i64;
+    ScanFunction(size_t numArrays = 0)
+        : mod(std::make_unique<llvm::Module>("codegen", ctx)) {
+        i64 = llvm::Type::getInt64Ty(ctx);
+        llvm::SmallVector<llvm::Type *> params(
+            2 + numArrays, llvm::PointerType::getUnqual(i64));
+        params[0] = i64;
+        F = llvm::Function::Create(
+            llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), params, false),
+            llvm::Function::ExternalLinkage, "scan", *mod);
+    }
+    // Appends `tag * 10000 + sum(ivs[k] * 100^(n-1-k))` to the trace.
+    LoopNestCodeGen::Body trace(int64_t tag) {
+        return [this, tag](llvm::IRBuilder<> &builder,
+                           llvm::ArrayRef<llvm::Value *> ivs,
+                           const VectorLanes &) {
+            llvm::Value *out = F->getArg(1);
+            llvm::Value *x = builder.getInt64(tag);
+            for (auto iv : ivs)
+                x = builder.CreateAdd(builder.CreateMul(x, builder.getInt64(100)),
+                                      iv);
+            llvm::Value *n = builder.CreateLoad(i64, out);
+            llvm::Value *next = builder.CreateAdd(n, builder.getInt64(1));
+            builder.CreateStore(x, builder.CreateGEP(i64, out, next));
+            builder.CreateStore(next, out);
+        };
+    }
+    // Stores `100 * i + j` to `out[1 + 16 * i + j]`.
+    LoopNestCodeGen::Body fill() {
+        return [this](llvm::IRBuilder<> &builder,
+                      llvm::ArrayRef<llvm::Value *> ivs,
+                      const VectorLanes &lanes) {
+            auto lane = [&](size_t d) {
+                return laneValues(builder, ivs[d],
+                                  lanes.isScalar() ? 0 : lanes.step[d], lanes);
+            };
+            llvm::Value *x = builder.CreateAdd(
+                builder.CreateMul(lane(0), broadcast(builder,
+                                                     builder.getInt64(100),
+                                                     lanes)),
+                lane(1));
+            llvm::Value *offset = builder.CreateAdd(
+                builder.CreateMul(ivs[0], builder.getInt64(16)),
+                builder.CreateAdd(ivs[1], builder.getInt64(1)));
+            emitStore(builder, x, builder.CreateGEP(i64, F->getArg(1), offset),
+                      lanes);
+        };
+    }
+    std::unique_ptr<llvm::ExecutionEngine> EE;
+    // Compiles `scan`, returning its address.
+    uint64_t compile() {
+        EXPECT_FALSE(llvm::verifyFunction(*F, &llvm::errs()));
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        std::string error;
+        EE.reset(llvm::EngineBuilder(std::move(mod))
+                     .setEngineKind(llvm::EngineKind::JIT)
+                     .setErrorStr(&error)
+                     .create());
+        EXPECT_TRUE(EE) << error;
+        return EE ? EE->getFunctionAddress("scan") : 0;
+    }
+    // Compiles `scan`, and runs `scan(N, out)`.
+    void run(int64_t N, int64_t *out) {
+        auto *scan = reinterpret_cast<void (*)(int64_t, int64_t *)>(compile());
+        ASSERT_TRUE(scan);
+        scan(N, out);
+    }
+    // Runs `scan(N, trace)`.
+    std::vector<int64_t> run(int64_t N) {
+        std::vector<int64_t> trace(1 + 4096);
+        run(N, trace.data());
+        trace.resize(1 + trace[0]);
+        trace.erase(trace.begin());
+        return trace;
+    }
+};
+
+// 0 <= i <= N-1, 0 <= j <= i
+llvm::IntrusiveRefCntPtr<AffineLoopNest> triangle() {
+    auto N = Polynomial::Monomial(Polynomial::ID{1});
+    return LoopNestBuilder(2).bound(0, 0, N - 1).bound(1, 0, 0, {}, {1}).nest();
+}
+
+// 0 <= i <= N-1, 0 <= j <= N-1
+llvm::IntrusiveRefCntPtr<AffineLoopNest> square() {
+    auto N = Polynomial::Monomial(Polynomial::ID{1});
+    return LoopNestBuilder(2).bound(0, 0, N - 1).bound(1, 0, N - 1).nest();
+}
+
+// Expected trace of `trace(0)` over the triangle, visited in the order of
+// `key(i, j)`.
+template <typename F> std::vector<int64_t> expectedTriangle(int64_t N, F key) {
+    std::vector<std::pair<std::pair<int64_t, int64_t>, int64_t>> points;
+    for (int64_t i = 0; i < N; ++i)
+        for (int64_t j = 0; j <= i; ++j)
+            points.emplace_back(key(i, j), i * 100 + j);
+    std::sort(points.begin(), points.end());
+    std::vector<int64_t> trace;
+    for (auto &p : points)
+        trace.push_back(p.second);
+    return trace;
+}
+
+// Emits `aln`, scheduled by `sch`, into `sf`.
+void emitLoopNest(ScanFunction &sf, const AffineLoopNest &aln,
+                  const Schedule &sch, LoopNestCodeGen::Body body) {
+    llvm::BasicBlock *entry =
+        llvm::BasicBlock::Create(sf.ctx, "entry", sf.F);
+    llvm::BasicBlock *exit = llvm::BasicBlock::Create(sf.ctx, "exit", sf.F);
+    llvm::IRBuilder<> builder(entry);
+    builder.CreateStore(builder.getInt64(0), sf.F->getArg(1));
+    builder.CreateBr(exit);
+    builder.SetInsertPoint(exit);
+    builder.CreateRetVoid();
+    Analyses an(*sf.F);
+    const llvm::SCEV *symbols[2] = {nullptr, an.SE.getSCEV(sf.F->getArg(0))};
+    LoopNestCodeGen codegen(an.SE, sf.mod->getDataLayout(), symbols, sf.i64);
+    EXPECT_FALSE(codegen.addStatement(aln, sch, std::move(body)));
+    EXPECT_FALSE(codegen.emit(entry));
+}
+
+// Emits the triangle, scheduled by `sch`, into `sf`.
+void emitTriangle(ScanFunction &sf, const Schedule &sch,
+                  LoopNestCodeGen::Body body) {
+    emitLoopNest(sf, *triangle(), sch, std::move(body));
+}
+
+std::vector<int64_t> scanTriangle(const Schedule &sch, int64_t N) {
+    ScanFunction sf;
+    emitTriangle(sf, sch, sf.trace(0));
+    return sf.run(N);
+}
+
+TEST(CodeGenTriangle, BasicAssertions) {
+    const int64_t N = 7;
+    Schedule identity(2);
+    EXPECT_EQ(scanTriangle(identity, N),
+              expectedTriangle(N, [](int64_t i, int64_t j) {
+                  return std::make_pair(i, j);
+              }));
+    // interchange: `j` outside
+    Schedule interchange(2);
+    interchange.getPhi()(0, 0) = 0;
+    interchange.getPhi()(1, 0) = 1;
+    interchange.getPhi()(0, 1) = 1;
+    interchange.getPhi()(1, 1) = 0;
+    EXPECT_EQ(scanTriangle(interchange, N),
+              expectedTriangle(N, [](int64_t i, int64_t j) {
+                  return std::make_pair(j, i);
+              }));
+    // wavefront: levels `i + j` and `j`
+    Schedule skew(2);
+    skew.getPhi()(1, 0) = 1;
+    EXPECT_EQ(scanTriangle(skew, N),
+              expectedTriangle(N, [](int64_t i, int64_t j) {
+                  return std::make_pair(i + j, j);
+              }));
+    // empty domains execute nothing
+    EXPECT_TRUE(scanTriangle(identity, 0).empty());
+    // non-unimodular schedules are rejected
+    ScanFunction sf;
+    llvm::IRBuilder<>(llvm::BasicBlock::Create(sf.ctx, "entry", sf.F))
+        .CreateRetVoid();
+    Analyses an(*sf.F);
+    LoopNestCodeGen codegen(an.SE, sf.mod->getDataLayout(), {}, sf.i64);
+    Schedule scaled(2);
+    scaled.getPhi()(0, 0) = 2;
+    EXPECT_TRUE(codegen.addStatement(*triangle(), scaled, sf.trace(0)));
+    // as are bounds using unknown symbols
+    EXPECT_TRUE(codegen.addStatement(*triangle(), identity, sf.trace(0)));
+}
+
+TEST(CodeGenExhaustedBudget, BasicAssertions) {
+    // the loop nests are lowered after the function's budget may have run
+    // out; their bounds must not be relaxed
+    const int64_t N = 7;
+    auto aln = triangle();
+    CompileBudget function("function", BudgetLimits{1, 0.0});
+    BudgetScope scope(&function);
+    EXPECT_TRUE(chargeBudget(2));
+    Schedule identity(2);
+    {
+        ScanFunction sf;
+        emitLoopNest(sf, *aln, identity, sf.trace(0));
+        EXPECT_EQ(sf.run(N), expectedTriangle(N, [](int64_t i, int64_t j) {
+                      return std::make_pair(i, j);
+                  }));
+    }
+    Schedule skew(2);
+    skew.getPhi()(1, 0) = 1;
+    ScanFunction sf;
+    emitLoopNest(sf, *aln, skew, sf.trace(0));
+    EXPECT_EQ(sf.run(N), expectedTriangle(N, [](int64_t i, int64_t j) {
+                  return std::make_pair(i + j, j);
+              }));
+    EXPECT_TRUE(budgetExhausted());
+}
+
+TEST(CodeGenOmega, BasicAssertions) {
+    // for (i = 0; i < N; ++i)
+    //   for (j = 0; j <= i; ++j)
+    //     S2(i, j);
+    // for (i = 0; i < N; ++i){
+    //   for (j = 0; j <= i; ++j)
+    //     S1(i, j);
+    //   for (j = 0; j <= i; ++j)
+    //     S0(i, j);
+    // }
+    const int64_t N = 4;
+    ScanFunction sf;
+    auto aln = triangle();
+    auto Nm = Polynomial::Monomial(Polynomial::ID{1});
+    IntMatrix A1(2, 1);
+    llvm::SmallVector<MPoly, 8> b1;
+    A1(0, 0) = 1;
+    b1.push_back(Nm - 1);
+    A1(1, 0) = -1;
+    b1.push_back(0);
+    PartiallyOrderedSet poset;
+    AffineLoopNest outer(A1, b1, poset);
+    Schedule s0(2), s1(2), s2(2);
+    s0.getOmega()[0] = 1;
+    s0.getOmega()[2] = 1;
+    s1.getOmega()[0] = 1;
+    s1.getOmega()[2] = 0;
+    s2.getOmega()[0] = 0;
+    llvm::BasicBlock *entry =
+        llvm::BasicBlock::Create(sf.ctx, "entry", sf.F);
+    llvm::BasicBlock *exit = llvm::BasicBlock::Create(sf.ctx, "exit", sf.F);
+    llvm::IRBuilder<> builder(entry);
+    builder.CreateStore(builder.getInt64(0), sf.F->getArg(1));
+    builder.CreateBr(exit);
+    builder.SetInsertPoint(exit);
+    builder.CreateRetVoid();
+    {
+        Analyses an(*sf.F);
+        const llvm::SCEV *symbols[2] = {nullptr,
+                                        an.SE.getSCEV(sf.F->getArg(0))};
+        LoopNestCodeGen codegen(an.SE, sf.mod->getDataLayout(), symbols,
+                                sf.i64);
+        // the single-loop statement has a one-level schedule
+        Schedule o(1);
+        o.getOmega()[0] = 1;
+        o.getOmega()[2] = 1;
+        EXPECT_FALSE(codegen.addStatement(*aln, s1, sf.trace(1)));
+        EXPECT_FALSE(codegen.addStatement(*aln, s2, sf.trace(2)));
+        EXPECT_FALSE(codegen.addStatement(outer, o, sf.trace(3)));
+        // `outer` does not share the domain of `aln`
+        EXPECT_TRUE(codegen.emit(entry));
+    }
+    {
+        Analyses an(*sf.F);
+        const llvm::SCEV *symbols[2] = {nullptr,
+                                        an.SE.getSCEV(sf.F->getArg(0))};
+        LoopNestCodeGen codegen(an.SE, sf.mod->getDataLayout(), symbols,
+                                sf.i64);
+        EXPECT_FALSE(codegen.addStatement(*aln, s0, sf.trace(1)));
+        EXPECT_FALSE(codegen.addStatement(*aln, s1, sf.trace(0)));
+        EXPECT_FALSE(codegen.addStatement(*aln, s2, sf.trace(2)));
+        EXPECT_FALSE(codegen.emit(entry));
+    }
+    std::vector<int64_t> expected;
+    for (int64_t i = 0; i < N; ++i)
+        for (int64_t j = 0; j <= i; ++j)
+            expected.push_back(20000 + 100 * i + j);
+    for (int64_t i = 0; i < N; ++i) {
+        for (int64_t j = 0; j <= i; ++j)
+            expected.push_back(100 * i + j);
+        for (int64_t j = 0; j <= i; ++j)
+            expected.push_back(10000 + 100 * i + j);
+    }
+    EXPECT_EQ(sf.run(N), expected);
+}
+
+TEST(CodeGenSplice, BasicAssertions) {
+    // for (i = 0; i < N; ++i) trace(i)
+    // replaced with the interchanged triangle
+    const int64_t N = 5;
+    ScanFunction sf;
+    llvm::BasicBlock *entry =
+        llvm::BasicBlock::Create(sf.ctx, "entry", sf.F);
+    llvm::BasicBlock *header =
+        llvm::BasicBlock::Create(sf.ctx, "header", sf.F);
+    llvm::BasicBlock *exit = llvm::BasicBlock::Create(sf.ctx, "exit", sf.F);
+    llvm::IRBuilder<> builder(entry);
+    builder.CreateStore(builder.getInt64(0), sf.F->getArg(1));
+    llvm::Value *nonEmpty =
+        builder.CreateICmpSGT(sf.F->getArg(0), builder.getInt64(0));
+    llvm::BasicBlock *preheader =
+        llvm::BasicBlock::Create(sf.ctx, "preheader", sf.F, header);
+    builder.CreateCondBr(nonEmpty, preheader, exit);
+    builder.SetInsertPoint(preheader);
+    builder.CreateBr(header);
+    builder.SetInsertPoint(header);
+    llvm::PHINode *i = builder.CreatePHI(sf.i64, 2);
+    i->addIncoming(builder.getInt64(0), preheader);
+    sf.trace(9)(builder, {i}, VectorLanes{});
+    llvm::Value *next = builder.CreateAdd(i, builder.getInt64(1));
+    i->addIncoming(next, header);
+    llvm::BasicBlock *loopExit =
+        llvm::BasicBlock::Create(sf.ctx, "loopexit", sf.F, exit);
+    builder.CreateCondBr(builder.CreateICmpSLT(next, sf.F->getArg(0)), header,
+                         loopExit);
+    builder.SetInsertPoint(loopExit);
+    builder.CreateBr(exit);
+    builder.SetInsertPoint(exit);
+    builder.CreateRetVoid();
+    EXPECT_FALSE(llvm::verifyFunction(*sf.F, &llvm::errs()));
+
+    auto aln = triangle();
+    Schedule interchange(2);
+    interchange.getPhi()(0, 0) = 0;
+    interchange.getPhi()(1, 0) = 1;
+    interchange.getPhi()(0, 1) = 1;
+    interchange.getPhi()(1, 1) = 0;
+    {
+        Analyses an(*sf.F);
+        ASSERT_EQ(an.LI.getTopLevelLoops().size(), 1);
+        llvm::Loop *L = an.LI.getTopLevelLoops().front();
+        const llvm::SCEV *symbols[2] = {nullptr,
+                                        an.SE.getSCEV(sf.F->getArg(0))};
+        LoopNestCodeGen codegen(an.SE, sf.mod->getDataLayout(), symbols,
+                                sf.i64);
+        EXPECT_FALSE(codegen.addStatement(*aln, interchange, sf.trace(0)));
+        EXPECT_FALSE(spliceLoopNest(L, codegen, an.DT, an.SE, an.LI));
+        EXPECT_TRUE(an.LI.empty());
+        EXPECT_TRUE(an.DT.verify());
+        for (auto &BB : *sf.F)
+            EXPECT_NE(BB.getName(), "header");
+    }
+    EXPECT_EQ(sf.run(N), expectedTriangle(N, [](int64_t i, int64_t j) {
+                  return std::make_pair(j, i);
+              }));
+}
+
+size_t countMaskedStores(llvm::Function &F) {
+    size_t count = 0;
+    for (auto &BB : F)
+        for (auto &I : BB)
+            if (auto *call = llvm::dyn_cast<llvm::IntrinsicInst>(&I))
+                count += call->getIntrinsicID() == llvm::Intrinsic::masked_store;
+    return count;
+}
+
+TEST(CodeGenVectorTail, BasicAssertions) {
+    // for (i = 0; i < N; ++i)
+    //   for (j = 0; j <= i; ++j)
+    //     out[16 * i + j] = 100 * i + j;
+    // vectorized along `j`, so the length of the remainder varies with `i`
+    const int64_t N = 11;
+    for (bool masked : {false, true}) {
+        for (int8_t vectorized : {int8_t(1), int8_t(0)}) {
+            Schedule sch(2);
+            sch.vectorized = vectorized;
+            sch.vectorWidth = 4;
+            sch.maskedTail = masked;
+            ScanFunction sf;
+            emitTriangle(sf, sch, sf.fill());
+            // the bounds of `j` depend on `i`, so `i` is not vectorized
+            EXPECT_EQ(countMaskedStores(*sf.F), masked && (vectorized == 1));
+            std::vector<int64_t> out(1 + 16 * N, -1);
+            sf.run(N, out.data());
+            for (int64_t i = 0; i < N; ++i)
+                for (int64_t j = 0; j < 16; ++j)
+                    EXPECT_EQ(out[1 + 16 * i + j], j <= i ? 100 * i + j : -1);
+        }
+    }
+}
+
+size_t countTileLoops(llvm::Function &F) {
+    size_t count = 0;
+    for (auto &BB : F)
+        count += BB.getName().startswith("turboloop.tile.header");
+    return count;
+}
+
+TEST(CodeGenTiles, BasicAssertions) {
+    const int64_t N = 7;
+    // `i` in L2 tiles of 4 and L1 tiles of 2, `j` in L1 tiles of 3, with
+    // partial tiles at the upper bounds
+    Schedule sch(2);
+    sch.tileL2 = {4, 0};
+    sch.tileL1 = {2, 3};
+    {
+        ScanFunction sf;
+        emitLoopNest(sf, *square(), sch, sf.trace(0));
+        EXPECT_EQ(countTileLoops(*sf.F), size_t(3));
+        std::vector<std::pair<std::array<int64_t, 5>, int64_t>> points;
+        for (int64_t i = 0; i < N; ++i)
+            for (int64_t j = 0; j < N; ++j)
+                points.push_back({{i / 4, i / 2, j / 3, i, j}, 100 * i + j});
+        std::sort(points.begin(), points.end());
+        std::vector<int64_t> expected;
+        for (auto &p : points)
+            expected.push_back(p.second);
+        EXPECT_EQ(sf.run(N), expected);
+    }
+    // the bounds of `j` depend on `i`, so only `i` is tiled, which keeps
+    // the original order
+    {
+        ScanFunction sf;
+        emitTriangle(sf, sch, sf.trace(0));
+        EXPECT_EQ(countTileLoops(*sf.F), size_t(2));
+        EXPECT_EQ(sf.run(N), expectedTriangle(N, [](int64_t i, int64_t j) {
+                      return std::make_pair(i, j);
+                  }));
+    }
+    // tiles of a vectorized level are multiples of the vector width; the
+    // remainders are those of the tiles
+    for (bool masked : {false, true}) {
+        Schedule vsch(2);
+        vsch.vectorized = 1;
+        vsch.vectorWidth = 4;
+        vsch.maskedTail = masked;
+        vsch.tileL1 = {2, 8};
+        const int64_t M = 13;
+        ScanFunction sf;
+        emitLoopNest(sf, *square(), vsch, sf.fill());
+        EXPECT_EQ(countTileLoops(*sf.F), size_t(2));
+        std::vector<int64_t> out(1 + 16 * M, -1);
+        sf.run(M, out.data());
+        for (int64_t i = 0; i < M; ++i)
+            for (int64_t j = 0; j < 16; ++j)
+                EXPECT_EQ(out[1 + 16 * i + j], j < M ? 100 * i + j : -1);
+    }
+}
+
+size_t countUnrolledLoops(llvm::Function &F) {
+    size_t count = 0;
+    for (auto &BB : F)
+        count += BB.getName().startswith("turboloop.unroll.header");
+    return count;
+}
+
+TEST(CodeGenUnroll, BasicAssertions) {
+    const int64_t N = 7;
+    // `i` unrolled and jammed by 3, `j` unrolled by 2: the copies of `i`
+    // share the loop over `j`, and `j = 6`, and `i = 6`, are remainders
+    Schedule sch(2);
+    sch.unrolledOuterLoop = 0;
+    sch.unrolledOuter = 3;
+    sch.unrolledInnerLoop = 1;
+    sch.unrolledInner = 2;
+    {
+        ScanFunction sf;
+        emitLoopNest(sf, *square(), sch, sf.trace(0));
+        // `j` is unrolled in the unrolled loop over `i`, and its remainder
+        EXPECT_EQ(countUnrolledLoops(*sf.F), size_t(3));
+        std::vector<std::pair<std::array<int64_t, 4>, int64_t>> points;
+        for (int64_t i = 0; i < N; ++i)
+            for (int64_t j = 0; j < N; ++j)
+                points.push_back({{i / 3, j / 2, i % 3, j}, 100 * i + j});
+        std::sort(points.begin(), points.end());
+        std::vector<int64_t> expected;
+        for (auto &p : points)
+            expected.push_back(p.second);
+        EXPECT_EQ(sf.run(N), expected);
+    }
+    // the bounds of `j` depend on `i`, so only `j` is unrolled, which keeps
+    // the original order
+    {
+        ScanFunction sf;
+        emitTriangle(sf, sch, sf.trace(0));
+        EXPECT_EQ(countUnrolledLoops(*sf.F), size_t(1));
+        EXPECT_EQ(sf.run(N), expectedTriangle(N, [](int64_t i, int64_t j) {
+                      return std::make_pair(i, j);
+                  }));
+    }
+    // unrolling a vectorized level runs copies of whole vectors; the
+    // remainder is vectorized as without unrolling
+    for (bool masked : {false, true}) {
+        Schedule vsch(2);
+        vsch.vectorized = 1;
+        vsch.vectorWidth = 4;
+        vsch.maskedTail = masked;
+        vsch.unrolledInnerLoop = 1;
+        vsch.unrolledInner = 2;
+        vsch.unrolledOuterLoop = 0;
+        vsch.unrolledOuter = 2;
+        const int64_t M = 13;
+        ScanFunction sf;
+        emitLoopNest(sf, *square(), vsch, sf.fill());
+        EXPECT_EQ(countUnrolledLoops(*sf.F), size_t(3));
+        // a masked tail for each copy of `i`, and one in its remainder
+        EXPECT_EQ(countMaskedStores(*sf.F), masked ? size_t(3) : size_t(0));
+        std::vector<int64_t> out(1 + 16 * M, -1);
+        sf.run(M, out.data());
+        for (int64_t i = 0; i < M; ++i)
+            for (int64_t j = 0; j < 16; ++j)
+                EXPECT_EQ(out[1 + 16 * i + j], j < M ? 100 * i + j : -1);
+    }
+}
+
+TEST(AccessExtent, BasicAssertions) {
+    // A(j, i) for 0 <= i <= N-1, 0 <= j <= i, with column stride M
+    auto N = Polynomial::Monomial(Polynomial::ID{1});
+    auto M = Polynomial::Monomial(Polynomial::ID{2});
+    auto aln = triangle();
+    auto ranges = loopRanges(*aln);
+    ASSERT_TRUE(ranges);
+    EXPECT_EQ((*ranges)[0].first, MPoly(0));
+    EXPECT_EQ((*ranges)[0].second, N - 1);
+    EXPECT_EQ((*ranges)[1].first, MPoly(0));
+    EXPECT_EQ((*ranges)[1].second, N - 1);
+    ArrayReference ref(0, aln, 2);
+    PtrMatrix<int64_t> IndMat = ref.indexMatrix();
+    IndMat(1, 0) = 1; // j
+    IndMat(0, 1) = 1; // i
+    ref.stridesOffsets[0] = std::make_pair(MPoly(1), MPoly(0));
+    ref.stridesOffsets[1] = std::make_pair(MPoly(M), MPoly(1));
+    llvm::SmallVector<MPoly> nonNegative;
+    auto extent = accessExtent(ref, nonNegative);
+    ASSERT_TRUE(extent);
+    // `j + M * (i + 1)`
+    EXPECT_EQ(extent->first, MPoly(M));
+    EXPECT_EQ(extent->second, (N - 1) + M * N);
+    // the extent holds if `M >= 0`
+    ASSERT_EQ(nonNegative.size(), size_t(1));
+    EXPECT_EQ(nonNegative[0], MPoly(M));
+    // A(-j), i.e. stride `-1`, spans `[1 - N, 0]`
+    ArrayReference reversed(0, aln, 1);
+    reversed.indexMatrix()(1, 0) = 1;
+    reversed.stridesOffsets[0] = std::make_pair(MPoly(-1), MPoly(0));
+    nonNegative.clear();
+    extent = accessExtent(reversed, nonNegative);
+    ASSERT_TRUE(extent);
+    EXPECT_EQ(extent->first, 1 - N);
+    EXPECT_EQ(extent->second, MPoly(0));
+    EXPECT_TRUE(nonNegative.empty());
+}
+
+TEST(AliasVersioning, BasicAssertions) {
+    // for (i = 0; i < N; ++i) A[i] = B[i] + 1;
+    // versioned with A[i] = B[i] + 100
+    const int64_t N = 8;
+    ScanFunction sf(2);
+    llvm::Argument *A = sf.F->getArg(2), *B = sf.F->getArg(3);
+    auto body = [&](llvm::IRBuilder<> &builder, llvm::Value *i,
+                    int64_t increment, const VectorLanes &lanes) {
+        llvm::Value *b =
+            emitLoad(builder, sf.i64, builder.CreateGEP(sf.i64, B, i), lanes);
+        llvm::Value *a = builder.CreateAdd(
+            b, broadcast(builder, builder.getInt64(increment), lanes));
+        emitStore(builder, a, builder.CreateGEP(sf.i64, A, i), lanes);
+    };
+    llvm::BasicBlock *entry =
+        llvm::BasicBlock::Create(sf.ctx, "entry", sf.F);
+    llvm::BasicBlock *header =
+        llvm::BasicBlock::Create(sf.ctx, "header", sf.F);
+    llvm::BasicBlock *exit = llvm::BasicBlock::Create(sf.ctx, "exit", sf.F);
+    llvm::IRBuilder<> builder(entry);
+    builder.CreateBr(header);
+    builder.SetInsertPoint(header);
+    llvm::PHINode *i = builder.CreatePHI(sf.i64, 2);
+    i->addIncoming(builder.getInt64(0), entry);
+    body(builder, i, 1, VectorLanes{});
+    llvm::Value *next = builder.CreateAdd(i, builder.getInt64(1));
+    i->addIncoming(next, header);
+    builder.CreateCondBr(builder.CreateICmpSLT(next, sf.F->getArg(0)), header,
+                         exit);
+    builder.SetInsertPoint(exit);
+    builder.CreateRetVoid();
+
+    // 0 <= i <= N-1
+    auto Nm = Polynomial::Monomial(Polynomial::ID{1});
+    auto aln = LoopNestBuilder(1).bound(0, 0, Nm - 1).nest();
+    LoopBlock lblock;
+    const MPoly strides[1] = {1};
+    auto ref = [&](size_t id) { return arrayRef(id, aln, {0}, strides); };
+    Schedule sch(1);
+    sch.vectorized = 0;
+    sch.vectorWidth = 4;
+    sch.maskedTail = true;
+    // the original loop's load of `B` and store to `A` size the elements
+    llvm::LoadInst *load = nullptr;
+    llvm::StoreInst *store = nullptr;
+    for (auto &I : *header) {
+        if (auto *l = llvm::dyn_cast<llvm::LoadInst>(&I))
+            load = l;
+        else if (auto *s = llvm::dyn_cast<llvm::StoreInst>(&I))
+            store = s;
+    }
+    ASSERT_TRUE(load && store);
+    lblock.memory.emplace_back(ref(1), load, sch, true);
+    lblock.memory.emplace_back(ref(0), store, sch, false);
+    {
+        Analyses an(*sf.F);
+        ASSERT_EQ(an.LI.getTopLevelLoops().size(), 1);
+        llvm::Loop *L = an.LI.getTopLevelLoops().front();
+        const llvm::SCEV *symbols[2] = {nullptr,
+                                        an.SE.getSCEV(sf.F->getArg(0))};
+        LoopNestCodeGen codegen(an.SE, sf.mod->getDataLayout(), symbols,
+                                sf.i64);
+        EXPECT_FALSE(codegen.addStatement(
+            *aln, sch,
+            [&](llvm::IRBuilder<> &builder, llvm::ArrayRef<llvm::Value *> ivs,
+                const VectorLanes &lanes) { body(builder, ivs[0], 100, lanes); }));
+        llvm::Value *bases[2] = {A, B};
+        // arrays sharing a base pointer cannot be versioned
+        llvm::Value *sameBases[2] = {A, A};
+        llvm::Instruction *term = L->getLoopPreheader()->getTerminator();
+        EXPECT_EQ(emitNoAliasCheck(term, an.SE, lblock, sameBases, symbols),
+                  nullptr);
+        EXPECT_FALSE(versionLoopNest(
+            L, codegen,
+            [&](llvm::Instruction *insertPt) {
+                return emitNoAliasCheck(insertPt, an.SE, lblock, bases,
+                                        symbols);
+            },
+            an.DT));
+        EXPECT_TRUE(an.DT.verify());
+        EXPECT_EQ(an.LI.getTopLevelLoops().size(), 1);
+    }
+    auto *scan = reinterpret_cast<void (*)(int64_t, int64_t *, int64_t *,
+                                           int64_t *)>(sf.compile());
+    ASSERT_TRUE(scan);
+    std::vector<int64_t> mem(3 * N, 0);
+    for (int64_t k = 0; k < 3 * N; ++k)
+        mem[k] = k;
+    // disjoint: the versioned nest runs
+    scan(N, nullptr, mem.data(), mem.data() + N);
+    for (int64_t k = 0; k < N; ++k)
+        EXPECT_EQ(mem[k], N + k + 100);
+    // `B` is `A` shifted by one: the original loop runs
+    for (int64_t k = 0; k < 3 * N; ++k)
+        mem[k] = k;
+    scan(N, nullptr, mem.data() + 1, mem.data());
+    for (int64_t k = 0; k < N; ++k)
+        EXPECT_EQ(mem[1 + k], k + 1);
+    // overlapping only past the accessed ranges is disjoint
+    for (int64_t k = 0; k < 3 * N; ++k)
+        mem[k] = k;
+    scan(N, nullptr, mem.data() + N, mem.data());
+    for (int64_t k = 0; k < N; ++k)
+        EXPECT_EQ(mem[N + k], k + 100);
+}
+
+TEST(AliasCheckElementSize, BasicAssertions) {
+    // `i1 check(i64 N, i1 *A, i1 *B)`, returning the check for
+    // for (i = 0; i < N; ++i) A[i] = B[i];
+    // `i1` is narrower than a byte, but each element is allocated one.
+    llvm::LLVMContext ctx;
+    auto mod = std::make_unique<llvm::Module>("alias", ctx);
+    llvm::Type *i1 = llvm::Type::getInt1Ty(ctx);
+    llvm::IntegerType *i64 = llvm::Type::getInt64Ty(ctx);
+    llvm::Type *ptr = llvm::PointerType::getUnqual(i1);
+    llvm::Function *F = llvm::Function::Create(
+        llvm::FunctionType::get(i1, {i64, ptr, ptr}, false),
+        llvm::Function::ExternalLinkage, "check", *mod);
+    llvm::Argument *A = F->getArg(1), *B = F->getArg(2);
+    llvm::BasicBlock *entry = llvm::BasicBlock::Create(ctx, "entry", F);
+    llvm::BasicBlock *header = llvm::BasicBlock::Create(ctx, "header", F);
+    llvm::BasicBlock *exit = llvm::BasicBlock::Create(ctx, "exit", F);
+    llvm::IRBuilder<> builder(entry);
+    builder.CreateBr(header);
+    builder.SetInsertPoint(header);
+    llvm::PHINode *i = builder.CreatePHI(i64, 2);
+    i->addIncoming(builder.getInt64(0), entry);
+    llvm::LoadInst *load =
+        builder.CreateLoad(i1, builder.CreateGEP(i1, B, i));
+    llvm::StoreInst *store =
+        builder.CreateStore(load, builder.CreateGEP(i1, A, i));
+    llvm::Value *next = builder.CreateAdd(i, builder.getInt64(1));
+    i->addIncoming(next, header);
+    builder.CreateCondBr(builder.CreateICmpSLT(next, F->getArg(0)), header,
+                         exit);
+    builder.SetInsertPoint(exit);
+    llvm::ReturnInst *ret = builder.CreateRet(builder.getTrue());
+
+    // 0 <= i <= N-1
+    auto Nm = Polynomial::Monomial(Polynomial::ID{1});
+    auto aln = LoopNestBuilder(1).bound(0, 0, Nm - 1).nest();
+    const MPoly strides[1] = {1};
+    auto ref = [&](size_t id) { return arrayRef(id, aln, {0}, strides); };
+    LoopBlock lblock;
+    Schedule sch(1);
+    lblock.memory.emplace_back(ref(1), load, sch, true);
+    lblock.memory.emplace_back(ref(0), store, sch, false);
+    {
+        Analyses an(*F);
+        const llvm::SCEV *symbols[2] = {nullptr, an.SE.getSCEV(F->getArg(0))};
+        llvm::Value *bases[2] = {A, B};
+        // without an element type there is no check
+        LoopBlock untyped;
+        untyped.memory.emplace_back(ref(1), nullptr, sch, true);
+        untyped.memory.emplace_back(ref(0), nullptr, sch, false);
+        EXPECT_EQ(emitNoAliasCheck(ret, an.SE, untyped, bases, symbols),
+                  nullptr);
+        llvm::Value *check =
+            emitNoAliasCheck(ret, an.SE, lblock, bases, symbols);
+        ASSERT_TRUE(check);
+        ret->setOperand(0, check);
+    }
+    EXPECT_FALSE(llvm::verifyFunction(*F, &llvm::errs()));
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    std::string error;
+    std::unique_ptr<llvm::ExecutionEngine> EE(
+        llvm::EngineBuilder(std::move(mod))
+            .setEngineKind(llvm::EngineKind::JIT)
+            .setErrorStr(&error)
+            .create());
+    ASSERT_TRUE(EE) << error;
+    auto *check = reinterpret_cast<bool (*)(int64_t, char *, char *)>(
+        EE->getFunctionAddress("check"));
+    ASSERT_TRUE(check);
+    char mem[32] = {};
+    EXPECT_TRUE(check(8, mem, mem + 8));
+    EXPECT_TRUE(check(8, mem + 8, mem));
+    // the same or overlapping bytes must not be reported as disjoint
+    EXPECT_FALSE(check(8, mem, mem));
+    EXPECT_FALSE(check(8, mem + 1, mem));
+    EXPECT_FALSE(check(8, mem, mem + 7));
+}
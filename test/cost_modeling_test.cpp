@@ -1,4 +1,6 @@
 #include "../include/ArrayReference.hpp"
+#include "../include/CacheTiling.hpp"
+#include "../include/CostModeling.hpp"
 #include "../include/DependencyPolyhedra.hpp"
 #include "../include/LoopBlock.hpp"
 #include "../include/Math.hpp"
@@ -14,6 +16,12 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Operator.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <memory>
+#include <string>
 
 TEST(TriangularExampleTest, BasicAssertions) {
 
@@ -459,3 +467,242 @@ TEST(TriangularExampleTest, BasicAssertions) {
     //    std::cout << "Edge:\n" << e << "\n" << std::endl;
     //}
 }
+
+// for (n = 0; n < N; ++n){
+//   for (k = 0; k < K; ++k){
+//     for (m = 0; m < M; ++m){
+//       C(m,n) = C(m,n) + A(m,k)*B(k,n);
+//     }
+//   }
+// }
+// with the schedule placing `k` inner most.
+void gemmBlock(LoopBlock &lblock, MPoly M, MPoly N, MPoly K) {
+    // loops are [n, k, m]
+    IntMatrix Aloop(6, 3);
+    llvm::SmallVector<MPoly, 8> bloop;
+    // n <= N-1
+    Aloop(0, 0) = 1;
+    bloop.push_back(N - 1);
+    // n >= 0
+    Aloop(1, 0) = -1;
+    bloop.push_back(0);
+    // k <= K-1
+    Aloop(2, 1) = 1;
+    bloop.push_back(K - 1);
+    // k >= 0
+    Aloop(3, 1) = -1;
+    bloop.push_back(0);
+    // m <= M-1
+    Aloop(4, 2) = 1;
+    bloop.push_back(M - 1);
+    // m >= 0
+    Aloop(5, 2) = -1;
+    bloop.push_back(0);
+    PartiallyOrderedSet poset;
+    auto loop = llvm::makeIntrusiveRefCnt<AffineLoopNest>(Aloop, bloop, poset);
+
+    // C(m,n)
+    ArrayReference Cmn(0, loop, 2);
+    {
+        PtrMatrix<int64_t> IndMat = Cmn.indexMatrix();
+        IndMat(2, 0) = 1; // m
+        IndMat(0, 1) = 1; // n
+        Cmn.stridesOffsets[0] = std::make_pair(MPoly(1), MPoly(0));
+        Cmn.stridesOffsets[1] = std::make_pair(M, MPoly(0));
+    }
+    // A(m,k)
+    ArrayReference Amk(1, loop, 2);
+    {
+        PtrMatrix<int64_t> IndMat = Amk.indexMatrix();
+        IndMat(2, 0) = 1; // m
+        IndMat(1, 1) = 1; // k
+        Amk.stridesOffsets[0] = std::make_pair(MPoly(1), MPoly(0));
+        Amk.stridesOffsets[1] = std::make_pair(M, MPoly(0));
+    }
+    // B(k,n)
+    ArrayReference Bkn(2, loop, 2);
+    {
+        PtrMatrix<int64_t> IndMat = Bkn.indexMatrix();
+        IndMat(1, 0) = 1; // k
+        IndMat(0, 1) = 1; // n
+        Bkn.stridesOffsets[0] = std::make_pair(MPoly(1), MPoly(0));
+        Bkn.stridesOffsets[1] = std::make_pair(K, MPoly(0));
+    }
+    // schedule levels are [n, m, k]
+    Schedule sch(3);
+    {
+        SquarePtrMatrix<int64_t> Phi = sch.getPhi();
+        for (size_t i = 0; i < 3; ++i)
+            Phi(i, i) = 0;
+        Phi(0, 0) = 1; // n
+        Phi(2, 1) = 1; // m
+        Phi(1, 2) = 1; // k
+    }
+    lblock.memory.reserve(4);
+    auto push = [&](const ArrayReference &ref, int64_t o, bool isLoad) {
+        Schedule s = sch;
+        s.getOmega()[6] = o;
+        lblock.memory.emplace_back(ref, nullptr, s, isLoad);
+    };
+    push(Cmn, 0, true);
+    push(Amk, 1, true);
+    push(Bkn, 2, true);
+    push(Cmn, 3, false);
+}
+
+TEST(RegisterTilingGEMM, BasicAssertions) {
+    LoopBlock lblock;
+    gemmBlock(lblock, Polynomial::Monomial(Polynomial::ID{1}),
+              Polynomial::Monomial(Polynomial::ID{2}),
+              Polynomial::Monomial(Polynomial::ID{3}));
+    lblock.fillEdges();
+    EXPECT_EQ(lblock.edges.size(), 2);
+
+    // AVX512-like target
+    CostModeling::RegisterFile regs{16, 32, 512};
+    CostModeling::RegisterTiling rt(lblock, {0, 1, 2, 3}, regs);
+    // the reduction over `k` is carried; `n` and `m` are not
+    EXPECT_FALSE(rt.carriesDependence[0]);
+    EXPECT_FALSE(rt.carriesDependence[1]);
+    EXPECT_TRUE(rt.carriesDependence[2]);
+    CostModeling::RegisterTile tile = rt.search();
+    std::cout << "vectorized = " << int(tile.vectorized) << " x "
+              << int(tile.vectorWidth)
+              << "; inner = " << int(tile.unrolledInnerLoop) << " x "
+              << int(tile.unrolledInner)
+              << "; outer = " << int(tile.unrolledOuterLoop) << " x "
+              << int(tile.unrolledOuter) << "; registers = " << tile.registers
+              << "; cost = " << tile.cost << std::endl;
+    // `m` is contiguous, so we vectorize it, and unroll-and-jam both `m`
+    // and `n` so that `C` stays in registers across `k`.
+    EXPECT_EQ(tile.vectorized, 1);
+    EXPECT_EQ(tile.vectorWidth, 8);
+    EXPECT_LE(tile.registers, 32);
+    EXPECT_NE(tile.unrolledInnerLoop, 2);
+    EXPECT_NE(tile.unrolledOuterLoop, 2);
+    EXPECT_GE(tile.unrolledInnerLoop, 0);
+    EXPECT_GE(tile.unrolledOuterLoop, 0);
+    // 4 cycle latency at 2 per cycle needs 8 accumulators
+    EXPECT_GE(tile.unrolledInner * tile.unrolledOuter, 8);
+
+    CostModeling::optimizeRegisterTiling(lblock, regs);
+    for (auto &ma : lblock.memory) {
+        EXPECT_EQ(ma.schedule.vectorized, tile.vectorized);
+        EXPECT_EQ(ma.schedule.unrolledInnerLoop, tile.unrolledInnerLoop);
+        EXPECT_EQ(ma.schedule.unrolledOuterLoop, tile.unrolledOuterLoop);
+    }
+    // without vector registers, we only unroll
+    CostModeling::RegisterTile scalarTile =
+        CostModeling::RegisterTiling(lblock, {0, 1, 2, 3}, {16, 0, 0}).search();
+    EXPECT_EQ(scalarTile.vectorized, -1);
+    EXPECT_LE(scalarTile.registers, 16);
+    EXPECT_GE(scalarTile.unrolledInnerLoop, 0);
+    // 8-bit elements of 4096-bit registers are more lanes than a schedule
+    // holds, so the width is clamped rather than wrapping to `0`
+    for (auto &ma : lblock.memory)
+        ma.elementBits = 8;
+    CostModeling::RegisterTile wideTile =
+        CostModeling::RegisterTiling(lblock, {0, 1, 2, 3}, {16, 32, 4096})
+            .search();
+    EXPECT_EQ(wideTile.vectorized, 1);
+    EXPECT_EQ(wideTile.vectorWidth, CostModeling::maxVectorWidth);
+}
+
+TEST(CacheTilingGEMM, BasicAssertions) {
+    LoopBlock lblock;
+    // 1000 x 1000 x 1000 doubles is far larger than L2
+    gemmBlock(lblock, MPoly(1000), MPoly(1000), MPoly(1000));
+    lblock.fillEdges();
+    CostModeling::RegisterFile regs{16, 32, 512};
+    CostModeling::optimizeRegisterTiling(lblock, regs);
+    CostModeling::CacheParameters cache;
+    cache.l1Bytes = 32 * 1024;
+    cache.l2Bytes = 1024 * 1024;
+
+    CostModeling::RegisterTiling rt(lblock, {0, 1, 2, 3}, regs);
+    CostModeling::CacheTiling ctg(rt, cache);
+    // all dependencies are carried by `k` alone, so all three loops tile
+    EXPECT_EQ(ctg.band, 0);
+    // `A`, `B`, and `C`
+    EXPECT_EQ(ctg.arrays.size(), 3);
+    for (auto t : ctg.maxTile)
+        EXPECT_EQ(t, 1000);
+    CostModeling::CacheTile ct = ctg.search();
+    EXPECT_LE(ct.l1Footprint, cache.l1Bytes / 2);
+    EXPECT_LE(ct.l2Footprint, cache.l2Bytes / 2);
+    EXPECT_LT(ct.l1Footprint, ct.l2Footprint);
+    for (size_t l = 0; l < 3; ++l) {
+        // tiles are multiples of the register tile, and nest
+        EXPECT_EQ(ct.l1[l] % ctg.base[l], 0);
+        EXPECT_EQ(ct.l2[l] % ct.l1[l], 0);
+        EXPECT_LE(ct.l2[l], 1000);
+    }
+    // tiling reduces traffic over the register tile alone
+    EXPECT_LT(ctg.traffic(ct.l1), ctg.traffic(ctg.base) / 4);
+    EXPECT_LT(ctg.traffic(ct.l2), ctg.traffic(ct.l1));
+
+    CostModeling::optimizeCacheTiling(lblock, regs, cache);
+    llvm::SmallVector<CostModeling::TiledLoop> tl =
+        CostModeling::tiledLoops(lblock.memory[0].schedule);
+    // loops over tiles come first, and the original loops last
+    EXPECT_GT(tl.size(), 3);
+    for (size_t i = 1; i < tl.size(); ++i)
+        EXPECT_LE(tl[i].cacheLevel, tl[i - 1].cacheLevel);
+    for (size_t l = 0; l < 3; ++l) {
+        EXPECT_EQ(tl[tl.size() - 3 + l].level, l);
+        EXPECT_EQ(tl[tl.size() - 3 + l].cacheLevel, 0);
+    }
+
+    // target parameters can be overridden
+    llvm::DataLayout dl("e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-"
+                        "n8:16:32:64-S128");
+    llvm::TargetTransformInfo TTI{dl};
+    CostModeling::CacheParameters fromTTI =
+        CostModeling::CacheParameters::get(TTI, {0, 48 * 1024, 0});
+    EXPECT_EQ(fromTTI.l1Bytes, 48 * 1024);
+    EXPECT_GT(fromTTI.l2Bytes, 0);
+    EXPECT_GT(fromTTI.lineBytes, 0);
+}
+
+TEST(MaskedTail, BasicAssertions) {
+    llvm::InitializeAllTargetInfos();
+    llvm::InitializeAllTargets();
+    llvm::InitializeAllTargetMCs();
+    std::string triple = "x86_64-unknown-linux-gnu", error;
+    const llvm::Target *target =
+        llvm::TargetRegistry::lookupTarget(triple, error);
+    if (!target)
+        GTEST_SKIP() << error;
+    llvm::LLVMContext ctx;
+    llvm::Module mod("tail", ctx);
+    llvm::Function *F = llvm::Function::Create(
+        llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), false),
+        llvm::Function::ExternalLinkage, "f", mod);
+    llvm::Type *f64 = llvm::Type::getDoubleTy(ctx);
+    auto getTTI = [&](const char *cpu) {
+        std::unique_ptr<llvm::TargetMachine> TM(target->createTargetMachine(
+            triple, cpu, "", llvm::TargetOptions(), llvm::None));
+        mod.setDataLayout(TM->createDataLayout());
+        llvm::TargetTransformInfo TTI = TM->getTargetTransformInfo(*F);
+        return std::make_pair(std::move(TM), std::move(TTI));
+    };
+    // AVX512 predicates loads and stores cheaply
+    auto [skx, skxTTI] = getTTI("skylake-avx512");
+    EXPECT_TRUE(CostModeling::preferMaskedTail(skxTTI, f64, 8, 2, 1));
+    EXPECT_FALSE(CostModeling::preferMaskedTail(skxTTI, f64, 1, 2, 1));
+    // without AVX, masked accesses are not legal
+    auto [core2, core2TTI] = getTTI("core2");
+    EXPECT_FALSE(CostModeling::preferMaskedTail(core2TTI, f64, 2, 2, 1));
+
+    // applied per loop nest; without instructions, the element types are
+    // unknown, so the tails remain scalar
+    LoopBlock lblock;
+    gemmBlock(lblock, MPoly(100), MPoly(100), MPoly(100));
+    for (auto &ma : lblock.memory) {
+        ma.schedule.vectorized = 1;
+        ma.schedule.vectorWidth = 8;
+    }
+    CostModeling::chooseVectorTails(lblock, skxTTI);
+    for (auto &ma : lblock.memory)
+        EXPECT_FALSE(ma.schedule.maskedTail);
+}
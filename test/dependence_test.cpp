@@ -43,7 +43,10 @@ TEST(DependenceTest, BasicAssertions) {
 
     PartiallyOrderedSet poset;
     assert(poset.delta.size() == 0);
+    const unsigned numEliminated = NumVariablesEliminated.getValue();
     auto loop = llvm::makeIntrusiveRefCnt<AffineLoopNest>(Aloop, bloop, poset);
+    // the bounds of the outer loop eliminate the inner one
+    EXPECT_EQ(NumVariablesEliminated.getValue(), numEliminated + 1);
     assert(loop->poset.delta.size() == 0);
 
     // we have three array refs
@@ -117,8 +120,17 @@ TEST(DependenceTest, BasicAssertions) {
 
     // MemoryAccess mtgt1{Atgt1,nullptr,schLoad,true};
     EXPECT_EQ(dc.size(), 0);
+    const unsigned numPolyhedra = NumDependencePolyhedra.getValue();
+    const unsigned numFarkas = NumFarkasPolyhedra.getValue();
+    const unsigned numDependences = NumDependences.getValue();
+    const unsigned numSolves = NumRedundancySolves.getValue();
     EXPECT_EQ(Dependence::check(dc, msrc, mtgt0), 1);
     EXPECT_EQ(dc.size(), 1);
+    EXPECT_EQ(NumDependencePolyhedra.getValue(), numPolyhedra + 1);
+    EXPECT_EQ(NumFarkasPolyhedra.getValue(), numFarkas + 2);
+    EXPECT_EQ(NumDependences.getValue(), numDependences + 1);
+    // the dependence polyhedron is pruned
+    EXPECT_GT(NumRedundancySolves.getValue(), numSolves);
     Dependence &d(dc.front());
     EXPECT_TRUE(d.forward);
     std::cout << d << std::endl;
@@ -0,0 +1,152 @@
+#include "../include/ArrayReference.hpp"
+#include "../include/Graphs.hpp"
+#include "../include/ILPScheduler.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/Math.hpp"
+#include "../include/Symbolics.hpp"
+#include "./TestBlocks.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <llvm/ADT/SmallVector.h>
+
+// for (i = 0; i < I; ++i){
+//   for (j = 0; j < J; ++j){
+//     A(i+1,j) = A(i,j);
+//   }
+// }
+void stencilBlock(LoopBlock &lblock) {
+    auto I = Polynomial::Monomial(Polynomial::ID{1});
+    auto J = Polynomial::Monomial(Polynomial::ID{2});
+    auto loop = LoopNestBuilder(2).bound(0, 0, I - 1).bound(1, 0, J - 1).nest();
+    const MPoly strides[2] = {1, I + 1};
+    lblock.memory.reserve(2);
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides), true, {0, 0, 0});
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides, {1, 0}), false,
+               {0, 0, 1});
+    lblock.valueFlow.emplace_back(0, 1);
+}
+
+// for (i = 1; i < I; ++i){
+//   for (j = 1; j < J; ++j){
+//     A(i,j) = A(i-1,j) + A(i,j-1);
+//   }
+// }
+void gaussSeidelBlock(LoopBlock &lblock) {
+    auto I = Polynomial::Monomial(Polynomial::ID{1});
+    auto J = Polynomial::Monomial(Polynomial::ID{2});
+    auto loop = LoopNestBuilder(2).bound(0, 1, I - 1).bound(1, 1, J - 1).nest();
+    const MPoly strides[2] = {1, I};
+    lblock.memory.reserve(3);
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides, {-1, 0}), true,
+               {0, 0, 0});
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides, {0, -1}), true,
+               {0, 0, 1});
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides), false, {0, 0, 2});
+    lblock.valueFlow.emplace_back(0, 2);
+    lblock.valueFlow.emplace_back(1, 2);
+}
+
+llvm::SmallVector<unsigned> allEdges(const LoopBlock &lblock) {
+    llvm::SmallVector<unsigned> edges;
+    for (unsigned e = 0; e < lblock.edges.size(); ++e)
+        edges.push_back(e);
+    return edges;
+}
+
+void expectLinearlyIndependent(const LoopBlock &lblock) {
+    for (auto &ma : lblock.memory) {
+        SquarePtrMatrix<const int64_t> Phi = ma.schedule.getPhi();
+        EXPECT_NE(Phi(0, 0) * Phi(1, 1) - Phi(0, 1) * Phi(1, 0), 0);
+    }
+}
+
+TEST(ILPScheduler, LevelByLevel) {
+    LoopBlock lblock;
+    stencilBlock(lblock);
+    lblock.fillEdges();
+    ASSERT_FALSE(lblock.edges.empty());
+    auto components = topologicallySortedComponents(lblock);
+    ASSERT_EQ(components.size(), size_t(1));
+    llvm::SmallVector<unsigned> edges = allEdges(lblock);
+    ILPScheduler ilp(lblock, components.front(), edges);
+    EXPECT_FALSE(ilp.solve());
+    EXPECT_TRUE(lblock.isSatisfied(edges));
+    expectLinearlyIndependent(lblock);
+    // `j` carries no dependence, so it goes first; `i` then satisfies
+    // them all
+    for (auto &ma : lblock.memory) {
+        SquarePtrMatrix<const int64_t> Phi = ma.schedule.getPhi();
+        EXPECT_EQ(Phi(0, 0), 0);
+        EXPECT_EQ(Phi(1, 0), 1);
+    }
+    // one solve per level, each replacing the independence row of each
+    // member, in the same model
+    ASSERT_EQ(ilp.statistics.size(), size_t(2));
+    for (auto &stats : ilp.statistics) {
+        EXPECT_EQ(stats.rowsAdded, size_t(2));
+        EXPECT_GE(stats.seconds, 0.0);
+        EXPECT_EQ(stats.numCols, ilp.statistics[0].numCols);
+    }
+    EXPECT_EQ(ilp.statistics[0].edgesSatisfied, size_t(0));
+    EXPECT_EQ(ilp.statistics[1].edgesSatisfied, edges.size());
+    EXPECT_FALSE(ilp.statistics[0].warmStarted);
+    EXPECT_TRUE(ilp.statistics[1].warmStarted);
+    // the rows of the satisfied dependences are deleted, leaving the
+    // independence rows
+    EXPECT_TRUE(ilp.activeEdges.empty());
+    EXPECT_EQ(ilp.statistics[1].numRows, size_t(2));
+    EXPECT_GE(ilp.statistics[1].rowsRemoved,
+              ilp.statistics[0].numRows - ilp.statistics[1].numRows);
+}
+
+TEST(ILPScheduler, DropsSatisfiedDependences) {
+    LoopBlock lblock;
+    gaussSeidelBlock(lblock);
+    lblock.fillEdges();
+    auto components = topologicallySortedComponents(lblock);
+    ASSERT_EQ(components.size(), size_t(1));
+    llvm::SmallVector<unsigned> edges = allEdges(lblock);
+    ILPScheduler ilp(lblock, components.front(), edges);
+    EXPECT_FALSE(ilp.solve());
+    EXPECT_TRUE(lblock.isSatisfied(edges));
+    expectLinearlyIndependent(lblock);
+    // both loops carry a dependence; the first level satisfies those it
+    // carries, and its solve deletes their rows, so the second level
+    // solves a smaller model
+    ASSERT_EQ(ilp.statistics.size(), size_t(2));
+    const auto &first = ilp.statistics[0], &second = ilp.statistics[1];
+    EXPECT_GT(first.edgesSatisfied, size_t(0));
+    EXPECT_GT(second.edgesSatisfied, size_t(0));
+    EXPECT_EQ(first.edgesSatisfied + second.edgesSatisfied, edges.size());
+    EXPECT_LT(second.numRows, first.numRows);
+    EXPECT_EQ(second.numCols, first.numCols);
+    EXPECT_TRUE(second.warmStarted);
+    // every level was counted in the timers, and each found its
+    // hyperplane without an ILP
+    for (size_t l = 0; l < 2; ++l)
+        EXPECT_GT(scheduleLevelSearches[l], uint64_t(0));
+    EXPECT_TRUE(first.relaxationIntegral);
+    EXPECT_TRUE(second.relaxationIntegral);
+}
+
+TEST(ILPScheduler, PermutationFallback) {
+    LoopBlock lblock;
+    stencilBlock(lblock);
+    lblock.fillEdges();
+    // reversing `i` violates the dependence carried by `i`, and no
+    // permutation of the loops repairs it, so `scheduleComponent` falls back
+    // on the ILP, whose coefficients are non-negative
+    for (auto &ma : lblock.memory)
+        ma.schedule.getPhi()(0, 0) = -1;
+    llvm::SmallVector<unsigned> edges = allEdges(lblock);
+    EXPECT_FALSE(lblock.isSatisfied(edges));
+    EXPECT_FALSE(lblock.optimizeSchedules());
+    EXPECT_TRUE(lblock.isSatisfied(edges));
+    for (auto &ma : lblock.memory) {
+        SquarePtrMatrix<const int64_t> Phi = ma.schedule.getPhi();
+        for (size_t i = 0; i < 2; ++i)
+            for (size_t j = 0; j < 2; ++j)
+                EXPECT_GE(Phi(i, j), 0);
+    }
+}
@@ -0,0 +1,441 @@
+#include "../include/CompileBudget.hpp"
+#include "../include/CostModeling.hpp"
+#include "../include/IRExtraction.hpp"
+#include "../include/IntegerMap.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/Math.hpp"
+#include "../include/POSet.hpp"
+#include "../include/Symbolics.hpp"
+#include "./TestIR.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/OptimizationRemarkEmitter.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <memory>
+#include <string>
+
+// Column major, lower triangle: `for j in 0:n-1, i in 0:j`,
+// `A[i + m*j] = 2 * A[i + m*j]`, then `B[j] = A[j + m*j]` after the inner
+// loop.
+static const char *triangleIR = R"(
+define void @scale(double* %A, double* %B, i64 %m, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %j = phi i64 [ 0, %entry ], [ %jnext, %outer.latch ]
+  %mj = mul nsw i64 %m, %j
+  br label %inner
+
+inner:
+  %i = phi i64 [ 0, %outer ], [ %inext, %inner ]
+  %idx = add nsw i64 %i, %mj
+  %p = getelementptr inbounds double, double* %A, i64 %idx
+  %x = load double, double* %p
+  %y = fmul double %x, 2.0
+  store double %y, double* %p
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp sle i64 %inext, %j
+  br i1 %ic, label %inner, label %outer.latch
+
+outer.latch:
+  %didx = add nsw i64 %j, %mj
+  %dp = getelementptr inbounds double, double* %A, i64 %didx
+  %d = load double, double* %dp
+  %bp = getelementptr inbounds double, double* %B, i64 %j
+  store double %d, double* %bp
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %outer, label %exit
+
+exit:
+  ret void
+}
+
+define void @gather(double* %A, i64* %I, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %loop, label %exit
+
+loop:
+  %k = phi i64 [ 0, %entry ], [ %knext, %loop ]
+  %ip = getelementptr inbounds i64, i64* %I, i64 %k
+  %idx = load i64, i64* %ip
+  %p = getelementptr inbounds double, double* %A, i64 %idx
+  store double 0.0, double* %p
+  %knext = add nuw nsw i64 %k, 1
+  %kc = icmp slt i64 %knext, %n
+  br i1 %kc, label %loop, label %exit
+
+exit:
+  ret void
+}
+)";
+
+// Column major, `for j in 1:n-1, i in 1:n-1`:
+// `stencil`: `A[i + m*j] = A[i-1 + m*j] + A[i + m*(j-1)]`
+// `skew`: `A[i-1 + m*j] = 0.5 * A[i + m*(j-1)] + A[i-1 + m*j]`
+static const char *stencilIR = R"(
+define void @stencil(double* %A, i64 %m, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 1
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %j = phi i64 [ 1, %entry ], [ %jnext, %outer.latch ]
+  %mj = mul nsw i64 %m, %j
+  %jm1 = add nsw i64 %j, -1
+  %mjm1 = mul nsw i64 %m, %jm1
+  br label %inner
+
+inner:
+  %i = phi i64 [ 1, %outer ], [ %inext, %inner ]
+  %im1 = add nsw i64 %i, -1
+  %widx = add nsw i64 %im1, %mj
+  %wp = getelementptr inbounds double, double* %A, i64 %widx
+  %w = load double, double* %wp
+  %sidx = add nsw i64 %i, %mjm1
+  %sp = getelementptr inbounds double, double* %A, i64 %sidx
+  %s = load double, double* %sp
+  %x = fadd double %w, %s
+  %idx = add nsw i64 %i, %mj
+  %p = getelementptr inbounds double, double* %A, i64 %idx
+  store double %x, double* %p
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp slt i64 %inext, %n
+  br i1 %ic, label %inner, label %outer.latch
+
+outer.latch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %outer, label %exit
+
+exit:
+  ret void
+}
+
+define void @skew(double* %A, i64 %m, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 1
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %j = phi i64 [ 1, %entry ], [ %jnext, %outer.latch ]
+  %mj = mul nsw i64 %m, %j
+  %jm1 = add nsw i64 %j, -1
+  %mjm1 = mul nsw i64 %m, %jm1
+  br label %inner
+
+inner:
+  %i = phi i64 [ 1, %outer ], [ %inext, %inner ]
+  %im1 = add nsw i64 %i, -1
+  %sidx = add nsw i64 %i, %mjm1
+  %sp = getelementptr inbounds double, double* %A, i64 %sidx
+  %s = load double, double* %sp
+  %idx = add nsw i64 %im1, %mj
+  %p = getelementptr inbounds double, double* %A, i64 %idx
+  %a = load double, double* %p
+  %hs = fmul double %s, 5.000000e-01
+  %x = fadd double %hs, %a
+  store double %x, double* %p
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp slt i64 %inext, %n
+  br i1 %ic, label %inner, label %outer.latch
+
+outer.latch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %outer, label %exit
+
+exit:
+  ret void
+}
+)";
+
+TEST(IRExtractionTest, ToMPoly) {
+    ParsedModule pm(triangleIR);
+    llvm::Function *F = pm.mod->getFunction("scale");
+    Analyses an(*F);
+    ValueToPosetMap symbols;
+    const llvm::SCEV *m = an.SE.getSCEV(F->getArg(2));
+    const llvm::SCEV *n = an.SE.getSCEV(F->getArg(3));
+    // 3*m*n - n + 2
+    llvm::SmallVector<const llvm::SCEV *> factors{
+        an.SE.getConstant(m->getType(), 3), m, n};
+    llvm::SmallVector<const llvm::SCEV *> terms{
+        an.SE.getMulExpr(factors), an.SE.getNegativeSCEV(n),
+        an.SE.getConstant(m->getType(), 2)};
+    const llvm::SCEV *S = an.SE.getAddExpr(terms);
+    llvm::Optional<MPoly> p = toMPoly(S, symbols);
+    ASSERT_TRUE(p);
+    auto M = Polynomial::Monomial(
+        Polynomial::ID{IDType(symbols.getForward(F->getArg(2)))});
+    auto N = Polynomial::Monomial(
+        Polynomial::ID{IDType(symbols.getForward(F->getArg(3)))});
+    MPoly expected = M * N;
+    expected *= 3;
+    expected -= N;
+    expected += 2;
+    EXPECT_EQ(*p, expected);
+    // truncations need not preserve the value
+    EXPECT_FALSE(toMPoly(
+        an.SE.getTruncateExpr(m, llvm::Type::getInt32Ty(pm.ctx)), symbols));
+}
+
+// The dependence of `lblock` from `memory[in]` to `memory[out]`.
+static const Dependence *findEdge(const LoopBlock &lblock, size_t in,
+                                  size_t out) {
+    for (auto &e : lblock.edges)
+        if ((e.in == &lblock.memory[in]) && (e.out == &lblock.memory[out]))
+            return &e;
+    return nullptr;
+}
+
+// Constant distances of `d` along each schedule level; empty if any is not.
+static llvm::SmallVector<int64_t> levelDistances(const Dependence &d) {
+    llvm::SmallVector<int64_t> dists;
+    for (size_t l = 0; l < d.in->schedule.numLoops; ++l) {
+        llvm::Optional<int64_t> dist = CostModeling::levelDistance(d, l);
+        if (!dist)
+            return {};
+        dists.push_back(*dist);
+    }
+    return dists;
+}
+
+TEST(IRExtractionTest, TriangularNest) {
+    ParsedModule pm(triangleIR);
+    llvm::Function *F = pm.mod->getFunction("scale");
+    Analyses an(*F);
+    ValueToPosetMap symbols;
+    PartiallyOrderedSet poset;
+    llvm::SmallVector<std::unique_ptr<ExtractedLoopBlock>> blocks;
+    // unless `i < m`, `A[i + m*j]` cannot be split into columns
+    extractLoopBlocks(blocks, an.LI, an.SE, pm.mod->getDataLayout(), symbols,
+                      poset);
+    EXPECT_TRUE(blocks.empty());
+    pushColumnFacts(symbols, poset, F->getArg(2), F->getArg(3));
+    extractLoopBlocks(blocks, an.LI, an.SE, pm.mod->getDataLayout(), symbols,
+                      poset);
+    ASSERT_EQ(blocks.size(), size_t(1));
+    ExtractedLoopBlock &eb = *blocks.front();
+    LoopBlock &lblock = eb.lblock;
+    ASSERT_EQ(lblock.memory.size(), size_t(4));
+    ASSERT_EQ(eb.basePointers.size(), size_t(2));
+    EXPECT_EQ(eb.basePointers[0], F->getArg(0));
+    EXPECT_EQ(eb.basePointers[1], F->getArg(1));
+    auto M = Polynomial::Monomial(
+        Polynomial::ID{IDType(symbols.getForward(F->getArg(2)))});
+    auto N = Polynomial::Monomial(
+        Polynomial::ID{IDType(symbols.getForward(F->getArg(3)))});
+
+    // the load and store in the inner loop: `A[i + m*j]`, delinearized
+    for (size_t k = 0; k < 2; ++k) {
+        MemoryAccess &ma = lblock.memory[k];
+        EXPECT_EQ(ma.isLoad, k == 0);
+        EXPECT_EQ(ma.ref.arrayID, size_t(0));
+        ASSERT_EQ(ma.ref.getNumLoops(), size_t(2));
+        ASSERT_EQ(ma.ref.arrayDim(), size_t(2));
+        // strides `1` and `m`
+        EXPECT_EQ(ma.ref.stridesOffsets[0].first, MPoly(1));
+        EXPECT_EQ(ma.ref.stridesOffsets[1].first, MPoly(M));
+        PtrMatrix<int64_t> indMat = ma.ref.indexMatrix();
+        EXPECT_EQ(indMat(0, 0), 0);
+        EXPECT_EQ(indMat(1, 0), 1); // i
+        EXPECT_EQ(indMat(0, 1), 1); // j
+        EXPECT_EQ(indMat(1, 1), 0);
+        // in program order, within the inner loop
+        llvm::ArrayRef<int64_t> omega = ma.schedule.getOmega();
+        EXPECT_EQ(omega[0], 0);
+        EXPECT_EQ(omega[2], 0);
+        EXPECT_EQ(omega[4], int64_t(k));
+        EXPECT_EQ(lblock.userToMemory[ma.user], &ma);
+    }
+    // both share the domain `0 <= j <= n-1, 0 <= i <= j`
+    AffineLoopNest &aln = *lblock.memory[0].ref.loop;
+    EXPECT_EQ(&aln, lblock.memory[1].ref.loop.get());
+    // redundant bounds, i.e. `0 <= j`, are pruned
+    auto hasConstraint = [&](int64_t aj, int64_t ai, const MPoly &b) {
+        for (size_t r = 0; r < aln.A.numRow(); ++r)
+            if ((aln.A(r, 0) == aj) && (aln.A(r, 1) == ai) && (aln.b[r] == b))
+                return true;
+        return false;
+    };
+    EXPECT_TRUE(hasConstraint(1, 0, N - 1));  // j <= n - 1
+    EXPECT_TRUE(hasConstraint(-1, 1, 0));     // i <= j
+    EXPECT_TRUE(hasConstraint(0, -1, 0));     // 0 <= i
+
+    // `A[j + m*j]` and `B[j]`, after the inner loop
+    MemoryAccess &diag = lblock.memory[2];
+    MemoryAccess &b = lblock.memory[3];
+    EXPECT_TRUE(diag.isLoad);
+    EXPECT_FALSE(b.isLoad);
+    ASSERT_EQ(diag.ref.getNumLoops(), size_t(1));
+    ASSERT_EQ(diag.ref.arrayDim(), size_t(2));
+    EXPECT_EQ(diag.ref.indexMatrix()(0, 0), 1);
+    EXPECT_EQ(diag.ref.indexMatrix()(0, 1), 1);
+    EXPECT_EQ(b.ref.arrayID, size_t(1));
+    ASSERT_EQ(b.ref.arrayDim(), size_t(1));
+    EXPECT_EQ(b.ref.indexMatrix()(0, 0), 1);
+    // the inner loop is at position 0 of the outer loop, these follow
+    EXPECT_EQ(diag.schedule.getOmega()[2], 1);
+    EXPECT_EQ(b.schedule.getOmega()[2], 2);
+    // each store is fed by the load before it
+    using Flow = std::pair<unsigned, unsigned>;
+    EXPECT_EQ(lblock.valueFlow,
+              (llvm::SmallVector<Flow>{Flow(0, 1), Flow(2, 3)}));
+    // the store to `A[i + m*j]` overwrites what the load of the same
+    // iteration read, and the store with `i == j` flows into the load of
+    // the diagonal after the inner loop
+    lblock.fillEdges();
+    ASSERT_EQ(lblock.edges.size(), size_t(2));
+    const Dependence *anti = findEdge(lblock, 0, 1);
+    const Dependence *flow = findEdge(lblock, 1, 2);
+    ASSERT_TRUE(anti && flow);
+    EXPECT_EQ(levelDistances(*anti), (llvm::SmallVector<int64_t>{0, 0}));
+    EXPECT_EQ(CostModeling::levelDistance(*flow, 0),
+              llvm::Optional<int64_t>(0));
+    for (auto &e : lblock.edges)
+        EXPECT_TRUE(lblock.isSatisfied(e));
+}
+
+// Extracts the nest of `name` in `stencilIR`, and fills in its edges.
+static void extractStencil(ParsedModule &pm, const char *name,
+                           llvm::SmallVectorImpl<
+                               std::unique_ptr<ExtractedLoopBlock>> &blocks) {
+    llvm::Function *F = pm.mod->getFunction(name);
+    Analyses an(*F);
+    ValueToPosetMap symbols;
+    PartiallyOrderedSet poset;
+    pushColumnFacts(symbols, poset, F->getArg(1), F->getArg(2));
+    extractLoopBlocks(blocks, an.LI, an.SE, pm.mod->getDataLayout(), symbols,
+                      poset);
+    ASSERT_EQ(blocks.size(), size_t(1));
+    LoopBlock &lblock = blocks.front()->lblock;
+    ASSERT_EQ(lblock.memory.size(), size_t(3));
+    lblock.fillEdges();
+}
+
+TEST(IRExtractionTest, StencilDistances) {
+    ParsedModule pm(stencilIR);
+    llvm::SmallVector<std::unique_ptr<ExtractedLoopBlock>> blocks;
+    ASSERT_NO_FATAL_FAILURE(extractStencil(pm, "stencil", blocks));
+    LoopBlock &lblock = blocks.front()->lblock;
+    // loads of `A[i-1, j]` and `A[i, j-1]`, then the store to `A[i, j]`
+    EXPECT_TRUE(lblock.memory[0].isLoad);
+    EXPECT_TRUE(lblock.memory[1].isLoad);
+    EXPECT_FALSE(lblock.memory[2].isLoad);
+    // the store flows into both loads of later iterations; the loads are
+    // not each other's dependences
+    ASSERT_EQ(lblock.edges.size(), size_t(2));
+    const Dependence *west = findEdge(lblock, 2, 0);
+    const Dependence *south = findEdge(lblock, 2, 1);
+    ASSERT_TRUE(west && south);
+    // distances along the levels `j, i`
+    EXPECT_EQ(levelDistances(*west), (llvm::SmallVector<int64_t>{0, 1}));
+    EXPECT_EQ(levelDistances(*south), (llvm::SmallVector<int64_t>{1, 0}));
+    for (auto &e : lblock.edges)
+        EXPECT_TRUE(lblock.isSatisfied(e));
+}
+
+TEST(IRExtractionTest, SkewDistances) {
+    ParsedModule pm(stencilIR);
+    llvm::SmallVector<std::unique_ptr<ExtractedLoopBlock>> blocks;
+    ASSERT_NO_FATAL_FAILURE(extractStencil(pm, "skew", blocks));
+    LoopBlock &lblock = blocks.front()->lblock;
+    // loads of `A[i, j-1]` and `A[i-1, j]`, then the store to `A[i-1, j]`
+    EXPECT_TRUE(lblock.memory[0].isLoad);
+    EXPECT_TRUE(lblock.memory[1].isLoad);
+    EXPECT_FALSE(lblock.memory[2].isLoad);
+    ASSERT_EQ(lblock.edges.size(), size_t(2));
+    // the store flows into the load of the next `j` and previous `i`
+    const Dependence *flow = findEdge(lblock, 2, 0);
+    ASSERT_TRUE(flow);
+    EXPECT_EQ(levelDistances(*flow), (llvm::SmallVector<int64_t>{1, -1}));
+    // and overwrites what the load of the same iteration read
+    const Dependence *anti = findEdge(lblock, 1, 2);
+    ASSERT_TRUE(anti);
+    EXPECT_EQ(levelDistances(*anti), (llvm::SmallVector<int64_t>{0, 0}));
+    for (auto &e : lblock.edges)
+        EXPECT_TRUE(lblock.isSatisfied(e));
+    // interchanging the loops would read `A[i, j-1]` before it is stored
+    for (auto &ma : lblock.memory) {
+        SquarePtrMatrix<int64_t> Phi = ma.schedule.getPhi();
+        Phi(0, 0) = Phi(1, 1) = 0;
+        Phi(0, 1) = Phi(1, 0) = 1;
+    }
+    EXPECT_FALSE(lblock.isSatisfied(*flow));
+    EXPECT_TRUE(lblock.isSatisfied(*anti));
+}
+
+TEST(IRExtractionTest, IndirectIndex) {
+    ParsedModule pm(triangleIR);
+    llvm::Function *F = pm.mod->getFunction("gather");
+    Analyses an(*F);
+    ValueToPosetMap symbols;
+    PartiallyOrderedSet poset;
+    llvm::SmallVector<std::unique_ptr<ExtractedLoopBlock>> blocks;
+    extractLoopBlocks(blocks, an.LI, an.SE, pm.mod->getDataLayout(), symbols,
+                      poset);
+    EXPECT_TRUE(blocks.empty());
+}
+
+// Collects the missed-optimization remarks of the pass.
+struct RemarkCollector : llvm::DiagnosticHandler {
+    llvm::SmallVector<std::string> remarks;
+    bool isMissedOptRemarkEnabled(llvm::StringRef passName) const override {
+        return passName == "turbo-loop";
+    }
+    bool handleDiagnostics(const llvm::DiagnosticInfo &DI) override {
+        if (auto *R = llvm::dyn_cast<llvm::OptimizationRemarkMissed>(&DI))
+            remarks.push_back(R->getMsg());
+        return true;
+    }
+};
+
+TEST(IRExtractionTest, CompileBudget) {
+    ParsedModule pm(triangleIR);
+    auto collector = std::make_unique<RemarkCollector>();
+    RemarkCollector &diag = *collector;
+    pm.ctx.setDiagnosticHandler(std::move(collector));
+    llvm::Function *F = pm.mod->getFunction("scale");
+    Analyses an(*F);
+    llvm::OptimizationRemarkEmitter ORE(F);
+    ValueToPosetMap symbols;
+    PartiallyOrderedSet poset;
+    pushColumnFacts(symbols, poset, F->getArg(2), F->getArg(3));
+    llvm::SmallVector<std::unique_ptr<ExtractedLoopBlock>> blocks;
+    // out of rows, the nest is left untouched
+    extractLoopBlocks(blocks, an.LI, an.SE, pm.mod->getDataLayout(), symbols,
+                      poset, BudgetLimits{1, 0.0}, &ORE);
+    EXPECT_TRUE(blocks.empty());
+    ASSERT_EQ(diag.remarks.size(), size_t(1));
+    EXPECT_NE(diag.remarks[0].find("loop nest budget of 1 constraint rows"),
+              std::string::npos);
+    // an exhausted function budget applies to each loop nest
+    CompileBudget function("function", BudgetLimits{10, 0.0});
+    BudgetScope scope(&function);
+    EXPECT_FALSE(chargeBudget(10));
+    EXPECT_TRUE(chargeBudget(1));
+    extractLoopBlocks(blocks, an.LI, an.SE, pm.mod->getDataLayout(), symbols,
+                      poset, BudgetLimits{}, &ORE);
+    EXPECT_TRUE(blocks.empty());
+    ASSERT_EQ(diag.remarks.size(), size_t(2));
+    EXPECT_NE(diag.remarks[1].find("function budget of 10 constraint rows"),
+              std::string::npos);
+    // a generous budget changes nothing
+    CompileBudget generous("function", BudgetLimits{1000000, 60.0});
+    BudgetScope generousScope(&generous);
+    extractLoopBlocks(blocks, an.LI, an.SE, pm.mod->getDataLayout(), symbols,
+                      poset, BudgetLimits{100000, 10.0}, &ORE);
+    EXPECT_EQ(blocks.size(), size_t(1));
+    EXPECT_EQ(diag.remarks.size(), size_t(2));
+    EXPECT_GT(generous.rows.load(), size_t(0));
+}
@@ -47,3 +47,81 @@ TEST(LinearAlgebraTest, BasicAssertions) {
     std::cout << "LUF.rdiv(B) = \n" << B << std::endl;
     EXPECT_TRUE(B == identity);
 }
+
+TEST(LinearAlgebraTest, FractionFree) {
+    // a permutation swapping two rows has determinant `-1`
+    SquareMatrix<int64_t> P(3);
+    P(0, 1) = 1;
+    P(1, 0) = 1;
+    P(2, 2) = 1;
+    auto LUP = LU::fact(P);
+    ASSERT_TRUE(LUP.hasValue());
+    EXPECT_EQ(LUP->det(), -1);
+    // singular
+    SquareMatrix<int64_t> S(2);
+    S(0, 0) = 2;
+    S(0, 1) = 4;
+    S(1, 0) = 3;
+    S(1, 1) = 6;
+    EXPECT_FALSE(LU::fact(S).hasValue());
+
+    // `[F_61 F_60; F_60 F_59]`, with Fibonacci numbers `F_n`, is
+    // unimodular, but `F_61 * F_59` overflows `int64_t`; so did rational
+    // elimination, computing `F_59 - F_60^2 / F_61`
+    int64_t f59 = 956722026041, f60 = 1548008755920, f61 = 2504730781961;
+    SquareMatrix<int64_t> F(2);
+    F(0, 0) = f61;
+    F(0, 1) = f60;
+    F(1, 0) = f60;
+    F(1, 1) = f59;
+    auto LUF = LU::fact(F);
+    ASSERT_TRUE(LUF.hasValue());
+    EXPECT_EQ(LUF->det(), 1);
+    auto Finv = integerInverse(F);
+    ASSERT_TRUE(Finv.hasValue());
+    EXPECT_EQ((*Finv)(0, 0), f59);
+    EXPECT_EQ((*Finv)(0, 1), -f60);
+    EXPECT_EQ((*Finv)(1, 0), -f60);
+    EXPECT_EQ((*Finv)(1, 1), f61);
+
+    // `A * adj(A) == adj(A) * A == det(A) * I`, and rational solutions
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int64_t> distrib(-5, 5);
+    size_t numFact = 0;
+    for (size_t iter = 0; iter < 200; ++iter) {
+        const size_t M = 1 + iter % 6;
+        SquareMatrix<int64_t> A(M);
+        for (auto &a : A)
+            a = distrib(rng);
+        auto LUA = LU::fact(A);
+        if (!LUA)
+            continue;
+        ++numFact;
+        const int64_t d = LUA->det();
+        EXPECT_NE(d, 0);
+        IntMatrix X = IntMatrix::identity(M), Y = IntMatrix::identity(M);
+        ASSERT_FALSE(LUA->ldivScaled(X));
+        ASSERT_FALSE(LUA->rdivScaled(Y));
+        EXPECT_TRUE(X == Y);
+        IntMatrix AX = matmul(A, X), XA = matmul(X, A);
+        for (size_t i = 0; i < M; ++i) {
+            for (size_t j = 0; j < M; ++j) {
+                EXPECT_EQ(AX(i, j), i == j ? d : 0);
+                EXPECT_EQ(XA(i, j), i == j ? d : 0);
+            }
+        }
+        // `A \ (A * B / 2) == B / 2`
+        Matrix<Rational, 0, 0> B(M, 2), AB(M, 2);
+        for (size_t i = 0; i < M; ++i) {
+            B(i, 0) = Rational::create(distrib(rng), 2);
+            B(i, 1) = distrib(rng);
+        }
+        for (size_t i = 0; i < M; ++i)
+            for (size_t j = 0; j < 2; ++j)
+                for (size_t k = 0; k < M; ++k)
+                    AB(i, j) += (B(k, j) * A(i, k)).getValue();
+        ASSERT_FALSE(LUA->ldiv(AB));
+        EXPECT_TRUE(AB == B);
+    }
+    EXPECT_GT(numFact, size_t(100));
+}
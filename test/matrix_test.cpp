@@ -1,6 +1,8 @@
 #include "../include/Math.hpp"
+#include <cstddef>
 #include <cstdint>
 #include <gtest/gtest.h>
+#include <random>
 
 // Demonstrate some basic assertions.
 TEST(HelloTest, BasicAssertions) {
@@ -62,3 +64,86 @@ TEST(HelloTest, BasicAssertions) {
     EXPECT_TRUE(C == matmulnt(A, B.transpose()));
     EXPECT_TRUE(C == matmultt(A.transpose(), B.transpose()));
 }
+
+// naive reference for `A * B`
+static IntMatrix naiveMul(const IntMatrix &A, const IntMatrix &B) {
+    IntMatrix C(A.numRow(), B.numCol());
+    for (size_t m = 0; m < A.numRow(); ++m)
+        for (size_t n = 0; n < B.numCol(); ++n)
+            for (size_t k = 0; k < A.numCol(); ++k)
+                C(m, n) += A(m, k) * B(k, n);
+    return C;
+}
+
+TEST(MatrixExpressionTest, BasicAssertions) {
+    // larger than a `matmulBlock` in every dimension
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int64_t> d(-5, 5);
+    IntMatrix A(70, 130), B(130, 90);
+    for (auto &a : A)
+        a = d(rng);
+    for (auto &b : B)
+        b = d(rng);
+    IntMatrix C = naiveMul(A, B);
+    IntMatrix At = A.transpose(), Bt = B.transpose();
+    EXPECT_TRUE(C == IntMatrix(A * B));
+    EXPECT_TRUE(C == IntMatrix(transpose(At) * B));
+    EXPECT_TRUE(C == IntMatrix(A * transpose(Bt)));
+    EXPECT_TRUE(C == IntMatrix(transpose(At) * transpose(Bt)));
+    EXPECT_TRUE(C == matmul(A, B));
+    EXPECT_TRUE(C == matmulnt(A, Bt));
+
+    // evaluating into a slice leaves the rest of the destination untouched
+    IntMatrix D(72, 93);
+    for (auto &x : D)
+        x = 7;
+    D.view(1, 71, 2, 92) = A * B;
+    for (size_t m = 0; m < D.numRow(); ++m) {
+        for (size_t n = 0; n < D.numCol(); ++n) {
+            bool inside = (m >= 1) && (m < 71) && (n >= 2) && (n < 92);
+            EXPECT_EQ(D(m, n), inside ? C(m - 1, n - 2) : 7);
+        }
+    }
+    // products of slices, and accumulation
+    PtrMatrix<int64_t> E = D.view(1, 71, 2, 92);
+    E += A.view(0, 70, 0, 60) * B.view(0, 60, 0, 90);
+    E += A.view(0, 70, 60, 130) * B.view(60, 130, 0, 90);
+    for (size_t m = 0; m < C.numRow(); ++m)
+        for (size_t n = 0; n < C.numCol(); ++n)
+            EXPECT_EQ(E(m, n), 2 * C(m, n));
+
+    // scaled row sums
+    IntMatrix R(3, 5);
+    for (size_t n = 0; n < 5; ++n) {
+        R(0, n) = n;
+        R(1, n) = 1;
+        R(2, n) = n * n;
+    }
+    scaleAddRow(R, 2, 2, 0, -3);
+    combineRows(R, 0, 1, 1, 2, 3, 4);
+    for (int64_t n = 0; n < 5; ++n) {
+        EXPECT_EQ(R(2, n), 2 * n * n - 3 * n);
+        EXPECT_EQ(R(0, n), n + 2);
+        EXPECT_EQ(R(1, n), 3 - 4 * n);
+    }
+}
+
+TEST(FixedSizeMatrixTest, BasicAssertions) {
+    auto I = Matrix<int64_t, 3, 3>::identity();
+    static_assert(sizeof(I) == 9 * sizeof(int64_t));
+    EXPECT_EQ(I.end() - I.begin(), 9);
+    for (size_t i = 0; i < 3; ++i)
+        for (size_t j = 0; j < 3; ++j)
+            EXPECT_EQ(I(i, j), i == j);
+    Matrix<int64_t, 2, 3> A;
+    for (size_t i = 0; i < 6; ++i)
+        A.mem[i] = i;
+    EXPECT_EQ(A.getRow(1)[2], 5);
+    PtrMatrix<int64_t> P = A;
+    EXPECT_EQ(P.numRow(), size_t(2));
+    EXPECT_EQ(P(1, 0), 3);
+    // sizes are passed as compile time constants up to the maximum
+    for (size_t n = 0; n < 6; ++n)
+        EXPECT_EQ(dispatchSize<4>(n, [](auto N) { return N(); }),
+                  n <= 4 ? n : 0);
+}
@@ -0,0 +1,132 @@
+// counts allocations by phase, as the `track_allocations` build option does
+#define TURBOLOOP_TRACK_ALLOCATIONS 1
+#include "../include/ArrayReference.hpp"
+#include "../include/Instrumentation.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/Loops.hpp"
+#include "../include/Math.hpp"
+#include "../include/MemoryUse.hpp"
+#include "../include/POSet.hpp"
+#include "../include/Schedule.hpp"
+#include "../include/Symbolics.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <llvm/ADT/SmallVector.h>
+
+TEST(MemoryUseTest, AllocationsByPhase) {
+    AllocationCounts start = allocationCounts();
+    {
+        PhaseTimer farkas(Phase::Farkas);
+        IntMatrix A(64, 64);
+        {
+            // nested phases are attributed to the innermost one
+            PhaseTimer pruning(Phase::RedundancyElimination);
+            IntMatrix B(32, 32);
+            EXPECT_EQ(B.numRow(), size_t(32));
+        }
+        EXPECT_EQ(allocationPhase, size_t(Phase::Farkas));
+        EXPECT_EQ(A.numRow(), size_t(64));
+    }
+    EXPECT_EQ(allocationPhase, numPhases);
+    AllocationCounts d = allocationCounts() - start;
+    EXPECT_GE(d.bytes[size_t(Phase::Farkas)], uint64_t(64 * 64 * 8));
+    EXPECT_GE(d.count[size_t(Phase::Farkas)], uint64_t(1));
+    EXPECT_GE(d.bytes[size_t(Phase::RedundancyElimination)],
+              uint64_t(32 * 32 * 8));
+    EXPECT_LT(d.bytes[size_t(Phase::RedundancyElimination)],
+              uint64_t(64 * 64 * 8));
+    EXPECT_EQ(d.count[size_t(Phase::Scheduling)], uint64_t(0));
+
+    // both matrices were live at once
+    resetPeakLiveBytes();
+    uint64_t live = liveBytes;
+    {
+        IntMatrix A(64, 64);
+        IntMatrix B(32, 32);
+        EXPECT_EQ(A.numRow() + B.numRow(), size_t(96));
+    }
+    EXPECT_GE(allocationCounts().peakLiveBytes - live,
+              uint64_t((64 * 64 + 32 * 32) * 8));
+    EXPECT_LE(liveBytes, live);
+}
+
+TEST(MemoryUseTest, AllocationFunctions) {
+    // every allocation function is counted, and releasing the block gives
+    // its bytes back
+    uint64_t live = liveBytes;
+    void *v = valloc(4096);
+    void *pv = pvalloc(100);
+    void *r = reallocarray(nullptr, 16, sizeof(double));
+    ASSERT_NE(v, nullptr);
+    ASSERT_NE(pv, nullptr);
+    ASSERT_NE(r, nullptr);
+    EXPECT_GE(liveBytes - live, uint64_t(4096 + 100 + 16 * sizeof(double)));
+    r = reallocarray(r, 64, sizeof(double));
+    ASSERT_NE(r, nullptr);
+    free(v);
+    free(pv);
+    free(r);
+    EXPECT_EQ(liveBytes, live);
+
+    // releasing a block allocated behind the counters' back does not wrap
+    void *uncounted = __libc_malloc(256);
+    ASSERT_NE(uncounted, nullptr);
+    liveBytes = 0;
+    free(uncounted);
+    EXPECT_EQ(liveBytes, uint64_t(0));
+    liveBytes = live;
+}
+
+TEST(MemoryUseTest, Census) {
+    // `for m in 0:M-1, n in 0:N-1, A[m + M*n] *= 2`
+    auto M = MPoly(Polynomial::Monomial(Polynomial::ID{1}));
+    auto N = MPoly(Polynomial::Monomial(Polynomial::ID{2}));
+    IntMatrix Aloop(4, 2);
+    llvm::SmallVector<MPoly, 8> bloop;
+    Aloop(0, 0) = 1;
+    bloop.push_back(M - 1);
+    Aloop(1, 0) = -1;
+    bloop.push_back(0);
+    Aloop(2, 1) = 1;
+    bloop.push_back(N - 1);
+    Aloop(3, 1) = -1;
+    bloop.push_back(0);
+    PartiallyOrderedSet poset;
+    poset.push(1, 2, Interval::nonNegative());
+    auto loop = llvm::makeIntrusiveRefCnt<AffineLoopNest>(Aloop, bloop, poset);
+    ArrayReference Amn(0, loop, 2);
+    {
+        PtrMatrix<int64_t> IndMat = Amn.indexMatrix();
+        IndMat(0, 0) = 1; // m
+        IndMat(1, 1) = 1; // n
+        Amn.stridesOffsets[0] = std::make_pair(MPoly(1), MPoly(0));
+        Amn.stridesOffsets[1] = std::make_pair(M, MPoly(0));
+    }
+    LoopBlock lblock;
+    Schedule sch(2);
+    lblock.memory.emplace_back(Amn, nullptr, sch, true);
+    sch.getOmega()[4] = 1;
+    lblock.memory.emplace_back(Amn, nullptr, sch, false);
+
+    MemoryUse before = memoryUse(lblock);
+    // the loop nest shared by both accesses is counted once
+    EXPECT_EQ(before.loops.size(), size_t(1));
+    // `M - 1` has two terms, more than are stored inline
+    EXPECT_GT(before.bytes[size_t(ObjectKind::Polynomial)], size_t(0));
+    EXPECT_GT(before.bytes[size_t(ObjectKind::POSet)], size_t(0));
+    EXPECT_EQ(before.totalBuffers(),
+              before.buffers[size_t(ObjectKind::Matrix)] +
+                  before.buffers[size_t(ObjectKind::Polynomial)] +
+                  before.buffers[size_t(ObjectKind::POSet)] +
+                  before.buffers[size_t(ObjectKind::Other)]);
+
+    // dependences add their polyhedra
+    lblock.fillEdges();
+    ASSERT_FALSE(lblock.edges.empty());
+    MemoryUse after = memoryUse(lblock);
+    EXPECT_GT(after.bytes[size_t(ObjectKind::Matrix)],
+              before.bytes[size_t(ObjectKind::Matrix)]);
+    EXPECT_GT(after.totalBytes(), before.totalBytes());
+}
@@ -286,6 +286,85 @@ TEST(Hermite, BasicAssertions) {
     }
 }
 
+// `U * A == H`, without overflow
+bool isExactProduct(PtrMatrix<int64_t> U, PtrMatrix<int64_t> A,
+                    PtrMatrix<int64_t> H) {
+    for (size_t i = 0; i < H.numRow(); ++i) {
+        for (size_t j = 0; j < H.numCol(); ++j) {
+            __int128_t h = 0;
+            for (size_t k = 0; k < A.numRow(); ++k)
+                h += widen(U(i, k)) * A(k, j);
+            if (h != H(i, j))
+                return false;
+        }
+    }
+    return true;
+}
+
+TEST(Hermite, Modular) {
+    std::mt19937 gen(1234);
+    std::uniform_int_distribution<> distrib(-6, 6);
+    size_t numChecked = 0;
+    for (size_t M = 2; M <= 7; ++M) {
+        for (size_t N = M; N <= M + 3; ++N) {
+            for (size_t t = 0; t < 8; ++t) {
+                IntMatrix A(M, N);
+                for (auto &a : A)
+                    a = distrib(gen);
+                // leading zero columns, as in the constraints of a nest
+                if (t & 1)
+                    for (size_t m = 0; m < M; ++m)
+                        A(m, 0) = 0;
+                auto HU = NormalForm::modularHermite(A);
+                IntMatrix H = A;
+                SquareMatrix<int64_t> U = SquareMatrix<int64_t>::identity(M);
+                NormalForm::simplifyEqualityConstraintsImpl(H, U);
+                // `A` has full row rank unless the last row of `H` is zero
+                if (allZero(H.getRow(M - 1))) {
+                    EXPECT_FALSE(HU.hasValue());
+                    continue;
+                }
+                ASSERT_TRUE(HU.hasValue());
+                EXPECT_TRUE(isHNF(HU->first));
+                EXPECT_TRUE(isExactProduct(HU->second, A, HU->first));
+                // row reduction may overflow, wrapping `H` and `U` alike
+                if (!isExactProduct(U, A, H))
+                    continue;
+                EXPECT_TRUE(HU->first == H);
+                EXPECT_TRUE(HU->second == U);
+                ++numChecked;
+            }
+        }
+    }
+    EXPECT_GT(numChecked, size_t(100));
+    // rank deficient
+    IntMatrix A(3, 4);
+    for (size_t n = 0; n < 4; ++n) {
+        A(0, n) = distrib(gen);
+        A(1, n) = distrib(gen);
+        A(2, n) = A(0, n) - 2 * A(1, n);
+    }
+    EXPECT_FALSE(NormalForm::modularHermite(A).hasValue());
+    // large coefficients; `|det(U)| == 1`, as `det(H) == |det(B)|`
+    std::uniform_int_distribution<int64_t> large(-4096, 4096);
+    for (size_t M = 2; M <= 4; ++M) {
+        SquareMatrix<int64_t> B(M);
+        for (auto &b : B)
+            b = large(gen);
+        auto HU = NormalForm::hermite(B);
+        ASSERT_TRUE(HU.hasValue());
+        auto [H, U] = HU.getValue();
+        EXPECT_TRUE(isHNF(H));
+        EXPECT_TRUE(isExactProduct(U, B, H));
+        llvm::Optional<LU> lu = LU::fact(B);
+        ASSERT_TRUE(lu.hasValue());
+        int64_t detH = 1;
+        for (size_t i = 0; i < M; ++i)
+            detH *= H(i, i);
+        EXPECT_EQ(detH, std::abs(lu->det()));
+    }
+}
+
 TEST(NullSpaceTests, BasicAssertions) {
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -315,3 +394,32 @@ TEST(NullSpaceTests, BasicAssertions) {
                   << double(nullDim) / double(numIters) << std::endl;
     }
 }
+
+// The null spaces of matrices with up to four rows, as of the loops shared by
+// two memory accesses, are found with the row count known at compile time,
+// the same as without.
+TEST(NullSpaceTests, StaticRows) {
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<> distrib(-10, 30);
+    for (size_t numCol = 1; numCol < 9; ++numCol) {
+        for (size_t i = 0; i < 200; ++i) {
+            for (size_t numRow = 1; numRow <= 4; ++numRow) {
+                IntMatrix B(numRow, numCol);
+                for (size_t n = 0; n < B.length(); ++n) {
+                    B[n] = distrib(gen);
+                    if (B[n] > 10)
+                        B[n] = 0;
+                }
+                IntMatrix NS = NormalForm::nullSpace(B);
+                IntMatrix C = B;
+                IntMatrix SNS = dispatchSize<4>(numRow, [&](auto M) {
+                    if constexpr (M())
+                        return NormalForm::nullSpace<M()>(C);
+                    else
+                        return NormalForm::nullSpace(C);
+                });
+                EXPECT_TRUE(NS == SNS);
+            }
+        }
+    }
+}
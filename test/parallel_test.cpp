@@ -0,0 +1,151 @@
+#include "../include/ArrayReference.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/Math.hpp"
+#include "../include/Parallelization.hpp"
+#include "../include/Runtime.hpp"
+#include "../include/Symbolics.hpp"
+#include "./TestBlocks.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <vector>
+
+struct CountContext {
+    std::vector<std::atomic<int>> counts;
+    std::atomic<size_t> calls{0};
+    int64_t maxChunk = 0;
+    CountContext(size_t N) : counts(N) {}
+};
+void countBody(void *context, int64_t begin, int64_t end) {
+    CountContext &c = *static_cast<CountContext *>(context);
+    ++c.calls;
+    EXPECT_LE(end - begin, c.maxChunk);
+    for (int64_t i = begin; i < end; ++i)
+        ++c.counts[i];
+}
+void nestedBody(void *context, int64_t begin, int64_t end) {
+    // nested calls run serially on this thread, in one call
+    for (int64_t i = begin; i < end; ++i)
+        turboloop_parallel_for(countBody, context, 4 * i, 4 * i + 4, 1);
+}
+
+TEST(ParallelRuntime, BasicAssertions) {
+    for (size_t numThreads = 1; numThreads <= 4; ++numThreads) {
+        turboloop_set_num_threads(numThreads);
+        EXPECT_EQ(turboloop_num_threads(), numThreads);
+        for (int64_t grain : {int64_t(0), int64_t(1), int64_t(7)}) {
+            const size_t N = 1000;
+            CountContext c(N);
+            const bool serial = numThreads == 1;
+            c.maxChunk = (grain > 0) && !serial ? grain : N;
+            turboloop_parallel_for(countBody, &c, 0, N, grain);
+            for (auto &x : c.counts)
+                EXPECT_EQ(x.load(), 1);
+            if (serial) {
+                EXPECT_EQ(c.calls.load(), 1);
+            } else if (grain > 0) {
+                EXPECT_GE(c.calls.load(), (N + grain - 1) / grain);
+            }
+        }
+        // empty ranges do nothing
+        CountContext e(1);
+        turboloop_parallel_for(countBody, &e, 5, 5, 1);
+        turboloop_parallel_for(countBody, &e, 5, 3, 1);
+        EXPECT_EQ(e.calls.load(), 0);
+        // offset ranges
+        CountContext o(100);
+        o.maxChunk = numThreads == 1 ? 60 : 3;
+        turboloop_parallel_for(countBody, &o, 40, 100, 3);
+        for (size_t i = 0; i < 100; ++i)
+            EXPECT_EQ(o.counts[i].load(), i >= 40);
+        // nested parallel loops
+        CountContext n(400);
+        n.maxChunk = 4;
+        turboloop_parallel_for(nestedBody, &n, 0, 100, 1);
+        for (auto &x : n.counts)
+            EXPECT_EQ(x.load(), 1);
+    }
+    turboloop_set_num_threads(0);
+    EXPECT_GE(turboloop_num_threads(), 1);
+}
+
+// for (i = 0; i < I; ++i){
+//   for (j = 0; j < J; ++j){
+//     A(j, i+1) = A(j, i) + B(j, i);
+//   }
+// }
+// for (i = 0; i < I; ++i){
+//   for (j = 0; j < J; ++j){
+//     C(j, i) = C(j, i) + B(j, i);
+//   }
+// }
+void recurrenceBlock(LoopBlock &lblock) {
+    auto I = Polynomial::Monomial(Polynomial::ID{1});
+    auto J = Polynomial::Monomial(Polynomial::ID{2});
+    auto loop =
+        LoopNestBuilder(2).bound(0, 0, I - 1).bound(1, 0, J - 1).nest();
+    const MPoly strides[2] = {1, J};
+    // `(j, i + offset)`
+    auto ref = [&](size_t id, int64_t offset) {
+        return arrayRef(id, loop, {1, 0}, strides, {0, offset});
+    };
+    lblock.memory.reserve(6);
+    pushAccess(lblock, ref(0, 0), true, {0, 0, 0});  // A(j, i)
+    pushAccess(lblock, ref(1, 0), true, {0, 0, 1});  // B(j, i)
+    pushAccess(lblock, ref(0, 1), false, {0, 0, 2}); // A(j, i+1) =
+    pushAccess(lblock, ref(2, 0), true, {1, 0, 0});  // C(j, i)
+    pushAccess(lblock, ref(1, 0), true, {1, 0, 1});  // B(j, i)
+    pushAccess(lblock, ref(2, 0), false, {1, 0, 2}); // C(j, i) =
+}
+
+TEST(ParallelLoops, BasicAssertions) {
+    LoopBlock lblock;
+    recurrenceBlock(lblock);
+    lblock.fillEdges();
+    for (auto &e : lblock.edges)
+        std::cout << "Edge: " << lblock.memoryIndex(e.in) << " -> "
+                  << lblock.memoryIndex(e.out) << std::endl;
+    optimizeParallelism(lblock);
+    // the recurrence is carried by `i`, so only `j` is parallel
+    for (size_t i = 0; i < 3; ++i)
+        EXPECT_EQ(lblock.memory[i].schedule.parallel, 1);
+    // the update of `C` has no carried dependencies
+    for (size_t i = 3; i < 6; ++i)
+        EXPECT_EQ(lblock.memory[i].schedule.parallel, 0);
+}
+
+TEST(ParallelForIR, BasicAssertions) {
+    llvm::LLVMContext ctx;
+    llvm::Module mod("parallel", ctx);
+    llvm::Function *body = llvm::Function::Create(
+        parallelBodyType(ctx), llvm::Function::ExternalLinkage, "body", mod);
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "entry", body));
+    builder.CreateRetVoid();
+
+    llvm::Type *i32 = llvm::Type::getInt32Ty(ctx);
+    llvm::Type *f64 = llvm::Type::getDoubleTy(ctx);
+    llvm::Function *caller = llvm::Function::Create(
+        llvm::FunctionType::get(llvm::Type::getVoidTy(ctx),
+                                {llvm::PointerType::getUnqual(f64), i32},
+                                false),
+        llvm::Function::ExternalLinkage, "caller", mod);
+    builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", caller));
+    llvm::CallInst *call =
+        emitParallelFor(builder, body, caller->getArg(0),
+                        builder.getInt64(0), caller->getArg(1),
+                        builder.getInt64(0));
+    builder.CreateRetVoid();
+    EXPECT_EQ(call->getCalledFunction()->getName(), "turboloop_parallel_for");
+    EXPECT_FALSE(llvm::verifyModule(mod, &llvm::errs()));
+    // declared only once
+    emitParallelFor(builder, body, caller->getArg(0), builder.getInt64(0),
+                    builder.getInt64(1), builder.getInt64(1));
+    EXPECT_EQ(mod.getFunctionList().size(), 3);
+}
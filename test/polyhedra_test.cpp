@@ -0,0 +1,63 @@
+#include "../include/AbstractEqualityPolyhedra.hpp"
+#include "../include/Math.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+
+// returns `true` if row `c` of `A` and `b` is `a' * x <= bound`
+static bool hasConstraint(PtrMatrix<const int64_t> A,
+                          llvm::ArrayRef<int64_t> b,
+                          llvm::ArrayRef<int64_t> a, int64_t bound) {
+    for (size_t c = 0; c < A.numRow(); ++c) {
+        if (b[c] != bound)
+            continue;
+        bool match = true;
+        for (size_t v = 0; v < a.size(); ++v)
+            match &= A(c, v) == a[v];
+        if (match)
+            return true;
+    }
+    return false;
+}
+
+TEST(PruneBoundsTest, BasicAssertions) {
+    // `pruneBounds` may be handed a system other than the polyhedron's
+    // own, which here has no inequalities at all.
+    IntegerEqPolyhedra P(0, 0, 2);
+    {
+        // 0 <= x0 <= 5, x0 <= 3; the first bound is redundant
+        IntMatrix A(3, 2);
+        llvm::SmallVector<int64_t, 8> b{5, 3, 0};
+        A(0, 0) = 1;
+        A(1, 0) = 1;
+        A(2, 0) = -1;
+        IntMatrix E(0, 2);
+        llvm::SmallVector<int64_t, 8> q;
+        EXPECT_FALSE(P.pruneBounds(A, b, E, q));
+        EXPECT_EQ(A.numRow(), 2);
+        EXPECT_TRUE(hasConstraint(A, b, {1, 0}, 3));
+        EXPECT_TRUE(hasConstraint(A, b, {-1, 0}, 0));
+    }
+    {
+        // 0 <= x0 <= 5, 0 <= x1 <= 3, x0 == x1
+        // `x1 <= 3` makes `x0 <= 5` redundant, and `0 <= x0` makes
+        // `0 <= x1` redundant, each through the equality.
+        IntMatrix A(4, 2);
+        llvm::SmallVector<int64_t, 8> b{5, 3, 0, 0};
+        A(0, 0) = 1;
+        A(1, 1) = 1;
+        A(2, 0) = -1;
+        A(3, 1) = -1;
+        IntMatrix E(1, 2);
+        llvm::SmallVector<int64_t, 8> q{0};
+        E(0, 0) = 1;
+        E(0, 1) = -1;
+        EXPECT_FALSE(P.pruneBounds(A, b, E, q));
+        EXPECT_EQ(A.numRow(), 2);
+        EXPECT_TRUE(hasConstraint(A, b, {0, 1}, 3));
+        EXPECT_TRUE(hasConstraint(A, b, {-1, 0}, 0));
+        EXPECT_EQ(E.numRow(), 1);
+    }
+}
@@ -1,6 +1,10 @@
 #include "../include/POSet.hpp"
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <gtest/gtest.h>
+#include <llvm/ADT/SmallVector.h>
+#include <random>
 
 TEST(POSet0, BasicAssertions) {
     PartiallyOrderedSet poset;
@@ -117,3 +121,44 @@ TEST(PolynomialCmp, BasicAssertions) {
     EXPECT_TRUE(poset.knownGreaterEqualZero(3 - P));
     EXPECT_FALSE(poset.knownGreaterEqualZero(2 - P));
 }
+
+// Random lower bounds between a quarter of all pairs of 64 variables, each
+// tightening many others; the closure used to recurse deeply enough to
+// overflow the stack.
+TEST(POSetOneSided, BasicAssertions) {
+    constexpr size_t n = 64;
+    std::mt19937_64 rng(n);
+    std::uniform_int_distribution<int64_t> value(-1000, 1000), slack(0, 100);
+    std::uniform_int_distribution<size_t> var(0, n);
+    llvm::SmallVector<int64_t> x(n + 1);
+    for (size_t i = 1; i <= n; ++i)
+        x[i] = value(rng);
+    PartiallyOrderedSet poset;
+    llvm::SmallVector<std::pair<size_t, size_t>> pushed;
+    while (pushed.size() < n * (n + 1) / 8) {
+        size_t i = var(rng), j = var(rng);
+        if (i == j)
+            continue;
+        // x_j - x_i >= d - slack
+        poset.push(i, j, Interval::LowerBound(x[j] - x[i] - slack(rng)));
+        pushed.emplace_back(i, j);
+    }
+    EXPECT_EQ(poset.nVar, n + 1);
+    // the values of the variables still satisfy every relation
+    for (size_t i = 0; i <= n; ++i) {
+        for (size_t j = 0; j <= n; ++j) {
+            Interval ij = poset(i, j);
+            EXPECT_LE(ij.lowerBound, x[j] - x[i]);
+            EXPECT_GE(ij.upperBound, x[j] - x[i]);
+        }
+    }
+    // and the bounds pushed are at most as tight as those known
+    for (auto [i, j] : pushed) {
+        EXPECT_LE(x[j] - x[i] - 100, poset(i, j).lowerBound);
+        // and are implied through any third variable
+        for (size_t k = 0; k <= n; ++k)
+            EXPECT_GE(poset(i, j).lowerBound,
+                      saturatedAdd(poset(i, k).lowerBound,
+                                   poset(k, j).lowerBound));
+    }
+}
@@ -0,0 +1,224 @@
+#include "../include/CacheTiling.hpp"
+#include "../include/CostModeling.hpp"
+#include "../include/IRExtraction.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/POSet.hpp"
+#include "../include/Remarks.hpp"
+#include "./TestIR.hpp"
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/OptimizationRemarkEmitter.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <memory>
+#include <string>
+
+// `for i in 0:n-1, A[i] = 2 * A[i]`,
+// `for i in 0:n-1, j in 0:n-1, C[j + n*i] = A[j] + B[j] + D[j]`, and the
+// recurrence
+// `for i in 1:n-1, A[i] = 2 * A[i-1]`.
+static const char *remarksIR = R"(
+define void @scale(double* %A, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %loop, label %exit
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inext, %loop ]
+  %p = getelementptr inbounds double, double* %A, i64 %i
+  %x = load double, double* %p
+  %y = fmul double %x, 2.0
+  store double %y, double* %p
+  %inext = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %inext, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+define void @broadcast(double* noalias %C, double* noalias %A, double* noalias %B, double* noalias %D, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %i = phi i64 [ 0, %entry ], [ %inext, %outer.latch ]
+  %ni = mul nsw i64 %n, %i
+  br label %inner
+
+inner:
+  %j = phi i64 [ 0, %outer ], [ %jnext, %inner ]
+  %ap = getelementptr inbounds double, double* %A, i64 %j
+  %a = load double, double* %ap
+  %bp = getelementptr inbounds double, double* %B, i64 %j
+  %b = load double, double* %bp
+  %dp = getelementptr inbounds double, double* %D, i64 %j
+  %d = load double, double* %dp
+  %ab = fadd double %a, %b
+  %abd = fadd double %ab, %d
+  %idx = add nsw i64 %j, %ni
+  %cp = getelementptr inbounds double, double* %C, i64 %idx
+  store double %abd, double* %cp
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %inner, label %outer.latch
+
+outer.latch:
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp slt i64 %inext, %n
+  br i1 %ic, label %outer, label %exit
+
+exit:
+  ret void
+}
+
+define void @recurrence(double* %A, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 1
+  br i1 %guard, label %loop, label %exit
+
+loop:
+  %i = phi i64 [ 1, %entry ], [ %inext, %loop ]
+  %im1 = add nsw i64 %i, -1
+  %q = getelementptr inbounds double, double* %A, i64 %im1
+  %x = load double, double* %q
+  %y = fmul double %x, 2.0
+  %p = getelementptr inbounds double, double* %A, i64 %i
+  store double %y, double* %p
+  %inext = add nuw nsw i64 %i, 1
+  %c = icmp slt i64 %inext, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+)";
+
+struct Remark {
+    std::string name;
+    std::string msg;
+    llvm::SmallVector<std::string> keys;
+};
+
+// Collects the analysis and missed-optimization remarks of the pass.
+struct RemarkCollector : llvm::DiagnosticHandler {
+    llvm::SmallVector<Remark> analyses, missed;
+    bool isAnalysisRemarkEnabled(llvm::StringRef passName) const override {
+        return passName == remarkPassName;
+    }
+    bool isMissedOptRemarkEnabled(llvm::StringRef passName) const override {
+        return passName == remarkPassName;
+    }
+    bool handleDiagnostics(const llvm::DiagnosticInfo &DI) override {
+        auto *R = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&DI);
+        if (!R)
+            return false;
+        Remark r{R->getRemarkName().str(), R->getMsg(), {}};
+        for (auto &arg : R->getArgs())
+            r.keys.push_back(arg.Key);
+        if (llvm::isa<llvm::OptimizationRemarkAnalysis>(&DI))
+            analyses.push_back(std::move(r));
+        else if (llvm::isa<llvm::OptimizationRemarkMissed>(&DI))
+            missed.push_back(std::move(r));
+        return true;
+    }
+};
+
+// Extracts, schedules and tiles the loop nest of `name`, emitting its
+// remarks to `diag`.
+struct ScheduledFunction : ParsedModule {
+    RemarkCollector *diag;
+    llvm::SmallVector<std::unique_ptr<ExtractedLoopBlock>> blocks;
+    ScheduledFunction(const char *name) : ParsedModule(remarksIR) {
+        auto collector = std::make_unique<RemarkCollector>();
+        diag = collector.get();
+        ctx.setDiagnosticHandler(std::move(collector));
+        llvm::Function *F = mod->getFunction(name);
+        Analyses an(*F);
+        llvm::TargetTransformInfo TTI{mod->getDataLayout()};
+        llvm::OptimizationRemarkEmitter ORE(F);
+        ValueToPosetMap symbols;
+        PartiallyOrderedSet poset;
+        extractLoopBlocks(blocks, an.LI, an.SE, mod->getDataLayout(), symbols,
+                          poset);
+        CostModeling::RegisterFile registers =
+            CostModeling::RegisterFile::get(TTI);
+        for (auto &eb : blocks) {
+            LoopBlock &lblock = eb->lblock;
+            lblock.fillEdges();
+            if (lblock.optimizeSchedules(1)) {
+                emitScheduleFailureRemark(ORE, lblock, eb->root,
+                                          eb->basePointers);
+                continue;
+            }
+            CostModeling::optimizeRegisterTiling(lblock, registers);
+            CostModeling::chooseVectorTails(lblock, TTI);
+            CostModeling::optimizeCacheTiling(
+                lblock, registers, CostModeling::CacheParameters::get(TTI));
+            emitScheduleRemarks(ORE, lblock, eb->root, eb->basePointers);
+        }
+    }
+};
+
+static bool hasKey(const Remark &r, llvm::StringRef key) {
+    return llvm::is_contained(r.keys, key);
+}
+
+TEST(RemarksTest, Schedule) {
+    ScheduledFunction sf("scale");
+    ASSERT_EQ(sf.blocks.size(), size_t(1));
+    ASSERT_EQ(sf.diag->analyses.size(), size_t(1));
+    const Remark &r = sf.diag->analyses.front();
+    EXPECT_EQ(r.name, "Schedule");
+    EXPECT_TRUE(hasKey(r, "Depth"));
+    EXPECT_TRUE(hasKey(r, "LoopOrder"));
+    EXPECT_NE(r.msg.find("loop nest of depth 1 with 2 memory accesses"),
+              std::string::npos);
+    EXPECT_NE(r.msg.find("loop order (0)"), std::string::npos);
+    // the load and store of `A[i]` carry no dependence
+    EXPECT_TRUE(sf.diag->missed.empty());
+}
+
+TEST(RemarksTest, PlannedUnroll) {
+    // the loads of `A[j]`, `B[j]` and `D[j]` are shared by the iterations of
+    // `i`, so unrolling `i` saves loads
+    ScheduledFunction sf("broadcast");
+    ASSERT_EQ(sf.blocks.size(), size_t(1));
+    ASSERT_EQ(sf.diag->analyses.size(), size_t(1));
+    const Remark &r = sf.diag->analyses.front();
+    EXPECT_EQ(r.name, "Schedule");
+    // unrolling is planned, never reported as applied
+    EXPECT_FALSE(hasKey(r, "UnrollInner"));
+    EXPECT_FALSE(hasKey(r, "UnrollOuter"));
+    EXPECT_TRUE(hasKey(r, "PlannedUnrolledInnerLevel"));
+    EXPECT_TRUE(hasKey(r, "PlannedUnrollInner"));
+    EXPECT_NE(r.msg.find("planned unroll of level 0"), std::string::npos)
+        << r.msg;
+    EXPECT_EQ(r.msg.find("not applied"), std::string::npos) << r.msg;
+    EXPECT_TRUE(sf.diag->missed.empty());
+}
+
+TEST(RemarksTest, CarriedDependence) {
+    ScheduledFunction sf("recurrence");
+    ASSERT_EQ(sf.blocks.size(), size_t(1));
+    ASSERT_EQ(sf.diag->analyses.size(), size_t(1));
+    EXPECT_EQ(sf.diag->analyses.front().name, "Schedule");
+    // `A[i] = 2 * A[i-1]` is carried by the only loop, naming the accesses
+    // and the array
+    ASSERT_EQ(sf.diag->missed.size(), size_t(1));
+    const Remark &r = sf.diag->missed.front();
+    EXPECT_EQ(r.name, "CarriedDependence");
+    EXPECT_TRUE(hasKey(r, "Level"));
+    EXPECT_TRUE(hasKey(r, "Source"));
+    EXPECT_TRUE(hasKey(r, "Sink"));
+    EXPECT_TRUE(hasKey(r, "Array"));
+    EXPECT_NE(r.msg.find("level 0 not vectorized"), std::string::npos);
+}
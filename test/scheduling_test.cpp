@@ -0,0 +1,240 @@
+#include "../include/ArrayReference.hpp"
+#include "../include/DependencyPolyhedra.hpp"
+#include "../include/Graphs.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/Math.hpp"
+#include "../include/Symbolics.hpp"
+#include "./TestBlocks.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <llvm/ADT/SmallVector.h>
+
+// badly written triangular solve:
+// for (m = 0; m < M; ++m){
+//   for (n = 0; n < N; ++n){
+//     A(m,n) = B(m,n); // sch2_0_{0-1}
+//   }
+//   for (n = 0; n < N; ++n){
+//     A(m,n) = A(m,n) / U(n,n); // sch2_1_{0-2}
+//     for (k = n+1; k < N; ++k){
+//       A(m,k) = A(m,k) - A(m,n)*U(n,k); // sch3_{0-3}
+//     }
+//   }
+// }
+// followed by an unrelated copy in a separate loop nest
+// for (m = 0; m < M; ++m){
+//   for (n = 0; n < N; ++n){
+//     C(m,n) = D(m,n); // sch2_2_{0-1}
+//   }
+// }
+void triangularBlock(LoopBlock &lblock) {
+    auto M = Polynomial::Monomial(Polynomial::ID{1});
+    auto N = Polynomial::Monomial(Polynomial::ID{2});
+    // 0 <= m <= M-1, 0 <= n <= N-1
+    auto loopMN =
+        LoopNestBuilder(2).bound(0, 0, M - 1).bound(1, 0, N - 1).nest();
+    // and n+1 <= k <= N-1
+    auto loopMNK = LoopNestBuilder(3)
+                       .bound(0, 0, M - 1)
+                       .bound(1, 0, N - 1)
+                       .bound(2, 1, N - 1, {0, 1})
+                       .nest();
+    const MPoly stridesM[2] = {1, M}, stridesN[2] = {1, N};
+    ArrayReference BmnInd = arrayRef(0, loopMN, {0, 1}, stridesM);
+    ArrayReference Amn2Ind = arrayRef(1, loopMN, {0, 1}, stridesM);
+    ArrayReference Amn3Ind = arrayRef(1, loopMNK, {0, 1}, stridesM);
+    ArrayReference AmkInd = arrayRef(1, loopMNK, {0, 2}, stridesM);
+    ArrayReference UnkInd = arrayRef(2, loopMNK, {1, 2}, stridesN);
+    ArrayReference UnnInd = arrayRef(2, loopMN, {1, 1}, stridesN);
+    ArrayReference DmnInd = arrayRef(3, loopMN, {0, 1}, stridesM);
+    ArrayReference CmnInd = arrayRef(4, loopMN, {0, 1}, stridesM);
+
+    // `edges` point into `memory`, so it must not reallocate
+    lblock.memory.reserve(11);
+    pushAccess(lblock, BmnInd, true, {0, 0, 0});
+    pushAccess(lblock, Amn2Ind, false, {0, 0, 1});
+    pushAccess(lblock, Amn2Ind, true, {0, 1, 0});
+    pushAccess(lblock, UnnInd, true, {0, 1, 1});
+    pushAccess(lblock, Amn2Ind, false, {0, 1, 2});
+    pushAccess(lblock, UnkInd, true, {0, 1, 3, 0});
+    pushAccess(lblock, Amn3Ind, true, {0, 1, 3, 1});
+    pushAccess(lblock, AmkInd, true, {0, 1, 3, 2});
+    pushAccess(lblock, AmkInd, false, {0, 1, 3, 3});
+    pushAccess(lblock, DmnInd, true, {1, 0, 0});
+    pushAccess(lblock, CmnInd, false, {1, 0, 1});
+}
+
+// for (i = 0; i < I; ++i){
+//   for (j = 0; j < J; ++j){
+//     A(i,j) = B(i,j);
+//     C(i,j) = A(i,j);
+//   }
+// }
+// for (i = 0; i < I; ++i){
+//   for (j = 0; j < J; ++j){
+//     D(i,j) = A(i,j);
+//   }
+// }
+void copyBlock(LoopBlock &lblock) {
+    auto I = Polynomial::Monomial(Polynomial::ID{1});
+    auto J = Polynomial::Monomial(Polynomial::ID{2});
+    auto loop = LoopNestBuilder(2).bound(0, 0, I - 1).bound(1, 0, J - 1).nest();
+    const MPoly strides[2] = {1, I};
+    lblock.memory.reserve(6);
+    auto push = [&](size_t id, bool isLoad, int64_t o0, int64_t o4) {
+        pushAccess(lblock, arrayRef(id, loop, {0, 1}, strides), isLoad,
+                   {o0, 0, o4});
+    };
+    push(1, true, 0, 0);  // B(i,j)
+    push(0, false, 0, 1); // A(i,j) =
+    push(0, true, 0, 2);  // A(i,j)
+    push(2, false, 0, 3); // C(i,j) =
+    push(0, true, 1, 0);  // A(i,j)
+    push(3, false, 1, 1); // D(i,j) =
+    for (unsigned s = 1; s < 6; s += 2)
+        lblock.valueFlow.emplace_back(s - 1, s);
+}
+
+// `numNests` loop nests, the `n`th of which is
+// for (i = 1; i < I; ++i){
+//   for (j = 1; j < J; ++j){
+//     A_n(i,j) = A_n(i,j) + A_n(i-1,j) + A_n(i,j-1);
+//   }
+// }
+// Each nest is a separate strongly connected component with internal edges.
+void stencilNests(LoopBlock &lblock, size_t numNests) {
+    auto I = Polynomial::Monomial(Polynomial::ID{1});
+    auto J = Polynomial::Monomial(Polynomial::ID{2});
+    auto loop = LoopNestBuilder(2).bound(0, 1, I - 1).bound(1, 1, J - 1).nest();
+    const MPoly strides[2] = {1, I};
+    lblock.memory.reserve(4 * numNests);
+    for (size_t n = 0; n < numNests; ++n) {
+        const int64_t o0 = n;
+        pushAccess(lblock, arrayRef(n, loop, {0, 1}, strides), true,
+                   {o0, 0, 0});
+        pushAccess(lblock, arrayRef(n, loop, {0, 1}, strides, {-1, 0}), true,
+                   {o0, 0, 1});
+        pushAccess(lblock, arrayRef(n, loop, {0, 1}, strides, {0, -1}), true,
+                   {o0, 0, 2});
+        pushAccess(lblock, arrayRef(n, loop, {0, 1}, strides), false,
+                   {o0, 0, 3});
+        for (unsigned l = 0; l < 3; ++l)
+            lblock.valueFlow.emplace_back(4 * n + l, 4 * n + 3);
+    }
+}
+
+TEST(StronglyConnectedComponents, BasicAssertions) {
+    LoopBlock lblock;
+    triangularBlock(lblock);
+    lblock.fillEdges();
+    std::cout << "Number of edges found: " << lblock.edges.size() << std::endl;
+    // 16 dependencies, less the 3 between pairs of loads
+    EXPECT_EQ(lblock.edges.size(), 13);
+
+    auto components = topologicallySortedComponents(lblock);
+    llvm::SmallVector<size_t> componentIds(lblock.memory.size());
+    size_t numVertices = 0;
+    for (size_t c = 0; c < components.size(); ++c) {
+        numVertices += components[c].size();
+        for (auto m : components[c])
+            componentIds[m] = c;
+    }
+    EXPECT_EQ(numVertices, lblock.memory.size());
+    // the load and store of `A(m,k)` depend on each other
+    EXPECT_EQ(componentIds[7], componentIds[8]);
+    EXPECT_NE(componentIds[1], componentIds[8]);
+    // edges only go forward between components
+    for (auto &e : lblock.edges)
+        EXPECT_LE(componentIds[lblock.memoryIndex(e.in)],
+                  componentIds[lblock.memoryIndex(e.out)]);
+}
+
+TEST(ScheduleByComponents, BasicAssertions) {
+    for (size_t maxThreads = 1; maxThreads <= 4; maxThreads *= 2) {
+        LoopBlock lblock;
+        copyBlock(lblock);
+        lblock.fillEdges();
+        EXPECT_EQ(lblock.edges.size(), 2);
+        // a legal schedule is left alone
+        EXPECT_FALSE(lblock.optimizeSchedules(maxThreads));
+        for (auto &e : lblock.edges)
+            EXPECT_TRUE(lblock.isSatisfied(e));
+        for (size_t i = 0; i < 6; ++i)
+            EXPECT_EQ(lblock.memory[i].schedule.getOmega()[0], i >= 4);
+        // move the statement `C(i,j) = A(i,j)` ahead of the store to
+        // `A(i,j)`; the scheduler must distribute it into a following
+        // loop, the store to `C` together with the load feeding it.
+        lblock.memory[2].schedule.getOmega()[4] = -2;
+        lblock.memory[3].schedule.getOmega()[4] = -1;
+        EXPECT_FALSE(lblock.isSatisfied(lblock.edges.front()));
+        EXPECT_FALSE(lblock.optimizeSchedules(maxThreads));
+        for (auto &e : lblock.edges)
+            EXPECT_TRUE(lblock.isSatisfied(e));
+        EXPECT_EQ(lblock.memory[0].schedule.getOmega()[0], 0);
+        EXPECT_EQ(lblock.memory[1].schedule.getOmega()[0], 0);
+        EXPECT_EQ(lblock.memory[2].schedule.getOmega()[0], 1);
+        EXPECT_EQ(lblock.memory[3].schedule.getOmega()[0], 1);
+        // the second nest stays last
+        EXPECT_EQ(lblock.memory[4].schedule.getOmega()[0], 2);
+        EXPECT_EQ(lblock.memory[5].schedule.getOmega()[0], 2);
+        // a consumer moved into an earlier loop nest cannot be repaired
+        lblock.memory[4].schedule.getOmega()[0] = -1;
+        EXPECT_TRUE(lblock.optimizeSchedules(maxThreads));
+    }
+}
+
+TEST(ScheduleComponents, CyclicComponent) {
+    llvm::SmallVector<llvm::SmallVector<int64_t, Schedule::maxStackStorage>>
+        results;
+    for (size_t maxThreads = 1; maxThreads <= 4; maxThreads *= 2) {
+        LoopBlock lblock;
+        triangularBlock(lblock);
+        lblock.fillEdges();
+        // move the store to `A(m,k)` ahead of the load it overwrites in
+        // the same iteration
+        std::swap(lblock.memory[7].schedule.getOmega()[6],
+                  lblock.memory[8].schedule.getOmega()[6]);
+        llvm::SmallVector<int64_t, Schedule::maxStackStorage> before =
+            lblock.memory[7].schedule.data;
+        EXPECT_FALSE(lblock.isSatisfied(lblock.memory[7].edgesOut));
+        // No permutation of the loops orders the store after the load of
+        // the same iteration, so the search, run concurrently with the
+        // other components if `maxThreads > 1`, fails and restores the
+        // component's schedules.
+        EXPECT_TRUE(lblock.optimizeSchedules(maxThreads));
+        llvm::ArrayRef<int64_t> phi7 = lblock.memory[7].schedule.data;
+        llvm::ArrayRef<int64_t> phi8 = lblock.memory[8].schedule.data;
+        EXPECT_EQ(phi7.take_front(9),
+                  llvm::ArrayRef<int64_t>(before).take_front(9));
+        EXPECT_EQ(phi8.take_front(9), phi7.take_front(9));
+        // the result does not depend on the number of threads
+        results.emplace_back();
+        for (auto &ma : lblock.memory)
+            results.back().append(ma.schedule.data.begin(),
+                                  ma.schedule.data.end());
+        EXPECT_EQ(results.back(), results.front());
+    }
+}
+
+TEST(ScheduleComponents, ThreadsMatchSerial) {
+    const size_t numNests = 8;
+    llvm::SmallVector<llvm::SmallVector<int64_t, Schedule::maxStackStorage>>
+        results;
+    // repeated calls reuse the threads of the scheduler's pool
+    for (size_t maxThreads : {1, 2, 4, 8, 4, 4}) {
+        LoopBlock lblock;
+        stencilNests(lblock, numNests);
+        lblock.fillEdges();
+        EXPECT_EQ(topologicallySortedComponents(lblock).size(), numNests);
+        EXPECT_FALSE(lblock.optimizeSchedules(maxThreads));
+        for (auto &e : lblock.edges)
+            EXPECT_TRUE(lblock.isSatisfied(e));
+        results.emplace_back();
+        for (auto &ma : lblock.memory)
+            results.back().append(ma.schedule.data.begin(),
+                                  ma.schedule.data.end());
+        EXPECT_EQ(results.back(), results.front());
+    }
+}
@@ -0,0 +1,206 @@
+#include "../include/ArrayReference.hpp"
+#include "../include/CostModeling.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/Loops.hpp"
+#include "../include/Math.hpp"
+#include "../include/POSet.hpp"
+#include "../include/Schedule.hpp"
+#include "../include/Serialization.hpp"
+#include "../include/Symbolics.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <sstream>
+#include <string>
+
+// `for m in 0:M-1, n in 0:N-1, C[m + M*n] = A[n + N*m]`, with `M <= N`.
+static void transposeBlock(LoopBlock &lblock) {
+    auto M = MPoly(Polynomial::Monomial(Polynomial::ID{1}));
+    auto N = MPoly(Polynomial::Monomial(Polynomial::ID{2}));
+    IntMatrix Aloop(4, 2);
+    llvm::SmallVector<MPoly, 8> bloop;
+    Aloop(0, 0) = 1;
+    bloop.push_back(M - 1);
+    Aloop(1, 0) = -1;
+    bloop.push_back(0);
+    Aloop(2, 1) = 1;
+    bloop.push_back(N - 1);
+    Aloop(3, 1) = -1;
+    bloop.push_back(0);
+    PartiallyOrderedSet poset;
+    poset.push(1, 2, Interval::nonNegative());
+    auto loop = llvm::makeIntrusiveRefCnt<AffineLoopNest>(Aloop, bloop, poset);
+    ArrayReference Amn(0, loop, 2);
+    {
+        PtrMatrix<int64_t> IndMat = Amn.indexMatrix();
+        IndMat(1, 0) = 1; // n
+        IndMat(0, 1) = 1; // m
+        Amn.stridesOffsets[0] = std::make_pair(MPoly(1), MPoly(0));
+        Amn.stridesOffsets[1] = std::make_pair(N, MPoly(0));
+    }
+    ArrayReference Cmn(1, loop, 2);
+    {
+        PtrMatrix<int64_t> IndMat = Cmn.indexMatrix();
+        IndMat(0, 0) = 1; // m
+        IndMat(1, 1) = 1; // n
+        Cmn.stridesOffsets[0] = std::make_pair(MPoly(1), MPoly(0));
+        Cmn.stridesOffsets[1] = std::make_pair(M, MPoly(0));
+    }
+    Schedule sch(2);
+    lblock.memory.emplace_back(Amn, nullptr, sch, true);
+    sch.getOmega()[4] = 1;
+    lblock.memory.emplace_back(Cmn, nullptr, sch, false);
+    lblock.valueFlow.emplace_back(0, 1);
+}
+
+// Copies `s` into 8 byte aligned storage.
+static llvm::StringRef aligned(llvm::SmallVectorImpl<uint64_t> &storage,
+                               const std::string &s) {
+    storage.resize((s.size() + 7) / 8);
+    std::memcpy(storage.data(), s.data(), s.size());
+    return {reinterpret_cast<const char *>(storage.data()), s.size()};
+}
+
+// A loop block with one loop nest, whose constraints claim to be `M x N`,
+// followed by `pad` zero bytes.
+static std::string matrixBlock(uint64_t M, uint64_t N, size_t pad) {
+    using namespace LoopBlockFormat;
+    std::string s(magic, sizeof(magic));
+    appendBytes<uint32_t>(s, version);
+    appendBytes<uint32_t>(s, 0);
+    appendBytes<uint64_t>(s, 0);
+    appendBytes<uint32_t>(s, 1);
+    appendBytes<uint64_t>(s, M);
+    appendBytes<uint64_t>(s, N);
+    s.append(pad, 0);
+    appendPadding(s);
+    llvm::support::endian::write<uint64_t, llvm::support::little,
+                                 llvm::support::unaligned>(
+        s.data() + sizeOffset, s.size());
+    return s;
+}
+
+TEST(SerializationTest, RoundTrip) {
+    LoopBlock lblock;
+    transposeBlock(lblock);
+    lblock.memory[1].schedule.vectorized = 1;
+    lblock.memory[1].schedule.vectorWidth = 4;
+    lblock.memory[1].schedule.tileL1 = {8, 32};
+    // `A` holds floats; `C` has no element size, so defaults to 64 bits
+    lblock.memory[0].elementBits = 32;
+    std::string bytes = serialize(lblock);
+    EXPECT_EQ(bytes.size() % 8, size_t(0));
+
+    llvm::SmallVector<uint64_t> storage;
+    llvm::StringRef buf = aligned(storage, bytes);
+    LoopBlockView view;
+    ASSERT_FALSE(view.parse(buf));
+    EXPECT_EQ(view.size, bytes.size());
+    ASSERT_EQ(view.loops.size(), size_t(1));
+    ASSERT_EQ(view.memory.size(), size_t(2));
+    // the matrices are read in place
+    const AffineLoopNest &aln = *lblock.memory[0].ref.loop;
+    PtrMatrix<const int64_t> A = view.loops[0].A;
+    EXPECT_GE(reinterpret_cast<const char *>(A.begin()), buf.begin());
+    EXPECT_LE(reinterpret_cast<const char *>(A.end()), buf.end());
+    EXPECT_TRUE(A == PtrMatrix<const int64_t>(aln.A));
+    EXPECT_EQ(view.loops[0].poset(1, 2).lowerBound,
+              aln.poset(1, 2).lowerBound);
+    EXPECT_EQ(view.loops[0].poset.delta.size(), aln.poset.delta.size());
+
+    LoopBlock replay;
+    view.materialize(replay);
+    ASSERT_EQ(replay.memory.size(), size_t(2));
+    // both accesses share their loop nest again
+    EXPECT_EQ(replay.memory[0].ref.loop, replay.memory[1].ref.loop);
+    for (size_t m = 0; m < 2; ++m) {
+        const MemoryAccess &x = lblock.memory[m];
+        const MemoryAccess &y = replay.memory[m];
+        EXPECT_EQ(x.isLoad, y.isLoad);
+        EXPECT_EQ(x.ref.arrayID, y.ref.arrayID);
+        EXPECT_EQ(x.ref.stridesOffsets, y.ref.stridesOffsets);
+        EXPECT_TRUE(x.ref.indexMatrix() == y.ref.indexMatrix());
+        EXPECT_EQ(x.schedule.data, y.schedule.data);
+        EXPECT_EQ(x.schedule.vectorized, y.schedule.vectorized);
+        EXPECT_EQ(x.schedule.tileL1, y.schedule.tileL1);
+        EXPECT_EQ(y.user, nullptr);
+        EXPECT_EQ(CostModeling::elementBits(x), CostModeling::elementBits(y));
+    }
+    EXPECT_EQ(CostModeling::elementBits(replay.memory[0]), size_t(32));
+    EXPECT_EQ(CostModeling::elementBits(replay.memory[1]), size_t(64));
+    EXPECT_EQ(replay.memory[0].ref.loop->b, aln.b);
+    EXPECT_EQ(replay.valueFlow, lblock.valueFlow);
+    // and serialize identically
+    EXPECT_EQ(serialize(replay), bytes);
+    // the dependence between the load and the store is found again
+    lblock.fillEdges();
+    replay.fillEdges();
+    EXPECT_EQ(replay.edges.size(), lblock.edges.size());
+
+    std::ostringstream text;
+    printLoopBlock(text, replay);
+    EXPECT_NE(text.str().find("access 0: load of array 0 in loop nest 0, 32 "
+                              "bit elements"),
+              std::string::npos);
+    EXPECT_NE(text.str().find("access 1: store of array 1 in loop nest 0, 64 "
+                              "bit elements"),
+              std::string::npos);
+}
+
+TEST(SerializationTest, Corpus) {
+    LoopBlock lblock;
+    transposeBlock(lblock);
+    std::string bytes = serialize(lblock);
+    llvm::SmallString<128> dir;
+    ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("corpus", dir));
+    std::string path = (dir + "/blocks").str();
+    for (size_t i = 0; i < 3; ++i)
+        EXPECT_FALSE(appendToCorpus(path, bytes));
+    auto corpus = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    ASSERT_TRUE(bool(corpus));
+    size_t count = 0;
+    EXPECT_FALSE(forEachLoopBlock((*corpus)->getBuffer(),
+                                  [&](const LoopBlockView &view) {
+                                      EXPECT_EQ(view.memory.size(), size_t(2));
+                                      ++count;
+                                  }));
+    EXPECT_EQ(count, size_t(3));
+    llvm::sys::fs::remove_directories(dir);
+
+    // truncated, or of another version, loop blocks are rejected
+    llvm::SmallVector<uint64_t> storage;
+    LoopBlockView view;
+    EXPECT_TRUE(
+        view.parse(aligned(storage, bytes.substr(0, bytes.size() - 8))));
+    std::string other = bytes;
+    other[sizeof(LoopBlockFormat::magic)] += 1;
+    EXPECT_TRUE(view.parse(aligned(storage, other)));
+    count = 0;
+    EXPECT_TRUE(forEachLoopBlock(aligned(storage, bytes + other),
+                                 [&](const LoopBlockView &) { ++count; }));
+    EXPECT_EQ(count, size_t(1));
+}
+
+TEST(SerializationTest, Malformed) {
+    llvm::SmallVector<uint64_t> storage;
+    LoopBlockView view;
+    // `N * sizeof(int64_t)` wraps to 0
+    EXPECT_TRUE(view.parse(aligned(storage, matrixBlock(1, 1ull << 61, 64))));
+    // no elements, but too many rows for their polynomials
+    EXPECT_TRUE(view.parse(aligned(storage, matrixBlock(1ull << 40, 0, 64))));
+    // more loops than a `Schedule` holds
+    EXPECT_TRUE(view.parse(aligned(storage, matrixBlock(0, 256, 4096))));
+    // while an empty nest of 255 loops is well formed
+    EXPECT_FALSE(view.parse(aligned(storage, matrixBlock(0, 255, 4096))));
+    size_t count = 0;
+    EXPECT_TRUE(forEachLoopBlock(
+        aligned(storage, matrixBlock(0, 1, 64) + matrixBlock(1, 1ull << 61, 64)),
+        [&](const LoopBlockView &) { ++count; }));
+    EXPECT_EQ(count, size_t(1));
+}
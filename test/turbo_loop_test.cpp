@@ -0,0 +1,402 @@
+#include "../include/Runtime.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/PassPlugin.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// End to end: kernels are optimized by `turbo-loop`, loaded from the plugin
+// named by `TURBO_LOOP_PLUGIN`, or `./libTurboLoop.so`, with code generation
+// and parallel loops enabled; the IR must verify, contain the emitted
+// loops, and compute what the kernels compute without the pass.
+
+// `void kernel(double *C, double *A, double *B, i64 n)`
+using KernelFn = void (*)(double *, double *, double *, int64_t);
+
+// for j in 0:n-1, i in 0:n-1
+//   C[i + n*j] = A[i + n*j] + B[i + n*j]
+// C, A and B may alias, so the nest is versioned.
+static const char *addIR = R"(
+define void @add(double* %C, double* %A, double* %B, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %jloop, label %exit
+
+jloop:
+  %j = phi i64 [ 0, %entry ], [ %jnext, %jlatch ]
+  %nj = mul nsw i64 %n, %j
+  br label %iloop
+
+iloop:
+  %i = phi i64 [ 0, %jloop ], [ %inext, %iloop ]
+  %idx = add nsw i64 %i, %nj
+  %ap = getelementptr inbounds double, double* %A, i64 %idx
+  %a = load double, double* %ap
+  %bp = getelementptr inbounds double, double* %B, i64 %idx
+  %b = load double, double* %bp
+  %ab = fadd double %a, %b
+  %cp = getelementptr inbounds double, double* %C, i64 %idx
+  store double %ab, double* %cp
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp slt i64 %inext, %n
+  br i1 %ic, label %iloop, label %jlatch
+
+jlatch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %jloop, label %exit
+
+exit:
+  ret void
+}
+)";
+
+// for i in 0:n-1
+//   C[i] = A[i] * B[0] + i
+static const char *scaleIR = R"(
+define void @scale(double* noalias %C, double* noalias %A, double* noalias %B, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %loop, label %exit
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inext, %loop ]
+  %ap = getelementptr inbounds double, double* %A, i64 %i
+  %a = load double, double* %ap
+  %b = load double, double* %B
+  %ab = fmul double %a, %b
+  %fi = sitofp i64 %i to double
+  %x = fadd double %ab, %fi
+  %cp = getelementptr inbounds double, double* %C, i64 %i
+  store double %x, double* %cp
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp slt i64 %inext, %n
+  br i1 %ic, label %loop, label %exit
+
+exit:
+  ret void
+}
+)";
+
+// for j in 0:n-1, i in 0:j
+//   C(i,j) += A(i,j) * B(j,i)
+static const char *triangularIR = R"(
+define void @triangular(double* noalias %C, double* noalias %A, double* noalias %B, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 0
+  br i1 %guard, label %jloop, label %exit
+
+jloop:
+  %j = phi i64 [ 0, %entry ], [ %jnext, %jlatch ]
+  %nj = mul nsw i64 %n, %j
+  br label %iloop
+
+iloop:
+  %i = phi i64 [ 0, %jloop ], [ %inext, %iloop ]
+  %idx = add nsw i64 %i, %nj
+  %ap = getelementptr inbounds double, double* %A, i64 %idx
+  %a = load double, double* %ap
+  %ni = mul nsw i64 %n, %i
+  %bidx = add nsw i64 %j, %ni
+  %bp = getelementptr inbounds double, double* %B, i64 %bidx
+  %b = load double, double* %bp
+  %cp = getelementptr inbounds double, double* %C, i64 %idx
+  %c = load double, double* %cp
+  %ab = fmul double %a, %b
+  %cab = fadd double %c, %ab
+  store double %cab, double* %cp
+  %inext = add nuw nsw i64 %i, 1
+  %ic = icmp sle i64 %inext, %j
+  br i1 %ic, label %iloop, label %jlatch
+
+jlatch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %jloop, label %exit
+
+exit:
+  ret void
+}
+)";
+
+// for j in 1:n-1, i in 0:n-2
+//   A[i + n*j] = 0.5 * A[i + 1 + n*(j-1)] + A[i + n*j]
+// The dependence distance is `(1, -1)`, so the loops may not be
+// interchanged.
+static const char *skewIR = R"(
+define void @skew(double* noalias %C, double* noalias %A, double* noalias %B, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 1
+  br i1 %guard, label %jloop, label %exit
+
+jloop:
+  %j = phi i64 [ 1, %entry ], [ %jnext, %jlatch ]
+  %nj = mul nsw i64 %n, %j
+  %jm1 = add nsw i64 %j, -1
+  %njm1 = mul nsw i64 %n, %jm1
+  br label %iloop
+
+iloop:
+  %i = phi i64 [ 0, %jloop ], [ %inext, %iloop ]
+  %ip1 = add nsw i64 %i, 1
+  %pidx = add nsw i64 %ip1, %njm1
+  %pp = getelementptr inbounds double, double* %A, i64 %pidx
+  %p = load double, double* %pp
+  %idx = add nsw i64 %i, %nj
+  %ap = getelementptr inbounds double, double* %A, i64 %idx
+  %a = load double, double* %ap
+  %hp = fmul double %p, 5.000000e-01
+  %x = fadd double %hp, %a
+  store double %x, double* %ap
+  %inext = add nuw nsw i64 %i, 1
+  %nm1 = add nsw i64 %n, -1
+  %ic = icmp slt i64 %inext, %nm1
+  br i1 %ic, label %iloop, label %jlatch
+
+jlatch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %jloop, label %exit
+
+exit:
+  ret void
+}
+)";
+
+static const llvm::PassPlugin *loadPlugin() {
+    static llvm::Optional<llvm::PassPlugin> plugin = [] {
+        const char *path = std::getenv("TURBO_LOOP_PLUGIN");
+        auto p = llvm::PassPlugin::Load(path ? path : "./libTurboLoop.so");
+        if (!p) {
+            llvm::consumeError(p.takeError());
+            return llvm::Optional<llvm::PassPlugin>();
+        }
+        llvm::StringMap<llvm::cl::Option *> &opts =
+            llvm::cl::getRegisteredOptions();
+        for (const char *name : {"turbo-loop-codegen", "turbo-loop-parallel"})
+            if (llvm::cl::Option *opt = opts.lookup(name))
+                opt->addOccurrence(0, name, "true");
+        return llvm::Optional<llvm::PassPlugin>(*p);
+    }();
+    return plugin ? &*plugin : nullptr;
+}
+
+// A kernel optimized by `pipeline` for the host, and compiled.
+struct CompiledKernel {
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    KernelFn f = nullptr;
+    // after the pipeline
+    std::string ir;
+    size_t parallelCalls = 0;
+    size_t vectorStores = 0;
+    bool versioned = false;
+};
+
+// Optimizes `kernel` with `pipeline` for the host, and compiles it to `ck`.
+void compile(CompiledKernel &ck, const char *kernel, const char *name,
+             llvm::StringRef pipeline, const llvm::PassPlugin &plugin) {
+    auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+    ASSERT_TRUE(bool(JTMB));
+    auto TM = JTMB->createTargetMachine();
+    ASSERT_TRUE(bool(TM));
+    auto ctx = std::make_unique<llvm::LLVMContext>();
+    llvm::SMDiagnostic err;
+    std::unique_ptr<llvm::Module> mod =
+        llvm::parseAssemblyString(kernel, err, *ctx);
+    ASSERT_TRUE(mod) << err.getMessage().str();
+    mod->setDataLayout((*TM)->createDataLayout());
+    mod->setTargetTriple((*TM)->getTargetTriple().str());
+
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::PassBuilder PB(TM->get());
+    plugin.registerPassBuilderCallbacks(PB);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    llvm::ModulePassManager MPM;
+    llvm::Error e = PB.parsePassPipeline(MPM, pipeline);
+    ASSERT_FALSE(bool(e)) << llvm::toString(std::move(e));
+    MPM.run(*mod, MAM);
+    ASSERT_FALSE(llvm::verifyModule(*mod, &llvm::errs()));
+    llvm::raw_string_ostream os(ck.ir);
+    mod->print(os, nullptr);
+    for (auto &F : *mod) {
+        for (auto &BB : F) {
+            ck.versioned |= BB.getName().startswith("turboloop.versioned");
+            for (auto &I : BB) {
+                if (auto *call = llvm::dyn_cast<llvm::CallInst>(&I)) {
+                    llvm::Function *callee = call->getCalledFunction();
+                    ck.parallelCalls += callee && (callee->getName() ==
+                                                "turboloop_parallel_for");
+                } else if (auto *store = llvm::dyn_cast<llvm::StoreInst>(&I)) {
+                    ck.vectorStores +=
+                        store->getValueOperand()->getType()->isVectorTy();
+                }
+            }
+        }
+    }
+
+    auto J = llvm::orc::LLJITBuilder()
+                 .setJITTargetMachineBuilder(std::move(*JTMB))
+                 .create();
+    ASSERT_TRUE(bool(J));
+    ck.jit = std::move(*J);
+    llvm::orc::MangleAndInterner mangle(ck.jit->getExecutionSession(),
+                                        ck.jit->getDataLayout());
+    llvm::orc::SymbolMap runtime;
+    runtime[mangle("turboloop_parallel_for")] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(&turboloop_parallel_for),
+        llvm::JITSymbolFlags::Exported);
+    ASSERT_FALSE(bool(ck.jit->getMainJITDylib().define(
+        llvm::orc::absoluteSymbols(std::move(runtime)))));
+    ASSERT_FALSE(bool(ck.jit->addIRModule(
+        llvm::orc::ThreadSafeModule(std::move(mod), std::move(ctx)))));
+    auto sym = ck.jit->lookup(name);
+    ASSERT_TRUE(bool(sym));
+    ck.f = reinterpret_cast<KernelFn>(sym->getAddress());
+}
+
+constexpr const char *referencePipeline = "function(loop-simplify,lcssa)";
+// at the top level, `turbo-loop` is the module pass, which outlines
+// parallel loops; within `function(...)`, they stay in place
+constexpr const char *turboLoopPipeline =
+    "function(loop-simplify,lcssa),turbo-loop";
+constexpr const char *functionPassPipeline =
+    "function(loop-simplify,lcssa,turbo-loop)";
+
+// Runs `f` and `g` on the same buffers, of `3 * size` elements, passing
+// `C`, `A` and `B` at the given offsets; expects the same results.
+void expectSameResults(KernelFn f, KernelFn g, int64_t n, size_t size,
+                       size_t offsetC, size_t offsetA, size_t offsetB) {
+    std::vector<double> x(3 * size), y(3 * size);
+    for (size_t k = 0; k < x.size(); ++k)
+        x[k] = y[k] = double((k * 7919) % 101) / 8.0;
+    f(x.data() + offsetC, x.data() + offsetA, x.data() + offsetB, n);
+    g(y.data() + offsetC, y.data() + offsetA, y.data() + offsetB, n);
+    for (size_t k = 0; k < x.size(); ++k)
+        ASSERT_EQ(x[k], y[k]) << "at " << k << " with n = " << n;
+}
+
+TEST(TurboLoopPass, EmitsScheduledLoopNests) {
+    const llvm::PassPlugin *plugin = loadPlugin();
+    if (!plugin)
+        GTEST_SKIP() << "TurboLoop plugin not found";
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    turboloop_set_num_threads(4);
+    const int64_t n = 37;
+    const size_t size = n * n;
+    {
+        CompiledKernel reference;
+        ASSERT_NO_FATAL_FAILURE(compile(reference, addIR, "add",
+                                        referencePipeline, *plugin));
+        CompiledKernel turboLoop;
+        ASSERT_NO_FATAL_FAILURE(compile(turboLoop, addIR, "add",
+                                        turboLoopPipeline, *plugin));
+        ASSERT_TRUE(reference.f && turboLoop.f);
+        EXPECT_TRUE(turboLoop.versioned) << turboLoop.ir;
+        EXPECT_EQ(turboLoop.parallelCalls, size_t(1)) << turboLoop.ir;
+        // disjoint arrays take the emitted loops, overlapping ones the
+        // original loop nest
+        expectSameResults(reference.f, turboLoop.f, n, size, 0, size,
+                          2 * size);
+        expectSameResults(reference.f, turboLoop.f, n, size, 1, 0, size);
+        expectSameResults(reference.f, turboLoop.f, n, size, 0, 0, 0);
+    }
+    {
+        CompiledKernel reference;
+        ASSERT_NO_FATAL_FAILURE(compile(reference, scaleIR, "scale",
+                                        referencePipeline, *plugin));
+        CompiledKernel turboLoop;
+        ASSERT_NO_FATAL_FAILURE(compile(turboLoop, scaleIR, "scale",
+                                        turboLoopPipeline, *plugin));
+        ASSERT_TRUE(reference.f && turboLoop.f);
+        EXPECT_FALSE(turboLoop.versioned) << turboLoop.ir;
+        EXPECT_EQ(turboLoop.parallelCalls, size_t(1)) << turboLoop.ir;
+        for (int64_t m : {1, 3, 4, 5, 16, 37})
+            expectSameResults(reference.f, turboLoop.f, m, size, 0, size,
+                              2 * size);
+    }
+    {
+        CompiledKernel reference;
+        ASSERT_NO_FATAL_FAILURE(compile(reference, triangularIR, "triangular",
+                                        referencePipeline, *plugin));
+        CompiledKernel turboLoop;
+        ASSERT_NO_FATAL_FAILURE(compile(turboLoop, triangularIR, "triangular",
+                                        turboLoopPipeline, *plugin));
+        ASSERT_TRUE(reference.f && turboLoop.f);
+        EXPECT_FALSE(turboLoop.versioned) << turboLoop.ir;
+        EXPECT_EQ(turboLoop.parallelCalls, size_t(1)) << turboLoop.ir;
+        for (int64_t m : {1, 2, 7, 37})
+            expectSameResults(reference.f, turboLoop.f, m, size, 0, size,
+                              2 * size);
+    }
+    {
+        CompiledKernel reference;
+        ASSERT_NO_FATAL_FAILURE(
+            compile(reference, skewIR, "skew", referencePipeline, *plugin));
+        CompiledKernel turboLoop;
+        ASSERT_NO_FATAL_FAILURE(
+            compile(turboLoop, skewIR, "skew", turboLoopPipeline, *plugin));
+        ASSERT_TRUE(reference.f && turboLoop.f);
+        EXPECT_FALSE(turboLoop.versioned) << turboLoop.ir;
+        for (int64_t m : {2, 3, 7, 37})
+            expectSameResults(reference.f, turboLoop.f, m, size, 0, size,
+                              2 * size);
+    }
+    turboloop_set_num_threads(0);
+}
+
+TEST(TurboLoopPass, FunctionPassKeepsParallelLoopsInPlace) {
+    const llvm::PassPlugin *plugin = loadPlugin();
+    if (!plugin)
+        GTEST_SKIP() << "TurboLoop plugin not found";
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    const int64_t n = 37;
+    const size_t size = n * n;
+    CompiledKernel reference;
+    ASSERT_NO_FATAL_FAILURE(
+        compile(reference, scaleIR, "scale", referencePipeline, *plugin));
+    CompiledKernel turboLoop;
+    ASSERT_NO_FATAL_FAILURE(
+        compile(turboLoop, scaleIR, "scale", functionPassPipeline, *plugin));
+    ASSERT_TRUE(reference.f && turboLoop.f);
+    EXPECT_EQ(turboLoop.parallelCalls, size_t(0)) << turboLoop.ir;
+    EXPECT_EQ(turboLoop.ir.find(".turboloop.parallel"), std::string::npos)
+        << turboLoop.ir;
+    for (int64_t m : {1, 3, 4, 5, 16, 37})
+        expectSameResults(reference.f, turboLoop.f, m, size, 0, size,
+                          2 * size);
+}
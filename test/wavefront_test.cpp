@@ -0,0 +1,329 @@
+#include "../include/ArrayReference.hpp"
+#include "../include/CostModeling.hpp"
+#include "../include/IRExtraction.hpp"
+#include "../include/LoopBlock.hpp"
+#include "../include/Math.hpp"
+#include "../include/Parallelization.hpp"
+#include "../include/Symbolics.hpp"
+#include "../include/Wavefront.hpp"
+#include "./TestBlocks.hpp"
+#include "./TestIR.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <llvm/ADT/SmallVector.h>
+#include <memory>
+
+// for (i = 1; i < I; ++i){
+//   for (j = 1; j < J; ++j){
+//     A(i,j) = A(i-1,j) + A(i,j-1);
+//   }
+// }
+void stencilBlock(LoopBlock &lblock, bool lowerFirst) {
+    auto I = Polynomial::Monomial(Polynomial::ID{1});
+    auto J = Polynomial::Monomial(Polynomial::ID{2});
+    auto loop = LoopNestBuilder(2, lowerFirst)
+                    .bound(0, 1, I - 1)
+                    .bound(1, 1, J - 1)
+                    .nest();
+    const MPoly strides[2] = {1, I};
+    lblock.memory.reserve(3);
+    // A(i-1,j)
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides, {-1, 0}), true,
+               {0, 0, 0});
+    // A(i,j-1)
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides, {0, -1}), true,
+               {0, 0, 1});
+    // A(i,j) =
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides), false, {0, 0, 2});
+}
+
+// for (i = 1; i < I; ++i){
+//   for (j = 1; j < J; ++j){
+//     A(i,j) = A(i,j) + A(i-1,j) + A(i,j-1);
+//   }
+// }
+// In place, so the load and store of `A(i,j)` also depend on each other
+// within an iteration.
+void gaussSeidelBlock(LoopBlock &lblock, bool lowerFirst) {
+    auto I = Polynomial::Monomial(Polynomial::ID{1});
+    auto J = Polynomial::Monomial(Polynomial::ID{2});
+    auto loop = LoopNestBuilder(2, lowerFirst)
+                    .bound(0, 1, I - 1)
+                    .bound(1, 1, J - 1)
+                    .nest();
+    const MPoly strides[2] = {1, I};
+    lblock.memory.reserve(4);
+    // A(i,j)
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides), true, {0, 0, 0});
+    // A(i-1,j)
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides, {-1, 0}), true,
+               {0, 0, 1});
+    // A(i,j-1)
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides, {0, -1}), true,
+               {0, 0, 2});
+    // A(i,j) =
+    pushAccess(lblock, arrayRef(0, loop, {0, 1}, strides), false, {0, 0, 3});
+    for (unsigned l = 0; l < 3; ++l)
+        lblock.valueFlow.emplace_back(l, 3);
+}
+
+// Column major, `for j in 1:n-1, i in 1:n-2`:
+// `average`: `A(i,j) = 0.5 * (A(i-1,j) + A(i,j-1))`
+// `upwind`: `A(i,j) = A(i+1,j) * A(i,j-1)`
+static const char *wavefrontIR = R"(
+define void @average(double* %A, i64 %m, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 2
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %j = phi i64 [ 1, %entry ], [ %jnext, %outer.latch ]
+  %mj = mul nsw i64 %m, %j
+  %jm1 = add nsw i64 %j, -1
+  %mjm1 = mul nsw i64 %m, %jm1
+  br label %inner
+
+inner:
+  %i = phi i64 [ 1, %outer ], [ %inext, %inner ]
+  %im1 = add nsw i64 %i, -1
+  %widx = add nsw i64 %im1, %mj
+  %wp = getelementptr inbounds double, double* %A, i64 %widx
+  %w = load double, double* %wp
+  %sidx = add nsw i64 %i, %mjm1
+  %sp = getelementptr inbounds double, double* %A, i64 %sidx
+  %s = load double, double* %sp
+  %ws = fadd double %w, %s
+  %x = fmul double %ws, 5.000000e-01
+  %idx = add nsw i64 %i, %mj
+  %p = getelementptr inbounds double, double* %A, i64 %idx
+  store double %x, double* %p
+  %inext = add nuw nsw i64 %i, 1
+  %nm1 = add nsw i64 %n, -1
+  %ic = icmp slt i64 %inext, %nm1
+  br i1 %ic, label %inner, label %outer.latch
+
+outer.latch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %outer, label %exit
+
+exit:
+  ret void
+}
+
+define void @upwind(double* %A, i64 %m, i64 %n) {
+entry:
+  %guard = icmp sgt i64 %n, 2
+  br i1 %guard, label %outer, label %exit
+
+outer:
+  %j = phi i64 [ 1, %entry ], [ %jnext, %outer.latch ]
+  %mj = mul nsw i64 %m, %j
+  %jm1 = add nsw i64 %j, -1
+  %mjm1 = mul nsw i64 %m, %jm1
+  br label %inner
+
+inner:
+  %i = phi i64 [ 1, %outer ], [ %inext, %inner ]
+  %ip1 = add nsw i64 %i, 1
+  %eidx = add nsw i64 %ip1, %mj
+  %ep = getelementptr inbounds double, double* %A, i64 %eidx
+  %e = load double, double* %ep
+  %sidx = add nsw i64 %i, %mjm1
+  %sp = getelementptr inbounds double, double* %A, i64 %sidx
+  %s = load double, double* %sp
+  %x = fmul double %e, %s
+  %idx = add nsw i64 %i, %mj
+  %p = getelementptr inbounds double, double* %A, i64 %idx
+  store double %x, double* %p
+  %inext = add nuw nsw i64 %i, 1
+  %nm1 = add nsw i64 %n, -1
+  %ic = icmp slt i64 %inext, %nm1
+  br i1 %ic, label %inner, label %outer.latch
+
+outer.latch:
+  %jnext = add nuw nsw i64 %j, 1
+  %jc = icmp slt i64 %jnext, %n
+  br i1 %jc, label %outer, label %exit
+
+exit:
+  ret void
+}
+)";
+
+TEST(WavefrontHyperplane, BasicAssertions) {
+    IntMatrix D(3, 3);
+    // (1, 0, 0), (0, 1, 0), (0, 0, 1)
+    for (size_t i = 0; i < 3; ++i)
+        D(i, i) = 1;
+    auto h = wavefrontHyperplane(D);
+    ASSERT_TRUE(h.hasValue());
+    EXPECT_EQ(*h, (llvm::SmallVector<int64_t>{1, 1, 1}));
+    // (1, -1, 0) requires weighting the first loop more
+    D(2, 0) = 1;
+    D(2, 1) = -1;
+    D(2, 2) = 0;
+    h = wavefrontHyperplane(D);
+    ASSERT_TRUE(h.hasValue());
+    EXPECT_EQ(*h, (llvm::SmallVector<int64_t>{2, 1, 0}));
+    auto T = completeUnimodular(*h);
+    ASSERT_TRUE(T.hasValue());
+    std::cout << "T =\n" << *T << std::endl;
+    for (size_t j = 0; j < 3; ++j)
+        EXPECT_EQ((*T)(0, j), (*h)[j]);
+    auto lu = LU::fact(*T);
+    ASSERT_TRUE(lu.hasValue());
+    int64_t det = lu->det();
+    EXPECT_TRUE((det == 1) || (det == -1));
+    // a dependence with a negative distance along every hyperplane
+    D(0, 0) = -1;
+    D(0, 1) = -1;
+    D(0, 2) = -1;
+    EXPECT_FALSE(wavefrontHyperplane(D).hasValue());
+    // but a loop independent dependence does not constrain the hyperplane
+    D(0, 0) = 0;
+    D(0, 1) = 0;
+    D(0, 2) = 0;
+    h = wavefrontHyperplane(D);
+    ASSERT_TRUE(h.hasValue());
+    EXPECT_EQ(*h, (llvm::SmallVector<int64_t>{2, 1, 0}));
+}
+
+TEST(WavefrontStencil, BasicAssertions) {
+    // with the bounds of each loop in either order
+    for (bool lowerFirst : {true, false}) {
+        LoopBlock lblock;
+        stencilBlock(lblock, lowerFirst);
+        lblock.fillEdges();
+        std::cout << "Number of edges found: " << lblock.edges.size()
+                  << std::endl;
+        EXPECT_GE(lblock.edges.size(), 2);
+        auto D = dependenceDistances(lblock, {0, 1, 2}, 2);
+        ASSERT_TRUE(D.hasValue());
+        std::cout << "Dependence distances:\n" << *D << std::endl;
+        bool foundI = false, foundJ = false;
+        for (size_t i = 0; i < D->numRow(); ++i) {
+            foundI |= ((*D)(i, 0) == 1) && ((*D)(i, 1) == 0);
+            foundJ |= ((*D)(i, 0) == 0) && ((*D)(i, 1) == 1);
+        }
+        EXPECT_TRUE(foundI);
+        EXPECT_TRUE(foundJ);
+
+        // as written, neither loop is parallel
+        optimizeParallelism(lblock);
+        for (auto &ma : lblock.memory)
+            EXPECT_EQ(ma.schedule.parallel, -1);
+
+        optimizeWavefronts(lblock);
+        for (auto &ma : lblock.memory) {
+            SquarePtrMatrix<const int64_t> Phi = ma.schedule.getPhi();
+            // the outer loop is `i + j`
+            EXPECT_EQ(Phi(0, 0), 1);
+            EXPECT_EQ(Phi(1, 0), 1);
+        }
+        // every dependence is carried by the wavefront
+        for (auto &d : lblock.edges) {
+            auto dist = CostModeling::levelDistance(d, 0);
+            ASSERT_TRUE(dist.hasValue());
+            EXPECT_GE(*dist, 1);
+            EXPECT_FALSE(CostModeling::carriedBy(d, 1));
+        }
+        // so the inner loop may run in parallel, or be vectorized
+        optimizeParallelism(lblock);
+        for (auto &ma : lblock.memory)
+            EXPECT_EQ(ma.schedule.parallel, 1);
+        CostModeling::RegisterTiling rt(lblock, {0, 1, 2}, {16, 32, 512});
+        EXPECT_TRUE(rt.carriesDependence[0]);
+        EXPECT_FALSE(rt.carriesDependence[1]);
+    }
+}
+
+TEST(WavefrontGaussSeidel, BasicAssertions) {
+    // with the bounds of each loop in either order
+    for (bool lowerFirst : {true, false}) {
+        LoopBlock lblock;
+        gaussSeidelBlock(lblock, lowerFirst);
+        lblock.fillEdges();
+        auto D = dependenceDistances(lblock, {0, 1, 2, 3}, 2);
+        ASSERT_TRUE(D.hasValue());
+        std::cout << "Dependence distances:\n" << *D << std::endl;
+        bool foundZero = false;
+        for (size_t i = 0; i < D->numRow(); ++i)
+            foundZero |= ((*D)(i, 0) == 0) && ((*D)(i, 1) == 0);
+        EXPECT_TRUE(foundZero);
+
+        optimizeWavefronts(lblock);
+        for (auto &ma : lblock.memory) {
+            SquarePtrMatrix<const int64_t> Phi = ma.schedule.getPhi();
+            // the outer loop is `i + j`
+            EXPECT_EQ(Phi(0, 0), 1);
+            EXPECT_EQ(Phi(1, 0), 1);
+        }
+        // the wavefront carries every dependence across iterations, and none
+        // is carried by the inner loop
+        for (auto &d : lblock.edges) {
+            auto dist = CostModeling::levelDistance(d, 0);
+            ASSERT_TRUE(dist.hasValue());
+            EXPECT_GE(*dist, 0);
+            EXPECT_FALSE(CostModeling::carriedBy(d, 1));
+        }
+        optimizeParallelism(lblock);
+        for (auto &ma : lblock.memory)
+            EXPECT_EQ(ma.schedule.parallel, 1);
+    }
+}
+
+// Extracts the loop nest of `name` in `wavefrontIR`, skews it into a
+// wavefront, and expects the outer loop to be `i + j`, carrying every
+// dependence, so that the inner loop is parallel.
+void expectWavefront(const char *name) {
+    ParsedModule pm(wavefrontIR);
+    llvm::Function *F = pm.mod->getFunction(name);
+    Analyses an(*F);
+    ValueToPosetMap symbols;
+    PartiallyOrderedSet poset;
+    pushColumnFacts(symbols, poset, F->getArg(1), F->getArg(2));
+    llvm::SmallVector<std::unique_ptr<ExtractedLoopBlock>> blocks;
+    extractLoopBlocks(blocks, an.LI, an.SE, pm.mod->getDataLayout(), symbols,
+                      poset);
+    ASSERT_EQ(blocks.size(), size_t(1));
+    LoopBlock &lblock = blocks.front()->lblock;
+    ASSERT_EQ(lblock.memory.size(), size_t(3));
+    lblock.fillEdges();
+    EXPECT_EQ(lblock.edges.size(), size_t(2));
+    // each loop carries one of the dependences
+    auto D = dependenceDistances(lblock, {0, 1, 2}, 2);
+    ASSERT_TRUE(D.hasValue());
+    bool foundJ = false, foundI = false;
+    for (size_t i = 0; i < D->numRow(); ++i) {
+        foundJ |= ((*D)(i, 0) == 1) && ((*D)(i, 1) == 0);
+        foundI |= ((*D)(i, 0) == 0) && ((*D)(i, 1) == 1);
+    }
+    EXPECT_TRUE(foundJ) << *D;
+    EXPECT_TRUE(foundI) << *D;
+    optimizeWavefronts(lblock);
+    for (auto &ma : lblock.memory) {
+        SquarePtrMatrix<const int64_t> Phi = ma.schedule.getPhi();
+        EXPECT_EQ(Phi(0, 0), 1);
+        EXPECT_EQ(Phi(1, 0), 1);
+    }
+    for (auto &d : lblock.edges) {
+        auto dist = CostModeling::levelDistance(d, 0);
+        ASSERT_TRUE(dist.hasValue());
+        EXPECT_GE(*dist, 1);
+        EXPECT_FALSE(CostModeling::carriedBy(d, 1));
+    }
+    optimizeParallelism(lblock);
+    for (auto &ma : lblock.memory)
+        EXPECT_EQ(ma.schedule.parallel, 1);
+}
+
+TEST(WavefrontIR, BasicAssertions) {
+    // a store flowing into the loads of the next `i` and next `j`
+    expectWavefront("average");
+    // a load of the next `i`, before the store overwrites it, and a store
+    // flowing into the load of the next `j`
+    expectWavefront("upwind");
+}